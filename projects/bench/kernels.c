@@ -0,0 +1,241 @@
+#include "kernels.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//
+// Micro kernels
+//
+
+// Operand of each addressing mode, branches go to the next instruction
+#define MICRO_OPERAND_IMP 0
+#define MICRO_OPERAND_NOW 0x01
+#define MICRO_OPERAND_REL 0x01
+#define MICRO_OPERAND_ZPG 0x10
+#define MICRO_OPERAND_X_ZPG 0x10
+#define MICRO_OPERAND_Y_ZPG 0x10
+#define MICRO_OPERAND_ABS 0x2010
+#define MICRO_OPERAND_X_ABS 0x2010
+#define MICRO_OPERAND_Y_ABS 0x2010
+#define MICRO_OPERAND_IND 0x2000
+#define MICRO_OPERAND_X_IND 0x10
+#define MICRO_OPERAND_Y_IND 0x10
+
+// Where JMP ($xxxx) finds the next instruction, two bytes per copy
+#define MICRO_JUMP_TABLE 0x2000
+
+typedef struct micro_opcode {
+    v502_byte_t opcode;
+    const char* name;
+    const char* mnemonic;
+    v502_byte_t length;
+    v502_word_t operand;
+} micro_opcode_t;
+
+#define MICRO_OPCODE(NAME, MNEMONIC, MODE, CYCLES, PAGE) { v502_MOS_OP_##NAME, #NAME, #MNEMONIC, v502_MODE_LENGTH_##MODE, MICRO_OPERAND_##MODE },
+static const micro_opcode_t MICRO_OPCODES[] = {
+    v502_MOS_OP_LIST(MICRO_OPCODE)
+};
+#undef MICRO_OPCODE
+
+#define MICRO_OPCODE_COUNT (sizeof(MICRO_OPCODES) / sizeof(MICRO_OPCODES[0]))
+
+// The flags that take each branch, and the ones that don't (equality is carry and zero together)
+typedef struct micro_branch {
+    const char* mnemonic;
+    v502_byte_t taken;
+    v502_byte_t not_taken;
+} micro_branch_t;
+
+static const micro_branch_t MICRO_BRANCHES[] = {
+    { "BPL", 0, v502_STATE_FLAG_NEGATIVE },
+    { "BMI", v502_STATE_FLAG_NEGATIVE, 0 },
+    { "BVC", 0, v502_STATE_FLAG_OVERFLOW },
+    { "BVS", v502_STATE_FLAG_OVERFLOW, 0 },
+    { "BCC", 0, v502_STATE_FLAG_CARRY },
+    { "BCS", v502_STATE_FLAG_CARRY, 0 },
+    { "BNE", 0, v502_STATE_FLAG_CARRY | v502_STATE_FLAG_ZERO },
+    { "BEQ", v502_STATE_FLAG_CARRY | v502_STATE_FLAG_ZERO, 0 },
+};
+
+static const micro_opcode_t* find_micro_opcode(v502_byte_t opcode) {
+    for (uint32_t o = 0; o < MICRO_OPCODE_COUNT; o++)
+        if (MICRO_OPCODES[o].opcode == opcode)
+            return &MICRO_OPCODES[o];
+
+    return NULL;
+}
+
+uint32_t list_micro_kernels(micro_kernel_t* kernels) {
+    uint32_t count = 0;
+
+    for (uint32_t o = 0; o < MICRO_OPCODE_COUNT; o++) {
+        const micro_opcode_t* op = &MICRO_OPCODES[o];
+
+        if (strcmp(op->mnemonic, "RTS") == 0 || strcmp(op->mnemonic, "RTI") == 0)
+            continue;
+
+        micro_kernel_t* kernel = &kernels[count++];
+        kernel->opcode = op->opcode;
+        kernel->flags = 0;
+
+        if (strcmp(op->mnemonic, "JSR") == 0)
+            snprintf(kernel->name, sizeof(kernel->name), "%s+RTS", op->name);
+        else
+            snprintf(kernel->name, sizeof(kernel->name), "%s", op->name);
+
+        for (uint32_t b = 0; b < sizeof(MICRO_BRANCHES) / sizeof(MICRO_BRANCHES[0]); b++) {
+            if (strcmp(op->mnemonic, MICRO_BRANCHES[b].mnemonic) != 0)
+                continue;
+
+            kernel->flags = MICRO_BRANCHES[b].not_taken;
+
+            micro_kernel_t* taken = &kernels[count++];
+            *taken = *kernel;
+            taken->flags = MICRO_BRANCHES[b].taken;
+            snprintf(taken->name, sizeof(taken->name), "%s taken", op->name);
+        }
+    }
+
+    return count;
+}
+
+static v502_word_t write_instruction(v502_byte_t* hunk, v502_word_t where, v502_byte_t opcode, v502_byte_t length, v502_word_t operand) {
+    hunk[where] = opcode;
+
+    if (length > 1)
+        hunk[where + 1] = (v502_byte_t)operand;
+
+    if (length > 2)
+        hunk[where + 2] = (v502_byte_t)(operand >> 8);
+
+    return where + length;
+}
+
+v502_word_t load_micro_kernel(v502_6502vm_t* vm, const micro_kernel_t* kernel) {
+    const micro_opcode_t* op = find_micro_opcode(kernel->opcode);
+    v502_byte_t* hunk = vm->hunk;
+
+    memset(hunk, 0, vm->hunk_length);
+    memset(hunk, 0x30, 0x100);
+
+    hunk[v502_MAGIC_VECTOR_INDEX] = (v502_byte_t)KERNEL_ORIGIN;
+    hunk[v502_MAGIC_VECTOR_INDEX + 1] = (v502_byte_t)(KERNEL_ORIGIN >> 8);
+
+    v502_word_t where = KERNEL_ORIGIN;
+
+    if (strcmp(op->mnemonic, "JMP") == 0) {
+        // A chain of jumps, the last one closes the loop
+        for (uint32_t u = 0; u < KERNEL_UNROLL; u++) {
+            v502_word_t next = u + 1 < KERNEL_UNROLL ? where + op->length : KERNEL_ORIGIN;
+
+            if (kernel->opcode == v502_MOS_OP_JMP_IND) {
+                v502_word_t pointer = MICRO_JUMP_TABLE + u * 2;
+
+                hunk[pointer] = (v502_byte_t)next;
+                hunk[pointer + 1] = (v502_byte_t)(next >> 8);
+
+                where = write_instruction(hunk, where, kernel->opcode, op->length, pointer);
+            } else
+                where = write_instruction(hunk, where, kernel->opcode, op->length, next);
+        }
+    } else if (strcmp(op->mnemonic, "JSR") == 0) {
+        v502_word_t subroutine = KERNEL_ORIGIN + (KERNEL_UNROLL + 1) * 3;
+
+        for (uint32_t u = 0; u < KERNEL_UNROLL; u++)
+            where = write_instruction(hunk, where, kernel->opcode, op->length, subroutine);
+
+        where = write_instruction(hunk, where, v502_MOS_OP_JMP_ABS, v502_MODE_LENGTH_ABS, KERNEL_ORIGIN);
+        where = write_instruction(hunk, where, v502_MOS_OP_RTS, v502_MODE_LENGTH_IMP, 0);
+    } else {
+        for (uint32_t u = 0; u < KERNEL_UNROLL; u++)
+            where = write_instruction(hunk, where, kernel->opcode, op->length, op->operand);
+
+        where = write_instruction(hunk, where, v502_MOS_OP_JMP_ABS, v502_MODE_LENGTH_ABS, KERNEL_ORIGIN);
+    }
+
+    v502_reset_vm(vm);
+
+    vm->accumulator = 0x01;
+    vm->index_x = 0x02;
+    vm->index_y = 0x03;
+    v502_set_flags_vm(vm, kernel->flags);
+
+    return where;
+}
+
+//
+// Macro kernels
+//
+
+static int check_memcpy(const v502_6502vm_t* vm) {
+    for (uint32_t page = 0; page < 8; page++) {
+        for (uint32_t b = 0; b < 256; b++) {
+            v502_byte_t expected = (v502_byte_t)(b + page * 0x11);
+
+            if (vm->hunk[0x2000 + page * 256 + b] != expected || vm->hunk[0x3000 + page * 256 + b] != expected)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Only the count, the marks are cleared again as soon as the next sieve starts
+static int check_sieve(const v502_6502vm_t* vm) {
+    v502_byte_t primes = 0;
+
+    for (uint32_t n = 2; n < 256; n++) {
+        int prime = 1;
+
+        for (uint32_t d = 2; d * d <= n; d++)
+            if (n % d == 0)
+                prime = 0;
+
+        primes += prime;
+    }
+
+    return vm->hunk[0x00] == primes;
+}
+
+static int check_crc(const v502_6502vm_t* vm) {
+    v502_byte_t crc = 0;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        crc ^= (v502_byte_t)(i * 0x4B);
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (v502_byte_t)((crc << 1) ^ 0x07) : (v502_byte_t)(crc << 1);
+    }
+
+    return vm->hunk[0x00] == crc;
+}
+
+static int check_sort(const v502_6502vm_t* vm) {
+    // The fill steps by an odd number so the 128 values are all different, sorted they go up by counting how many are smaller
+    v502_byte_t values[128];
+
+    for (uint32_t i = 0; i < 128; i++)
+        values[i] = (v502_byte_t)(0x0D + i * 0x59);
+
+    for (uint32_t i = 0; i < 128; i++) {
+        uint32_t smaller = 0;
+
+        for (uint32_t j = 0; j < 128; j++)
+            smaller += values[j] < values[i];
+
+        if (vm->hunk[0x3100 + smaller] != values[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+const macro_kernel_t MACRO_KERNELS[] = {
+    { "memcpy", "memcpy.s", check_memcpy },
+    { "sieve", "sieve.s", check_sieve },
+    { "crc", "crc.s", check_crc },
+    { "sort", "sort.s", check_sort },
+};
+
+const uint32_t MACRO_KERNEL_COUNT = sizeof(MACRO_KERNELS) / sizeof(MACRO_KERNELS[0]);
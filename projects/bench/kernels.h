@@ -0,0 +1,54 @@
+#ifndef V502_BENCH_KERNELS_H
+#define V502_BENCH_KERNELS_H
+
+#include <v502/v502.h>
+
+//
+// Micro kernels
+//
+// One tight loop per implemented opcode, generated from v502_MOS_OP_LIST so new opcodes get one without touching the bench
+// Each is KERNEL_UNROLL copies of the instruction followed by a JMP back, so the JMP is 1 in KERNEL_UNROLL + 1 of what's timed
+// Operands point at zero page $10 and $2010, the zero page is filled with $30 so every indirect pointer lands on $30xx
+//
+// Branches get two kernels, taken and not, both go to the next instruction so only the flags differ
+// JMP chains to the next instruction itself, JSR is paired with an RTS and RTI has no kernel since it needs an interrupt to return from
+//
+
+#define KERNEL_ORIGIN 0x4000
+#define KERNEL_UNROLL 64
+
+typedef struct micro_kernel {
+    char name[24];
+    v502_byte_t opcode;
+    v502_byte_t flags; // Loaded before the first run, decides whether a branch is taken
+} micro_kernel_t;
+
+// Fills kernels (which needs room for 2 per opcode) and returns how many there are
+uint32_t list_micro_kernels(micro_kernel_t* kernels);
+
+// Writes the kernel over the whole hunk and resets the VM onto it
+// Returns one past its last byte of code, the VM never leaves [KERNEL_ORIGIN, end) while it runs correctly
+v502_word_t load_micro_kernel(v502_6502vm_t* vm, const micro_kernel_t* kernel);
+
+//
+// Macro kernels
+//
+// Small programs in kernels/*.s, assembled when the bench starts
+// Each loops forever and stores $A5 in $01 every time it finishes, checks compare what it left in memory to the same work done in C
+// A run can stop anywhere, so kernels only put their results where checks look once they're done and never touch them again mid way
+//
+
+#define MACRO_KERNEL_DONE 0xA5
+
+typedef struct macro_kernel {
+    const char* name;
+    const char* file;
+
+    // Returns 1 if the VM's memory holds what a finished run should
+    int (*check)(const v502_6502vm_t* vm);
+} macro_kernel_t;
+
+extern const macro_kernel_t MACRO_KERNELS[];
+extern const uint32_t MACRO_KERNEL_COUNT;
+
+#endif
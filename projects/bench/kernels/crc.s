@@ -0,0 +1,88 @@
+; CRC-8 (polynomial $07, no reflection, starting from 0) of the 256 bytes at $3000, the result goes into $00
+; Every finished checksum stores $A5 in $01
+; There's no EOR, AND or shifts, so it goes a bit at a time, c << 1 is c + c with the top bit carrying out and c ^ 7 comes from a table
+; ADC leaves the carry out of A, it only decides whether the add carries out
+
+; i ^ 7 at $2100 + i, each run of 8 counts down from its top
+  ldx #$00
+  lda #$07
+flip:
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  sta $2100,X
+  inx
+  sbc #$01
+  adc #$10
+  cpx #$00 ; INX doesn't set flags
+  bne flip
+
+; The data, i * $4B at $3000 + i
+  ldx #$00
+  lda #$00
+fill:
+  sta $3000,X
+  adc #$4B
+  inx
+  cpx #$00
+  bne fill
+
+crc:
+  lda #$00
+  sta $14
+  ldx #$00
+crc_byte:
+  lda $3000,X
+  sta $11
+  lda #$08
+  sta $13
+crc_bit:
+  lda $11
+  adc $11 ; The next data bit carries out
+  sta $11
+  bcs data_one
+  lda $14
+  adc $14 ; The top CRC bit carries out
+  bcc crc_next
+  jmp polynomial
+data_one:
+  lda $14
+  adc $14
+  bcs crc_next
+polynomial:
+  tay
+  lda $2100,Y
+crc_next:
+  sta $14
+  lda $13
+  sbc #$01
+  sta $13
+  cmp #$00 ; SBC doesn't set Z
+  bne crc_bit
+  inx
+  cpx #$00
+  bne crc_byte
+
+  lda $14
+  sta $00
+  lda #$A5
+  sta $01
+  jmp crc
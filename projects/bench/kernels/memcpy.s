@@ -0,0 +1,51 @@
+; Copies 2 KiB from $2000 to $3000 over and over, eight pages per trip around the loop
+; Every finished copy stores $A5 in $01
+
+  ldx #$00
+fill:
+  txa
+  sta $2000,X
+  adc #$11
+  sta $2100,X
+  adc #$11
+  sta $2200,X
+  adc #$11
+  sta $2300,X
+  adc #$11
+  sta $2400,X
+  adc #$11
+  sta $2500,X
+  adc #$11
+  sta $2600,X
+  adc #$11
+  sta $2700,X
+  inx
+  cpx #$00 ; INX doesn't set flags
+  bne fill
+
+copy:
+  ldx #$00
+copy_pages:
+  lda $2000,X
+  sta $3000,X
+  lda $2100,X
+  sta $3100,X
+  lda $2200,X
+  sta $3200,X
+  lda $2300,X
+  sta $3300,X
+  lda $2400,X
+  sta $3400,X
+  lda $2500,X
+  sta $3500,X
+  lda $2600,X
+  sta $3600,X
+  lda $2700,X
+  sta $3700,X
+  inx
+  cpx #$00
+  bne copy_pages
+
+  lda #$A5
+  sta $01
+  jmp copy
@@ -0,0 +1,50 @@
+; Sieve of Eratosthenes over 0 - 255, composites are marked at $2000 and the number of primes goes into $00
+; Every finished sieve stores $A5 in $01
+; There's no multiply, the multiples of a prime are found by adding it over and over until that carries
+
+sieve:
+  ldx #$00
+  lda #$00
+clear:
+  sta $2000,X
+  inx
+  cpx #$00 ; INX doesn't set flags
+  bne clear
+
+  ldx #$02
+next_prime:
+  lda $2000,X
+  cmp #$00
+  bne composite
+  txa
+  sta $10
+mark:
+  adc $10 ; Only the first add can have carry set going in and that's too small to matter
+  bcs composite
+  tay
+  lda #$01
+  sta $2000,Y
+  tya
+  jmp mark
+composite:
+  inx
+  cpx #$10 ; Every composite below 256 has a factor below 16
+  bne next_prime
+
+  ldx #$02
+  ldy #$00
+count:
+  lda $2000,X
+  cmp #$00
+  bne counted
+  iny
+counted:
+  inx
+  cpx #$00
+  bne count
+
+  tya
+  sta $00
+  lda #$A5
+  sta $01
+  jmp sieve
@@ -0,0 +1,62 @@
+; Bubble sorts 128 bytes at $3000 into ascending order, refilling them with the same shuffled values every time
+; Every finished sort is copied to $3100 and stores $A5 in $01
+; CMP only takes an immediate, so b >= a comes from whether b + (255 - a) + 1 carries
+
+; 255 - i at $2300 + i
+  ldx #$00
+  lda #$FF
+complement:
+  sta $2300,X
+  sbc #$01
+  inx
+  cpx #$00 ; INX doesn't set flags
+  bne complement
+
+sort:
+  ldx #$00
+  lda #$0D
+fill:
+  sta $3000,X
+  adc #$59
+  inx
+  cpx #$80
+  bne fill
+
+pass:
+  lda #$00
+  sta $15
+  ldx #$00
+compare:
+  lda $3000,X
+  tay
+  lda $2300,Y
+  cmp #$00 ; Sets carry, there's no SEC
+  adc $3001,X
+  bcs in_order
+  lda $3000,X
+  sta $10
+  lda $3001,X
+  sta $3000,X
+  lda $10
+  sta $3001,X
+  lda #$01
+  sta $15
+in_order:
+  inx
+  cpx #$7F
+  bne compare
+  lda $15
+  cmp #$00
+  bne pass
+
+  ldx #$00
+keep:
+  lda $3000,X
+  sta $3100,X
+  inx
+  cpx #$80
+  bne keep
+
+  lda #$A5
+  sta $01
+  jmp sort
@@ -0,0 +1,78 @@
+#include "legacy_ops.h"
+
+// NOTE: These are kept as they were, quirks included, so the comparison stays honest
+
+v502_OP_STATE_E legacy_OP_ADC(v502_6502vm_t* vm, v502_byte_t op) {
+    uint16_t where = 0;
+    if (op == v502_MOS_OP_ADC_NOW)
+        where = ++vm->program_counter;
+
+    if (op == v502_MOS_OP_ADC_ZPG || op == v502_MOS_OP_ADC_X_ZPG)
+        where = v502_make_word(0x00, vm->hunk[++vm->program_counter] + (op == v502_MOS_OP_ADC_X_ZPG ? vm->index_x : 0));
+
+    if (op == v502_MOS_OP_ADC_ABS || op == v502_MOS_OP_ADC_X_ABS || op == v502_MOS_OP_ADC_Y_ABS) {
+        where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
+        where += (op == v502_MOS_OP_STA_ABS ? 0 : (op == v502_MOS_OP_STA_X_ABS ? vm->index_x : vm->index_y));
+        vm->program_counter += 2;
+    }
+
+    if (op == v502_MOS_OP_ADC_X_IND || op == v502_MOS_OP_ADC_Y_IND) {
+        where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
+        where += (op == v502_MOS_OP_ADC_X_IND ? vm->index_x : 0);
+
+        where = v502_make_word(vm->hunk[where + 1], vm->hunk[where]) + (op == v502_MOS_OP_ADC_Y_IND ? vm->index_y : 0);
+        vm->program_counter += 2;
+    }
+
+    v502_safe_add_vm(vm, vm->hunk[where]);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_OP_STATE_E legacy_OP_STA(v502_6502vm_t* vm, v502_byte_t op) {
+    uint16_t where = 0;
+    if (op == v502_MOS_OP_STA_ZPG || op == v502_MOS_OP_STA_X_ZPG)
+        where = v502_make_word(0x00, vm->hunk[++vm->program_counter] + (op == v502_MOS_OP_STA_X_ZPG ? vm->index_x : 0));
+
+    if (op == v502_MOS_OP_STA_ABS || op == v502_MOS_OP_STA_X_ABS || op == v502_MOS_OP_STA_Y_ABS) {
+        where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
+        where += (op == v502_MOS_OP_STA_ABS ? 0 : (op == v502_MOS_OP_STA_X_ABS ? vm->index_x : vm->index_y));
+        vm->program_counter += 2;
+    }
+
+    vm->hunk[where] = vm->accumulator;
+
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_OP_STATE_E legacy_OP_CPR(v502_6502vm_t* vm, v502_byte_t op) {
+    v502_byte_t lhs = vm->accumulator;
+    v502_byte_t rhs = 0;
+
+    if (op == v502_MOS_OP_CPX_NOW)
+        lhs = vm->index_x;
+
+    if (op == v502_MOS_OP_CMP_NOW || op == v502_MOS_OP_CPX_NOW) {
+        rhs = vm->hunk[++vm->program_counter];
+    }
+
+    v502_compare_vm(vm, lhs, rhs);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_OP_STATE_E legacy_OP_LDR(v502_6502vm_t* vm, v502_byte_t op) {
+    uint8_t* what = &vm->accumulator;
+    uint16_t where = 0;
+
+    if (op == v502_MOS_OP_LDX_NOW)
+        what = &vm->index_x;
+
+    if (op == v502_MOS_OP_LDA_NOW || op == v502_MOS_OP_LDX_NOW)
+        where = ++vm->program_counter;
+
+    if (op == v502_MOS_OP_LDA_ZPG)
+        where = v502_make_word(0x00, ++vm->program_counter);
+
+    *what = vm->hunk[where];
+
+    return V502_OP_STATE_SUCCESS;
+}
@@ -0,0 +1,13 @@
+#ifndef V502_BENCH_LEGACY_OPS_H
+#define V502_BENCH_LEGACY_OPS_H
+
+#include <v502/v502.h>
+
+// The shared handlers the VM used before each opcode got its own specialized opfunc
+// They decode the addressing mode at runtime and are kept around as a baseline to measure against
+v502_OP_STATE_E legacy_OP_ADC(v502_6502vm_t* vm, v502_byte_t op);
+v502_OP_STATE_E legacy_OP_STA(v502_6502vm_t* vm, v502_byte_t op);
+v502_OP_STATE_E legacy_OP_CPR(v502_6502vm_t* vm, v502_byte_t op);
+v502_OP_STATE_E legacy_OP_LDR(v502_6502vm_t* vm, v502_byte_t op);
+
+#endif
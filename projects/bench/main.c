@@ -0,0 +1,516 @@
+#include <v502/v502.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "kernels.h"
+#include "legacy_ops.h"
+
+//
+// Timing
+//
+static double bench_now_ns() {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+#endif
+}
+
+//
+// Per opcode microbenchmark, specialized opfunc vs the old shared handler
+//
+typedef struct opcode_case {
+    v502_byte_t opcode;
+    const char* name;
+    v502_opfunc_t legacy;
+} opcode_case_t;
+
+#define CASE(NAME, LEGACY) { v502_MOS_OP_##NAME, #NAME, LEGACY }
+
+static const opcode_case_t OPCODE_CASES[] = {
+    CASE(ADC_NOW, legacy_OP_ADC),
+    CASE(ADC_ZPG, legacy_OP_ADC),
+    CASE(ADC_X_ZPG, legacy_OP_ADC),
+    CASE(ADC_ABS, legacy_OP_ADC),
+    CASE(ADC_X_ABS, legacy_OP_ADC),
+    CASE(ADC_Y_ABS, legacy_OP_ADC),
+    CASE(ADC_X_IND, legacy_OP_ADC),
+    CASE(ADC_Y_IND, legacy_OP_ADC),
+
+    CASE(STA_ZPG, legacy_OP_STA),
+    CASE(STA_X_ZPG, legacy_OP_STA),
+    CASE(STA_ABS, legacy_OP_STA),
+    CASE(STA_X_ABS, legacy_OP_STA),
+    CASE(STA_Y_ABS, legacy_OP_STA),
+
+    CASE(LDA_NOW, legacy_OP_LDR),
+    CASE(LDA_ZPG, legacy_OP_LDR),
+    CASE(LDX_NOW, legacy_OP_LDR),
+
+    CASE(CMP_NOW, legacy_OP_CPR),
+    CASE(CPX_NOW, legacy_OP_CPR),
+};
+
+#define OPCODE_CASE_COUNT (sizeof(OPCODE_CASES) / sizeof(OPCODE_CASES[0]))
+
+// Where the instruction under test is placed, the operand bytes point at 0x10 / 0x2010 so every mode stays in bounds
+#define BENCH_ORIGIN 0x4000
+
+static void setup_vm(v502_6502vm_t* vm, v502_byte_t opcode) {
+    memset(vm->hunk, 0, vm->hunk_length);
+
+    vm->hunk[BENCH_ORIGIN] = opcode;
+    vm->hunk[BENCH_ORIGIN + 1] = 0x10;
+    vm->hunk[BENCH_ORIGIN + 2] = 0x20;
+
+    // Pointer used by the indirect modes
+    vm->hunk[0x10] = 0x00;
+    vm->hunk[0x11] = 0x30;
+
+    vm->accumulator = 0x01;
+    vm->index_x = 0x02;
+    vm->index_y = 0x03;
+    vm->flags = 0;
+    vm->stack_ptr = 0xFF;
+}
+
+// Returns the best ns/call out of the repeats
+static double time_opfunc(v502_6502vm_t* vm, v502_opfunc_t func, v502_byte_t opcode, uint32_t iterations, uint32_t repeats) {
+    double best = -1;
+
+    for (uint32_t r = 0; r < repeats; r++) {
+        setup_vm(vm, opcode);
+
+        double start = bench_now_ns();
+
+        for (uint32_t i = 0; i < iterations; i++) {
+            vm->program_counter = BENCH_ORIGIN;
+            func(vm, opcode);
+        }
+
+        double elapsed = (bench_now_ns() - start) / (double)iterations;
+
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+static void bench_opfuncs(uint32_t iterations, uint32_t repeats) {
+    v502_6502vm_createinfo_t createinfo = { 0 };
+    createinfo.hunk_size = 0xFFFF + 1;
+
+    v502_6502vm_t* vm = v502_create_vm(&createinfo);
+
+    printf("%-12s %12s %12s %9s\n", "OPCODE", "SHARED ns", "SPECIAL ns", "SPEEDUP");
+
+    double legacy_total = 0, special_total = 0;
+    for (size_t c = 0; c < OPCODE_CASE_COUNT; c++) {
+        const opcode_case_t* bench_case = &OPCODE_CASES[c];
+
+        double legacy = time_opfunc(vm, bench_case->legacy, bench_case->opcode, iterations, repeats);
+        double special = time_opfunc(vm, vm->opfuncs[bench_case->opcode], bench_case->opcode, iterations, repeats);
+
+        legacy_total += legacy;
+        special_total += special;
+
+        printf("%-12s %12.3f %12.3f %8.2fx\n", bench_case->name, legacy, special, legacy / special);
+    }
+
+    printf("%-12s %12.3f %12.3f %8.2fx\n", "TOTAL", legacy_total, special_total, legacy_total / special_total);
+
+    v502_free_vm(vm);
+}
+
+//
+// Kernels under every engine
+//
+static const char* ENGINE_NAMES[4] = { "table", "threaded", "predecoded", "jit" };
+
+#define ENGINE_COUNT (sizeof(ENGINE_NAMES) / sizeof(ENGINE_NAMES[0]))
+
+typedef struct kernel_timing {
+    double median; // ns per instruction
+    double spread; // Standard deviation relative to the mean, in percent
+} kernel_timing_t;
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static kernel_timing_t summarize(double* samples, uint32_t count) {
+    kernel_timing_t timing;
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+    timing.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+
+    double mean = 0, variance = 0;
+
+    for (uint32_t s = 0; s < count; s++)
+        mean += samples[s] / count;
+
+    for (uint32_t s = 0; s < count; s++)
+        variance += (samples[s] - mean) * (samples[s] - mean) / count;
+
+    timing.spread = mean > 0 ? sqrt(variance) / mean * 100 : 0;
+
+    return timing;
+}
+
+static v502_6502vm_t* create_engine_vm(v502_ENGINE_E engine) {
+    v502_6502vm_createinfo_t createinfo = { 0 };
+    createinfo.hunk_size = 0xFFFF + 1;
+    createinfo.engine = engine;
+
+    return v502_create_vm(&createinfo);
+}
+
+// One untimed run first so the decode cache and JIT are warm, then the timed ones pick up wherever the last stopped
+// Returns 0 if the VM stopped on its own, exit_info says where
+static int time_kernel(v502_6502vm_t* vm, uint32_t instructions, uint32_t repeats, kernel_timing_t* timing, v502_exit_info_t* exit_info) {
+    double samples[64];
+
+    if (v502_run_vm(vm, instructions, exit_info) != v502_EXIT_REASON_BUDGET)
+        return 0;
+
+    for (uint32_t r = 0; r < repeats; r++) {
+        double start = bench_now_ns();
+
+        if (v502_run_vm(vm, instructions, exit_info) != v502_EXIT_REASON_BUDGET)
+            return 0;
+
+        samples[r] = (bench_now_ns() - start) / (double)exit_info->instructions;
+    }
+
+    *timing = summarize(samples, repeats);
+    return 1;
+}
+
+static void print_engine_header(const char* title, uint32_t engines) {
+    printf("%-16s", title);
+
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+        if (engines & (1 << e))
+            printf(" %16s", ENGINE_NAMES[e]);
+
+    printf("\n");
+}
+
+static void print_timing(const kernel_timing_t* timing) {
+    char cell[32];
+    snprintf(cell, sizeof(cell), "%.3f +-%.1f%%", timing->median, timing->spread);
+
+    printf(" %16s", cell);
+}
+
+// Geometric means of the medians, so no single slow kernel dominates
+static void print_geomean(double* log_sums, uint32_t* counts, uint32_t engines) {
+    printf("%-16s", "GEOMEAN");
+
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++) {
+        if (!(engines & (1 << e)))
+            continue;
+
+        if (counts[e] == 0)
+            printf(" %16s", "-");
+        else
+            printf(" %16.3f", exp(log_sums[e] / counts[e]));
+    }
+
+    printf("\n");
+}
+
+static int bench_micro(uint32_t engines, const char* filter, uint32_t instructions, uint32_t repeats) {
+    micro_kernel_t kernels[512];
+    uint32_t kernel_count = list_micro_kernels(kernels);
+
+    double log_sums[ENGINE_COUNT] = { 0 };
+    uint32_t counts[ENGINE_COUNT] = { 0 };
+    int failed = 0;
+
+    print_engine_header("MICRO KERNEL", engines);
+
+    for (uint32_t k = 0; k < kernel_count; k++) {
+        if (filter != NULL && strstr(kernels[k].name, filter) == NULL)
+            continue;
+
+        printf("%-16s", kernels[k].name);
+
+        for (uint32_t e = 0; e < ENGINE_COUNT; e++) {
+            if (!(engines & (1 << e)))
+                continue;
+
+            v502_6502vm_t* vm = create_engine_vm((v502_ENGINE_E)e);
+            v502_word_t end = load_micro_kernel(vm, &kernels[k]);
+
+            kernel_timing_t timing;
+            v502_exit_info_t exit_info = { 0 };
+
+            // Every kernel loops inside its own code forever, anything else means the engine got it wrong
+            if (!time_kernel(vm, instructions, repeats, &timing, &exit_info) || vm->program_counter < KERNEL_ORIGIN || vm->program_counter >= end) {
+                printf(" %16s", "FAILED");
+                failed = 1;
+            } else {
+                print_timing(&timing);
+
+                log_sums[e] += log(timing.median);
+                counts[e]++;
+            }
+
+            fflush(stdout);
+            v502_free_vm(vm);
+        }
+
+        printf("\n");
+    }
+
+    print_geomean(log_sums, counts, engines);
+
+    return !failed;
+}
+
+static v502_binary_file_t* assemble_kernel(v502_assembler_instance_t* assembler, const char* directory, const char* file) {
+    char path[1024];
+    int length = snprintf(path, sizeof(path), "%s/%s", directory, file);
+
+    if (length < 0 || (size_t)length >= sizeof(path)) {
+        fprintf(stderr, "The path of the kernel '%s' is too long, move the kernels somewhere shorter and pass that to -k!\n", file);
+        return NULL;
+    }
+
+    // v502_load_source() asserts the file is there
+    FILE* source_file = fopen(path, "r");
+
+    if (source_file == NULL) {
+        fprintf(stderr, "Couldn't open the kernel '%s', pass -k to say where the kernels are!\n", path);
+        return NULL;
+    }
+
+    fclose(source_file);
+
+    const char* source = v502_load_source(path);
+    v502_binary_file_t* binary = v502_assemble_source(assembler, source);
+
+    free((void*)source);
+    return binary;
+}
+
+static int bench_macro(uint32_t engines, const char* filter, const char* directory, uint32_t instructions, uint32_t repeats) {
+    v502_assembler_instance_t* assembler = v502_create_assembler();
+    v502_binary_file_t* binaries[16] = { 0 };
+
+    // Assembled up front, the assembler reports what it's doing on stderr and that shouldn't end up in the middle of the table
+    for (uint32_t k = 0; k < MACRO_KERNEL_COUNT; k++) {
+        if (filter != NULL && strstr(MACRO_KERNELS[k].name, filter) == NULL)
+            continue;
+
+        binaries[k] = assemble_kernel(assembler, directory, MACRO_KERNELS[k].file);
+
+        if (binaries[k] == NULL)
+            return 0;
+    }
+
+    fflush(stderr);
+
+    double log_sums[ENGINE_COUNT] = { 0 };
+    uint32_t counts[ENGINE_COUNT] = { 0 };
+    int failed = 0;
+
+    print_engine_header("MACRO KERNEL", engines);
+
+    for (uint32_t k = 0; k < MACRO_KERNEL_COUNT; k++) {
+        if (binaries[k] == NULL)
+            continue;
+
+        printf("%-16s", MACRO_KERNELS[k].name);
+
+        for (uint32_t e = 0; e < ENGINE_COUNT; e++) {
+            if (!(engines & (1 << e)))
+                continue;
+
+            v502_6502vm_t* vm = create_engine_vm((v502_ENGINE_E)e);
+            memcpy(vm->hunk, binaries[k]->bytes, binaries[k]->length < vm->hunk_length ? binaries[k]->length : vm->hunk_length);
+            v502_reset_vm(vm);
+
+            kernel_timing_t timing;
+            v502_exit_info_t exit_info = { 0 };
+
+            if (!time_kernel(vm, instructions, repeats, &timing, &exit_info)) {
+                printf(" %16s", "FAILED");
+                failed = 1;
+            } else if (vm->hunk[0x01] != MACRO_KERNEL_DONE) {
+                printf(" %16s", "UNFINISHED"); // Didn't get through once, -i is too low to tell if it works
+                failed = 1;
+            } else if (!MACRO_KERNELS[k].check(vm)) {
+                printf(" %16s", "WRONG");
+                failed = 1;
+            } else {
+                print_timing(&timing);
+
+                log_sums[e] += log(timing.median);
+                counts[e]++;
+            }
+
+            fflush(stdout);
+            v502_free_vm(vm);
+        }
+
+        printf("\n");
+    }
+
+    print_geomean(log_sums, counts, engines);
+
+    for (uint32_t k = 0; k < MACRO_KERNEL_COUNT; k++) {
+        if (binaries[k] != NULL) {
+            free(binaries[k]->bytes);
+            free(binaries[k]);
+        }
+    }
+
+    return !failed;
+}
+
+static void print_help() {
+    printf("Arguments: \n");
+    printf("\t-n <count>, how many times each opcode is executed per repeat in the opfunc comparison (default 10000000)\n");
+    printf("\t-r <count>, how many repeats to take the best (opfuncs) or median (kernels) of, at most 64 (default 5)\n");
+    printf("\t-i <count>, how many instructions each timed kernel run executes (default 1000000)\n");
+    printf("\t-e <engine>, only runs kernels on this engine, can be given more than once (table, threaded, predecoded or jit), by default every engine this build has\n");
+    printf("\t-f <text>, only runs kernels with this in their name\n");
+    printf("\t-k <directory>, where the macro kernel sources are (default the bench folder next to bench502)\n");
+    printf("\t--opfuncs, --micro, --macro, only runs these parts, by default all of them\n");
+    printf("\n");
+    printf("Opfuncs compares each specialized opfunc to the shared handler it replaced, called directly\n");
+    printf("Micro kernels are %d copies of one instruction and a JMP back, generated for every implemented opcode and addressing mode\n", KERNEL_UNROLL);
+    printf("Macro kernels are small programs (memcpy, sieve, CRC and sort), their results are checked after timing\n");
+    printf("Kernel times are the median ns per instruction of the repeats, plus minus their standard deviation relative to the mean\n");
+    printf("\n");
+}
+
+// The bench folder next to the executable, that's where the build copies the kernels to
+static void default_kernel_directory(char* directory, size_t size, const char* argv0) {
+    const char* slash = strrchr(argv0, '/');
+    const char* backslash = strrchr(argv0, '\\');
+
+    if (backslash != NULL && (slash == NULL || backslash > slash))
+        slash = backslash;
+
+    if (slash == NULL)
+        snprintf(directory, size, "bench");
+    else
+        snprintf(directory, size, "%.*s/bench", (int)(slash - argv0), argv0);
+}
+
+int main(int argc, char** argv) {
+    uint32_t iterations = 10000000;
+    uint32_t repeats = 5;
+    uint32_t instructions = 1000000;
+    uint32_t engines = 0;
+    const char* filter = NULL;
+    int run_opfuncs = 0, run_micro = 0, run_macro = 0;
+
+    char kernel_directory[1024];
+    default_kernel_directory(kernel_directory, sizeof(kernel_directory), argv[0]);
+
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-h") == 0 || strcmp(argv[a], "--help") == 0) {
+            print_help();
+            return 0;
+        }
+
+        if (strcmp(argv[a], "-n") == 0 && a + 1 < argc)
+            iterations = strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "-r") == 0 && a + 1 < argc)
+            repeats = strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "-i") == 0 && a + 1 < argc)
+            instructions = strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "-f") == 0 && a + 1 < argc)
+            filter = argv[++a];
+        else if (strcmp(argv[a], "-k") == 0 && a + 1 < argc)
+            snprintf(kernel_directory, sizeof(kernel_directory), "%s", argv[++a]);
+        else if (strcmp(argv[a], "-e") == 0 && a + 1 < argc) {
+            const char* name = argv[++a];
+            uint32_t named = 0;
+
+            for (uint32_t e = 0; e < ENGINE_COUNT; e++)
+                if (strcmp(name, ENGINE_NAMES[e]) == 0)
+                    named = 1 << e;
+
+            engines |= named;
+
+            if (named == 0) {
+                fprintf(stderr, "Unknown engine '%s', pick table, threaded, predecoded or jit!\n", name);
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--opfuncs") == 0)
+            run_opfuncs = 1;
+        else if (strcmp(argv[a], "--micro") == 0)
+            run_micro = 1;
+        else if (strcmp(argv[a], "--macro") == 0)
+            run_macro = 1;
+        else {
+            fprintf(stderr, "Unknown argument '%s', pass --help to see possible arguments!\n", argv[a]);
+            return 1;
+        }
+    }
+
+    if (iterations == 0 || repeats == 0 || instructions == 0) {
+        fprintf(stderr, "Iteration, repeat and instruction counts must be at least 1!\n");
+        return 1;
+    }
+
+    if (repeats > 64) {
+        fprintf(stderr, "At most 64 repeats are kept!\n");
+        return 1;
+    }
+
+    if (!run_opfuncs && !run_micro && !run_macro)
+        run_opfuncs = run_micro = run_macro = 1;
+
+    // Engines this build doesn't have fall back to another one, timing that twice says nothing
+    if (engines == 0)
+        engines = (1 << ENGINE_COUNT) - 1;
+
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++) {
+        if ((engines & (1 << e)) && !v502_engine_supported((v502_ENGINE_E)e)) {
+            fprintf(stderr, "The %s engine isn't available in this build, skipping it\n", ENGINE_NAMES[e]);
+            engines &= ~(1 << e);
+        }
+    }
+
+    if (engines == 0)
+        return 1;
+
+    int passed = 1;
+
+    if (run_opfuncs) {
+        bench_opfuncs(iterations, repeats);
+        printf("\n");
+    }
+
+    if (run_macro) {
+        passed &= bench_macro(engines, filter, kernel_directory, instructions, repeats);
+        printf("\n");
+    }
+
+    if (run_micro)
+        passed &= bench_micro(engines, filter, instructions, repeats);
+
+    return passed ? 0 : 1;
+}
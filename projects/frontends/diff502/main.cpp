@@ -0,0 +1,782 @@
+#include <v502/v502.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// What --left and --right take, indexed by v502_ENGINE_E with step tacked on the end
+// step is the reference, every instruction is its own run through the table engine exactly like v502_cycle_vm()
+const char* engine_names[5] = { "table", "threaded", "predecoded", "jit", "step" };
+#define DIFF502_ENGINE_STEP 4
+
+const char* exit_reasons[6] = { "budget exhausted", "unknown opcode", "breakpoint", "halted", "watched read", "watched write" };
+
+int fastest_engine() {
+    if (v502_engine_supported(v502_ENGINE_JIT))
+        return v502_ENGINE_JIT;
+
+    if (v502_engine_supported(v502_ENGINE_THREADED))
+        return v502_ENGINE_THREADED;
+
+    return v502_ENGINE_PREDECODED;
+}
+
+// How each opcode is printed, built from the same list the VM is
+struct op_info_t {
+    v502_byte_t opcode = 0;
+    const char* mnemonic = nullptr; // nullptr for opcodes the VM doesn't implement
+    const char* mode = nullptr;
+    int length = 1;
+};
+
+std::vector<op_info_t> build_op_infos() {
+    std::vector<op_info_t> infos(256);
+
+#define DIFF502_OP_INFO(NAME, MNEMONIC, MODE, CYCLES, PAGE) infos[v502_MOS_OP_##NAME] = { v502_MOS_OP_##NAME, #MNEMONIC, #MODE, v502_MODE_LENGTH_##MODE };
+    v502_MOS_OP_LIST(DIFF502_OP_INFO)
+#undef DIFF502_OP_INFO
+
+    return infos;
+}
+
+const std::vector<op_info_t> op_infos = build_op_infos();
+
+//
+// Running both sides
+//
+
+struct side_t {
+    int engine; // v502_ENGINE_E or DIFF502_ENGINE_STEP
+    v502_6502vm_t* vm;
+};
+
+// The stock fallback prints every unknown opcode it runs into, which random programs do nearly every time
+v502_OP_STATE_E quiet_unknown(v502_6502vm_t*, v502_byte_t) {
+    return V502_OP_STATE_FAILED;
+}
+
+v502_6502vm_t* create_side_vm(int engine) {
+    v502_6502vm_createinfo_t createinfo {};
+    createinfo.hunk_size = 0xFFFF + 1;
+    createinfo.engine = engine == DIFF502_ENGINE_STEP ? v502_ENGINE_OPFUNC_TABLE : (v502_ENGINE_E)engine;
+
+    v502_6502vm_t* vm = v502_create_vm(&createinfo);
+
+    // Only unimplemented opcodes are overridden, the engines keep inlining the rest
+    for (int op = 0; op < 256; op++)
+        if (op_infos[op].mnemonic == nullptr)
+            v502_set_opfunc_vm(vm, (v502_byte_t)op, quiet_unknown);
+
+    return vm;
+}
+
+// Runs up to count instructions (never 0), the step engine adds its single instruction runs up into one exit info
+void run_side(const side_t& side, v502_qword_t count, v502_exit_info_t& info) {
+    if (side.engine != DIFF502_ENGINE_STEP) {
+        v502_run_vm(side.vm, count, &info);
+        return;
+    }
+
+    info = {};
+
+    v502_exit_info_t step {};
+    while (info.instructions < count) {
+        v502_run_table_vm(side.vm, 1, 0, &step);
+
+        info.reason = step.reason;
+        info.instructions += step.instructions;
+        info.cycles += step.cycles;
+        info.program_counter = step.program_counter;
+        info.opcode = step.opcode;
+        info.watch_address = step.watch_address;
+
+        if (step.reason != v502_EXIT_REASON_BUDGET)
+            break;
+    }
+}
+
+// Everything a comparison looks at, so both sides can be put back where they last agreed
+struct state_t {
+    std::vector<v502_byte_t> memory;
+
+    v502_word_t program_counter = 0;
+    v502_byte_t stack_ptr = 0xFF;
+    v502_byte_t accumulator = 0;
+    v502_byte_t index_x = 0;
+    v502_byte_t index_y = 0;
+    v502_byte_t flags = 0;
+    v502_qword_t cycles = 0;
+};
+
+void capture_state(v502_6502vm_t* vm, state_t& state) {
+    state.memory.assign(vm->hunk, vm->hunk + vm->hunk_length);
+
+    state.program_counter = vm->program_counter;
+    state.stack_ptr = vm->stack_ptr;
+    state.accumulator = vm->accumulator;
+    state.index_x = vm->index_x;
+    state.index_y = vm->index_y;
+    state.flags = v502_get_flags_vm(vm);
+    state.cycles = vm->cycles;
+}
+
+// Only pages that differ are copied and invalidated, so code that didn't change stays decoded and translated
+void load_state(v502_6502vm_t* vm, const state_t& state) {
+    for (v502_dword_t where = 0; where < vm->hunk_length; where += 256) {
+        if (memcmp(vm->hunk + where, state.memory.data() + where, 256) == 0)
+            continue;
+
+        memcpy(vm->hunk + where, state.memory.data() + where, 256);
+        v502_invalidate_vm(vm, (v502_word_t)where, 256);
+    }
+
+    vm->program_counter = state.program_counter;
+    vm->stack_ptr = state.stack_ptr;
+    vm->accumulator = state.accumulator;
+    vm->index_x = state.index_x;
+    vm->index_y = state.index_y;
+    v502_set_flags_vm(vm, state.flags);
+    vm->cycles = state.cycles;
+}
+
+// FNV-1a taking eight bytes at a time in four lanes, so each multiply doesn't wait on the one before it
+// The hunk is always 64K, a multiple of the 32 bytes each round takes
+uint64_t hash_memory(const v502_6502vm_t* vm) {
+    const uint64_t PRIME = 0x100000001B3ull;
+    uint64_t lanes[4] = { 0xCBF29CE484222325ull, 0xCBF29CE484222325ull ^ 1, 0xCBF29CE484222325ull ^ 2, 0xCBF29CE484222325ull ^ 3 };
+
+    for (v502_dword_t where = 0; where < vm->hunk_length; where += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            memcpy(&word, vm->hunk + where + l * 8, sizeof(word));
+            lanes[l] = (lanes[l] ^ word) * PRIME;
+        }
+    }
+
+    uint64_t hash = lanes[0];
+    for (int l = 1; l < 4; l++)
+        hash = (hash ^ lanes[l]) * PRIME;
+
+    return hash;
+}
+
+//
+// Comparing
+//
+
+void describe_byte(std::string& out, const char* what, unsigned left, unsigned right) {
+    char line[64];
+
+    if (left != right) {
+        snprintf(line, sizeof(line), "  %-12s %02X vs %02X\n", what, left, right);
+        out += line;
+    }
+}
+
+void describe_word(std::string& out, const char* what, unsigned left, unsigned right) {
+    char line[64];
+
+    if (left != right) {
+        snprintf(line, sizeof(line), "  %-12s %04X vs %04X\n", what, left, right);
+        out += line;
+    }
+}
+
+void describe_count(std::string& out, const char* what, v502_qword_t left, v502_qword_t right) {
+    char line[96];
+
+    if (left != right) {
+        snprintf(line, sizeof(line), "  %-12s %llu vs %llu\n", what, (unsigned long long)left, (unsigned long long)right);
+        out += line;
+    }
+}
+
+// Lists what differs between the two sides, one line each, empty when they agree
+std::string compare_sides(const side_t& left, const v502_exit_info_t& left_info, const side_t& right, const v502_exit_info_t& right_info) {
+    std::string out;
+    const v502_6502vm_t* l = left.vm;
+    const v502_6502vm_t* r = right.vm;
+
+    if (left_info.reason != right_info.reason)
+        out += std::string("  exit reason  ") + exit_reasons[left_info.reason] + " vs " + exit_reasons[right_info.reason] + "\n";
+    else if (left_info.reason != v502_EXIT_REASON_BUDGET)
+        describe_byte(out, "exit opcode", left_info.opcode, right_info.opcode);
+
+    describe_count(out, "instructions", left_info.instructions, right_info.instructions);
+    describe_count(out, "cycles", l->cycles, r->cycles);
+
+    describe_word(out, "PC", l->program_counter, r->program_counter);
+    describe_byte(out, "A", l->accumulator, r->accumulator);
+    describe_byte(out, "X", l->index_x, r->index_x);
+    describe_byte(out, "Y", l->index_y, r->index_y);
+    describe_byte(out, "SP", l->stack_ptr, r->stack_ptr);
+    describe_byte(out, "flags", v502_get_flags_vm((v502_6502vm_t*)l), v502_get_flags_vm((v502_6502vm_t*)r));
+
+    uint64_t left_hash = hash_memory(l);
+    uint64_t right_hash = hash_memory(r);
+
+    if (left_hash != right_hash) {
+        char line[128];
+        snprintf(line, sizeof(line), "  %-12s %016llX vs %016llX\n", "memory hash", (unsigned long long)left_hash, (unsigned long long)right_hash);
+        out += line;
+
+        v502_dword_t first = 0;
+        v502_dword_t differing = 0;
+        for (v502_dword_t where = 0; where < l->hunk_length; where++) {
+            if (l->hunk[where] == r->hunk[where])
+                continue;
+
+            if (differing++ == 0)
+                first = where;
+        }
+
+        snprintf(line, sizeof(line), "  %-12s %u bytes, the first at %04X (%02X vs %02X)\n", "memory", differing, first, l->hunk[first], r->hunk[first]);
+        out += line;
+    }
+
+    return out;
+}
+
+std::string format_instruction(const v502_6502vm_t* vm, v502_word_t where) {
+    const op_info_t& info = op_infos[vm->hunk[where]];
+    char text[64];
+
+    v502_byte_t lo = vm->hunk[(v502_word_t)(where + 1)];
+    v502_byte_t hi = vm->hunk[(v502_word_t)(where + 2)];
+
+    if (info.mnemonic == nullptr)
+        snprintf(text, sizeof(text), "%04X  %02X        ???", where, vm->hunk[where]);
+    else if (info.length == 3)
+        snprintf(text, sizeof(text), "%04X  %02X %02X %02X  %s %s", where, info.opcode, lo, hi, info.mnemonic, info.mode);
+    else if (info.length == 2)
+        snprintf(text, sizeof(text), "%04X  %02X %02X     %s %s", where, info.opcode, lo, info.mnemonic, info.mode);
+    else
+        snprintf(text, sizeof(text), "%04X  %02X        %s", where, info.opcode, info.mnemonic);
+
+    return text;
+}
+
+//
+// Lockstep
+//
+// Both sides run interval instructions at a time and are compared after each slice
+// Before every slice the left side is captured, once a slice ends in disagreement both are put back and rerun for fewer instructions
+// Halving the count each time finds the first instruction after which they differ in about log2(interval) reruns
+// Reruns are whole runs of that many instructions rather than single steps, so engines that only go wrong over longer runs still do
+//
+
+struct lockstep_result_t {
+    bool diverged = false;
+    v502_qword_t instructions = 0; // Executed by the left side before it stopped, or up to the divergence
+    v502_exit_info_t exit_info {}; // How the left side's last run ended
+};
+
+lockstep_result_t lockstep(side_t& left, side_t& right, v502_qword_t interval, v502_qword_t max_instructions, state_t& checkpoint) {
+    lockstep_result_t result;
+    v502_exit_info_t left_info {}, right_info {};
+
+    while (max_instructions == 0 || result.instructions < max_instructions) {
+        v502_qword_t count = interval;
+        if (max_instructions != 0 && max_instructions - result.instructions < count)
+            count = max_instructions - result.instructions;
+
+        capture_state(left.vm, checkpoint);
+
+        run_side(left, count, left_info);
+        run_side(right, count, right_info);
+
+        if (compare_sides(left, left_info, right, right_info).empty()) {
+            result.instructions += left_info.instructions;
+            result.exit_info = left_info;
+
+            if (left_info.reason != v502_EXIT_REASON_BUDGET)
+                break;
+
+            continue;
+        }
+
+        // They agree after lo instructions from the checkpoint and don't after hi
+        v502_qword_t lo = 0, hi = count;
+        while (hi - lo > 1) {
+            v502_qword_t mid = lo + (hi - lo) / 2;
+
+            load_state(left.vm, checkpoint);
+            load_state(right.vm, checkpoint);
+            run_side(left, mid, left_info);
+            run_side(right, mid, right_info);
+
+            if (compare_sides(left, left_info, right, right_info).empty())
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        load_state(left.vm, checkpoint);
+        if (lo != 0)
+            run_side(left, lo, left_info);
+
+        std::string culprit = format_instruction(left.vm, left.vm->program_counter);
+
+        load_state(left.vm, checkpoint);
+        load_state(right.vm, checkpoint);
+        run_side(left, hi, left_info);
+        run_side(right, hi, right_info);
+
+        result.diverged = true;
+        result.instructions += lo;
+
+        std::cout << "Diverged on instruction " << result.instructions + 1 << ": " << culprit << "\n";
+        std::cout << "  (" << engine_names[left.engine] << " vs " << engine_names[right.engine] << ")\n";
+        std::cout << compare_sides(left, left_info, right, right_info) << std::flush;
+        break;
+    }
+
+    return result;
+}
+
+//
+// Fuzzing
+//
+// Programs are random streams of implemented opcodes, picked uniformly from v502_MOS_OP_LIST
+// A prologue loads random registers and flags (decimal included) through the stack, so the image alone reproduces a program
+// Branches, JMP and JSR only ever go to the start of another instruction in the program, or just past its end
+// JMP ($xxxx) goes through a table of such addresses, RTS and RTI return wherever the stack says which is usually into zeroes
+// Absolute operands mostly point at a page of random data, but one in eight lands on the program itself to exercise self modifying code
+// Execution stops at the zero after the program (an unknown opcode) unless it ended with a JMP back or jumped away, or at the budget
+//
+
+#define FUZZ_DATA 0x0200 // Two pages of random bytes
+#define FUZZ_DATA_LENGTH 0x0200
+#define FUZZ_JUMP_TABLE 0x0400 // FUZZ_JUMP_SLOTS pointers to instructions
+#define FUZZ_JUMP_SLOTS 32
+#define FUZZ_ORIGIN 0x0500
+#define FUZZ_CODE_LENGTH 0x0100 // Room for the prologue, the longest program and its closing JMP
+#define FUZZ_MAX_LENGTH 48 // Instructions, not counting the prologue
+
+// splitmix64, every program comes from the seed alone
+struct rng_t {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint32_t below(uint32_t bound) {
+        return (uint32_t)(next() % bound);
+    }
+
+    v502_byte_t byte() {
+        return (v502_byte_t)next();
+    }
+};
+
+// What a random operand has to be for each opcode, worked out once from the mnemonic and mode
+enum FUZZ_OPERAND_E {
+    FUZZ_OPERAND_NONE,
+    FUZZ_OPERAND_BYTE, // Immediates and zero page, anything goes
+    FUZZ_OPERAND_DATA, // Absolute addresses
+    FUZZ_OPERAND_BRANCH,
+    FUZZ_OPERAND_TARGET, // JMP and JSR
+    FUZZ_OPERAND_POINTER // JMP ($xxxx)
+};
+
+struct fuzz_opcode_t {
+    v502_byte_t opcode;
+    v502_byte_t length;
+    FUZZ_OPERAND_E operand;
+};
+
+std::vector<fuzz_opcode_t> list_fuzz_opcodes() {
+    std::vector<fuzz_opcode_t> opcodes;
+
+    for (const auto& info : op_infos) {
+        if (info.mnemonic == nullptr)
+            continue;
+
+        fuzz_opcode_t opcode { info.opcode, (v502_byte_t)info.length, FUZZ_OPERAND_NONE };
+
+        if (strcmp(info.mode, "REL") == 0)
+            opcode.operand = FUZZ_OPERAND_BRANCH;
+        else if (strcmp(info.mode, "IND") == 0)
+            opcode.operand = FUZZ_OPERAND_POINTER;
+        else if (strcmp(info.mnemonic, "JMP") == 0 || strcmp(info.mnemonic, "JSR") == 0)
+            opcode.operand = FUZZ_OPERAND_TARGET;
+        else if (info.length == 3)
+            opcode.operand = FUZZ_OPERAND_DATA;
+        else if (info.length == 2)
+            opcode.operand = FUZZ_OPERAND_BYTE;
+
+        opcodes.push_back(opcode);
+    }
+
+    return opcodes;
+}
+
+v502_word_t emit(std::vector<v502_byte_t>& memory, v502_word_t where, v502_byte_t opcode, v502_byte_t operand) {
+    memory[where] = opcode;
+    memory[where + 1] = operand;
+    return where + 2;
+}
+
+// Replaces the program in state with a fresh one, registers as v502_reset_vm() leaves them
+// Only the areas below FUZZ_ORIGIN + FUZZ_CODE_LENGTH and the reset vector are ever written, the rest stays zeroed
+void generate_program(rng_t& rng, const std::vector<fuzz_opcode_t>& opcodes, state_t& state) {
+    std::vector<v502_byte_t>& memory = state.memory;
+    std::fill(memory.begin() + FUZZ_ORIGIN, memory.begin() + FUZZ_ORIGIN + FUZZ_CODE_LENGTH, 0);
+
+    for (uint32_t b = 0; b < 0x200; b++)
+        memory[b] = rng.byte(); // Zero page pointers and the stack
+
+    for (uint32_t b = 0; b < FUZZ_DATA_LENGTH; b++)
+        memory[FUZZ_DATA + b] = rng.byte();
+
+    memory[v502_MAGIC_VECTOR_INDEX] = (v502_byte_t)FUZZ_ORIGIN;
+    memory[v502_MAGIC_VECTOR_INDEX + 1] = (v502_byte_t)(FUZZ_ORIGIN >> 8);
+
+    v502_word_t where = FUZZ_ORIGIN;
+    where = emit(memory, where, v502_MOS_OP_LDX_NOW, rng.byte());
+    memory[where++] = v502_MOS_OP_TXS;
+    where = emit(memory, where, v502_MOS_OP_LDA_NOW, rng.byte());
+    memory[where++] = v502_MOS_OP_PHA;
+    memory[where++] = v502_MOS_OP_PLP;
+    where = emit(memory, where, v502_MOS_OP_LDA_NOW, rng.byte());
+    where = emit(memory, where, v502_MOS_OP_LDX_NOW, rng.byte());
+    where = emit(memory, where, v502_MOS_OP_LDY_NOW, rng.byte());
+
+    // Laid out first so operands can point at instructions further along, the last target is just past the end
+    const fuzz_opcode_t* body[FUZZ_MAX_LENGTH];
+    v502_word_t targets[FUZZ_MAX_LENGTH + 1];
+    uint32_t length = 1 + rng.below(FUZZ_MAX_LENGTH);
+
+    for (uint32_t i = 0; i < length; i++) {
+        body[i] = &opcodes[rng.below((uint32_t)opcodes.size())];
+        targets[i] = where;
+        where += body[i]->length;
+    }
+
+    v502_word_t end = targets[length] = where;
+    bool loops = rng.below(2) == 0;
+
+    for (uint32_t slot = 0; slot < FUZZ_JUMP_SLOTS; slot++) {
+        v502_word_t target = targets[rng.below(length + 1)];
+        memory[FUZZ_JUMP_TABLE + slot * 2] = (v502_byte_t)target;
+        memory[FUZZ_JUMP_TABLE + slot * 2 + 1] = (v502_byte_t)(target >> 8);
+    }
+
+    for (uint32_t i = 0; i < length; i++) {
+        const fuzz_opcode_t* op = body[i];
+        v502_word_t operand = 0;
+
+        switch (op->operand) {
+            case FUZZ_OPERAND_NONE:
+                break;
+
+            case FUZZ_OPERAND_BYTE:
+                operand = rng.byte();
+                break;
+
+            case FUZZ_OPERAND_DATA:
+                if (rng.below(8) == 0)
+                    operand = FUZZ_ORIGIN + rng.below(end - FUZZ_ORIGIN);
+                else
+                    operand = FUZZ_DATA + rng.below(FUZZ_DATA_LENGTH);
+                break;
+
+            case FUZZ_OPERAND_BRANCH: {
+                // Relative to the offset byte, so only targets an int8 can reach from there
+                int from = targets[i] + 1;
+                uint32_t first = 0, last = length;
+
+                while (targets[first] < from - 128)
+                    first++;
+
+                while (targets[last] > from + 127)
+                    last--;
+
+                operand = (v502_byte_t)(targets[first + rng.below(last - first + 1)] - from);
+                break;
+            }
+
+            case FUZZ_OPERAND_TARGET:
+                operand = targets[rng.below(length + 1)];
+                break;
+
+            case FUZZ_OPERAND_POINTER:
+                operand = FUZZ_JUMP_TABLE + rng.below(FUZZ_JUMP_SLOTS) * 2;
+                break;
+        }
+
+        memory[targets[i]] = op->opcode;
+
+        if (op->length > 1)
+            memory[targets[i] + 1] = (v502_byte_t)operand;
+
+        if (op->length > 2)
+            memory[targets[i] + 2] = (v502_byte_t)(operand >> 8);
+    }
+
+    if (loops) {
+        memory[end] = v502_MOS_OP_JMP_ABS;
+        memory[end + 1] = (v502_byte_t)targets[0];
+        memory[end + 2] = (v502_byte_t)(targets[0] >> 8);
+    }
+
+    state.program_counter = FUZZ_ORIGIN;
+    state.stack_ptr = 0xFF;
+    state.accumulator = state.index_x = state.index_y = 0;
+    state.flags = 0;
+    state.cycles = 0;
+}
+
+int fuzz(side_t& left, side_t& right, v502_qword_t programs, uint64_t seed, v502_qword_t interval, v502_qword_t max_instructions, const std::string& out_path) {
+    std::vector<fuzz_opcode_t> opcodes = list_fuzz_opcodes();
+    rng_t rng { seed };
+    state_t program, checkpoint;
+    program.memory.resize(left.vm->hunk_length);
+
+    std::cout << "Fuzzing " << engine_names[left.engine] << " against " << engine_names[right.engine] << " with seed " << seed << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    auto last_report = start;
+    v502_qword_t instructions = 0;
+
+    for (v502_qword_t p = 0; p < programs; p++) {
+        generate_program(rng, opcodes, program);
+        load_state(left.vm, program);
+        load_state(right.vm, program);
+
+        lockstep_result_t result = lockstep(left, right, interval, max_instructions, checkpoint);
+        instructions += result.instructions;
+
+        if (result.diverged) {
+            std::ofstream out(out_path, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(program.memory.data()), program.memory.size());
+
+            std::cout << "Program " << p << " diverged, " << (out.good() ? "saved it to '" + out_path + "'" : "couldn't save it to '" + out_path + "'");
+            std::cout << ", rerun it with diff502 -b " << out_path << " -s " << max_instructions << std::endl;
+            return 1;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(1)) {
+            double seconds = std::chrono::duration<double>(now - start).count();
+            std::cerr << "\r" << p + 1 << " programs, " << (v502_qword_t)((p + 1) / seconds) << " per second" << std::flush;
+            last_report = now;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << "\r";
+    std::cout << programs << " programs (" << instructions << " instructions) agreed in " << seconds << " s, ";
+    std::cout << (v502_qword_t)(seconds > 0 ? programs / seconds * 60 : 0) << " programs per minute" << std::endl;
+
+    return 0;
+}
+
+void print_help() {
+    std::cout << "Example: diff502 -b program.bin --right jit\n";
+    std::cout << "Example: diff502 --fuzz 1000000 --right predecoded\n";
+    std::cout << "Arguments: \n";
+    std::cout << "\t-b or --bin, requires a path after, the binary both sides run\n";
+    std::cout << "\t-l or --left, requires a name after (step, table, threaded, predecoded or jit), defaults to step, single steps through the table engine like v502_cycle_vm()\n";
+    std::cout << "\t-r or --right, requires a name after, same choices, defaults to the fastest engine in this build\n";
+    std::cout << "\t-i or --interval, requires a number after, how many instructions run between comparisons (10000 by default)\n";
+    std::cout << "\t-s or --steps, requires a number after, stops after that many instructions, 0 runs until the VMs stop\n";
+    std::cout << "\t\tDefaults to 0, or 1000 per program when fuzzing\n";
+    std::cout << "\t--fuzz, requires a number after, runs that many random programs instead of a binary\n";
+    std::cout << "\t--seed, requires a number after, where the random programs come from (the time by default)\n";
+    std::cout << "\t-o or --out, requires a path after, where a program that diverged is saved (diverged.bin by default)\n";
+    std::cout << std::endl;
+}
+
+// Runs two engines side by side and reports the first instruction they disagree on
+int main(int argc, char** argv) {
+    std::string bin_path;
+    std::string out_path = "diverged.bin";
+    int left_engine = DIFF502_ENGINE_STEP;
+    int right_engine = fastest_engine();
+    v502_qword_t interval = 10000;
+    v502_qword_t max_instructions = 0;
+    bool custom_steps = false;
+    bool fuzzing = false;
+    v502_qword_t programs = 0;
+    uint64_t seed = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+
+    if (argc > 1) {
+        std::vector<std::string> args;
+
+        for (int a = 1; a < argc; a++)
+            args.emplace_back(std::string(argv[a]));
+
+        bool need_input = false;
+        std::string what_input = "";
+        for (auto arg : args) {
+            auto named = arg.find("--");
+
+            if (need_input) {
+                if (arg.find("-") != std::string::npos) {
+                    std::cerr << what_input << " needs input but nothing was provided!" << std::endl;
+                    return 1;
+                }
+
+                if (what_input == "bin" || what_input == "b") {
+                    bin_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "out" || what_input == "o") {
+                    out_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "left" || what_input == "l" || what_input == "right" || what_input == "r") {
+                    int engine = -1;
+                    for (int e = 0; e < 5; e++)
+                        if (arg == engine_names[e])
+                            engine = e;
+
+                    if (engine == -1) {
+                        std::cerr << "Unknown engine '" << arg << "', pick step, table, threaded, predecoded or jit!" << std::endl;
+                        return 1;
+                    }
+
+                    // Comparing the fallback against itself would prove nothing
+                    if (engine != DIFF502_ENGINE_STEP && !v502_engine_supported((v502_ENGINE_E)engine)) {
+                        std::cerr << "The " << arg << " engine isn't available in this build!" << std::endl;
+                        return 1;
+                    }
+
+                    (what_input[0] == 'l' ? left_engine : right_engine) = engine;
+                    need_input = false;
+                }
+
+                if (what_input == "interval" || what_input == "i" || what_input == "steps" || what_input == "s" || what_input == "fuzz" || what_input == "seed") {
+                    try {
+                        v502_qword_t value = std::stoull(arg);
+
+                        if (what_input[0] == 'i')
+                            interval = value;
+                        else if (what_input == "fuzz")
+                            programs = value;
+                        else if (what_input == "seed")
+                            seed = value;
+                        else {
+                            max_instructions = value;
+                            custom_steps = true;
+                        }
+
+                        need_input = false;
+                    } catch (std::exception err) {
+                        std::cout << "Provided " << what_input << " wasn't a valid number!" << std::endl;
+                        std::cerr << err.what() << std::endl;
+                        return 1;
+                    }
+                }
+            } else {
+                if (named != std::string::npos) {
+                    std::string sub = arg.substr(2);
+
+                    if (sub == "help") {
+                        print_help();
+                        return 0;
+                    }
+
+                    if (sub == "fuzz")
+                        fuzzing = true;
+
+                    if (sub == "bin" || sub == "out" || sub == "left" || sub == "right" || sub == "interval" || sub == "steps" || sub == "fuzz" || sub == "seed") {
+                        need_input = true;
+                        what_input = sub;
+                    }
+                } else {
+                    auto shorthand = arg.find("-");
+
+                    if (shorthand != std::string::npos) {
+                        std::string sub = arg.substr(1);
+
+                        for (auto ch : sub) {
+                            if (ch == 'h') {
+                                print_help();
+                                return 0;
+                            }
+
+                            if (ch == 'b' || ch == 'o' || ch == 'l' || ch == 'r' || ch == 'i' || ch == 's') {
+                                need_input = true;
+                                what_input = std::string(1, ch);
+                            }
+                        }
+                    } else
+                        bin_path = arg;
+                }
+            }
+        }
+    } else {
+        std::cerr << "Please provide a .bin file to compare engines on, or --fuzz!\nPass --help to see possible arguments!" << std::endl;
+        return 1;
+    }
+
+    if (!fuzzing && bin_path.empty()) {
+        std::cerr << "No bin path was provided, please provide one using -b or --bin!" << std::endl;
+        return 1;
+    }
+
+    if (interval == 0) {
+        std::cerr << "The interval must be at least 1!" << std::endl;
+        return 1;
+    }
+
+    if (fuzzing && programs == 0) {
+        std::cerr << "--fuzz needs at least 1 program!" << std::endl;
+        return 1;
+    }
+
+    side_t left { left_engine, create_side_vm(left_engine) };
+    side_t right { right_engine, create_side_vm(right_engine) };
+
+    int status;
+    if (fuzzing)
+        status = fuzz(left, right, programs, seed, interval, custom_steps ? max_instructions : 1000, out_path);
+    else {
+        std::ifstream bin_file(bin_path, std::ios::binary);
+
+        if (!bin_file.is_open()) {
+            std::cerr << "bin file not found at '" << bin_path << "'" << std::endl;
+            v502_free_vm(left.vm);
+            v502_free_vm(right.vm);
+            return 1;
+        }
+
+        bin_file.read(reinterpret_cast<char*>(left.vm->hunk), left.vm->hunk_length);
+        memcpy(right.vm->hunk, left.vm->hunk, right.vm->hunk_length);
+
+        v502_reset_vm(left.vm);
+        v502_reset_vm(right.vm);
+
+        state_t checkpoint;
+        auto start = std::chrono::steady_clock::now();
+        lockstep_result_t result = lockstep(left, right, interval, max_instructions, checkpoint);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (!result.diverged) {
+            std::cout << engine_names[left.engine] << " and " << engine_names[right.engine] << " agreed for " << result.instructions << " instructions";
+            std::cout << " in " << seconds << " s, " << exit_reasons[result.exit_info.reason];
+            std::cout << " at PC = " << std::hex << left.vm->program_counter << std::dec << std::endl;
+        }
+
+        status = result.diverged ? 1 : 0;
+    }
+
+    v502_free_vm(left.vm);
+    v502_free_vm(right.vm);
+
+    return status;
+}
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <vector>
 #include <iomanip> // for setw and setfill
+#include <cstdlib>
 
 #include <glad/glad.h>
 #include <SDL2/SDL.h>
@@ -293,6 +294,9 @@ int main(int argc, char** argv) {
 
     v502_6502vm_t *vm = v502_functions->v502_create_vm(&createinfo);
 
+    // Lets the image skip uploads while its pages are untouched
+    v502_functions->v502_track_dirty_vm(vm, v502_DIRTY_TRACKING_PAGES);
+
     v502_assembler_instance_t* assembler_instance = v502_functions->v502_create_assembler();
 
     ImGui::CreateContext();
@@ -315,6 +319,14 @@ int main(int argc, char** argv) {
     char path_buf[256];
     memset(path_buf, 0, 256);
 
+    char breakpoint_buf[5];
+    memset(breakpoint_buf, 0, 5);
+
+    char last_write_buf[5];
+    memset(last_write_buf, 0, 5);
+
+    int history_budget = 64; // MB
+
     bool auto_cycle = false;
     int cycle_interval = 1000; // 1 ms
 
@@ -322,8 +334,14 @@ int main(int argc, char** argv) {
 
     int substeps = 1;
 
+    // Measured from vm->cycles, so this is in actual 6502 clock cycles rather than instructions
+    uint64_t cps_cycles = 0;
+    float cps_time = 0.0F;
+    double cycles_per_second = 0.0;
+
     // Memory for the 16x16 image that lives in page 5000 - 52FF by default, but can be shifted
     int image_page = 0x50;
+    int shown_image_page = -1; // The page the texture was last built from, -1 forces a rebuild
     GLuint image_buffer;
     glGenTextures(1, &image_buffer);
     glBindTexture(GL_TEXTURE_2D, image_buffer);
@@ -377,14 +395,28 @@ int main(int argc, char** argv) {
 
             auto vm_hunk = vm->hunk;
             auto vm_funcs = vm->opfuncs;
+            auto vm_cache = vm->decode_cache;
 
             memcpy(vm, old_vm, sizeof(v502_6502vm_t));
 
             vm->hunk = vm_hunk;
             memcpy(vm->hunk, old_vm->hunk, vm->hunk_length);
 
+            // Overrides point into the old library as well, so we go back to the new library's shared table
             vm->opfuncs = vm_funcs;
+            vm->owned_opfuncs = nullptr;
+
+            // The old cache points into the library we just unloaded, the new VM rebuilds its own
+            vm->decode_cache = vm_cache;
+
+            // So might the device table, pages past the hunk point at a device inside the library
+            v502_functions->v502_map_ram_vm(vm, 0, v502_BUS_PAGES);
 
+            // Translated code calls into the old library too, keep the buffer but throw away everything in it
+            v502_functions->v502_invalidate_vm(vm, 0, v502_DECODE_CACHE_ENTRIES);
+
+            free(old_vm->decode_cache);
+            free(old_vm->owned_opfuncs);
             free(old_vm->hunk);
             free(old_vm);
 
@@ -547,8 +579,80 @@ int main(int argc, char** argv) {
 
         bool manual_cycle = ImGui::Button("Step");
 
+        ImGui::InputTextWithHint("Breakpoint", "ex: 0600", breakpoint_buf, 5, ImGuiInputTextFlags_CharsHexadecimal);
+
+        if (ImGui::Button("Toggle Breakpoint") && breakpoint_buf[0] != 0) {
+            v502_word_t where = (v502_word_t)strtoul(breakpoint_buf, nullptr, 16);
+            bool enabled = vm->debug == nullptr || !v502_has_breakpoint(vm->debug, where);
+
+            v502_functions->v502_set_breakpoint_vm(vm, where, enabled);
+            call_stream << (enabled ? "Set" : "Cleared") << " breakpoint at 0x" << std::hex << PAD_HEX << where << std::dec << "\n" << std::endl;
+        }
+
+        ImGui::InputInt("History Budget (MB)", &history_budget);
+
+        if (history_budget < 1)
+            history_budget = 1;
+
+        bool history_on = vm->history != nullptr;
+        bool went_back = false;
+
+        if (ImGui::Checkbox("History", &history_on)) {
+            if (!history_on)
+                v502_functions->v502_end_history_vm(vm);
+            else if (!v502_functions->v502_begin_history_vm(vm, (v502_qword_t)history_budget << 20, 0))
+                call_stream << "Couldn't turn history on with a " << history_budget << " MB budget\n" << std::endl;
+        }
+
+        if (vm->history != nullptr) {
+            v502_history_info_t history_info {};
+            v502_functions->v502_get_history_vm(vm, &history_info);
+
+            ImGui::SameLine();
+            ImGui::Text("%llu steps back (%llu without re-running), %.1f of %.1f MB", (unsigned long long)(history_info.position - history_info.oldest),
+                        (unsigned long long)(history_info.position - history_info.undo_start), history_info.used / 1048576.0, history_info.budget / 1048576.0);
+
+            // Going back a step at a time mirrors the Step button, so it takes back as many steps as that runs
+            if (ImGui::Button("Step Back")) {
+                v502_functions->v502_step_back_vm(vm, substeps);
+                auto_cycle = false;
+                went_back = true;
+            }
+
+            ImGui::SameLine();
+
+            if (ImGui::Button("Run Back")) {
+                v502_exit_info_t exit_info {};
+
+                if (v502_functions->v502_run_back_vm(vm, 0, &exit_info) == v502_EXIT_REASON_BREAKPOINT)
+                    call_stream << "Went back " << exit_info.instructions << " steps to the breakpoint at 0x" << std::hex << PAD_HEX << exit_info.program_counter << std::dec << "\n" << std::endl;
+                else
+                    call_stream << "Went back " << exit_info.instructions << " steps to the start of the history\n" << std::endl;
+
+                auto_cycle = false;
+                went_back = true;
+            }
+
+            ImGui::InputTextWithHint("Address", "ex: 0200", last_write_buf, 5, ImGuiInputTextFlags_CharsHexadecimal);
+            ImGui::SameLine();
+
+            if (ImGui::Button("Last Write") && last_write_buf[0] != 0) {
+                v502_word_t where = (v502_word_t)strtoul(last_write_buf, nullptr, 16);
+                v502_history_write_t write {};
+
+                if (v502_functions->v502_last_write_vm(vm, where, &write)) {
+                    call_stream << "0x" << std::hex << PAD_HEX << where << " was last written by the instruction at 0x" << PAD_HEX << write.program_counter;
+                    call_stream << " (0x" << PAD_HEX_LO << +write.old_value << " -> 0x" << PAD_HEX_LO << +write.new_value << std::dec << "), ";
+                    call_stream << history_info.position - write.step << " steps back\n" << std::endl;
+                } else
+                    call_stream << "Nothing in the undo log wrote 0x" << std::hex << PAD_HEX << where << std::dec << "\n" << std::endl;
+            }
+        }
+
         ImGui::End();
 
+        bool image_refresh = went_back;
+
         if (auto_cycle || manual_cycle) {
             cycle_wait += imguiIO.DeltaTime;
 
@@ -556,13 +660,35 @@ int main(int argc, char** argv) {
                 cycle_wait = 0;
 
                 try {
-                    for (int s = 0; s < substeps; s++)
-                        v502_functions->v502_cycle_vm(vm);
+                    v502_exit_info_t exit_info {};
+
+                    if (v502_functions->v502_run_vm(vm, substeps, &exit_info) != v502_EXIT_REASON_BUDGET) {
+                        const char* exit_reasons[6] = { "budget exhausted", "unknown opcode", "breakpoint", "halted", "watched read", "watched write" };
+
+                        call_stream << "VM stopped (" << exit_reasons[exit_info.reason] << ") at 0x" << std::hex << PAD_HEX << exit_info.program_counter;
+                        call_stream << " on opcode 0x" << PAD_HEX_LO << +exit_info.opcode << std::dec << "\n" << std::endl;
+                        auto_cycle = false;
+                    }
                 } catch (std::exception& err) {
                     call_stream << "Encountered exception while trying to cycle the CPU (check console for specifics!):\n" << err.what() << "\n" << std::endl;
                 }
 
-                // We refresh the image here instead because of performance
+                image_refresh = true;
+            }
+        } else
+            cycle_wait = 0.0F;
+
+        // We refresh the image here instead because of performance, and only if the program (or going back) wrote to it
+        if (image_refresh) {
+            uint64_t dirty_pages[v502_DIRTY_PAGE_WORDS];
+            v502_functions->v502_take_dirty_pages_vm(vm, dirty_pages);
+
+            bool image_dirty = image_page != shown_image_page;
+
+            for (int c = 0; c < 3; c++)
+                image_dirty |= v502_is_dirty(dirty_pages, image_page + c) != 0;
+
+            if (image_dirty) {
                 uint8_t pixels[256 * 3];
                 for (int p = 0; p < 256; p++) {
                     auto o = p * 3;
@@ -572,9 +698,9 @@ int main(int argc, char** argv) {
                 }
 
                 glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 16, 16, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+                shown_image_page = image_page;
             }
-        } else
-            cycle_wait = 0.0F;
+        }
 
         ImGui::Begin("Memory");
         ImGui::InputInt("Page", &page_number);
@@ -613,6 +739,7 @@ int main(int argc, char** argv) {
                 v502_functions->v502_reset_vm(vm);
 
                 dasm_dirty = true;
+                shown_image_page = -1;
                 bin_file.close();
             } else {
                 call_stream << "Failed to load binary at '" << path_buf << "', does it exist? Do you have access to it?\n" << std::endl;
@@ -693,8 +820,19 @@ int main(int argc, char** argv) {
 
         ImGui::Spacing();
 
-        ImGui::Text("If auto stepping at max speed:");
-        ImGui::Text("Cycles (CPS) = %f", io.Framerate * substeps);
+        cps_time += io.DeltaTime;
+
+        if (vm->cycles < cps_cycles)
+            cps_cycles = vm->cycles; // Reset or reloaded
+
+        if (cps_time >= 0.5F) {
+            cycles_per_second = (double)(vm->cycles - cps_cycles) / cps_time;
+            cps_cycles = vm->cycles;
+            cps_time = 0.0F;
+        }
+
+        ImGui::Text("Cycles = %llu", (unsigned long long)vm->cycles);
+        ImGui::Text("Cycles (CPS) = %.0f", cycles_per_second);
 
         ImGui::End();
 
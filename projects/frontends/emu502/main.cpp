@@ -1,21 +1,26 @@
 #include <v502/v502.h>
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <iomanip> // for setw and setfill
 
 #ifdef _WIN32
 #include <Windows.h>
+#include <psapi.h>
 #endif
 
-#if defined(__linux__) || defined(__FreeBSD__) || defined(__unix__)
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__unix__) || defined(__APPLE__)
 #define UNIX_LIKE
 #include <unistd.h>
+#include <sys/resource.h>
 #endif
 
 #include <time.h>
+#include <csignal>
 
 #define PAD_HEX_LO std::setfill('0') << std::setw(2)
 #define PAD_HEX std::setfill('0') << std::setw(4)
@@ -32,17 +37,245 @@ void zero_cursor() {
 #endif
 }
 
+// Set by Ctrl+C while profiling, tracing or running headless, so the profile, trace or report still gets written
+volatile std::sig_atomic_t interrupted = 0;
+
+void on_interrupt(int) {
+    interrupted = 1;
+}
+
+// Only what actually ran is written, in address order
+bool write_profile(const std::string& path, const v502_profile_t* profile) {
+    std::ofstream out(path);
+
+    if (!out.is_open())
+        return false;
+
+    v502_qword_t total = 0;
+    for (auto count : profile->opcodes)
+        total += count;
+
+    out << "{\n";
+    out << "    \"instructions\": " << std::dec << total << ",\n";
+
+    out << "    \"opcodes\": [";
+    bool first = true;
+    for (int op = 0; op < 256; op++) {
+        if (profile->opcodes[op] == 0)
+            continue;
+
+        out << (first ? "\n" : ",\n");
+        out << "        { \"opcode\": \"0x" << std::hex << PAD_HEX_LO << op << "\", \"count\": " << std::dec << profile->opcodes[op] << " }";
+        first = false;
+    }
+    out << "\n    ],\n";
+
+    out << "    \"addresses\": [";
+    first = true;
+    for (int where = 0; where < 0x10000; where++) {
+        if (profile->addresses[where] == 0)
+            continue;
+
+        out << (first ? "\n" : ",\n");
+        out << "        { \"address\": \"0x" << std::hex << PAD_HEX << where << "\", \"count\": " << std::dec << profile->addresses[where] << " }";
+        first = false;
+    }
+    out << "\n    ]\n";
+    out << "}\n";
+
+    return out.good();
+}
+
+// Indexed by v502_ENGINE_E, also what --engine takes
+const char* engine_names[4] = { "table", "threaded", "predecoded", "jit" };
+
+const char* exit_reasons[6] = { "budget exhausted", "unknown opcode", "breakpoint", "halted", "watched read", "watched write" };
+
+v502_ENGINE_E fastest_engine() {
+    if (v502_engine_supported(v502_ENGINE_JIT))
+        return v502_ENGINE_JIT;
+
+    if (v502_engine_supported(v502_ENGINE_THREADED))
+        return v502_ENGINE_THREADED;
+
+    return v502_ENGINE_PREDECODED;
+}
+
+// In KiB, 0 where the platform won't tell
+uint64_t peak_rss_kib() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters {};
+
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / 1024;
+#endif
+
+#ifdef UNIX_LIKE
+    rusage usage {};
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024; // Bytes there
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+
+    return 0;
+}
+
+std::string json_escape(const std::string& text) {
+    std::ostringstream out;
+
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\')
+            out << '\\' << ch;
+        else if ((unsigned char)ch < 0x20)
+            out << "\\u" << std::hex << std::setfill('0') << std::setw(4) << +(unsigned char)ch << std::dec;
+        else
+            out << ch;
+    }
+
+    return out.str();
+}
+
+struct HeadlessRun {
+    v502_exit_info_t exit_info {}; // Of the last slice, except instructions and cycles which add up all of them
+    double seconds = 0;
+};
+
+// Runs without drawing or sleeping, max_instructions of 0 runs until the VM stops
+// The budget is handed over in slices so Ctrl+C still gets through, that costs nothing next to what a slice runs
+HeadlessRun run_headless(v502_6502vm_t* cpu, v502_qword_t max_instructions) {
+    const v502_qword_t slice = 1 << 24;
+
+    HeadlessRun run;
+    v502_qword_t instructions = 0;
+    v502_qword_t cycles = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (!interrupted) {
+        v502_qword_t budget = slice;
+
+        if (max_instructions != 0 && max_instructions - instructions < slice)
+            budget = max_instructions - instructions;
+
+        v502_EXIT_REASON_E reason = v502_run_vm(cpu, budget, &run.exit_info);
+
+        instructions += run.exit_info.instructions;
+        cycles += run.exit_info.cycles;
+
+        if (reason != v502_EXIT_REASON_BUDGET || (max_instructions != 0 && instructions >= max_instructions))
+            break;
+    }
+
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.exit_info.instructions = instructions;
+    run.exit_info.cycles = cycles;
+
+    return run;
+}
+
+void print_bench(const HeadlessRun& run, const std::string& bin_path, v502_ENGINE_E engine, bool json) {
+    double ips = run.seconds > 0 ? run.exit_info.instructions / run.seconds : 0;
+    double cps = run.seconds > 0 ? run.exit_info.cycles / run.seconds : 0;
+
+    if (json) {
+        std::cout << "{\n";
+        std::cout << "    \"bin\": \"" << json_escape(bin_path) << "\",\n";
+        std::cout << "    \"engine\": \"" << engine_names[engine] << "\",\n";
+        std::cout << "    \"instructions\": " << run.exit_info.instructions << ",\n";
+        std::cout << "    \"cycles\": " << run.exit_info.cycles << ",\n";
+        std::cout << "    \"seconds\": " << std::fixed << std::setprecision(6) << run.seconds << std::defaultfloat << ",\n";
+        std::cout << "    \"instructions_per_second\": " << (uint64_t)ips << ",\n";
+        std::cout << "    \"cycles_per_second\": " << (uint64_t)cps << ",\n";
+        std::cout << "    \"peak_rss_kib\": " << peak_rss_kib() << ",\n";
+        std::cout << "    \"exit_reason\": \"" << (interrupted ? "interrupted" : exit_reasons[run.exit_info.reason]) << "\"\n";
+        std::cout << "}" << std::endl;
+        return;
+    }
+
+    std::cout << "Ran " << run.exit_info.instructions << " instructions (" << run.exit_info.cycles << " cycles) on the " << engine_names[engine] << " engine in " << run.seconds << " s\n";
+    std::cout << ips / 1e6 << " MIPS, " << cps / 1e6 << " million cycles per second, peak RSS " << peak_rss_kib() << " KiB" << std::endl;
+}
+
+// Replays on the fastest engine this build has, nothing is drawn so this is as fast as the VM goes
+int replay(const std::string& path) {
+    v502_replay_t* replay = v502_open_replay(path.c_str());
+
+    if (replay == nullptr) {
+        std::cerr << "'" << path << "' isn't a recording this version of v502 can replay" << std::endl;
+        return 1;
+    }
+
+    v502_6502vm_t* cpu = v502_create_replay_vm(replay, fastest_engine());
+
+    if (cpu == nullptr) {
+        std::cerr << "Couldn't create a VM to replay '" << path << "' on" << std::endl;
+        v502_close_replay(replay);
+        return 1;
+    }
+
+    v502_exit_info_t exit_info {};
+
+    auto start = std::chrono::steady_clock::now();
+    v502_REPLAY_RESULT_E result = v502_run_replay_vm(replay, cpu, &exit_info);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const char* results[4] = { "matched the recording", "diverged from the recording", "ended in a different state than recorded", "reached the end of an unfinished recording" };
+
+    std::cout << "Replay " << results[result] << " after " << std::dec << exit_info.instructions << " instructions (" << exit_info.cycles << " cycles)";
+    std::cout << " in " << seconds << " s, " << (seconds > 0 ? exit_info.instructions / seconds / 1e6 : 0) << " MIPS\n";
+    std::cout << std::hex << "PC = " << PAD_HEX << +cpu->program_counter << ", AC = " << PAD_HEX_LO << +cpu->accumulator;
+    std::cout << ", IX = " << PAD_HEX_LO << +cpu->index_x << ", IY = " << PAD_HEX_LO << +cpu->index_y << ", ST = " << PAD_HEX_LO << +cpu->stack_ptr << std::endl;
+
+    v502_free_vm(cpu);
+    v502_close_replay(replay);
+
+    return result == v502_REPLAY_RESULT_MATCHED || result == v502_REPLAY_RESULT_TRUNCATED ? 0 : 1;
+}
+
 void print_help() {
     std::cout << "Arguments: \n";
     std::cout << "\t-b or --bin, requires a value after, tells the program what binary file to load\n";
     std::cout << "\t-i or --interval, requires a number after, tells the program to wait the provided number of milliseconds\n";
+    std::cout << "\t-s or --steps, requires a number after, tells the program how many instructions to run between redraws\n";
+    std::cout << "\t--shm, requires a name after, puts the VM's memory in a shared memory object other programs can watch (e.g. /emu502)\n";
+    std::cout << "\t--shm-replace, removes an object left under the --shm name by an emu502 that died first, don't use it while another one is still running\n";
+    std::cout << "\t--profile, requires a path after, writes how often each opcode and address ran there as JSON once the VM stops or on Ctrl+C\n";
+    std::cout << "\t\tOnly works if v502 was built with V502_PROFILING\n";
+    std::cout << "\t--trace, requires a path after, records every instruction into a binary trace there, read it back with trace502\n";
+    std::cout << "\t--break, requires a hex address after, stops the VM before it executes that address, can be given more than once\n";
+    std::cout << "\t--watch, requires a hex address after, stops the VM after an instruction reads or writes that address, can be given more than once\n";
+    std::cout << "\t--record, requires a path after, records every input to the VM there so the run can be replayed exactly\n";
+    std::cout << "\t--replay, requires a path after, replays a recording at full speed without drawing anything, no --bin needed\n";
+    std::cout << "\t--engine, requires a name after (table, threaded, predecoded or jit), picks how the VM executes instructions\n";
+    std::cout << "\t--headless, runs as fast as possible without drawing or sleeping and prints where the VM stopped, on the fastest engine unless --engine says otherwise\n";
+    std::cout << "\t--bench, requires a number after, implies --headless, runs that many instructions (0 runs until the VM stops) and reports instructions and cycles per second, wall time and peak RSS\n";
+    std::cout << "\t--json, prints the --bench report as JSON instead\n";
     std::cout << std::endl;
 }
 
 int main(int argc, char** argv) {
     std::string bin_path;
+    std::string shm_name;
+    std::string profile_path;
+    std::string trace_path;
+    std::string record_path;
+    std::string replay_path;
+    std::vector<v502_word_t> breakpoints;
+    std::vector<v502_word_t> watchpoints;
     bool custom_time = false;
     int interval = 0;
+    int steps = 1;
+    bool headless = false;
+    bool shm_replace = false;
+    bool bench = false;
+    bool json = false;
+    v502_qword_t bench_instructions = 0;
+    int engine = -1; // The VM's default, or the fastest engine when headless
 
     if (argc > 1) {
         std::vector<std::string> args;
@@ -77,6 +310,93 @@ int main(int argc, char** argv) {
                         return 1;
                     }
                 }
+
+                if (what_input == "shm") {
+                    shm_name = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "profile") {
+                    profile_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "trace") {
+                    trace_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "record") {
+                    record_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "replay") {
+                    replay_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "engine") {
+                    for (int e = 0; e < 4; e++)
+                        if (arg == engine_names[e])
+                            engine = e;
+
+                    if (engine == -1) {
+                        std::cerr << "Unknown engine '" << arg << "', pick table, threaded, predecoded or jit!" << std::endl;
+                        return 1;
+                    }
+
+                    // Rather than quietly benchmarking the engine it falls back to
+                    if (!v502_engine_supported((v502_ENGINE_E)engine)) {
+                        std::cerr << "The " << arg << " engine isn't available in this build!" << std::endl;
+                        return 1;
+                    }
+
+                    need_input = false;
+                }
+
+                if (what_input == "bench") {
+                    try {
+                        bench_instructions = std::stoull(arg);
+                        need_input = false;
+                    } catch (std::exception err) {
+                        std::cout << "Provided instruction count wasn't a valid number!" << std::endl;
+                        std::cerr << err.what() << std::endl;
+                        return 1;
+                    }
+                }
+
+                if (what_input == "break" || what_input == "watch") {
+                    try {
+                        unsigned long address = std::stoul(arg, nullptr, 16);
+
+                        if (address > 0xFFFF)
+                            throw std::out_of_range("addresses only go up to FFFF");
+
+                        (what_input == "break" ? breakpoints : watchpoints).push_back((v502_word_t)address);
+                        need_input = false;
+                    } catch (std::exception err) {
+                        std::cout << "Provided " << what_input << " address wasn't a valid hex address!" << std::endl;
+                        std::cerr << err.what() << std::endl;
+                        return 1;
+                    }
+                }
+
+                if (what_input == "steps" || what_input == "s") {
+                    try {
+                        steps = stoi(arg);
+                        need_input = false;
+                    } catch (std::exception err) {
+                        std::cout << "Provided step count wasn't a valid number!" << std::endl;
+                        std::cerr << err.what() << std::endl;
+                        return 1;
+                    }
+
+                    if (steps < 1) {
+                        std::cerr << "Step count must be at least 1!" << std::endl;
+                        return 1;
+                    }
+                }
             } else {
                 if (named != std::string::npos) {
                     std::string sub = arg.substr(2);
@@ -95,6 +415,56 @@ int main(int argc, char** argv) {
                         need_input = true;
                         what_input = "interval";
                     }
+
+                    if (sub == "steps") {
+                        need_input = true;
+                        what_input = "steps";
+                    }
+
+                    if (sub == "shm") {
+                        need_input = true;
+                        what_input = "shm";
+                    }
+
+                    if (sub == "profile") {
+                        need_input = true;
+                        what_input = "profile";
+                    }
+
+                    if (sub == "trace") {
+                        need_input = true;
+                        what_input = "trace";
+                    }
+
+                    if (sub == "record" || sub == "replay") {
+                        need_input = true;
+                        what_input = sub;
+                    }
+
+                    if (sub == "break" || sub == "watch") {
+                        need_input = true;
+                        what_input = sub;
+                    }
+
+                    if (sub == "engine") {
+                        need_input = true;
+                        what_input = "engine";
+                    }
+
+                    if (sub == "bench") {
+                        need_input = true;
+                        what_input = "bench";
+                        bench = headless = true;
+                    }
+
+                    if (sub == "headless")
+                        headless = true;
+
+                    if (sub == "shm-replace")
+                        shm_replace = true;
+
+                    if (sub == "json")
+                        json = true;
                 } else {
                     auto shorthand = arg.find("-");
 
@@ -116,6 +486,11 @@ int main(int argc, char** argv) {
                                 need_input = true;
                                 what_input = "i";
                             }
+
+                            if (ch == 's') {
+                                need_input = true;
+                                what_input = "s";
+                            }
                         }
                     }
                 }
@@ -126,6 +501,9 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (!replay_path.empty())
+        return replay(replay_path);
+
     if (bin_path.empty()) {
         std::cerr << "No bin path was provided, please provide one using -b or --bin!" << std::endl;
         return 1;
@@ -134,12 +512,31 @@ int main(int argc, char** argv) {
     v502_6502vm_createinfo_t createinfo {};
     createinfo.hunk_size = 0xFFFF + 1;
 
+    if (engine != -1)
+        createinfo.engine = (v502_ENGINE_E)engine;
+    else if (headless)
+        createinfo.engine = fastest_engine();
+
+    if (!shm_name.empty()) {
+        createinfo.hunk_backing = v502_HUNK_BACKING_SHARED;
+        createinfo.hunk_name = shm_name.c_str();
+
+        if (shm_replace)
+            v502_remove_hunk(shm_name.c_str());
+    }
+
     v502_6502vm_t *cpu = v502_create_vm(&createinfo);
 
+    if (cpu == nullptr) {
+        std::cerr << "Couldn't create the shared memory object '" << shm_name << "', if nothing is using that name anymore try --shm-replace" << std::endl;
+        return 1;
+    }
+
     std::ifstream bin_file(bin_path);
 
     if (!bin_file.is_open()) {
         std::cerr << "bin file not found at '" << bin_path << "'" << std::endl;
+        v502_free_vm(cpu);
         return 1;
     }
 
@@ -148,161 +545,236 @@ int main(int argc, char** argv) {
 
     bin_file.close();
 
-    // This is the best it gets without ncurses!
-    zero_cursor();
-    std::cout << std::endl;
-    for (int h = 0; h < 60; h++) {
-        for (int x = 0; x < 512; x++)
-            std::cout << " ";
-        std::cout << std::endl;
+    if (!profile_path.empty()) {
+        if (!v502_profile_vm(cpu, 1)) {
+            std::cerr << "--profile needs v502 to be built with V502_PROFILING (cmake -DV502_PROFILING=1)" << std::endl;
+            v502_free_vm(cpu);
+            return 1;
+        }
+
+        std::signal(SIGINT, on_interrupt);
     }
-    zero_cursor();
 
-    timespec wait = {};
-    wait.tv_nsec = 1000; // 1mhz
+    if (!trace_path.empty()) {
+        if (!v502_begin_trace_vm(cpu, trace_path.c_str())) {
+            std::cerr << "Couldn't create the trace '" << trace_path << "'" << std::endl;
+            v502_free_vm(cpu);
+            return 1;
+        }
 
-    while (v502_cycle_vm(cpu)) {
-        std::cout << std::hex;
+        std::signal(SIGINT, on_interrupt);
+    }
 
-        std::cout << "[ Emu502 (6502 Simulator) - Powered by V502 ]\n\n";
+    if (!record_path.empty()) {
+        if (!v502_begin_recording_vm(cpu, record_path.c_str())) {
+            std::cerr << "Couldn't create the recording '" << record_path << "'" << std::endl;
+            v502_free_vm(cpu);
+            return 1;
+        }
+
+        std::signal(SIGINT, on_interrupt);
+    }
+
+    for (v502_word_t address : breakpoints)
+        v502_set_breakpoint_vm(cpu, address, 1);
+
+    for (v502_word_t address : watchpoints)
+        v502_set_watchpoint_vm(cpu, address, v502_WATCH_READ | v502_WATCH_WRITE, 1);
+
+    v502_exit_info_t exit_info {};
+
+    if (headless) {
+        std::signal(SIGINT, on_interrupt);
 
-        std::cout << "Flags: \n";
-        std::cout << "| C Z I D - B V N |\n";
-        std::cout << "| ";
+        HeadlessRun run = run_headless(cpu, bench ? bench_instructions : 0);
+        exit_info = run.exit_info;
 
-        for (uint8_t t = 0; t < 8; t++) {
-            std::cout << ((cpu->flags >> t) & 1) << " ";
+        if (bench)
+            print_bench(run, bin_path, cpu->engine, json);
+    } else {
+        // This is the best it gets without ncurses!
+        zero_cursor();
+        std::cout << std::endl;
+        for (int h = 0; h < 60; h++) {
+            for (int x = 0; x < 512; x++)
+                std::cout << " ";
+            std::cout << std::endl;
         }
+        zero_cursor();
 
-        std::cout << "|\n\n";
-        std::cout << "Registers: \n";
-
-        std::cout << "| IX = " << PAD_HEX_LO << +cpu->index_x;
-        std::cout << " | IY = " << PAD_HEX_LO << +cpu->index_y;
-        std::cout << " | AC = " << PAD_HEX_LO << +cpu->accumulator;
-        std::cout << " | ST = " << PAD_HEX_LO << +cpu->stack_ptr;
-        std::cout << " | PC = " << PAD_HEX << +cpu->program_counter;
-        std::cout << " |        \n\n";
-
-        std::cout << "Program Memory: \n";
-        auto lower = (cpu->program_counter - 16) / 16;
-        auto upper = (cpu->program_counter + 32) / 16;
-        for (int x = lower; x < upper; x++) {
-            if (x == lower) {
-                std::cout << "PRV";
-            } else if (x == upper - 1) {
-                std::cout << "NXT";
-            } else {
-                std::cout << "CUR";
-            }
-            std::cout << ": ";
+        // Without an interval we sleep off the cycles each redraw took, one microsecond per cycle like a 1 MHz 6502
+        timespec wait = {};
 
-            if (x < 0) {
-                std::cout << "NONE\n";
-                continue;
-            }
+        while (v502_run_vm(cpu, steps, &exit_info) == v502_EXIT_REASON_BUDGET && !interrupted) {
+            std::cout << std::hex;
 
-            std::cout << std::setfill('0') << std::setw(4) << x * 16 << " -> ";
-            std::cout << std::setfill('0') << std::setw(4) << ((x + 1) * 16) - 1 << ": ";
+            std::cout << "[ Emu502 (6502 Simulator) - Powered by V502 ]\n\n";
 
-            for (int y = 0; y < 16; y++) {
-                int idx = x * 16 + y;
-                if (idx >= cpu->hunk_length)
-                    break;
+            std::cout << "Flags: \n";
+            std::cout << "| C Z I D - B V N |\n";
+            std::cout << "| ";
 
-                int value = +cpu->hunk[idx];
+            for (uint8_t t = 0; t < 8; t++) {
+                std::cout << ((cpu->flags >> t) & 1) << " ";
+            }
 
-                if (cpu->program_counter == idx) {
-#ifdef UNIX_LIKE
-                    std::cout << "\033[1;4;93m";
-#endif
+            std::cout << "|\n\n";
+            std::cout << "Registers: \n";
+
+            std::cout << "| IX = " << PAD_HEX_LO << +cpu->index_x;
+            std::cout << " | IY = " << PAD_HEX_LO << +cpu->index_y;
+            std::cout << " | AC = " << PAD_HEX_LO << +cpu->accumulator;
+            std::cout << " | ST = " << PAD_HEX_LO << +cpu->stack_ptr;
+            std::cout << " | PC = " << PAD_HEX << +cpu->program_counter;
+            std::cout << " |        \n\n";
+
+            std::cout << "Program Memory: \n";
+            auto lower = (cpu->program_counter - 16) / 16;
+            auto upper = (cpu->program_counter + 32) / 16;
+            for (int x = lower; x < upper; x++) {
+                if (x == lower) {
+                    std::cout << "PRV";
+                } else if (x == upper - 1) {
+                    std::cout << "NXT";
+                } else {
+                    std::cout << "CUR";
+                }
+                std::cout << ": ";
 
-#ifdef _WIN32
-                    SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_INTENSITY | FOREGROUND_RED | FOREGROUND_GREEN | COMMON_LVB_UNDERSCORE);
-#endif
+                if (x < 0) {
+                    std::cout << "NONE\n";
+                    continue;
                 }
 
-                if (value < 16)
-                    std::cout << "0";
+                std::cout << std::setfill('0') << std::setw(4) << x * 16 << " -> ";
+                std::cout << std::setfill('0') << std::setw(4) << ((x + 1) * 16) - 1 << ": ";
 
-                std::cout << value;
+                for (int y = 0; y < 16; y++) {
+                    int idx = x * 16 + y;
+                    if (idx >= cpu->hunk_length)
+                        break;
 
-                if (cpu->program_counter == idx) {
-#ifdef UNIX_LIKE
+                    int value = +cpu->hunk[idx];
 
-                    std::cout << "\033[0m";
-#endif
+                    if (cpu->program_counter == idx) {
+    #ifdef UNIX_LIKE
+                        std::cout << "\033[1;4;93m";
+    #endif
 
-#ifdef _WIN32
-                    SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
-#endif
+    #ifdef _WIN32
+                        SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_INTENSITY | FOREGROUND_RED | FOREGROUND_GREEN | COMMON_LVB_UNDERSCORE);
+    #endif
+                    }
+
+                    if (value < 16)
+                        std::cout << "0";
+
+                    std::cout << value;
+
+                    if (cpu->program_counter == idx) {
+    #ifdef UNIX_LIKE
+
+                        std::cout << "\033[0m";
+    #endif
+
+    #ifdef _WIN32
+                        SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+    #endif
+                    }
+
+                    std::cout << " ";
                 }
 
-                std::cout << " ";
+                std::cout << "\n";
             }
 
             std::cout << "\n";
-        }
 
-        std::cout << "\n";
+            std::cout << "System Memory: \n";
+            for (int x = 0; x < 16; x++) {
+                std::cout << PAD_HEX << x * 16 << " -> ";
+                std::cout << PAD_HEX << ((x + 1) * 16) - 1 << ": ";
 
-        std::cout << "System Memory: \n";
-        for (int x = 0; x < 16; x++) {
-            std::cout << PAD_HEX << x * 16 << " -> ";
-            std::cout << PAD_HEX << ((x + 1) * 16) - 1 << ": ";
+                for (int y = 0; y < 16; y++) {
+                    int idx = x * 16 + y;
+                    if (idx >= cpu->hunk_length)
+                        break;
 
-            for (int y = 0; y < 16; y++) {
-                int idx = x * 16 + y;
-                if (idx >= cpu->hunk_length)
-                    break;
+                    int value = +cpu->hunk[idx];
 
-                int value = +cpu->hunk[idx];
+                    if (value < 16)
+                        std::cout << "0";
 
-                if (value < 16)
-                    std::cout << "0";
+                    std::cout << value << " ";
+                }
 
-                std::cout << value << " ";
+                std::cout << "\n";
             }
 
             std::cout << "\n";
-        }
+            std::cout << "Stack Memory: \n";
+            for (int x = 0; x < 16; x++) {
+                // I hate C++ syntax at times...
+                std::cout << "01" << PAD_HEX_LO << x * 16 << " -> ";
+                std::cout << "01" << PAD_HEX_LO << ((x + 1) * 16) - 1 << ": ";
 
-        std::cout << "\n";
-        std::cout << "Stack Memory: \n";
-        for (int x = 0; x < 16; x++) {
-            // I hate C++ syntax at times...
-            std::cout << "01" << PAD_HEX_LO << x * 16 << " -> ";
-            std::cout << "01" << PAD_HEX_LO << ((x + 1) * 16) - 1 << ": ";
+                for (int y = 0; y < 16; y++) {
+                    int idx = x * 16 + y;
+                    if (idx >= cpu->hunk_length)
+                        break;
 
-            for (int y = 0; y < 16; y++) {
-                int idx = x * 16 + y;
-                if (idx >= cpu->hunk_length)
-                    break;
+                    int value = +cpu->hunk[v502_make_word(0x01, idx)];
 
-                int value = +cpu->hunk[v502_make_word(0x01, idx)];
+                    std::cout << PAD_HEX_LO << value << " ";
+                }
 
-                std::cout << PAD_HEX_LO << value << " ";
+                std::cout << "\n";
             }
 
-            std::cout << "\n";
+    #ifdef UNIX_LIKE
+            if (custom_time)
+                usleep(interval * 1000);
+            else {
+                wait.tv_sec = exit_info.cycles / 1000000;
+                wait.tv_nsec = (exit_info.cycles % 1000000) * 1000;
+                nanosleep(&wait, nullptr);
+            }
+    #endif
+
+    #ifdef _WIN32
+            if (custom_time)
+                Sleep(interval);
+            //else
+                //throw std::runtime_error("Sorry windows doesn't support nanosleep() so you must provide an interval!");
+    #endif
+
+            zero_cursor();
         }
+    }
 
-#ifdef UNIX_LIKE
-        if (custom_time)
-            usleep(interval * 1000);
-        else
-            nanosleep(&wait, nullptr);
-#endif
+    // The JSON report is all --json prints to stdout
+    if (!json) {
+        std::cout << std::hex;
+        std::cout << "\nVM stopped (" << exit_reasons[exit_info.reason] << ") at PC = " << PAD_HEX << +exit_info.program_counter;
+        std::cout << " on opcode " << PAD_HEX_LO << +exit_info.opcode;
 
-#ifdef _WIN32
-        if (custom_time)
-            Sleep(interval);
-        //else
-            //throw std::runtime_error("Sorry windows doesn't support nanosleep() so you must provide an interval!");
-#endif
+        if (exit_info.reason == v502_EXIT_REASON_WATCH_READ || exit_info.reason == v502_EXIT_REASON_WATCH_WRITE)
+            std::cout << " touching " << PAD_HEX << +exit_info.watch_address;
 
-        zero_cursor();
+        std::cout << std::endl;
     }
 
+    if (!profile_path.empty() && !write_profile(profile_path, v502_get_profile_vm(cpu)))
+        std::cerr << "Couldn't write the profile to '" << profile_path << "'" << std::endl;
+
+    if (!v502_end_trace_vm(cpu))
+        std::cerr << "Couldn't write all of the trace to '" << trace_path << "'" << std::endl;
+
+    if (!v502_end_recording_vm(cpu))
+        std::cerr << "Couldn't write all of the recording to '" << record_path << "'" << std::endl;
+
+    // Also takes the shared memory object's name away again
+    v502_free_vm(cpu);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include <v502/v502.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// How each opcode is printed, built from the same list the VM is
+struct op_info_t {
+    const char* mnemonic = nullptr; // nullptr for opcodes the VM doesn't implement
+    const char* mode = nullptr;
+    int length = 1;
+};
+
+static std::vector<op_info_t> build_op_infos() {
+    std::vector<op_info_t> infos(256);
+
+#define TRACE502_OP_INFO(NAME, MNEMONIC, MODE, CYCLES, PAGE) infos[v502_MOS_OP_##NAME] = { #MNEMONIC, #MODE, v502_MODE_LENGTH_##MODE };
+    v502_MOS_OP_LIST(TRACE502_OP_INFO)
+#undef TRACE502_OP_INFO
+
+    return infos;
+}
+
+// Operands are printed the way the assembler takes them, branches show where they go
+static std::string format_operand(const op_info_t& info, const v502_trace_record_t& record) {
+    char text[16] = {};
+    std::string mode = info.mode;
+    unsigned lo = record.operand[0];
+    unsigned word = v502_make_word(record.operand[1], record.operand[0]);
+
+    if (mode == "NOW")
+        snprintf(text, sizeof(text), "#$%02X", lo);
+    else if (mode == "REL")
+        snprintf(text, sizeof(text), "$%04X", record.effective_address);
+    else if (mode == "ZPG")
+        snprintf(text, sizeof(text), "$%02X", lo);
+    else if (mode == "X_ZPG")
+        snprintf(text, sizeof(text), "$%02X,X", lo);
+    else if (mode == "Y_ZPG")
+        snprintf(text, sizeof(text), "$%02X,Y", lo);
+    else if (mode == "ABS")
+        snprintf(text, sizeof(text), "$%04X", word);
+    else if (mode == "X_ABS")
+        snprintf(text, sizeof(text), "$%04X,X", word);
+    else if (mode == "Y_ABS")
+        snprintf(text, sizeof(text), "$%04X,Y", word);
+    else if (mode == "IND")
+        snprintf(text, sizeof(text), "($%04X)", word);
+    else if (mode == "X_IND")
+        snprintf(text, sizeof(text), "($%02X,X)", lo);
+    else if (mode == "Y_IND")
+        snprintf(text, sizeof(text), "($%02X),Y", lo);
+
+    return text;
+}
+
+static void print_record(const std::vector<op_info_t>& infos, v502_qword_t index, const v502_trace_record_t& record) {
+    const op_info_t& info = infos[record.opcode];
+
+    char bytes[16];
+    if (info.length == 3)
+        snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record.opcode, record.operand[0], record.operand[1]);
+    else if (info.length == 2)
+        snprintf(bytes, sizeof(bytes), "%02X %02X", record.opcode, record.operand[0]);
+    else
+        snprintf(bytes, sizeof(bytes), "%02X", record.opcode);
+
+    std::string text = info.mnemonic != nullptr ? std::string(info.mnemonic) + " " + format_operand(info, record) : "???";
+
+    printf("%10llu  %04X  %-8s  %-14s  A:%02X X:%02X Y:%02X SP:%02X P:%02X  EA:%04X  CYC:%u\n",
+        (unsigned long long)index, record.program_counter, bytes, text.c_str(),
+        record.accumulator, record.index_x, record.index_y, record.stack_ptr, record.flags,
+        record.effective_address, record.cycles);
+}
+
+void print_help() {
+    std::cout << "Example: trace502 -t run.trace --from 1000 --count 50\n";
+    std::cout << "Arguments: \n";
+    std::cout << "\t-t or --trace, requires a path after, the trace to read (made with emu502 --trace)\n";
+    std::cout << "\t-f or --from, requires a number after, skips to that record before printing\n";
+    std::cout << "\t-c or --count, requires a number after, stops after printing that many records\n";
+    std::cout << "\t--summary, prints how often each opcode ran instead of the records themselves\n";
+    std::cout << std::endl;
+}
+
+// Dumps binary execution traces as text
+int main(int argc, char** argv) {
+    std::string trace_path;
+    v502_qword_t from = 0;
+    v502_qword_t count = 0;
+    bool summary = false;
+
+    if (argc > 1) {
+        std::vector<std::string> args;
+
+        for (int a = 1; a < argc; a++)
+            args.emplace_back(std::string(argv[a]));
+
+        bool need_input = false;
+        std::string what_input = "";
+        for (auto arg : args) {
+            auto named = arg.find("--");
+
+            if (need_input) {
+                if (arg.find("-") != std::string::npos) {
+                    std::cerr << what_input << " needs input but nothing was provided!" << std::endl;
+                    return 1;
+                }
+
+                if (what_input == "trace" || what_input == "t") {
+                    trace_path = arg;
+                    need_input = false;
+                }
+
+                if (what_input == "from" || what_input == "f" || what_input == "count" || what_input == "c") {
+                    try {
+                        v502_qword_t value = std::stoull(arg);
+                        (what_input[0] == 'f' ? from : count) = value;
+                        need_input = false;
+                    } catch (std::exception err) {
+                        std::cout << "Provided " << what_input << " wasn't a valid number!" << std::endl;
+                        std::cerr << err.what() << std::endl;
+                        return 1;
+                    }
+                }
+            } else {
+                if (named != std::string::npos) {
+                    std::string sub = arg.substr(2);
+
+                    if (sub == "help") {
+                        print_help();
+                        return 0;
+                    }
+
+                    if (sub == "summary")
+                        summary = true;
+
+                    if (sub == "trace" || sub == "from" || sub == "count") {
+                        need_input = true;
+                        what_input = sub;
+                    }
+                } else {
+                    auto shorthand = arg.find("-");
+
+                    if (shorthand != std::string::npos) {
+                        std::string sub = arg.substr(1);
+
+                        for (auto ch : sub) {
+                            if (ch == 'h') {
+                                print_help();
+                                return 0;
+                            }
+
+                            if (ch == 't' || ch == 'f' || ch == 'c') {
+                                need_input = true;
+                                what_input = std::string(1, ch);
+                            }
+                        }
+                    } else
+                        trace_path = arg;
+                }
+            }
+        }
+    } else {
+        std::cerr << "Please provide a trace to read!\nPass --help to see possible arguments!" << std::endl;
+        return 1;
+    }
+
+    if (trace_path.empty()) {
+        std::cerr << "No trace was provided, please provide one using -t or --trace!" << std::endl;
+        return 1;
+    }
+
+    v502_trace_reader_t* reader = v502_open_trace(trace_path.c_str());
+
+    if (reader == nullptr) {
+        std::cerr << "'" << trace_path << "' couldn't be opened or isn't a v502 trace" << std::endl;
+        return 1;
+    }
+
+    if (!v502_seek_trace(reader, from)) {
+        std::cerr << "The trace has fewer than " << from << " records" << std::endl;
+        v502_close_trace(reader);
+        return 1;
+    }
+
+    std::vector<op_info_t> infos = build_op_infos();
+    std::vector<v502_trace_record_t> records(4096);
+    std::vector<v502_qword_t> opcodes(256);
+
+    v502_qword_t index = from;
+    uint32_t previous_cycles = 0;
+    v502_qword_t total_cycles = 0;
+
+    size_t read;
+    while ((count == 0 || index - from < count) && (read = v502_read_trace(reader, records.data(), records.size())) != 0) {
+        if (count != 0 && read > count - (index - from))
+            read = count - (index - from);
+
+        for (size_t r = 0; r < read; r++, index++) {
+            const v502_trace_record_t& record = records[r];
+
+            if (summary) {
+                // Cycles are 32 bits in the trace, summing the differences survives them wrapping
+                if (index != from)
+                    total_cycles += record.cycles - previous_cycles;
+
+                previous_cycles = record.cycles;
+                opcodes[record.opcode] += 1;
+            } else
+                print_record(infos, index, record);
+        }
+    }
+
+    v502_close_trace(reader);
+
+    if (summary) {
+        printf("%llu instructions, %llu cycles between the first and the last\n", (unsigned long long)(index - from), (unsigned long long)total_cycles);
+
+        for (int op = 0; op < 256; op++) {
+            if (opcodes[op] == 0)
+                continue;
+
+            const char* mnemonic = infos[op].mnemonic != nullptr ? infos[op].mnemonic : "???";
+            printf("%02X  %s %-6s %12llu\n", op, mnemonic, infos[op].mode != nullptr ? infos[op].mode : "", (unsigned long long)opcodes[op]);
+        }
+    }
+
+    return 0;
+}
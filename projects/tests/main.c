@@ -0,0 +1,197 @@
+#include <v502/v502.h>
+
+#include <stdio.h>
+#include <string.h>
+
+//
+// Reference decimal arithmetic
+//
+
+#define FLAGS_TESTED (v502_STATE_FLAG_NEGATIVE | v502_STATE_FLAG_OVERFLOW | v502_STATE_FLAG_ZERO | v502_STATE_FLAG_CARRY)
+
+// The NMOS decimal algorithms as they're usually written down, nibble by nibble with branches
+// Both return the accumulator and leave N, V, Z and C in flags
+static v502_byte_t reference_bcd_add(int a, int val, int carry, v502_byte_t* flags) {
+    int low = (a & 0x0F) + (val & 0x0F) + carry;
+
+    if (low >= 0x0A)
+        low = ((low + 0x06) & 0x0F) + 0x10;
+
+    int result = (a & 0xF0) + (val & 0xF0) + low;
+
+    // N and V are taken before the high digit is adjusted, Z from the binary sum
+    *flags = 0;
+    *flags |= (result & 0x80) ? v502_STATE_FLAG_NEGATIVE : 0;
+    *flags |= (~(a ^ val) & (a ^ result) & 0x80) ? v502_STATE_FLAG_OVERFLOW : 0;
+    *flags |= ((a + val + carry) & 0xFF) == 0 ? v502_STATE_FLAG_ZERO : 0;
+
+    if (result >= 0xA0)
+        result += 0x60;
+
+    *flags |= result >= 0x100 ? v502_STATE_FLAG_CARRY : 0;
+
+    return result & 0xFF;
+}
+
+static v502_byte_t reference_bcd_sub(int a, int val, int carry, v502_byte_t* flags) {
+    int low = (a & 0x0F) - (val & 0x0F) + carry - 1;
+
+    if (low < 0)
+        low = ((low - 0x06) & 0x0F) - 0x10;
+
+    int result = (a & 0xF0) - (val & 0xF0) + low;
+
+    if (result < 0)
+        result -= 0x60;
+
+    // Every flag comes from the binary subtraction
+    int binary = a - val + carry - 1;
+
+    *flags = 0;
+    *flags |= (binary & 0x80) ? v502_STATE_FLAG_NEGATIVE : 0;
+    *flags |= ((a ^ val) & (a ^ binary) & 0x80) ? v502_STATE_FLAG_OVERFLOW : 0;
+    *flags |= (binary & 0xFF) == 0 ? v502_STATE_FLAG_ZERO : 0;
+    *flags |= binary >= 0 ? v502_STATE_FLAG_CARRY : 0;
+
+    return result & 0xFF;
+}
+
+//
+// Exhaustive comparison
+//
+// Every operand and carry gets a kernel of its own, so the code never changes under the engines and the JIT keeps its blocks
+// Each one loops over every A, storing the result and the flags PHP pushed into two tables:
+//
+//          LDX #0
+//  loop:   LDA #flags      (D, plus C for the carry kernels)
+//          PHA
+//          PLP
+//          TXA
+//          ADC #operand    (or SBC)
+//          PHP
+//          STA RESULTS,X
+//          PLA
+//          STA FLAGS,X
+//          INX
+//          CPX #0
+//          BNE loop
+//
+// The VM's BNE only falls through when C and Z are both set, CPX #0 always sets C so that's once X wraps to 0
+// The loop runs 256 times, far past the JIT's heat threshold, and every kernel runs twice so all of it also goes through translated code
+//
+#define TEST_KERNELS 0x1000
+#define TEST_KERNEL_STRIDE 32
+#define TEST_KERNEL_LENGTH 22
+#define TEST_KERNEL_INSTRUCTIONS (1 + 256 * 12)
+#define TEST_RESULTS 0x0300
+#define TEST_FLAGS 0x0400
+#define TEST_RUNS 2
+
+// How many mismatches get printed before the rest are only counted
+#define TEST_REPORT_LIMIT 8
+
+static const char* ENGINE_NAMES[] = { "table", "threaded", "predecoded", "jit" };
+
+#define ENGINE_COUNT (sizeof(ENGINE_NAMES) / sizeof(ENGINE_NAMES[0]))
+
+static v502_word_t kernel_address(int subtract, int carry, int val) {
+    return TEST_KERNELS + (((subtract * 2 + carry) * 256 + val) * TEST_KERNEL_STRIDE);
+}
+
+static void write_kernel(v502_byte_t* hunk, int subtract, int carry, int val) {
+    v502_word_t at = kernel_address(subtract, carry, val);
+    v502_word_t loop = at + 2;
+    v502_word_t branch_operand = at + TEST_KERNEL_LENGTH - 1; // The VM's branches are relative to their operand byte
+
+    const v502_byte_t kernel[TEST_KERNEL_LENGTH] = {
+        v502_MOS_OP_LDX_NOW, 0x00,
+        v502_MOS_OP_LDA_NOW, v502_STATE_FLAG_DECIMAL | (carry ? v502_STATE_FLAG_CARRY : 0),
+        v502_MOS_OP_PHA,
+        v502_MOS_OP_PLP,
+        v502_MOS_OP_TXA,
+        subtract ? v502_MOS_OP_SBC_NOW : v502_MOS_OP_ADC_NOW, (v502_byte_t)val,
+        v502_MOS_OP_PHP,
+        v502_MOS_OP_STA_X_ABS, TEST_RESULTS & 0xFF, TEST_RESULTS >> 8,
+        v502_MOS_OP_PLA,
+        v502_MOS_OP_STA_X_ABS, TEST_FLAGS & 0xFF, TEST_FLAGS >> 8,
+        v502_MOS_OP_INX,
+        v502_MOS_OP_CPX_NOW, 0x00,
+        v502_MOS_OP_BNE, (v502_byte_t)(loop - branch_operand)
+    };
+
+    memcpy(hunk + at, kernel, sizeof(kernel));
+}
+
+// Returns how many results differ from the reference, counting a kernel that didn't run to its end as every one of its results
+static uint32_t check_kernel(v502_6502vm_t* vm, int subtract, int carry, int val, uint32_t reported) {
+    v502_word_t at = kernel_address(subtract, carry, val);
+    uint32_t mismatches = 0;
+
+    vm->program_counter = at;
+    v502_run_vm(vm, TEST_KERNEL_INSTRUCTIONS, NULL);
+
+    if (vm->program_counter != at + TEST_KERNEL_LENGTH) {
+        fprintf(stderr, "  %s #%02X C=%d: stopped at %04X\n", subtract ? "SBC" : "ADC", val, carry, vm->program_counter);
+        return 256;
+    }
+
+    for (int a = 0; a < 256; a++) {
+        v502_byte_t expected_flags;
+        v502_byte_t expected = subtract ? reference_bcd_sub(a, val, carry, &expected_flags) : reference_bcd_add(a, val, carry, &expected_flags);
+
+        v502_byte_t actual = vm->hunk[TEST_RESULTS + a];
+        v502_byte_t actual_flags = vm->hunk[TEST_FLAGS + a] & FLAGS_TESTED;
+
+        if (actual == expected && actual_flags == expected_flags)
+            continue;
+
+        if (reported + mismatches++ < TEST_REPORT_LIMIT) {
+            fprintf(stderr, "  %s A=%02X #%02X C=%d: got %02X flags %02X, expected %02X flags %02X\n",
+                subtract ? "SBC" : "ADC", a, val, carry, actual, actual_flags, expected, expected_flags);
+        }
+    }
+
+    return mismatches;
+}
+
+int main() {
+    int failed = 0;
+
+    for (uint32_t e = 0; e < ENGINE_COUNT; e++) {
+        if (!v502_engine_supported((v502_ENGINE_E)e))
+            continue;
+
+        v502_6502vm_createinfo_t createinfo = { 0 };
+        createinfo.hunk_size = 0xFFFF + 1;
+        createinfo.engine = (v502_ENGINE_E)e;
+
+        v502_6502vm_t* vm = v502_create_vm(&createinfo);
+        v502_reset_vm(vm);
+
+        for (int subtract = 0; subtract < 2; subtract++)
+            for (int carry = 0; carry < 2; carry++)
+                for (int val = 0; val < 256; val++)
+                    write_kernel(vm->hunk, subtract, carry, val);
+
+        v502_invalidate_vm(vm, 0, vm->hunk_length);
+
+        uint32_t mismatches = 0;
+
+        for (int run = 0; run < TEST_RUNS; run++)
+            for (int subtract = 0; subtract < 2; subtract++)
+                for (int carry = 0; carry < 2; carry++)
+                    for (int val = 0; val < 256; val++)
+                        mismatches += check_kernel(vm, subtract, carry, val, mismatches);
+
+        printf("%-12s %s", ENGINE_NAMES[e], mismatches == 0 ? "ok\n" : "FAILED");
+
+        if (mismatches != 0) {
+            printf(", %u results differ from the reference\n", mismatches);
+            failed = 1;
+        }
+
+        v502_free_vm(vm);
+    }
+
+    return failed;
+}
@@ -158,7 +158,7 @@ v502_binary_file_t* v502_assemble_source(v502_assembler_instance_t* assembler, c
 
     uint32_t source_len = strlen(source);
 
-    char* source_dupe = calloc(source_len, 1);
+    char* source_dupe = calloc(source_len + 1, 1); // + 1 keeps it terminated for strtok()
     memcpy(source_dupe, source, source_len);
 
     source_line_stack_t* line_stack = calloc(1, sizeof(source_line_stack_t));
@@ -298,7 +298,7 @@ v502_binary_file_t* v502_assemble_source(v502_assembler_instance_t* assembler, c
         if (strlen(token) == 0)
             continue;
 
-        char* line_dupe = malloc(strlen(token));
+        char* line_dupe = malloc(strlen(token) + 1);
         strcpy(line_dupe, token);
 
         source_line_t* line = calloc(1, sizeof(source_line_t));
@@ -337,7 +337,7 @@ v502_binary_file_t* v502_assemble_source(v502_assembler_instance_t* assembler, c
         uint32_t line_len = strlen(child->line);
 
         // The opcode is the first 3 characters
-        char op[4];
+        char op[4] = { 0 };
         memcpy(op, child->line, 3);
 
         for (int c = 0; c < 3; c++)
@@ -439,7 +439,8 @@ v502_binary_file_t* v502_assemble_source(v502_assembler_instance_t* assembler, c
                 if (child->line[c] != ' ') {
                     for (label_placeholder_t *child_label = label_stack; child_label != NULL; child_label = child_label->next) {
                         // We need to single out the label name
-                        char* label_name = calloc(strlen(child_label->symbol), 1);
+                        // Sized for the rest of the line, the name we're comparing against can be shorter than what's written here
+                        char* label_name = calloc(line_len - c + 1, 1);
 
                         for (uint32_t b = c; b < line_len; b++) {
                             if (child->line[b] == '[')
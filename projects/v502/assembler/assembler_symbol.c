@@ -28,6 +28,12 @@ const v502_assembler_symbol_t SYMBOL_TABLE[] = {
     { "PLA", MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, OP(PLA), FLAG_NONE, NULL },
     { "PLP", MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, OP(PLP), FLAG_NONE, NULL },
 
+    //
+    // State register
+    //
+    { "SEI", MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, OP(SEI), FLAG_NONE, NULL },
+    { "CLI", MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, OP(CLI), FLAG_NONE, NULL },
+
     //
     // X Register
     //
@@ -68,6 +74,7 @@ const v502_assembler_symbol_t SYMBOL_TABLE[] = {
     { "JMP", MISSING, MISSING, MISSING, OP(JMP_ABS), MISSING, MISSING, OP(JMP_IND), MISSING, MISSING, MISSING, MISSING, FLAG_WIDE, NULL },
     { "JSR", MISSING, MISSING, MISSING, OP(JSR_ABS), MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, FLAG_WIDE, NULL },
     { "RTS", MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, OP(RTS), FLAG_NONE, NULL },
+    { "RTI", MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, MISSING, OP(RTI), FLAG_NONE, NULL },
 
     //
     // Branching
@@ -8,6 +8,69 @@ v502_function_table_t* v502_get_function_table() {
     ftable->v502_create_vm = v502_create_vm;
     ftable->v502_reset_vm = v502_reset_vm;
     ftable->v502_cycle_vm = v502_cycle_vm;
+    ftable->v502_run_vm = v502_run_vm;
+    ftable->v502_run_budgeted_vm = v502_run_budgeted_vm;
+    ftable->v502_invalidate_vm = v502_invalidate_vm;
+    ftable->v502_get_flags_vm = v502_get_flags_vm;
+    ftable->v502_set_flags_vm = v502_set_flags_vm;
+    ftable->v502_set_irq_vm = v502_set_irq_vm;
+    ftable->v502_raise_nmi_vm = v502_raise_nmi_vm;
+    ftable->v502_profile_vm = v502_profile_vm;
+    ftable->v502_get_profile_vm = v502_get_profile_vm;
+    ftable->v502_set_breakpoint_vm = v502_set_breakpoint_vm;
+    ftable->v502_set_watchpoint_vm = v502_set_watchpoint_vm;
+    ftable->v502_clear_debug_vm = v502_clear_debug_vm;
+
+    ftable->v502_map_device_vm = v502_map_device_vm;
+    ftable->v502_map_ram_vm = v502_map_ram_vm;
+    ftable->v502_read_vm = v502_read_vm;
+    ftable->v502_write_vm = v502_write_vm;
+
+    ftable->v502_track_dirty_vm = v502_track_dirty_vm;
+    ftable->v502_take_dirty_pages_vm = v502_take_dirty_pages_vm;
+    ftable->v502_take_dirty_lines_vm = v502_take_dirty_lines_vm;
+
+    ftable->v502_create_fleet = v502_create_fleet;
+    ftable->v502_free_fleet = v502_free_fleet;
+    ftable->v502_run_fleet = v502_run_fleet;
+
+    ftable->v502_create_batch = v502_create_batch;
+    ftable->v502_free_batch = v502_free_batch;
+    ftable->v502_reset_batch = v502_reset_batch;
+    ftable->v502_load_batch_lane = v502_load_batch_lane;
+    ftable->v502_store_batch_lane = v502_store_batch_lane;
+    ftable->v502_run_batch = v502_run_batch;
+
+    ftable->v502_snapshot_vm = v502_snapshot_vm;
+    ftable->v502_free_snapshot = v502_free_snapshot;
+    ftable->v502_fork_vm = v502_fork_vm;
+    ftable->v502_restore_vm = v502_restore_vm;
+
+    ftable->v502_attach_hunk = v502_attach_hunk;
+    ftable->v502_detach_hunk = v502_detach_hunk;
+    ftable->v502_remove_hunk = v502_remove_hunk;
+
+    ftable->v502_begin_trace_vm = v502_begin_trace_vm;
+    ftable->v502_end_trace_vm = v502_end_trace_vm;
+    ftable->v502_open_trace = v502_open_trace;
+    ftable->v502_close_trace = v502_close_trace;
+    ftable->v502_read_trace = v502_read_trace;
+    ftable->v502_seek_trace = v502_seek_trace;
+
+    ftable->v502_begin_recording_vm = v502_begin_recording_vm;
+    ftable->v502_end_recording_vm = v502_end_recording_vm;
+    ftable->v502_open_replay = v502_open_replay;
+    ftable->v502_close_replay = v502_close_replay;
+    ftable->v502_create_replay_vm = v502_create_replay_vm;
+    ftable->v502_run_replay_vm = v502_run_replay_vm;
+
+    ftable->v502_begin_history_vm = v502_begin_history_vm;
+    ftable->v502_end_history_vm = v502_end_history_vm;
+    ftable->v502_get_history_vm = v502_get_history_vm;
+    ftable->v502_step_back_vm = v502_step_back_vm;
+    ftable->v502_run_back_vm = v502_run_back_vm;
+    ftable->v502_last_write_vm = v502_last_write_vm;
+
     ftable->v502_get_fallback_func = v502_get_fallback_func;
 
     ftable->v502_make_word = v502_make_word;
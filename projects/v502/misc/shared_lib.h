@@ -7,6 +7,13 @@ extern "C" {
 
 #include "../vm/6502_ops.h"
 #include "../vm/6502_vm.h"
+#include "../vm/6502_fleet.h"
+#include "../vm/6502_batch.h"
+#include "../vm/6502_snapshot.h"
+#include "../vm/6502_hunk.h"
+#include "../vm/6502_trace.h"
+#include "../vm/6502_record.h"
+#include "../vm/6502_history.h"
 
 #ifdef V502_INCLUDE_ASSEMBLER
 #include "../assembler/assembler_symbol.h"
@@ -17,6 +24,68 @@ typedef struct v502_function_table {
     v502_6502vm_t*(*v502_create_vm)(v502_6502vm_createinfo_t*);
     void(*v502_reset_vm)(v502_6502vm_t*);
     int(*v502_cycle_vm)(v502_6502vm_t*);
+    v502_EXIT_REASON_E(*v502_run_vm)(v502_6502vm_t*, v502_qword_t, v502_exit_info_t*);
+    v502_EXIT_REASON_E(*v502_run_budgeted_vm)(v502_6502vm_t*, v502_qword_t, v502_qword_t, v502_exit_info_t*);
+    void(*v502_invalidate_vm)(v502_6502vm_t*, v502_word_t, v502_dword_t);
+    v502_byte_t(*v502_get_flags_vm)(v502_6502vm_t*);
+    void(*v502_set_flags_vm)(v502_6502vm_t*, v502_byte_t);
+    void(*v502_set_irq_vm)(v502_6502vm_t*, int);
+    void(*v502_raise_nmi_vm)(v502_6502vm_t*);
+    int(*v502_profile_vm)(v502_6502vm_t*, int);
+    const v502_profile_t*(*v502_get_profile_vm)(const v502_6502vm_t*);
+    void(*v502_set_breakpoint_vm)(v502_6502vm_t*, v502_word_t, int);
+    void(*v502_set_watchpoint_vm)(v502_6502vm_t*, v502_word_t, uint32_t, int);
+    void(*v502_clear_debug_vm)(v502_6502vm_t*);
+
+    void(*v502_map_device_vm)(v502_6502vm_t*, v502_byte_t, uint32_t, const v502_bus_device_t*);
+    void(*v502_map_ram_vm)(v502_6502vm_t*, v502_byte_t, uint32_t);
+    v502_byte_t(*v502_read_vm)(v502_6502vm_t*, v502_word_t);
+    void(*v502_write_vm)(v502_6502vm_t*, v502_word_t, v502_byte_t);
+
+    void(*v502_track_dirty_vm)(v502_6502vm_t*, v502_DIRTY_TRACKING_E);
+    uint32_t(*v502_take_dirty_pages_vm)(v502_6502vm_t*, uint64_t*);
+    uint32_t(*v502_take_dirty_lines_vm)(v502_6502vm_t*, uint64_t*);
+
+    v502_fleet_t*(*v502_create_fleet)(v502_fleet_createinfo_t*);
+    void(*v502_free_fleet)(v502_fleet_t*);
+    void(*v502_run_fleet)(v502_fleet_t*, v502_6502vm_t**, uint32_t, v502_qword_t, v502_exit_info_t*, v502_fleet_report_t*);
+
+    v502_batch_t*(*v502_create_batch)(v502_batch_createinfo_t*);
+    void(*v502_free_batch)(v502_batch_t*);
+    void(*v502_reset_batch)(v502_batch_t*);
+    void(*v502_load_batch_lane)(v502_batch_t*, uint32_t, const v502_6502vm_t*);
+    void(*v502_store_batch_lane)(v502_batch_t*, uint32_t, v502_6502vm_t*);
+    uint32_t(*v502_run_batch)(v502_batch_t*, v502_qword_t, v502_exit_info_t*);
+
+    v502_snapshot_t*(*v502_snapshot_vm)(v502_6502vm_t*);
+    void(*v502_free_snapshot)(v502_snapshot_t*);
+    v502_6502vm_t*(*v502_fork_vm)(const v502_snapshot_t*);
+    void(*v502_restore_vm)(v502_6502vm_t*, const v502_snapshot_t*);
+
+    const v502_byte_t*(*v502_attach_hunk)(const char*, v502_dword_t);
+    void(*v502_detach_hunk)(const v502_byte_t*, v502_dword_t);
+    void(*v502_remove_hunk)(const char*);
+
+    int(*v502_begin_trace_vm)(v502_6502vm_t*, const char*);
+    int(*v502_end_trace_vm)(v502_6502vm_t*);
+    v502_trace_reader_t*(*v502_open_trace)(const char*);
+    void(*v502_close_trace)(v502_trace_reader_t*);
+    size_t(*v502_read_trace)(v502_trace_reader_t*, v502_trace_record_t*, size_t);
+    int(*v502_seek_trace)(v502_trace_reader_t*, v502_qword_t);
+
+    int(*v502_begin_recording_vm)(v502_6502vm_t*, const char*);
+    int(*v502_end_recording_vm)(v502_6502vm_t*);
+    v502_replay_t*(*v502_open_replay)(const char*);
+    void(*v502_close_replay)(v502_replay_t*);
+    v502_6502vm_t*(*v502_create_replay_vm)(v502_replay_t*, v502_ENGINE_E);
+    v502_REPLAY_RESULT_E(*v502_run_replay_vm)(v502_replay_t*, v502_6502vm_t*, v502_exit_info_t*);
+
+    int(*v502_begin_history_vm)(v502_6502vm_t*, v502_qword_t, v502_qword_t);
+    void(*v502_end_history_vm)(v502_6502vm_t*);
+    int(*v502_get_history_vm)(const v502_6502vm_t*, v502_history_info_t*);
+    v502_qword_t(*v502_step_back_vm)(v502_6502vm_t*, v502_qword_t);
+    v502_EXIT_REASON_E(*v502_run_back_vm)(v502_6502vm_t*, v502_qword_t, v502_exit_info_t*);
+    int(*v502_last_write_vm)(const v502_6502vm_t*, v502_word_t, v502_history_write_t*);
 
     v502_opfunc_t(*v502_get_fallback_func)();
 
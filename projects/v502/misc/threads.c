@@ -0,0 +1,139 @@
+#include "threads.h"
+
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+int v502_thread_create(v502_thread_t* thread, v502_thread_func_t func, void* arg) {
+    *thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return *thread != NULL;
+}
+
+void v502_thread_join(v502_thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void v502_thread_yield() {
+    SwitchToThread();
+}
+
+void v502_thread_sleep_ms(uint32_t ms) {
+    Sleep(ms);
+}
+
+uint32_t v502_hardware_threads() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+void v502_mutex_init(v502_mutex_t* mutex) {
+    InitializeSRWLock(mutex);
+}
+
+void v502_mutex_destroy(v502_mutex_t* mutex) {
+
+}
+
+void v502_mutex_lock(v502_mutex_t* mutex) {
+    AcquireSRWLockExclusive(mutex);
+}
+
+void v502_mutex_unlock(v502_mutex_t* mutex) {
+    ReleaseSRWLockExclusive(mutex);
+}
+
+void v502_cond_init(v502_cond_t* cond) {
+    InitializeConditionVariable(cond);
+}
+
+void v502_cond_destroy(v502_cond_t* cond) {
+
+}
+
+void v502_cond_wait(v502_cond_t* cond, v502_mutex_t* mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+void v502_cond_broadcast(v502_cond_t* cond) {
+    WakeAllConditionVariable(cond);
+}
+
+double v502_time_now_seconds() {
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    return (double)now.QuadPart / (double)freq.QuadPart;
+}
+
+#else
+
+int v502_thread_create(v502_thread_t* thread, v502_thread_func_t func, void* arg) {
+    return pthread_create(thread, NULL, func, arg) == 0;
+}
+
+void v502_thread_join(v502_thread_t thread) {
+    pthread_join(thread, NULL);
+}
+
+void v502_thread_yield() {
+    sched_yield();
+}
+
+void v502_thread_sleep_ms(uint32_t ms) {
+    struct timespec wait = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&wait, NULL);
+}
+
+uint32_t v502_hardware_threads() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+void v502_mutex_init(v502_mutex_t* mutex) {
+    pthread_mutex_init(mutex, NULL);
+}
+
+void v502_mutex_destroy(v502_mutex_t* mutex) {
+    pthread_mutex_destroy(mutex);
+}
+
+void v502_mutex_lock(v502_mutex_t* mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void v502_mutex_unlock(v502_mutex_t* mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+void v502_cond_init(v502_cond_t* cond) {
+    pthread_cond_init(cond, NULL);
+}
+
+void v502_cond_destroy(v502_cond_t* cond) {
+    pthread_cond_destroy(cond);
+}
+
+void v502_cond_wait(v502_cond_t* cond, v502_mutex_t* mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+void v502_cond_broadcast(v502_cond_t* cond) {
+    pthread_cond_broadcast(cond);
+}
+
+double v502_time_now_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef V502_THREADS_H
+#define V502_THREADS_H
+
+// Minimal threading shim so the library doesn't care whether it's on pthreads or Win32
+// Internal to the library, frontends bring their own threading
+
+#include "../v502_types.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+
+typedef HANDLE v502_thread_t;
+typedef SRWLOCK v502_mutex_t;
+typedef CONDITION_VARIABLE v502_cond_t;
+
+// Thread entry points are declared with this so they match what the platform expects
+#define v502_THREAD_FUNC(NAME) DWORD WINAPI NAME(LPVOID arg)
+typedef LPTHREAD_START_ROUTINE v502_thread_func_t;
+#else
+#include <pthread.h>
+
+typedef pthread_t v502_thread_t;
+typedef pthread_mutex_t v502_mutex_t;
+typedef pthread_cond_t v502_cond_t;
+
+#define v502_THREAD_FUNC(NAME) void* NAME(void* arg)
+typedef void*(*v502_thread_func_t)(void*);
+#endif
+
+//
+// Threads
+//
+
+// Returns 0 if the thread couldn't be started
+int v502_thread_create(v502_thread_t* thread, v502_thread_func_t func, void* arg);
+void v502_thread_join(v502_thread_t thread);
+void v502_thread_yield();
+
+// Gives up the CPU for at least this long, for threads that poll something that's usually idle
+void v502_thread_sleep_ms(uint32_t ms);
+
+// How many threads the machine can run at once, at least 1
+uint32_t v502_hardware_threads();
+
+//
+// Locks
+//
+void v502_mutex_init(v502_mutex_t* mutex);
+void v502_mutex_destroy(v502_mutex_t* mutex);
+void v502_mutex_lock(v502_mutex_t* mutex);
+void v502_mutex_unlock(v502_mutex_t* mutex);
+
+void v502_cond_init(v502_cond_t* cond);
+void v502_cond_destroy(v502_cond_t* cond);
+void v502_cond_wait(v502_cond_t* cond, v502_mutex_t* mutex);
+void v502_cond_broadcast(v502_cond_t* cond);
+
+//
+// Atomics, all of these are full barriers
+//
+#ifdef _MSC_VER
+#define v502_atomic_load_u32(PTR) ((uint32_t)InterlockedCompareExchange((volatile LONG*)(PTR), 0, 0))
+#define v502_atomic_store_u32(PTR, VALUE) ((void)InterlockedExchange((volatile LONG*)(PTR), (LONG)(VALUE)))
+#define v502_atomic_fetch_add_u32(PTR, VALUE) ((uint32_t)InterlockedExchangeAdd((volatile LONG*)(PTR), (LONG)(VALUE)))
+#define v502_atomic_fetch_sub_u32(PTR, VALUE) ((uint32_t)InterlockedExchangeAdd((volatile LONG*)(PTR), -(LONG)(VALUE)))
+#define v502_atomic_fetch_or_u32(PTR, VALUE) ((uint32_t)InterlockedOr((volatile LONG*)(PTR), (LONG)(VALUE)))
+#define v502_atomic_fetch_and_u32(PTR, VALUE) ((uint32_t)InterlockedAnd((volatile LONG*)(PTR), (LONG)(VALUE)))
+#else
+#define v502_atomic_load_u32(PTR) __atomic_load_n((PTR), __ATOMIC_SEQ_CST)
+#define v502_atomic_store_u32(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#define v502_atomic_fetch_add_u32(PTR, VALUE) __atomic_fetch_add((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#define v502_atomic_fetch_sub_u32(PTR, VALUE) __atomic_fetch_sub((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#define v502_atomic_fetch_or_u32(PTR, VALUE) __atomic_fetch_or((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#define v502_atomic_fetch_and_u32(PTR, VALUE) __atomic_fetch_and((PTR), (VALUE), __ATOMIC_SEQ_CST)
+#endif
+
+//
+// Time
+//
+
+// Monotonic, only useful for measuring intervals
+double v502_time_now_seconds();
+
+#endif
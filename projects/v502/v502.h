@@ -5,6 +5,13 @@
 
 #include "vm/6502_ops.h"
 #include "vm/6502_vm.h"
+#include "vm/6502_fleet.h"
+#include "vm/6502_batch.h"
+#include "vm/6502_snapshot.h"
+#include "vm/6502_hunk.h"
+#include "vm/6502_trace.h"
+#include "vm/6502_record.h"
+#include "vm/6502_history.h"
 
 #ifdef V502_INCLUDE_ASSEMBLER
 #include "assembler/assembler.h"
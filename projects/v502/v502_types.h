@@ -6,5 +6,6 @@
 typedef uint8_t v502_byte_t;
 typedef uint16_t v502_word_t;
 typedef uint32_t v502_dword_t;
+typedef uint64_t v502_qword_t;
 
 #endif
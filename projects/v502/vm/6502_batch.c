@@ -0,0 +1,550 @@
+#include "6502_batch.h"
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Lane vectors
+//
+// Kernels are written once against these, AVX2 handles 32 lanes at a time, SSE2 16 and the portable fallback 1
+// AVX2 needs the compiler to target it (see V502_AVX2 in the CMakeLists), SSE2 is always there on x86-64
+//
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef __m256i v502_lanes_t;
+#define v502_LANES 32
+
+static inline v502_lanes_t v502_lanes_load(const v502_byte_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+static inline void v502_lanes_store(v502_byte_t* p, v502_lanes_t v) { _mm256_storeu_si256((__m256i*)p, v); }
+static inline v502_lanes_t v502_lanes_set(v502_byte_t b) { return _mm256_set1_epi8((char)b); }
+static inline v502_lanes_t v502_lanes_add(v502_lanes_t a, v502_lanes_t b) { return _mm256_add_epi8(a, b); }
+static inline v502_lanes_t v502_lanes_adds(v502_lanes_t a, v502_lanes_t b) { return _mm256_adds_epu8(a, b); }
+static inline v502_lanes_t v502_lanes_max(v502_lanes_t a, v502_lanes_t b) { return _mm256_max_epu8(a, b); }
+static inline v502_lanes_t v502_lanes_and(v502_lanes_t a, v502_lanes_t b) { return _mm256_and_si256(a, b); }
+static inline v502_lanes_t v502_lanes_or(v502_lanes_t a, v502_lanes_t b) { return _mm256_or_si256(a, b); }
+static inline v502_lanes_t v502_lanes_andnot(v502_lanes_t a, v502_lanes_t b) { return _mm256_andnot_si256(a, b); }
+static inline v502_lanes_t v502_lanes_eq(v502_lanes_t a, v502_lanes_t b) { return _mm256_cmpeq_epi8(a, b); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+
+typedef __m128i v502_lanes_t;
+#define v502_LANES 16
+
+static inline v502_lanes_t v502_lanes_load(const v502_byte_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void v502_lanes_store(v502_byte_t* p, v502_lanes_t v) { _mm_storeu_si128((__m128i*)p, v); }
+static inline v502_lanes_t v502_lanes_set(v502_byte_t b) { return _mm_set1_epi8((char)b); }
+static inline v502_lanes_t v502_lanes_add(v502_lanes_t a, v502_lanes_t b) { return _mm_add_epi8(a, b); }
+static inline v502_lanes_t v502_lanes_adds(v502_lanes_t a, v502_lanes_t b) { return _mm_adds_epu8(a, b); }
+static inline v502_lanes_t v502_lanes_max(v502_lanes_t a, v502_lanes_t b) { return _mm_max_epu8(a, b); }
+static inline v502_lanes_t v502_lanes_and(v502_lanes_t a, v502_lanes_t b) { return _mm_and_si128(a, b); }
+static inline v502_lanes_t v502_lanes_or(v502_lanes_t a, v502_lanes_t b) { return _mm_or_si128(a, b); }
+static inline v502_lanes_t v502_lanes_andnot(v502_lanes_t a, v502_lanes_t b) { return _mm_andnot_si128(a, b); }
+static inline v502_lanes_t v502_lanes_eq(v502_lanes_t a, v502_lanes_t b) { return _mm_cmpeq_epi8(a, b); }
+
+#else
+
+typedef v502_byte_t v502_lanes_t;
+#define v502_LANES 1
+
+static inline v502_lanes_t v502_lanes_load(const v502_byte_t* p) { return *p; }
+static inline void v502_lanes_store(v502_byte_t* p, v502_lanes_t v) { *p = v; }
+static inline v502_lanes_t v502_lanes_set(v502_byte_t b) { return b; }
+static inline v502_lanes_t v502_lanes_add(v502_lanes_t a, v502_lanes_t b) { return a + b; }
+static inline v502_lanes_t v502_lanes_adds(v502_lanes_t a, v502_lanes_t b) { return a + b > 0xFF ? 0xFF : a + b; }
+static inline v502_lanes_t v502_lanes_max(v502_lanes_t a, v502_lanes_t b) { return a > b ? a : b; }
+static inline v502_lanes_t v502_lanes_and(v502_lanes_t a, v502_lanes_t b) { return a & b; }
+static inline v502_lanes_t v502_lanes_or(v502_lanes_t a, v502_lanes_t b) { return a | b; }
+static inline v502_lanes_t v502_lanes_andnot(v502_lanes_t a, v502_lanes_t b) { return ~a & b; }
+static inline v502_lanes_t v502_lanes_eq(v502_lanes_t a, v502_lanes_t b) { return a == b ? 0xFF : 0x00; }
+
+#endif
+
+// mask ? a : b, per lane
+static inline v502_lanes_t v502_lanes_select(v502_lanes_t mask, v502_lanes_t a, v502_lanes_t b) {
+    return v502_lanes_or(v502_lanes_and(mask, a), v502_lanes_andnot(mask, b));
+}
+
+//
+// Kernels, each applies one instruction to every lane in batch->group
+//
+static void v502_batch_kernel_step(v502_batch_t* batch, v502_byte_t* reg, v502_byte_t delta) {
+    v502_lanes_t d = v502_lanes_set(delta);
+
+    for (uint32_t l = 0; l < batch->lane_capacity; l += v502_LANES) {
+        v502_lanes_t group = v502_lanes_load(batch->group + l);
+        v502_lanes_store(reg + l, v502_lanes_add(v502_lanes_load(reg + l), v502_lanes_and(group, d)));
+    }
+}
+
+static void v502_batch_kernel_copy(v502_batch_t* batch, v502_byte_t* dst, const v502_byte_t* src) {
+    for (uint32_t l = 0; l < batch->lane_capacity; l += v502_LANES) {
+        v502_lanes_t group = v502_lanes_load(batch->group + l);
+        v502_lanes_store(dst + l, v502_lanes_select(group, v502_lanes_load(src + l), v502_lanes_load(dst + l)));
+    }
+}
+
+static void v502_batch_kernel_set(v502_batch_t* batch, v502_byte_t* dst, v502_byte_t value) {
+    v502_lanes_t v = v502_lanes_set(value);
+
+    for (uint32_t l = 0; l < batch->lane_capacity; l += v502_LANES) {
+        v502_lanes_t group = v502_lanes_load(batch->group + l);
+        v502_lanes_store(dst + l, v502_lanes_select(group, v, v502_lanes_load(dst + l)));
+    }
+}
+
+// Mirrors v502_safe_add_vm(), overflow and carry are set together when A + value + C doesn't fit
+static void v502_batch_kernel_adc(v502_batch_t* batch, v502_byte_t value) {
+    v502_lanes_t v = v502_lanes_set(value);
+    v502_lanes_t full = v502_lanes_set(0xFF);
+    v502_lanes_t carry_bit = v502_lanes_set(v502_STATE_FLAG_CARRY);
+    v502_lanes_t changed = v502_lanes_set(v502_STATE_FLAG_OVERFLOW | v502_STATE_FLAG_CARRY);
+
+    for (uint32_t l = 0; l < batch->lane_capacity; l += v502_LANES) {
+        v502_lanes_t group = v502_lanes_load(batch->group + l);
+        v502_lanes_t a = v502_lanes_load(batch->accumulator + l);
+        v502_lanes_t f = v502_lanes_load(batch->flags + l);
+
+        v502_lanes_t carry = v502_lanes_eq(v502_lanes_and(f, carry_bit), carry_bit);
+        v502_lanes_t wrapped = v502_lanes_add(a, v);
+        v502_lanes_t saturated = v502_lanes_adds(a, v);
+
+        // Saturating at 0xFF means A + value went past it, unless it landed right on 0xFF without a carry coming in
+        v502_lanes_t exact = v502_lanes_andnot(carry, v502_lanes_eq(wrapped, full));
+        v502_lanes_t over = v502_lanes_andnot(exact, v502_lanes_eq(saturated, full));
+
+        v502_lanes_t new_f = v502_lanes_or(v502_lanes_andnot(changed, f), v502_lanes_and(over, changed));
+
+        v502_lanes_store(batch->accumulator + l, v502_lanes_select(group, wrapped, a));
+        v502_lanes_store(batch->flags + l, v502_lanes_select(group, new_f, f));
+    }
+}
+
+// Mirrors v502_compare_vm()
+static void v502_batch_kernel_compare(v502_batch_t* batch, const v502_byte_t* lhs, v502_byte_t value) {
+    v502_lanes_t rhs = v502_lanes_set(value);
+    v502_lanes_t carry_bit = v502_lanes_set(v502_STATE_FLAG_CARRY);
+    v502_lanes_t zero_bit = v502_lanes_set(v502_STATE_FLAG_ZERO);
+    v502_lanes_t negative_bit = v502_lanes_set(v502_STATE_FLAG_NEGATIVE);
+
+    for (uint32_t l = 0; l < batch->lane_capacity; l += v502_LANES) {
+        v502_lanes_t group = v502_lanes_load(batch->group + l);
+        v502_lanes_t left = v502_lanes_load(lhs + l);
+        v502_lanes_t f = v502_lanes_load(batch->flags + l);
+
+        v502_lanes_t equal = v502_lanes_eq(left, rhs);
+        v502_lanes_t at_least = v502_lanes_eq(v502_lanes_max(left, rhs), left);
+
+        v502_lanes_t new_f = v502_lanes_andnot(v502_lanes_or(carry_bit, zero_bit), f);
+        new_f = v502_lanes_or(new_f, v502_lanes_and(at_least, carry_bit));
+        new_f = v502_lanes_or(new_f, v502_lanes_and(equal, zero_bit));
+        new_f = v502_lanes_andnot(v502_lanes_and(equal, negative_bit), new_f);
+
+        v502_lanes_store(batch->flags + l, v502_lanes_select(group, new_f, f));
+    }
+}
+
+// Fills batch->taken with the lanes in the group taking the branch, when_set picks if that's with all of bits set or not
+static void v502_batch_kernel_condition(v502_batch_t* batch, v502_byte_t bits, int when_set) {
+    v502_lanes_t b = v502_lanes_set(bits);
+
+    for (uint32_t l = 0; l < batch->lane_capacity; l += v502_LANES) {
+        v502_lanes_t group = v502_lanes_load(batch->group + l);
+        v502_lanes_t set = v502_lanes_eq(v502_lanes_and(v502_lanes_load(batch->flags + l), b), b);
+
+        v502_lanes_store(batch->taken + l, when_set ? v502_lanes_and(group, set) : v502_lanes_andnot(set, group));
+    }
+}
+
+//
+// Lanes
+//
+
+// Returned instead of a program counter once no lane runs anymore
+#define v502_BATCH_DONE 0x10000
+
+typedef enum v502_BATCH_FLOW {
+    v502_BATCH_FLOW_NEXT, // The group moves past the instruction
+    v502_BATCH_FLOW_BRANCH, // Lanes in batch->taken go to the target, the rest move past the instruction
+    v502_BATCH_FLOW_JUMP // The whole group goes to the target
+} v502_BATCH_FLOW_E;
+
+// Moves the group along, counts the step and its cycles and retires lanes out of budget, all in one pass over the lanes
+// Returns the lowest program counter among the lanes still running
+// Lanes taking a branch spend taken_cycles on top of cycles
+static v502_dword_t v502_batch_finish_step(v502_batch_t* batch, v502_byte_t length, v502_byte_t cycles, v502_BATCH_FLOW_E flow, v502_word_t target, v502_byte_t taken_cycles, v502_qword_t max_instructions) {
+    v502_dword_t lowest = v502_BATCH_DONE;
+
+    for (uint32_t l = 0; l < batch->lane_count; l++) {
+        if (batch->group[l]) {
+            v502_word_t next = batch->program_counter[l] + length;
+            v502_byte_t spent = cycles;
+
+            if (flow == v502_BATCH_FLOW_JUMP)
+                next = target;
+
+            if (flow == v502_BATCH_FLOW_BRANCH && batch->taken[l]) {
+                next = target;
+                spent += taken_cycles;
+            }
+
+            batch->program_counter[l] = next;
+            batch->cycles[l] += spent;
+            batch->progress[l].instructions += 1;
+            batch->progress[l].cycles += spent;
+
+            if (max_instructions != 0 && batch->progress[l].instructions >= max_instructions)
+                batch->active[l] = 0;
+        }
+
+        if (batch->active[l] && batch->program_counter[l] < lowest)
+            lowest = batch->program_counter[l];
+    }
+
+    return lowest;
+}
+
+static v502_dword_t v502_batch_lowest_pc(v502_batch_t* batch) {
+    v502_dword_t lowest = v502_BATCH_DONE;
+
+    for (uint32_t l = 0; l < batch->lane_count; l++)
+        if (batch->active[l] && batch->program_counter[l] < lowest)
+            lowest = batch->program_counter[l];
+
+    return lowest;
+}
+
+static void v502_batch_stop(v502_batch_t* batch, uint32_t lane, v502_EXIT_REASON_E reason, v502_byte_t opcode) {
+    batch->active[lane] = 0;
+    batch->progress[lane].reason = reason;
+    batch->progress[lane].opcode = opcode;
+}
+
+// Runs a single instruction for one lane through the opfunc table, same state handling as v502_run_table_vm()
+static void v502_batch_scalar_step(v502_batch_t* batch, uint32_t lane, v502_qword_t max_instructions) {
+    v502_6502vm_t* vm = &batch->scalar;
+
+    vm->hunk = v502_get_batch_hunk(batch, lane);
+    vm->program_counter = batch->program_counter[lane];
+    vm->stack_ptr = batch->stack_ptr[lane];
+    vm->accumulator = batch->accumulator[lane];
+    vm->index_x = batch->index_x[lane];
+    vm->index_y = batch->index_y[lane];
+    vm->flags = batch->flags[lane];
+    vm->cycles = batch->cycles[lane];
+
+    v502_byte_t op = vm->hunk[vm->program_counter];
+
+    // Lanes keep plain flags, the kernels work on all of them at once
+    v502_begin_flags_vm(vm);
+    v502_OP_STATE_E state = batch->opfuncs[op](vm, op);
+    v502_end_flags_vm(vm);
+
+    if (state == V502_OP_STATE_SUCCESS || state == V502_OP_STATE_HALT)
+        vm->program_counter += 1;
+
+    batch->program_counter[lane] = vm->program_counter;
+    batch->stack_ptr[lane] = vm->stack_ptr;
+    batch->accumulator[lane] = vm->accumulator;
+    batch->index_x[lane] = vm->index_x;
+    batch->index_y[lane] = vm->index_y;
+    batch->flags[lane] = vm->flags;
+    batch->progress[lane].cycles += vm->cycles - batch->cycles[lane];
+    batch->cycles[lane] = vm->cycles;
+
+    if (state == V502_OP_STATE_BREAKPOINT) {
+        v502_batch_stop(batch, lane, v502_EXIT_REASON_BREAKPOINT, op);
+        return;
+    }
+
+    if (state == V502_OP_STATE_FAILED) {
+        v502_batch_stop(batch, lane, v502_EXIT_REASON_UNKNOWN_OP, op);
+        return;
+    }
+
+    batch->progress[lane].instructions += 1;
+
+    if (state == V502_OP_STATE_HALT)
+        v502_batch_stop(batch, lane, v502_EXIT_REASON_HALT, op);
+    else if (max_instructions != 0 && batch->progress[lane].instructions >= max_instructions)
+        batch->active[lane] = 0;
+}
+
+// Fills batch->group with every running lane sitting on pc that can execute together, returns the first of them
+static uint32_t v502_batch_gather(v502_batch_t* batch, v502_word_t pc, int* vector) {
+    uint32_t leader = 0;
+
+    while (!batch->active[leader] || batch->program_counter[leader] != pc)
+        leader++;
+
+    const v502_byte_t* code = v502_get_batch_hunk(batch, leader);
+
+    v502_byte_t op = code[pc];
+    v502_byte_t operand = code[(v502_word_t)(pc + 1)];
+    v502_byte_t operand_high = code[(v502_word_t)(pc + 2)];
+
+    // Kernels bake in the operand, so lanes only group up when their instruction bytes match too
+    switch (op) {
+        case v502_MOS_OP_INX: case v502_MOS_OP_DEX: case v502_MOS_OP_INY: case v502_MOS_OP_DEY:
+        case v502_MOS_OP_TAX: case v502_MOS_OP_TXA: case v502_MOS_OP_TAY: case v502_MOS_OP_TYA:
+        case v502_MOS_OP_TSX: case v502_MOS_OP_TXS: case v502_MOS_OP_NOP:
+        case v502_MOS_OP_LDA_NOW: case v502_MOS_OP_LDX_NOW: case v502_MOS_OP_LDY_NOW:
+        case v502_MOS_OP_ADC_NOW: case v502_MOS_OP_CMP_NOW: case v502_MOS_OP_CPX_NOW:
+        case v502_MOS_OP_BPL: case v502_MOS_OP_BMI: case v502_MOS_OP_BVC: case v502_MOS_OP_BVS:
+        case v502_MOS_OP_BCC: case v502_MOS_OP_BCS: case v502_MOS_OP_BNE: case v502_MOS_OP_BEQ:
+        case v502_MOS_OP_JMP_ABS:
+            *vector = batch->opfuncs[op] == v502_get_dispatch_table(batch->feature_set)[op];
+
+            // The add kernel is binary only, lanes in decimal mode go through the scalar path
+            if (op == v502_MOS_OP_ADC_NOW && (batch->flags[leader] & v502_STATE_FLAG_DECIMAL))
+                *vector = 0;
+
+            break;
+
+        default:
+            *vector = 0;
+            break;
+    }
+
+    for (uint32_t l = 0; l < batch->lane_count; l++) {
+        int match = batch->active[l] && batch->program_counter[l] == pc;
+
+        if (match && *vector && l != leader) {
+            const v502_byte_t* lane_code = v502_get_batch_hunk(batch, l);
+
+            match = lane_code[pc] == op && lane_code[(v502_word_t)(pc + 1)] == operand;
+
+            if (op == v502_MOS_OP_JMP_ABS)
+                match = match && lane_code[(v502_word_t)(pc + 2)] == operand_high;
+
+            if (op == v502_MOS_OP_ADC_NOW)
+                match = match && !(batch->flags[l] & v502_STATE_FLAG_DECIMAL);
+        }
+
+        batch->group[l] = match ? 0xFF : 0x00;
+    }
+
+    return leader;
+}
+
+// Executes the leader's instruction for the whole group with a kernel, returns the next lowest program counter
+static v502_dword_t v502_batch_vector_step(v502_batch_t* batch, uint32_t leader, v502_qword_t max_instructions) {
+    v502_word_t pc = batch->program_counter[leader];
+    const v502_byte_t* code = v502_get_batch_hunk(batch, leader);
+
+    v502_byte_t op = code[pc];
+    v502_byte_t operand = code[(v502_word_t)(pc + 1)];
+
+    v502_byte_t length = 1;
+    v502_BATCH_FLOW_E flow = v502_BATCH_FLOW_NEXT;
+    v502_word_t target = 0;
+    v502_byte_t taken_cycles = 0;
+
+    switch (op) {
+        case v502_MOS_OP_INX: v502_batch_kernel_step(batch, batch->index_x, 1); break;
+        case v502_MOS_OP_DEX: v502_batch_kernel_step(batch, batch->index_x, 0xFF); break;
+        case v502_MOS_OP_INY: v502_batch_kernel_step(batch, batch->index_y, 1); break;
+        case v502_MOS_OP_DEY: v502_batch_kernel_step(batch, batch->index_y, 0xFF); break;
+
+        case v502_MOS_OP_TAX: v502_batch_kernel_copy(batch, batch->index_x, batch->accumulator); break;
+        case v502_MOS_OP_TXA: v502_batch_kernel_copy(batch, batch->accumulator, batch->index_x); break;
+        case v502_MOS_OP_TAY: v502_batch_kernel_copy(batch, batch->index_y, batch->accumulator); break;
+        case v502_MOS_OP_TYA: v502_batch_kernel_copy(batch, batch->accumulator, batch->index_y); break;
+        case v502_MOS_OP_TSX: v502_batch_kernel_copy(batch, batch->index_x, batch->stack_ptr); break;
+        case v502_MOS_OP_TXS: v502_batch_kernel_copy(batch, batch->stack_ptr, batch->index_x); break;
+
+        case v502_MOS_OP_NOP: break;
+
+        case v502_MOS_OP_LDA_NOW: v502_batch_kernel_set(batch, batch->accumulator, operand); length = 2; break;
+        case v502_MOS_OP_LDX_NOW: v502_batch_kernel_set(batch, batch->index_x, operand); length = 2; break;
+        case v502_MOS_OP_LDY_NOW: v502_batch_kernel_set(batch, batch->index_y, operand); length = 2; break;
+
+        case v502_MOS_OP_ADC_NOW: v502_batch_kernel_adc(batch, operand); length = 2; break;
+        case v502_MOS_OP_CMP_NOW: v502_batch_kernel_compare(batch, batch->accumulator, operand); length = 2; break;
+        case v502_MOS_OP_CPX_NOW: v502_batch_kernel_compare(batch, batch->index_x, operand); length = 2; break;
+
+        case v502_MOS_OP_JMP_ABS:
+            flow = v502_BATCH_FLOW_JUMP;
+            target = v502_make_word(code[(v502_word_t)(pc + 2)], operand);
+            break;
+
+        default: {
+            // Branches, relative to the offset byte like v502_DEFINE_BRANCH
+            v502_byte_t bits = v502_STATE_FLAG_CARRY;
+            int when_set = op == v502_MOS_OP_BMI || op == v502_MOS_OP_BVS || op == v502_MOS_OP_BCS || op == v502_MOS_OP_BEQ;
+
+            if (op == v502_MOS_OP_BPL || op == v502_MOS_OP_BMI)
+                bits = v502_STATE_FLAG_NEGATIVE;
+
+            if (op == v502_MOS_OP_BVC || op == v502_MOS_OP_BVS)
+                bits = v502_STATE_FLAG_OVERFLOW;
+
+            if (op == v502_MOS_OP_BNE || op == v502_MOS_OP_BEQ)
+                bits = v502_STATE_FLAG_CARRY | v502_STATE_FLAG_ZERO;
+
+            v502_batch_kernel_condition(batch, bits, when_set);
+
+            length = 2;
+            flow = v502_BATCH_FLOW_BRANCH;
+            target = (v502_word_t)(pc + 1) + (int8_t)operand;
+            taken_cycles = v502_branch_cycles((v502_word_t)(pc + 2), target);
+            break;
+        }
+    }
+
+    v502_byte_t cycles = v502_get_cycle_table(batch->feature_set)[op];
+
+    return v502_batch_finish_step(batch, length, cycles, flow, target, taken_cycles, max_instructions);
+}
+
+//
+// Batch lifetime
+//
+v502_batch_t* v502_create_batch(v502_batch_createinfo_t* p_createinfo) {
+    assert(p_createinfo != NULL);
+
+    v502_batch_t* batch = calloc(1, sizeof(v502_batch_t));
+
+    batch->lane_count = p_createinfo->lane_count;
+    batch->lane_capacity = (batch->lane_count + v502_BATCH_LANE_ALIGN - 1) / v502_BATCH_LANE_ALIGN * v502_BATCH_LANE_ALIGN;
+
+    batch->hunk_length = p_createinfo->hunk_size != 0 ? p_createinfo->hunk_size : 0xFFFF + 1;
+    batch->hunk_stride = batch->hunk_length + 64 * 3;
+    batch->hunks = calloc(batch->lane_count, batch->hunk_stride);
+
+    batch->program_counter = calloc(batch->lane_capacity, sizeof(v502_word_t));
+    batch->stack_ptr = calloc(batch->lane_capacity, 1);
+    batch->accumulator = calloc(batch->lane_capacity, 1);
+    batch->index_x = calloc(batch->lane_capacity, 1);
+    batch->index_y = calloc(batch->lane_capacity, 1);
+    batch->flags = calloc(batch->lane_capacity, 1);
+    batch->cycles = calloc(batch->lane_capacity, sizeof(v502_qword_t));
+
+    batch->active = calloc(batch->lane_capacity, 1);
+    batch->group = calloc(batch->lane_capacity, 1);
+    batch->taken = calloc(batch->lane_capacity, 1);
+    batch->progress = calloc(batch->lane_capacity, sizeof(v502_exit_info_t));
+
+    batch->feature_set = p_createinfo->feature_set;
+    batch->opfuncs = v502_get_dispatch_table(batch->feature_set);
+
+    batch->scalar.hunk_length = batch->hunk_length;
+    batch->scalar.feature_set = batch->feature_set;
+    batch->scalar.opfuncs = batch->opfuncs;
+    v502_map_ram_vm(&batch->scalar, 0, v502_BUS_PAGES);
+
+    return batch;
+}
+
+void v502_free_batch(v502_batch_t* batch) {
+    if (batch == NULL)
+        return;
+
+    free(batch->progress);
+    free(batch->taken);
+    free(batch->group);
+    free(batch->active);
+
+    free(batch->cycles);
+    free(batch->flags);
+    free(batch->index_y);
+    free(batch->index_x);
+    free(batch->accumulator);
+    free(batch->stack_ptr);
+    free(batch->program_counter);
+
+    free(batch->hunks);
+    free(batch);
+}
+
+void v502_reset_batch(v502_batch_t* batch) {
+    assert(batch != NULL);
+
+    for (uint32_t l = 0; l < batch->lane_count; l++) {
+        v502_byte_t* hunk = v502_get_batch_hunk(batch, l);
+
+        batch->program_counter[l] = v502_make_word(hunk[v502_MAGIC_VECTOR_INDEX + 1], hunk[v502_MAGIC_VECTOR_INDEX]);
+        batch->stack_ptr[l] = 0xFF;
+        batch->accumulator[l] = batch->index_x[l] = batch->index_y[l] = 0;
+        batch->cycles[l] = 0;
+    }
+}
+
+void v502_load_batch_lane(v502_batch_t* batch, uint32_t lane, const v502_6502vm_t* vm) {
+    assert(batch != NULL && vm != NULL);
+    assert(lane < batch->lane_count);
+
+    batch->program_counter[lane] = vm->program_counter;
+    batch->stack_ptr[lane] = vm->stack_ptr;
+    batch->accumulator[lane] = vm->accumulator;
+    batch->index_x[lane] = vm->index_x;
+    batch->index_y[lane] = vm->index_y;
+    batch->flags[lane] = vm->flags;
+    batch->cycles[lane] = vm->cycles;
+
+    v502_dword_t length = vm->hunk_length < batch->hunk_length ? vm->hunk_length : batch->hunk_length;
+    memcpy(v502_get_batch_hunk(batch, lane), vm->hunk, length);
+}
+
+void v502_store_batch_lane(v502_batch_t* batch, uint32_t lane, v502_6502vm_t* vm) {
+    assert(batch != NULL && vm != NULL);
+    assert(lane < batch->lane_count);
+
+    vm->program_counter = batch->program_counter[lane];
+    vm->stack_ptr = batch->stack_ptr[lane];
+    vm->accumulator = batch->accumulator[lane];
+    vm->index_x = batch->index_x[lane];
+    vm->index_y = batch->index_y[lane];
+    vm->flags = batch->flags[lane];
+    vm->cycles = batch->cycles[lane];
+
+    v502_dword_t length = vm->hunk_length < batch->hunk_length ? vm->hunk_length : batch->hunk_length;
+    memcpy(vm->hunk, v502_get_batch_hunk(batch, lane), length);
+
+    // The VM's cached code was built from what its hunk held before
+    v502_invalidate_code_vm(vm, 0, v502_DECODE_CACHE_ENTRIES);
+}
+
+uint32_t v502_run_batch(v502_batch_t* batch, v502_qword_t max_instructions, v502_exit_info_t* exit_infos) {
+    assert(batch != NULL);
+
+    memset(batch->progress, 0, batch->lane_capacity * sizeof(v502_exit_info_t));
+    memset(batch->active, 0, batch->lane_capacity);
+    memset(batch->active, 0xFF, batch->lane_count);
+
+    v502_dword_t lowest = v502_batch_lowest_pc(batch);
+
+    while (lowest != v502_BATCH_DONE) {
+        int vector = 0;
+        uint32_t leader = v502_batch_gather(batch, (v502_word_t)lowest, &vector);
+
+        if (vector) {
+            lowest = v502_batch_vector_step(batch, leader, max_instructions);
+            continue;
+        }
+
+        for (uint32_t l = leader; l < batch->lane_count; l++)
+            if (batch->group[l])
+                v502_batch_scalar_step(batch, l, max_instructions);
+
+        lowest = v502_batch_lowest_pc(batch);
+    }
+
+    uint32_t stopped = 0;
+
+    for (uint32_t l = 0; l < batch->lane_count; l++) {
+        batch->progress[l].program_counter = batch->program_counter[l];
+
+        if (batch->progress[l].reason != v502_EXIT_REASON_BUDGET)
+            stopped += 1;
+    }
+
+    if (exit_infos != NULL)
+        memcpy(exit_infos, batch->progress, batch->lane_count * sizeof(v502_exit_info_t));
+
+    return stopped;
+}
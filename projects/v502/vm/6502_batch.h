@@ -0,0 +1,91 @@
+#ifndef V502_6502_BATCH_H
+#define V502_6502_BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+#include <stddef.h>
+
+//
+// Batches run many copies of a program in lockstep, one lane per copy
+//
+// Registers are stored structure of arrays style, one array per register with an entry per lane
+// Every step takes the lowest program counter among the running lanes, all lanes sitting on it with the same instruction bytes execute together
+// Register only instructions run as SIMD kernels over the whole group, everything else is executed lane by lane
+// Lanes that branch differently split up and join again once their program counters line up
+// Lane memory is plain RAM, batches don't support memory mapped devices or dirty tracking
+// Lanes have no interrupt lines either, those stay with the VM a lane was loaded from
+// Breakpoints and watchpoints aren't copied into lanes either, a batch always runs until its budget or a lane stops by itself
+// Lanes don't look for idle loops (see 6502_idle.c), a lane waiting on memory spins through its budget like any other
+// Lanes aren't recorded (see 6502_record.h), and storing a lane into a VM that is being recorded doesn't count as input to it
+// Lanes have no history (see 6502_history.h), storing one into a VM with history on is a host change that going back leaves alone
+//
+
+// Lane arrays are padded to this many lanes so the kernels never need a scalar tail
+#define v502_BATCH_LANE_ALIGN 32
+
+typedef struct v502_batch_createinfo {
+    uint32_t lane_count;
+    v502_dword_t hunk_size; // Per lane, 0 gives every lane the full 64K
+    v502_FEATURESET_E feature_set;
+} v502_batch_createinfo_t;
+
+typedef struct v502_batch {
+    uint32_t lane_count;
+    uint32_t lane_capacity; // lane_count rounded up to v502_BATCH_LANE_ALIGN, the padding lanes never run
+
+    // Registers, lane_capacity entries each
+    v502_word_t* program_counter;
+    v502_byte_t* stack_ptr;
+    v502_byte_t* accumulator;
+    v502_byte_t* index_x;
+    v502_byte_t* index_y;
+    v502_byte_t* flags;
+    v502_qword_t* cycles;
+
+    v502_byte_t* hunks; // Lane l's memory starts at hunks + l * hunk_stride
+    v502_dword_t hunk_length;
+    v502_dword_t hunk_stride; // hunk_length plus some padding, so lanes don't all land in the same cache sets
+
+    const v502_opfunc_t* opfuncs;
+    v502_FEATURESET_E feature_set;
+
+    // Scratch used while running
+    v502_byte_t* active; // 0xFF while a lane still runs
+    v502_byte_t* group; // 0xFF for lanes executing the current step
+    v502_byte_t* taken; // 0xFF for lanes taking the current branch
+    v502_exit_info_t* progress;
+    v502_6502vm_t scalar; // Stands in for a lane when an instruction has no kernel
+} v502_batch_t;
+
+// NOTE: Like VMs, creating a batch doesn't initialize the lanes, load them or call v502_reset_batch()!
+v502_batch_t* v502_create_batch(v502_batch_createinfo_t* p_createinfo);
+
+void v502_free_batch(v502_batch_t* batch);
+
+// Resets every lane like v502_reset_vm() would
+void v502_reset_batch(v502_batch_t* batch);
+
+static inline v502_byte_t* v502_get_batch_hunk(v502_batch_t* batch, uint32_t lane) {
+    return batch->hunks + (size_t)lane * batch->hunk_stride;
+}
+
+// Copies the registers and as much of the hunk as fits from vm into a lane
+void v502_load_batch_lane(v502_batch_t* batch, uint32_t lane, const v502_6502vm_t* vm);
+
+// Copies a lane's registers and hunk back out into vm
+void v502_store_batch_lane(v502_batch_t* batch, uint32_t lane, v502_6502vm_t* vm);
+
+// Runs every lane until it stops or has executed max_instructions, passing 0 removes the limit
+// exit_infos gets one entry per lane and is optional, returns how many lanes stopped for a reason other than the budget
+uint32_t v502_run_batch(v502_batch_t* batch, v502_qword_t max_instructions, v502_exit_info_t* exit_infos);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,356 @@
+#include "6502_fleet.h"
+
+#include "../misc/threads.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Work stealing deques
+//
+// The owner pushes and pops at the tail, thieves take from the head
+// A VM only ever sits in one deque, and workers only push what they just popped or stole, so vm_count entries always fit
+//
+typedef struct v502_fleet_deque {
+    v502_mutex_t lock;
+
+    uint32_t* items;
+    uint32_t head;
+    uint32_t tail;
+
+    v502_qword_t steals;
+} v502_fleet_deque_t;
+
+// Returns how many items the deque holds now
+static uint32_t v502_fleet_push(v502_fleet_deque_t* deque, uint32_t item) {
+    v502_mutex_lock(&deque->lock);
+
+    if (deque->head == deque->tail)
+        deque->head = deque->tail = 0;
+
+    deque->items[deque->tail++] = item;
+    uint32_t count = deque->tail - deque->head;
+
+    v502_mutex_unlock(&deque->lock);
+    return count;
+}
+
+static int v502_fleet_pop(v502_fleet_deque_t* deque, uint32_t* item) {
+    int found = 0;
+    v502_mutex_lock(&deque->lock);
+
+    if (deque->head != deque->tail) {
+        *item = deque->items[--deque->tail];
+        found = 1;
+    }
+
+    v502_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int v502_fleet_steal_from(v502_fleet_deque_t* deque, uint32_t* item) {
+    int found = 0;
+    v502_mutex_lock(&deque->lock);
+
+    if (deque->head != deque->tail) {
+        *item = deque->items[deque->head++];
+        found = 1;
+    }
+
+    v502_mutex_unlock(&deque->lock);
+    return found;
+}
+
+//
+// The fleet
+//
+typedef struct v502_fleet_worker {
+    struct v502_fleet* fleet;
+    uint32_t index;
+} v502_fleet_worker_t;
+
+struct v502_fleet {
+    uint32_t thread_count;
+
+    v502_thread_t* threads; // thread_count - 1 of these, the caller of v502_run_fleet() is worker 0
+    v502_fleet_worker_t* workers;
+    v502_fleet_deque_t* deques;
+    uint32_t capacity;
+
+    v502_mutex_t lock;
+    v502_cond_t wake;
+    v502_cond_t idle;
+    v502_cond_t work; // Workers with nothing to run or steal park on this, see v502_fleet_park()
+    uint32_t generation;
+    uint32_t busy;
+    int shutdown;
+
+    // The current job
+    v502_6502vm_t** vms;
+    v502_exit_info_t* progress;
+    v502_qword_t max_instructions;
+    uint32_t pending;
+    uint32_t queued; // VMs sitting in a deque rather than being run
+    uint32_t parked;
+};
+
+// Returns 1 once the VM is done
+static int v502_fleet_run_slice(v502_fleet_t* fleet, uint32_t index) {
+    v502_exit_info_t* progress = &fleet->progress[index];
+    v502_qword_t slice = v502_FLEET_SLICE;
+
+    if (fleet->max_instructions != 0 && fleet->max_instructions - progress->instructions < slice)
+        slice = fleet->max_instructions - progress->instructions;
+
+    v502_exit_info_t info = { 0 };
+    v502_run_vm(fleet->vms[index], slice, &info);
+
+    progress->reason = info.reason;
+    progress->instructions += info.instructions;
+    progress->cycles += info.cycles;
+    progress->program_counter = info.program_counter;
+    progress->opcode = info.opcode;
+    progress->watch_address = info.watch_address;
+
+    if (info.reason != v502_EXIT_REASON_BUDGET)
+        return 1;
+
+    return fleet->max_instructions != 0 && progress->instructions >= fleet->max_instructions;
+}
+
+static int v502_fleet_steal(v502_fleet_t* fleet, uint32_t thief, uint32_t* item) {
+    for (uint32_t v = 1; v < fleet->thread_count; v++) {
+        uint32_t victim = (thief + v) % fleet->thread_count;
+
+        if (v502_fleet_steal_from(&fleet->deques[victim], item)) {
+            fleet->deques[thief].steals += 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Sleeps while everything left is being run by someone else, so a few long running VMs don't keep the other cores spinning
+// parked goes up before queued and pending are checked, and wakers change those before they check parked, so no wake up is missed
+static void v502_fleet_park(v502_fleet_t* fleet) {
+    v502_mutex_lock(&fleet->lock);
+    v502_atomic_fetch_add_u32(&fleet->parked, 1);
+
+    while (v502_atomic_load_u32(&fleet->queued) == 0 && v502_atomic_load_u32(&fleet->pending) != 0)
+        v502_cond_wait(&fleet->work, &fleet->lock);
+
+    v502_atomic_fetch_sub_u32(&fleet->parked, 1);
+    v502_mutex_unlock(&fleet->lock);
+}
+
+static void v502_fleet_unpark(v502_fleet_t* fleet) {
+    if (v502_atomic_load_u32(&fleet->parked) == 0)
+        return;
+
+    v502_mutex_lock(&fleet->lock);
+    v502_cond_broadcast(&fleet->work);
+    v502_mutex_unlock(&fleet->lock);
+}
+
+static void v502_fleet_work(v502_fleet_t* fleet, uint32_t worker) {
+    v502_fleet_deque_t* own = &fleet->deques[worker];
+
+    while (v502_atomic_load_u32(&fleet->pending) != 0) {
+        uint32_t index;
+
+        if (!v502_fleet_pop(own, &index) && !v502_fleet_steal(fleet, worker, &index)) {
+            v502_fleet_park(fleet);
+            continue;
+        }
+
+        v502_atomic_fetch_sub_u32(&fleet->queued, 1);
+
+        if (v502_fleet_run_slice(fleet, index)) {
+            if (v502_atomic_fetch_sub_u32(&fleet->pending, 1) == 1)
+                v502_fleet_unpark(fleet);
+
+            continue;
+        }
+
+        uint32_t count = v502_fleet_push(own, index);
+        v502_atomic_fetch_add_u32(&fleet->queued, 1);
+
+        // We take the VM we just pushed straight back, anything past it can go to a parked worker
+        if (count > 1)
+            v502_fleet_unpark(fleet);
+    }
+}
+
+static v502_THREAD_FUNC(v502_fleet_thread) {
+    v502_fleet_worker_t* worker = arg;
+    v502_fleet_t* fleet = worker->fleet;
+    uint32_t seen = 0;
+
+    v502_mutex_lock(&fleet->lock);
+
+    for (;;) {
+        while (fleet->generation == seen && !fleet->shutdown)
+            v502_cond_wait(&fleet->wake, &fleet->lock);
+
+        if (fleet->shutdown)
+            break;
+
+        seen = fleet->generation;
+        v502_mutex_unlock(&fleet->lock);
+
+        v502_fleet_work(fleet, worker->index);
+
+        v502_mutex_lock(&fleet->lock);
+
+        if (--fleet->busy == 0)
+            v502_cond_broadcast(&fleet->idle);
+    }
+
+    v502_mutex_unlock(&fleet->lock);
+    return 0;
+}
+
+v502_fleet_t* v502_create_fleet(v502_fleet_createinfo_t* p_createinfo) {
+    assert(p_createinfo != NULL);
+
+    v502_fleet_t* fleet = calloc(1, sizeof(v502_fleet_t));
+
+    fleet->thread_count = p_createinfo->thread_count;
+
+    if (fleet->thread_count == 0)
+        fleet->thread_count = v502_hardware_threads();
+
+    v502_mutex_init(&fleet->lock);
+    v502_cond_init(&fleet->wake);
+    v502_cond_init(&fleet->idle);
+    v502_cond_init(&fleet->work);
+
+    fleet->deques = calloc(fleet->thread_count, sizeof(v502_fleet_deque_t));
+
+    for (uint32_t w = 0; w < fleet->thread_count; w++)
+        v502_mutex_init(&fleet->deques[w].lock);
+
+    fleet->workers = calloc(fleet->thread_count, sizeof(v502_fleet_worker_t));
+    fleet->threads = calloc(fleet->thread_count, sizeof(v502_thread_t));
+
+    for (uint32_t w = 1; w < fleet->thread_count; w++) {
+        fleet->workers[w].fleet = fleet;
+        fleet->workers[w].index = w;
+
+        // Whatever we couldn't start, the remaining workers pick up through stealing
+        if (!v502_thread_create(&fleet->threads[w - 1], v502_fleet_thread, &fleet->workers[w])) {
+            fleet->thread_count = w;
+            break;
+        }
+    }
+
+    return fleet;
+}
+
+void v502_free_fleet(v502_fleet_t* fleet) {
+    if (fleet == NULL)
+        return;
+
+    v502_mutex_lock(&fleet->lock);
+    fleet->shutdown = 1;
+    v502_cond_broadcast(&fleet->wake);
+    v502_mutex_unlock(&fleet->lock);
+
+    for (uint32_t w = 1; w < fleet->thread_count; w++)
+        v502_thread_join(fleet->threads[w - 1]);
+
+    for (uint32_t w = 0; w < fleet->thread_count; w++) {
+        v502_mutex_destroy(&fleet->deques[w].lock);
+        free(fleet->deques[w].items);
+    }
+
+    v502_cond_destroy(&fleet->work);
+    v502_cond_destroy(&fleet->idle);
+    v502_cond_destroy(&fleet->wake);
+    v502_mutex_destroy(&fleet->lock);
+
+    free(fleet->progress);
+    free(fleet->deques);
+    free(fleet->workers);
+    free(fleet->threads);
+    free(fleet);
+}
+
+void v502_run_fleet(v502_fleet_t* fleet, v502_6502vm_t** vms, uint32_t vm_count, v502_qword_t max_instructions, v502_exit_info_t* exit_infos, v502_fleet_report_t* report) {
+    assert(fleet != NULL);
+    assert(vms != NULL || vm_count == 0);
+
+    double start = v502_time_now_seconds();
+
+    if (report != NULL) {
+        memset(report, 0, sizeof(v502_fleet_report_t));
+        report->thread_count = fleet->thread_count;
+    }
+
+    if (vm_count == 0)
+        return;
+
+    if (vm_count > fleet->capacity) {
+        for (uint32_t w = 0; w < fleet->thread_count; w++) {
+            free(fleet->deques[w].items);
+            fleet->deques[w].items = malloc(vm_count * sizeof(uint32_t));
+        }
+
+        free(fleet->progress);
+        fleet->progress = malloc(vm_count * sizeof(v502_exit_info_t));
+        fleet->capacity = vm_count;
+    }
+
+    memset(fleet->progress, 0, vm_count * sizeof(v502_exit_info_t));
+
+    // Deal the VMs out round robin, stealing evens out whatever this gets wrong
+    for (uint32_t w = 0; w < fleet->thread_count; w++) {
+        fleet->deques[w].head = fleet->deques[w].tail = 0;
+        fleet->deques[w].steals = 0;
+    }
+
+    for (uint32_t v = 0; v < vm_count; v++) {
+        v502_fleet_deque_t* deque = &fleet->deques[v % fleet->thread_count];
+        deque->items[deque->tail++] = v;
+    }
+
+    fleet->vms = vms;
+    fleet->max_instructions = max_instructions;
+    fleet->pending = fleet->queued = vm_count;
+
+    // Wake the pool and work alongside it
+    v502_mutex_lock(&fleet->lock);
+    fleet->busy = fleet->thread_count - 1;
+    fleet->generation += 1;
+    v502_cond_broadcast(&fleet->wake);
+    v502_mutex_unlock(&fleet->lock);
+
+    v502_fleet_work(fleet, 0);
+
+    v502_mutex_lock(&fleet->lock);
+
+    while (fleet->busy != 0)
+        v502_cond_wait(&fleet->idle, &fleet->lock);
+
+    v502_mutex_unlock(&fleet->lock);
+
+    if (exit_infos != NULL)
+        memcpy(exit_infos, fleet->progress, vm_count * sizeof(v502_exit_info_t));
+
+    if (report != NULL) {
+        for (uint32_t v = 0; v < vm_count; v++) {
+            report->instructions += fleet->progress[v].instructions;
+            report->cycles += fleet->progress[v].cycles;
+        }
+
+        for (uint32_t w = 0; w < fleet->thread_count; w++)
+            report->steals += fleet->deques[w].steals;
+
+        report->seconds = v502_time_now_seconds() - start;
+        report->instructions_per_second = report->seconds > 0 ? (double)report->instructions / report->seconds : 0;
+    }
+
+    fleet->vms = NULL;
+}
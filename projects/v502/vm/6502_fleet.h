@@ -0,0 +1,52 @@
+#ifndef V502_6502_FLEET_H
+#define V502_6502_FLEET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+//
+// Fleets run many independent VMs at once on a pool of worker threads
+//
+// Every worker owns a deque of VMs, when it runs dry it steals from the other workers
+// VMs run in slices of v502_FLEET_SLICE instructions, so a few long running programs still spread over every core
+// A VM is only ever touched by one worker at a time, VMs must not share hunks or anything else they write to
+// Forks of the same snapshot are fine, they only share memory copy on write
+//
+
+// How many instructions a VM runs before its worker checks for other work again
+#define v502_FLEET_SLICE (1 << 20)
+
+typedef struct v502_fleet v502_fleet_t;
+
+typedef struct v502_fleet_createinfo {
+    uint32_t thread_count; // 0 uses one thread per hardware thread, the thread calling v502_run_fleet() counts as one
+} v502_fleet_createinfo_t;
+
+typedef struct v502_fleet_report {
+    v502_qword_t instructions; // Summed over every VM
+    v502_qword_t cycles; // Same for clock cycles
+    double seconds; // Wall clock time of the whole run
+    double instructions_per_second;
+    v502_qword_t steals; // How often a worker took a VM from another worker
+    uint32_t thread_count;
+} v502_fleet_report_t;
+
+v502_fleet_t* v502_create_fleet(v502_fleet_createinfo_t* p_createinfo);
+
+// Stops and joins the worker threads, the VMs that were run are left alone
+void v502_free_fleet(v502_fleet_t* fleet);
+
+// Runs every VM until it stops or has executed max_instructions, passing 0 removes the limit
+// exit_infos gets one entry per VM in the same order, report gets the totals, both are optional
+// Blocks until every VM is done
+void v502_run_fleet(v502_fleet_t* fleet, v502_6502vm_t** vms, uint32_t vm_count, v502_qword_t max_instructions, v502_exit_info_t* exit_infos, v502_fleet_report_t* report);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
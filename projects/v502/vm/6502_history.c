@@ -0,0 +1,647 @@
+#include "6502_history.h"
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Reverse execution
+//
+// The undo log is two rings, one of steps and one of the bytes they overwrote, each step knows how many of the latter are its own
+// Positions count steps from when history started, ring slots are positions modulo the capacity
+//
+// Checkpoints keep a page's image the first time anything writes to it after them, so each one holds the pages as they were when it was taken
+// Applying them from the newest down to one turns memory at the start of the undo log back into memory at that checkpoint
+// None are needed for steps still in the undo log, so the oldest checkpoint is the one dropped whenever they grow past their share
+//
+// Running forward from a checkpoint again takes the interrupts where they were taken the first time, whatever the lines say now
+// They're kept in a list of their own that shares the checkpoints' part of the budget
+//
+
+typedef struct v502_history_step {
+    v502_word_t program_counter;
+    uint16_t cycles; // The low bits of vm->cycles, no step takes anywhere near 64K cycles
+    uint16_t writes; // How many entries of the write ring this step made
+    v502_byte_t stack_ptr;
+    v502_byte_t accumulator;
+    v502_byte_t index_x;
+    v502_byte_t index_y;
+    v502_byte_t flags;
+} v502_history_step_t;
+
+typedef struct v502_history_undo {
+    v502_word_t where;
+    v502_byte_t old_value;
+} v502_history_undo_t;
+
+typedef struct v502_history_interrupt {
+    v502_qword_t step;
+    v502_word_t vector;
+} v502_history_interrupt_t;
+
+typedef struct v502_checkpoint {
+    v502_qword_t step; // Taken right before this step ran
+    v502_qword_t cycles;
+    v502_word_t program_counter;
+    v502_byte_t stack_ptr;
+    v502_byte_t accumulator;
+    v502_byte_t index_x;
+    v502_byte_t index_y;
+    v502_byte_t flags;
+
+    uint64_t pages[v502_BUS_PAGES / 64]; // Pages with an image below
+    v502_byte_t page_list[v502_BUS_PAGES]; // Which page each image is, in the order they were taken
+    uint32_t page_count;
+    uint32_t page_capacity;
+    v502_byte_t* images; // 256 bytes a page
+} v502_checkpoint_t;
+
+typedef struct v502_history {
+    v502_qword_t budget;
+    v502_qword_t interval;
+
+    v502_history_step_t* steps;
+    v502_history_undo_t* writes;
+    v502_qword_t step_capacity;
+    v502_qword_t write_capacity;
+
+    v502_qword_t position; // The next step to log
+    v502_qword_t undo_start; // The oldest step still logged
+    v502_qword_t write_position;
+    v502_qword_t write_start;
+
+    v502_checkpoint_t* checkpoints; // Oldest first, there's always at least one
+    uint32_t checkpoint_count;
+    uint32_t checkpoint_capacity;
+    v502_qword_t checkpoint_bytes; // Interrupts included
+    v502_qword_t checkpoint_budget;
+
+    v502_history_interrupt_t* interrupts; // Oldest first, nothing before the oldest checkpoint
+    uint32_t interrupt_count;
+    uint32_t interrupt_capacity;
+} v502_history_t;
+
+// Steps logged for each byte of the undo log's share, every step gets room for one write
+#define v502_HISTORY_STEP_BYTES (sizeof(v502_history_step_t) + sizeof(v502_history_undo_t))
+
+// Budgets that hold fewer steps than this aren't worth it
+#define v502_HISTORY_MIN_STEPS 1024
+
+//
+// Checkpoints
+//
+
+static v502_checkpoint_t* v502_newest_checkpoint(v502_history_t* history) {
+    return &history->checkpoints[history->checkpoint_count - 1];
+}
+
+static v502_qword_t v502_checkpoint_size(const v502_checkpoint_t* checkpoint) {
+    return sizeof(v502_checkpoint_t) + (v502_qword_t)checkpoint->page_count * 256;
+}
+
+static void v502_drop_checkpoint(v502_history_t* history, uint32_t index) {
+    v502_checkpoint_t* checkpoint = &history->checkpoints[index];
+
+    history->checkpoint_bytes -= v502_checkpoint_size(checkpoint);
+    free(checkpoint->images);
+
+    history->checkpoint_count -= 1;
+    memmove(checkpoint, checkpoint + 1, (history->checkpoint_count - index) * sizeof(v502_checkpoint_t));
+
+    if (index != 0 || history->checkpoint_count == 0)
+        return;
+
+    // Nothing runs forward from before the oldest checkpoint anymore
+    uint32_t stale = 0;
+
+    while (stale < history->interrupt_count && history->interrupts[stale].step < history->checkpoints[0].step)
+        stale += 1;
+
+    history->interrupt_count -= stale;
+    history->checkpoint_bytes -= stale * sizeof(v502_history_interrupt_t);
+    memmove(history->interrupts, history->interrupts + stale, history->interrupt_count * sizeof(v502_history_interrupt_t));
+}
+
+static void v502_add_checkpoint(v502_6502vm_t* vm) {
+    v502_history_t* history = vm->history;
+
+    if (history->checkpoint_count == history->checkpoint_capacity) {
+        history->checkpoint_capacity = history->checkpoint_capacity == 0 ? 16 : history->checkpoint_capacity * 2;
+        history->checkpoints = realloc(history->checkpoints, history->checkpoint_capacity * sizeof(v502_checkpoint_t));
+    }
+
+    v502_checkpoint_t* checkpoint = &history->checkpoints[history->checkpoint_count++];
+    memset(checkpoint, 0, sizeof(v502_checkpoint_t));
+
+    checkpoint->step = history->position;
+    checkpoint->cycles = vm->cycles;
+    checkpoint->program_counter = vm->program_counter;
+    checkpoint->stack_ptr = vm->stack_ptr;
+    checkpoint->accumulator = vm->accumulator;
+    checkpoint->index_x = vm->index_x;
+    checkpoint->index_y = vm->index_y;
+    checkpoint->flags = v502_get_flags_vm(vm);
+
+    history->checkpoint_bytes += sizeof(v502_checkpoint_t);
+}
+
+// Keeps what the page holds right now, before the first write to it since the newest checkpoint
+static void v502_keep_page(v502_6502vm_t* vm, uint32_t page) {
+    v502_history_t* history = vm->history;
+    v502_checkpoint_t* checkpoint = v502_newest_checkpoint(history);
+
+    if (checkpoint->page_count == checkpoint->page_capacity) {
+        checkpoint->page_capacity = checkpoint->page_capacity == 0 ? 16 : checkpoint->page_capacity * 2;
+        checkpoint->images = realloc(checkpoint->images, (size_t)checkpoint->page_capacity * 256);
+    }
+
+    memcpy(checkpoint->images + (size_t)checkpoint->page_count * 256, vm->hunk + page * 256, 256);
+
+    checkpoint->pages[page >> 6] |= (uint64_t)1 << (page & 63);
+    checkpoint->page_list[checkpoint->page_count++] = (v502_byte_t)page;
+
+    history->checkpoint_bytes += 256;
+
+    // The newest checkpoint is always kept, however far over its share it goes it can't be more than a copy of the hunk
+    while (history->checkpoint_bytes > history->checkpoint_budget && history->checkpoint_count > 1)
+        v502_drop_checkpoint(history, 0);
+}
+
+//
+// Undoing
+//
+
+// Puts back a byte like v502_store_ram_vm() would, without logging it again
+static void v502_put_back_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    vm->hunk[where] = value;
+
+    if (vm->dirty != NULL)
+        v502_mark_dirty_vm(vm, where);
+
+    v502_invalidate_code_vm(vm, where, 1);
+}
+
+static void v502_restore_checkpoint_vm(v502_6502vm_t* vm, const v502_checkpoint_t* checkpoint) {
+    for (uint32_t i = 0; i < checkpoint->page_count; i++) {
+        v502_word_t base = (v502_word_t)(checkpoint->page_list[i] << 8);
+
+        memcpy(vm->hunk + base, checkpoint->images + (size_t)i * 256, 256);
+
+        if (vm->dirty != NULL)
+            for (uint32_t line = 0; line < 256; line += 16)
+                v502_mark_dirty_vm(vm, base + line);
+
+        v502_invalidate_code_vm(vm, base, 256);
+    }
+}
+
+// Drops the oldest step to make room, its writes go with it
+static void v502_forget_step(v502_history_t* history) {
+    history->write_start += history->steps[history->undo_start % history->step_capacity].writes;
+    history->undo_start += 1;
+}
+
+// Takes back the newest step in the undo log
+static void v502_undo_step_vm(v502_6502vm_t* vm) {
+    v502_history_t* history = vm->history;
+    const v502_history_step_t* step = &history->steps[(history->position - 1) % history->step_capacity];
+
+    for (uint32_t w = 0; w < step->writes; w++) {
+        history->write_position -= 1;
+
+        const v502_history_undo_t* undo = &history->writes[history->write_position % history->write_capacity];
+        v502_put_back_vm(vm, undo->where, undo->old_value);
+    }
+
+    vm->program_counter = step->program_counter;
+    vm->stack_ptr = step->stack_ptr;
+    vm->accumulator = step->accumulator;
+    vm->index_x = step->index_x;
+    vm->index_y = step->index_y;
+    vm->cycles -= (uint16_t)((uint16_t)vm->cycles - step->cycles);
+    v502_set_flags_vm(vm, step->flags);
+
+    history->position -= 1;
+
+    // A checkpoint taken after the step doesn't hold anything that happened anymore
+    if (history->position < v502_newest_checkpoint(history)->step) {
+        v502_drop_checkpoint(history, history->checkpoint_count - 1);
+
+        if (history->checkpoint_count == 0)
+            v502_add_checkpoint(vm);
+    }
+}
+
+// Runs forward with the table engine until position reaches target
+// Interrupts are steps that don't count as instructions, so runs can overshoot and have to be taken back
+static void v502_run_steps_vm(v502_6502vm_t* vm, v502_qword_t target) {
+    v502_history_t* history = vm->history;
+
+    while (history->position < target) {
+        v502_qword_t before = history->position;
+        v502_run_table_vm(vm, target - history->position, 0, NULL);
+
+        // Stuck, the program took a different path this time
+        if (history->position == before)
+            break;
+    }
+}
+
+// Runs forward with the table engine until the position reaches target, taking the interrupts logged on the way at the same steps
+static void v502_redo_to_vm(v502_6502vm_t* vm, v502_qword_t target) {
+    v502_history_t* history = vm->history;
+
+    // Logging the first step drops the interrupts after it as a future that didn't happen, so the ones to take are copied out first
+    uint32_t first = 0;
+
+    while (first < history->interrupt_count && history->interrupts[first].step < history->position)
+        first += 1;
+
+    uint32_t count = history->interrupt_count - first;
+    v502_history_interrupt_t* interrupts = NULL;
+
+    if (count != 0) {
+        interrupts = malloc(count * sizeof(v502_history_interrupt_t));
+        memcpy(interrupts, history->interrupts + first, count * sizeof(v502_history_interrupt_t));
+    }
+
+    // Whatever ran before was already traced and recorded, running it again isn't something new to them
+    struct v502_trace* trace = vm->trace;
+    struct v502_recording* recording = vm->recording;
+    uint32_t lines = v502_atomic_fetch_and_u32(&vm->interrupt_lines, 0);
+
+    vm->trace = NULL;
+    vm->recording = NULL;
+
+    for (uint32_t i = 0; i < count && interrupts[i].step < target; i++) {
+        v502_run_steps_vm(vm, interrupts[i].step);
+
+        if (history->position != interrupts[i].step)
+            break;
+
+        v502_enter_interrupt_vm(vm, interrupts[i].vector);
+    }
+
+    v502_run_steps_vm(vm, target);
+
+    vm->trace = trace;
+    vm->recording = recording;
+    v502_atomic_fetch_or_u32(&vm->interrupt_lines, lines);
+
+    free(interrupts);
+}
+
+static v502_qword_t v502_oldest_step(const v502_history_t* history) {
+    v502_qword_t oldest = history->checkpoints[0].step;
+    return history->undo_start < oldest ? history->undo_start : oldest;
+}
+
+// Goes back to target, which has to lie between v502_oldest_step() and the position
+static void v502_rewind_vm(v502_6502vm_t* vm, v502_qword_t target) {
+    v502_history_t* history = vm->history;
+
+    if (target < history->undo_start) {
+        // The newest checkpoint at or before the target
+        uint32_t index = history->checkpoint_count - 1;
+
+        while (history->checkpoints[index].step > target)
+            index -= 1;
+
+        while (history->position > history->undo_start)
+            v502_undo_step_vm(vm);
+
+        for (uint32_t c = history->checkpoint_count; c > index; c--)
+            v502_restore_checkpoint_vm(vm, &history->checkpoints[c - 1]);
+
+        while (history->checkpoint_count > index + 1)
+            v502_drop_checkpoint(history, history->checkpoint_count - 1);
+
+        const v502_checkpoint_t* checkpoint = &history->checkpoints[index];
+
+        vm->program_counter = checkpoint->program_counter;
+        vm->stack_ptr = checkpoint->stack_ptr;
+        vm->accumulator = checkpoint->accumulator;
+        vm->index_x = checkpoint->index_x;
+        vm->index_y = checkpoint->index_y;
+        vm->cycles = checkpoint->cycles;
+        v502_set_flags_vm(vm, checkpoint->flags);
+
+        history->position = history->undo_start = checkpoint->step;
+        history->write_start = history->write_position;
+
+        v502_redo_to_vm(vm, target);
+        return;
+    }
+
+    while (history->position > target)
+        v502_undo_step_vm(vm);
+}
+
+// Fills the undo log again from the checkpoint before its start, returns 0 if there's nothing older
+static int v502_refill_history_vm(v502_6502vm_t* vm) {
+    v502_history_t* history = vm->history;
+    v502_qword_t target = history->position;
+    uint32_t index = history->checkpoint_count;
+
+    while (index > 0 && history->checkpoints[index - 1].step >= target)
+        index -= 1;
+
+    if (index == 0)
+        return 0;
+
+    v502_rewind_vm(vm, history->checkpoints[index - 1].step);
+    v502_redo_to_vm(vm, target);
+
+    return history->undo_start < history->position;
+}
+
+//
+// Logging
+//
+void v502_history_step_vm(v502_6502vm_t* vm) {
+    v502_history_t* history = vm->history;
+
+    // Interrupts logged after a step that's being taken again never happened
+    while (history->interrupt_count != 0 && history->interrupts[history->interrupt_count - 1].step >= history->position) {
+        history->interrupt_count -= 1;
+        history->checkpoint_bytes -= sizeof(v502_history_interrupt_t);
+    }
+
+    if (history->position - v502_newest_checkpoint(history)->step >= history->interval)
+        v502_add_checkpoint(vm);
+
+    if (history->position - history->undo_start == history->step_capacity)
+        v502_forget_step(history);
+
+    v502_history_step_t* step = &history->steps[history->position % history->step_capacity];
+
+    step->program_counter = vm->program_counter;
+    step->cycles = (uint16_t)vm->cycles;
+    step->writes = 0;
+    step->stack_ptr = vm->stack_ptr;
+    step->accumulator = vm->accumulator;
+    step->index_x = vm->index_x;
+    step->index_y = vm->index_y;
+    step->flags = v502_get_flags_vm(vm);
+
+    history->position += 1;
+}
+
+void v502_history_interrupt_vm(v502_6502vm_t* vm, v502_word_t vector) {
+    v502_history_t* history = vm->history;
+
+    v502_history_step_vm(vm);
+
+    if (history->interrupt_count == history->interrupt_capacity) {
+        history->interrupt_capacity = history->interrupt_capacity == 0 ? 64 : history->interrupt_capacity * 2;
+        history->interrupts = realloc(history->interrupts, history->interrupt_capacity * sizeof(v502_history_interrupt_t));
+    }
+
+    v502_history_interrupt_t* interrupt = &history->interrupts[history->interrupt_count++];
+
+    interrupt->step = history->position - 1;
+    interrupt->vector = vector;
+
+    history->checkpoint_bytes += sizeof(v502_history_interrupt_t);
+}
+
+void v502_history_store_vm(v502_6502vm_t* vm, v502_word_t where) {
+    v502_history_t* history = vm->history;
+
+    if (!v502_is_dirty(v502_newest_checkpoint(history)->pages, where >> 8))
+        v502_keep_page(vm, where >> 8);
+
+    // Not made by any step, so like a host write it stays when going back
+    if (history->position == history->undo_start)
+        return;
+
+    // Only the step this write belongs to is left, it made more writes than the ring holds
+    while (history->write_position - history->write_start == history->write_capacity) {
+        assert(history->position - history->undo_start > 1);
+        v502_forget_step(history);
+    }
+
+    v502_history_undo_t* undo = &history->writes[history->write_position % history->write_capacity];
+
+    undo->where = where;
+    undo->old_value = vm->hunk[where];
+
+    history->write_position += 1;
+    history->steps[(history->position - 1) % history->step_capacity].writes += 1;
+}
+
+void v502_drop_history_step_vm(v502_6502vm_t* vm) {
+    v502_history_t* history = vm->history;
+
+    history->position -= 1;
+    history->write_position -= history->steps[history->position % history->step_capacity].writes;
+}
+
+void v502_restart_history_vm(v502_6502vm_t* vm) {
+    v502_history_t* history = vm->history;
+
+    while (history->checkpoint_count != 0)
+        v502_drop_checkpoint(history, history->checkpoint_count - 1);
+
+    history->checkpoint_bytes -= history->interrupt_count * sizeof(v502_history_interrupt_t);
+    history->interrupt_count = 0;
+
+    history->position = history->undo_start = 0;
+    history->write_position = history->write_start = 0;
+
+    v502_add_checkpoint(vm);
+}
+
+//
+// Public API
+//
+int v502_begin_history_vm(v502_6502vm_t* vm, v502_qword_t budget, v502_qword_t interval) {
+    assert(vm != NULL);
+
+    if (vm->history != NULL)
+        return 0;
+
+    if (budget == 0)
+        budget = v502_HISTORY_DEFAULT_BUDGET;
+
+    if (interval == 0)
+        interval = v502_HISTORY_DEFAULT_INTERVAL;
+
+    // The undo log gets three quarters up front, checkpoints grow into the rest
+    v502_qword_t checkpoint_budget = budget / 4;
+    v502_qword_t step_capacity = (budget - checkpoint_budget) / v502_HISTORY_STEP_BYTES;
+
+    if (step_capacity < v502_HISTORY_MIN_STEPS)
+        return 0;
+
+    // Going back past the undo log runs forward from the checkpoint before, which has to refill more than one interval of it
+    if (interval > step_capacity / 2)
+        interval = step_capacity / 2;
+
+    v502_history_t* history = calloc(1, sizeof(v502_history_t));
+
+    history->budget = budget;
+    history->interval = interval;
+    history->step_capacity = history->write_capacity = step_capacity;
+    history->steps = malloc(step_capacity * sizeof(v502_history_step_t));
+    history->writes = malloc(step_capacity * sizeof(v502_history_undo_t));
+    history->checkpoint_budget = checkpoint_budget;
+
+    if (history->steps == NULL || history->writes == NULL) {
+        free(history->steps);
+        free(history->writes);
+        free(history);
+        return 0;
+    }
+
+    vm->history = history;
+    v502_add_checkpoint(vm);
+
+    return 1;
+}
+
+void v502_end_history_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+
+    v502_history_t* history = vm->history;
+
+    if (history == NULL)
+        return;
+
+    vm->history = NULL;
+
+    for (uint32_t c = 0; c < history->checkpoint_count; c++)
+        free(history->checkpoints[c].images);
+
+    free(history->checkpoints);
+    free(history->interrupts);
+    free(history->steps);
+    free(history->writes);
+    free(history);
+}
+
+int v502_get_history_vm(const v502_6502vm_t* vm, v502_history_info_t* info) {
+    assert(vm != NULL && info != NULL);
+
+    const v502_history_t* history = vm->history;
+
+    if (history == NULL)
+        return 0;
+
+    info->position = history->position;
+    info->undo_start = history->undo_start;
+    info->oldest = v502_oldest_step(history);
+    info->checkpoints = history->checkpoint_count;
+    info->used = history->step_capacity * v502_HISTORY_STEP_BYTES + history->checkpoint_bytes;
+    info->budget = history->budget;
+
+    return 1;
+}
+
+// Going back isn't something the program did, so a recording sees it as the host putting the whole VM into another state
+// That's the pages that changed and the registers, which takes a copy of the memory from before
+static v502_byte_t* v502_begin_recorded_rewind_vm(const v502_6502vm_t* vm) {
+    if (vm->recording == NULL)
+        return NULL;
+
+    v502_byte_t* before = malloc(vm->hunk_length);
+    memcpy(before, vm->hunk, vm->hunk_length);
+
+    return before;
+}
+
+static void v502_end_recorded_rewind_vm(v502_6502vm_t* vm, v502_qword_t cycles, v502_byte_t* before) {
+    if (before == NULL)
+        return;
+
+    v502_record_state_vm(vm, cycles, before);
+    free(before);
+}
+
+v502_qword_t v502_step_back_vm(v502_6502vm_t* vm, v502_qword_t steps) {
+    assert(vm != NULL);
+
+    v502_history_t* history = vm->history;
+
+    if (history == NULL)
+        return 0;
+
+    v502_qword_t start = history->position;
+    v502_qword_t oldest = v502_oldest_step(history);
+    v502_qword_t target = start - oldest < steps ? oldest : start - steps;
+    v502_qword_t cycles = vm->cycles;
+    v502_byte_t* before = v502_begin_recorded_rewind_vm(vm);
+
+    v502_rewind_vm(vm, target);
+
+    v502_end_recorded_rewind_vm(vm, cycles, before);
+    return start - history->position;
+}
+
+v502_EXIT_REASON_E v502_run_back_vm(v502_6502vm_t* vm, v502_qword_t max_steps, v502_exit_info_t* exit_info) {
+    assert(vm != NULL);
+
+    v502_history_t* history = vm->history;
+    v502_EXIT_REASON_E reason = v502_EXIT_REASON_BUDGET;
+    v502_qword_t gone = 0;
+    v502_qword_t start_cycles = vm->cycles;
+    v502_byte_t* before = history != NULL ? v502_begin_recorded_rewind_vm(vm) : NULL;
+
+    while (history != NULL && (max_steps == 0 || gone < max_steps)) {
+        if (history->position == history->undo_start && !v502_refill_history_vm(vm))
+            break;
+
+        v502_undo_step_vm(vm);
+        gone += 1;
+
+        if (vm->debug != NULL && v502_has_breakpoint(vm->debug, vm->program_counter)) {
+            reason = v502_EXIT_REASON_BREAKPOINT;
+            break;
+        }
+    }
+
+    v502_end_recorded_rewind_vm(vm, start_cycles, before);
+
+    if (exit_info != NULL) {
+        exit_info->reason = reason;
+        exit_info->instructions = gone;
+        exit_info->cycles = start_cycles - vm->cycles;
+        exit_info->program_counter = vm->program_counter;
+        exit_info->opcode = vm->hunk[vm->program_counter];
+        exit_info->watch_address = 0;
+    }
+
+    return reason;
+}
+
+int v502_last_write_vm(const v502_6502vm_t* vm, v502_word_t address, v502_history_write_t* write) {
+    assert(vm != NULL && write != NULL);
+
+    const v502_history_t* history = vm->history;
+
+    if (history == NULL)
+        return 0;
+
+    v502_qword_t w = history->write_position;
+
+    for (v502_qword_t s = history->position; s > history->undo_start; s--) {
+        const v502_history_step_t* step = &history->steps[(s - 1) % history->step_capacity];
+
+        for (uint32_t n = 0; n < step->writes; n++) {
+            const v502_history_undo_t* undo = &history->writes[--w % history->write_capacity];
+
+            if (undo->where != address)
+                continue;
+
+            write->step = s - 1;
+            write->program_counter = step->program_counter;
+            write->old_value = undo->old_value;
+            write->new_value = vm->hunk[address];
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef V502_6502_HISTORY_H
+#define V502_6502_HISTORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+#include <stdint.h>
+
+//
+// Reverse execution
+//
+// While history is on, every step the VM takes (an instruction, or taking an interrupt) goes into an undo log
+// A step keeps the registers it started from and the old value of every byte of RAM it wrote, going back one pops it off again
+// That costs about as much as the step did and never runs anything, so whatever the program read from devices doesn't matter
+//
+// The undo log only holds the most recent steps, the oldest are dropped to stay within the memory budget
+// To reach further back there's a checkpoint every interval steps, with the registers and what each page held before its first write after it
+// Going back past the undo log restores the newest checkpoint before the target and runs forward from there, refilling the undo log on the way
+// Interrupts are taken again where they were the first time, but devices are read again, so a program that depends on them can take a different path
+//
+// Going back throws away what was undone, running forward again executes it again
+// Device writes and changes made by the host aren't undone, v502_reset_vm() starts the history over
+// Runs with history always take the opfunc table engine and never skip idle loops, batches have no history
+//
+// Go back between runs, not while the VM is running on another thread
+//
+
+// Used when v502_begin_history_vm() is given 0
+#define v502_HISTORY_DEFAULT_BUDGET ((v502_qword_t)64 << 20)
+#define v502_HISTORY_DEFAULT_INTERVAL ((v502_qword_t)1 << 18)
+
+typedef struct v502_history_info {
+    v502_qword_t position; // Steps taken since history was turned on or the VM was reset, minus the ones gone back
+    v502_qword_t undo_start; // The oldest step the undo log still holds, going back this far doesn't run anything
+    v502_qword_t oldest; // The oldest step that can be gone back to at all
+    v502_qword_t checkpoints;
+    v502_qword_t used; // Bytes of the budget in use, the undo log takes its share up front
+    v502_qword_t budget;
+} v502_history_info_t;
+
+typedef struct v502_history_write {
+    v502_qword_t step; // The step that wrote, counted like v502_history_info_t::position
+    v502_word_t program_counter; // Where that step started
+    v502_byte_t old_value;
+    v502_byte_t new_value;
+} v502_history_write_t;
+
+// Turns history on, budget is how many bytes it may use and interval how many steps lie between checkpoints, 0 picks the defaults above
+// Returns 0 if history is already on or the budget is too small to hold anything
+int v502_begin_history_vm(v502_6502vm_t* vm, v502_qword_t budget, v502_qword_t interval);
+
+// Drops all of it, v502_free_vm() does this too
+void v502_end_history_vm(v502_6502vm_t* vm);
+
+// Returns 0 while history is off
+int v502_get_history_vm(const v502_6502vm_t* vm, v502_history_info_t* info);
+
+// Goes back steps steps, or as far as the history reaches, and returns how many that was
+v502_qword_t v502_step_back_vm(v502_6502vm_t* vm, v502_qword_t steps);
+
+// Goes back until the VM sits right before an instruction with a breakpoint (v502_EXIT_REASON_BREAKPOINT)
+// Otherwise stops after max_steps steps (0 removes the limit) or once the history runs out, both return v502_EXIT_REASON_BUDGET
+// Like running forwards it never stops where it starts, exit_info->instructions counts the steps gone back
+v502_EXIT_REASON_E v502_run_back_vm(v502_6502vm_t* vm, v502_qword_t max_steps, v502_exit_info_t* exit_info);
+
+// Finds the newest step in the undo log that wrote address, returns 0 if none did
+// Doesn't look past the undo log, that would mean running the program again
+int v502_last_write_vm(const v502_6502vm_t* vm, v502_word_t address, v502_history_write_t* write);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
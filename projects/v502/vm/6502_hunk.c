@@ -0,0 +1,215 @@
+// memfd_create() is a GNU extension
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "6502_hunk.h"
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//
+// Shared memory objects
+//
+// Views stay valid after the object itself is closed, so whoever created it can go away while others keep theirs
+// Anonymous objects only exist on Linux (memfd) and Windows, elsewhere creating one fails and callers fall back to the heap
+//
+
+#if defined(_WIN32)
+intptr_t v502_create_backing(const char* name, v502_dword_t length) {
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, length, name);
+
+    if (mapping == NULL)
+        return -1;
+
+    // Someone still has a mapping under that name open, sharing it would have both VMs write the same memory
+    if (name != NULL && GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return -1;
+    }
+
+    return (intptr_t)mapping;
+}
+
+static intptr_t v502_open_backing(const char* name) {
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    return mapping == NULL ? -1 : (intptr_t)mapping;
+}
+
+void v502_close_backing(intptr_t backing) {
+    CloseHandle((HANDLE)backing);
+}
+
+v502_byte_t* v502_map_backing(intptr_t backing, v502_dword_t length, int private_copy) {
+    return MapViewOfFile((HANDLE)backing, private_copy ? FILE_MAP_COPY : FILE_MAP_ALL_ACCESS, 0, 0, length);
+}
+
+static const v502_byte_t* v502_map_backing_read_only(intptr_t backing, v502_dword_t length) {
+    return MapViewOfFile((HANDLE)backing, FILE_MAP_READ, 0, 0, length);
+}
+
+void v502_unmap_backing(const v502_byte_t* view, v502_dword_t length) {
+    UnmapViewOfFile(view);
+}
+
+// Named mappings disappear along with their last handle, there's nothing to unlink
+static void v502_unlink_backing(const char* name) {
+}
+#else
+intptr_t v502_create_backing(const char* name, v502_dword_t length) {
+    int fd = -1;
+
+    // Fails if the name is taken, like Windows does, a running VM keeps its object and stale ones have to be removed with v502_remove_hunk()
+    if (name != NULL)
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+#if defined(__linux__)
+    else
+        fd = memfd_create("v502_snapshot", MFD_CLOEXEC);
+#endif
+
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, length) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static intptr_t v502_open_backing(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    return fd < 0 ? -1 : fd;
+}
+
+void v502_close_backing(intptr_t backing) {
+    close((int)backing);
+}
+
+v502_byte_t* v502_map_backing(intptr_t backing, v502_dword_t length, int private_copy) {
+    void* view = mmap(NULL, length, PROT_READ | PROT_WRITE, private_copy ? MAP_PRIVATE : MAP_SHARED, (int)backing, 0);
+    return view == MAP_FAILED ? NULL : view;
+}
+
+static const v502_byte_t* v502_map_backing_read_only(intptr_t backing, v502_dword_t length) {
+    void* view = mmap(NULL, length, PROT_READ, MAP_SHARED, (int)backing, 0);
+    return view == MAP_FAILED ? NULL : view;
+}
+
+void v502_unmap_backing(const v502_byte_t* view, v502_dword_t length) {
+    munmap((void*)view, length);
+}
+
+static void v502_unlink_backing(const char* name) {
+    shm_unlink(name);
+}
+#endif
+
+//
+// VM memory
+//
+int v502_alloc_hunk_vm(v502_6502vm_t* vm, const v502_6502vm_createinfo_t* p_createinfo) {
+    vm->hunk_backing = p_createinfo->hunk_backing;
+    vm->hunk_object = -1;
+
+    switch (vm->hunk_backing) {
+        case v502_HUNK_BACKING_HEAP:
+            vm->hunk = calloc(1, vm->hunk_length);
+            return 1;
+
+        case v502_HUNK_BACKING_SHARED:
+            assert(p_createinfo->hunk_name != NULL && vm->hunk_length != 0);
+
+            vm->hunk_object = v502_create_backing(p_createinfo->hunk_name, vm->hunk_length);
+
+            if (vm->hunk_object == -1)
+                return 0;
+
+            vm->hunk = v502_map_backing(vm->hunk_object, vm->hunk_length, 0);
+
+            if (vm->hunk == NULL) {
+                v502_close_backing(vm->hunk_object);
+                v502_unlink_backing(p_createinfo->hunk_name);
+                return 0;
+            }
+
+            vm->hunk_name = malloc(strlen(p_createinfo->hunk_name) + 1);
+            strcpy(vm->hunk_name, p_createinfo->hunk_name);
+            return 1;
+
+        case v502_HUNK_BACKING_EXTERNAL:
+            assert(p_createinfo->hunk != NULL);
+
+            vm->hunk = p_createinfo->hunk;
+            return 1;
+
+        default:
+            // Forks are only made by v502_fork_vm()
+            assert(0 && "Unsupported hunk backing!");
+            return 0;
+    }
+}
+
+void v502_release_hunk_vm(v502_6502vm_t* vm) {
+    switch (vm->hunk_backing) {
+        case v502_HUNK_BACKING_HEAP:
+            free(vm->hunk);
+            break;
+
+        case v502_HUNK_BACKING_SHARED:
+            v502_unmap_backing(vm->hunk, vm->hunk_length);
+            v502_close_backing(vm->hunk_object);
+
+            // Observers that are still attached keep their view, new ones won't find it anymore
+            v502_unlink_backing(vm->hunk_name);
+            free(vm->hunk_name);
+            break;
+
+        case v502_HUNK_BACKING_FORK:
+            v502_unmap_backing(vm->hunk, vm->hunk_length);
+            break;
+
+        case v502_HUNK_BACKING_EXTERNAL:
+            break;
+    }
+
+    vm->hunk = NULL;
+}
+
+//
+// Observers
+//
+const v502_byte_t* v502_attach_hunk(const char* name, v502_dword_t length) {
+    assert(name != NULL && length != 0);
+
+    intptr_t backing = v502_open_backing(name);
+
+    if (backing == -1)
+        return NULL;
+
+    const v502_byte_t* view = v502_map_backing_read_only(backing, length);
+    v502_close_backing(backing);
+
+    return view;
+}
+
+void v502_detach_hunk(const v502_byte_t* hunk, v502_dword_t length) {
+    if (hunk != NULL)
+        v502_unmap_backing(hunk, length);
+}
+
+void v502_remove_hunk(const char* name) {
+    assert(name != NULL);
+    v502_unlink_backing(name);
+}
@@ -0,0 +1,35 @@
+#ifndef V502_6502_HUNK_H
+#define V502_6502_HUNK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+//
+// Observing shared VM memory
+//
+// A VM created with v502_HUNK_BACKING_SHARED keeps its hunk in a named shared memory object
+// Other processes can map that object read only and watch the guest's memory without copies or IPC
+// Names follow the platform's rules, on POSIX they start with a slash ("/v502_guest"), on Windows they're file mapping names
+// Only RAM pages live in the hunk, what devices return never shows up there
+//
+
+// Maps the hunk of a VM created under that name, returns NULL if there's no such VM running
+const v502_byte_t* v502_attach_hunk(const char* name, v502_dword_t length);
+
+// The view stays valid after the VM that owns it is freed, until it's detached
+void v502_detach_hunk(const v502_byte_t* hunk, v502_dword_t length);
+
+// Removes the object under that name so a new VM can be created with it, for objects left behind by processes that died before freeing their VM
+// Don't call it while a VM is still running under that name, observers attaching later would no longer find it
+// Does nothing on Windows, named mappings go away along with the last process that had them open
+void v502_remove_hunk(const char* name);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,234 @@
+#include "6502_ops_impl.h"
+#include "../misc/threads.h"
+
+#include <assert.h>
+#include <string.h>
+
+//
+// Idle loops
+//
+// A loop is idle when one trip around it writes nothing, reads nothing but RAM and comes back with every register and flag as it started
+// Nothing it reads can change either, so every following trip is the same and the VM is stuck in it until an interrupt comes in
+// Instead of working that out from the code, one trip is run on a scratch copy of the VM and the two are compared
+//
+// Skipping trips only moves the cycle counter and the instruction count, the result is exactly what running them would have given
+//
+
+// Trips longer than this aren't considered, real wait loops are a handful of instructions
+#define v502_IDLE_MAX_INSTRUCTIONS 8
+
+// Every check in a row that finds nothing doubles the wait until the next one, up to v502_IDLE_CHECK_INTERVAL << this
+#define v502_IDLE_MAX_BACKOFF 6
+
+// Opcodes that can't write memory or touch the stack, the rest (stores, pushes, pulls, calls and returns) end the search
+#define v502_IDLE_SAFE_ADC 1
+#define v502_IDLE_SAFE_BCC 1
+#define v502_IDLE_SAFE_BCS 1
+#define v502_IDLE_SAFE_BEQ 1
+#define v502_IDLE_SAFE_BMI 1
+#define v502_IDLE_SAFE_BNE 1
+#define v502_IDLE_SAFE_BPL 1
+#define v502_IDLE_SAFE_BVC 1
+#define v502_IDLE_SAFE_BVS 1
+#define v502_IDLE_SAFE_CLI 1
+#define v502_IDLE_SAFE_CMP 1
+#define v502_IDLE_SAFE_CPX 1
+#define v502_IDLE_SAFE_DEX 1
+#define v502_IDLE_SAFE_DEY 1
+#define v502_IDLE_SAFE_INX 1
+#define v502_IDLE_SAFE_INY 1
+#define v502_IDLE_SAFE_JMP 1
+#define v502_IDLE_SAFE_JSR 0
+#define v502_IDLE_SAFE_LDA 1
+#define v502_IDLE_SAFE_LDX 1
+#define v502_IDLE_SAFE_LDY 1
+#define v502_IDLE_SAFE_NOP 1
+#define v502_IDLE_SAFE_PHA 0
+#define v502_IDLE_SAFE_PHP 0
+#define v502_IDLE_SAFE_PLA 0
+#define v502_IDLE_SAFE_PLP 0
+#define v502_IDLE_SAFE_RTI 0
+#define v502_IDLE_SAFE_RTS 0
+#define v502_IDLE_SAFE_SBC 1
+#define v502_IDLE_SAFE_SEI 1
+#define v502_IDLE_SAFE_STA 0
+#define v502_IDLE_SAFE_TAX 1
+#define v502_IDLE_SAFE_TAY 1
+#define v502_IDLE_SAFE_TSX 1
+#define v502_IDLE_SAFE_TXA 1
+#define v502_IDLE_SAFE_TXS 1
+#define v502_IDLE_SAFE_TYA 1
+
+// The stock opfunc of every safe opcode, overridden opfuncs could do anything so they end the search too
+#define v502_IDLE_OP(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = v502_IDLE_SAFE_##MNEMONIC ? OP_##NAME : NULL,
+static const v502_opfunc_t v502_IDLE_OPS[256] = {
+    v502_MOS_OP_LIST(v502_IDLE_OP)
+};
+#undef v502_IDLE_OP
+
+#define v502_IDLE_LENGTH(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = v502_MODE_LENGTH_##MODE,
+static const v502_byte_t v502_IDLE_LENGTHS[256] = {
+    v502_MOS_OP_LIST(v502_IDLE_LENGTH)
+};
+#undef v502_IDLE_LENGTH
+
+// Follows the code for a way back to the start, so most code is turned down without copying the VM
+// Branches are read past as if they weren't taken unless they go straight back, whether they are is left to the trip
+static int v502_idle_prescan(const v502_6502vm_t* vm) {
+    v502_word_t start = vm->program_counter;
+    v502_word_t pc = start;
+
+    for (uint32_t count = 0; count < v502_IDLE_MAX_INSTRUCTIONS; count++) {
+        v502_byte_t op = vm->hunk[pc];
+
+        if (v502_IDLE_OPS[op] == NULL || vm->opfuncs[op] != v502_IDLE_OPS[op])
+            return 0;
+
+        switch (op) {
+            case v502_MOS_OP_JMP_ABS:
+                pc = v502_make_word(vm->hunk[(v502_word_t)(pc + 2)], vm->hunk[(v502_word_t)(pc + 1)]);
+
+                if (pc == start)
+                    return 1;
+
+                continue;
+
+            // Where it goes depends on memory, only the trip can tell
+            case v502_MOS_OP_JMP_IND:
+                return 1;
+
+            case v502_MOS_OP_BPL:
+            case v502_MOS_OP_BMI:
+            case v502_MOS_OP_BVC:
+            case v502_MOS_OP_BVS:
+            case v502_MOS_OP_BCC:
+            case v502_MOS_OP_BCS:
+            case v502_MOS_OP_BNE:
+            case v502_MOS_OP_BEQ:
+                // Relative to the offset byte, like v502_DEFINE_BRANCH()
+                if ((v502_word_t)(pc + 1 + (int8_t)vm->hunk[(v502_word_t)(pc + 1)]) == start)
+                    return 1;
+
+                break;
+
+            default:
+                break;
+        }
+
+        pc += v502_IDLE_LENGTHS[op];
+
+        if (pc == start)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Mapped over every device page of the scratch copy, a device could return something different next time so touching one isn't idle
+static v502_byte_t v502_idle_tripwire_read(void* user, v502_6502vm_t* vm, v502_word_t where) {
+    *(int*)user = 1;
+    return 0xFF;
+}
+
+static void v502_idle_tripwire_write(void* user, v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    *(int*)user = 1;
+}
+
+uint32_t v502_find_idle_loop_vm(v502_6502vm_t* vm, v502_qword_t* cycles) {
+    assert(vm != NULL && cycles != NULL);
+
+    // Traced, debugged, profiled and history runs have to see every instruction
+    if (vm->trace != NULL || vm->debug != NULL || vm->profile != NULL || vm->history != NULL)
+        return 0;
+
+    if (!v502_idle_prescan(vm))
+        return 0;
+
+    int tripped = 0;
+    v502_bus_device_t tripwire = { v502_idle_tripwire_read, v502_idle_tripwire_write, &tripped };
+
+    v502_6502vm_t copy;
+    memcpy(&copy, vm, sizeof(copy));
+
+    // The trip never happened as far as a recording is concerned
+    copy.recording = NULL;
+
+    for (uint32_t p = 0; p < v502_BUS_PAGES; p++)
+        if (copy.devices[p] != NULL)
+            copy.devices[p] = &tripwire;
+
+    for (uint32_t count = 1; count <= v502_IDLE_MAX_INSTRUCTIONS; count++) {
+        v502_byte_t op = copy.hunk[copy.program_counter];
+
+        if (v502_IDLE_OPS[op] == NULL || vm->opfuncs[op] != v502_IDLE_OPS[op])
+            return 0;
+
+        v502_OP_STATE_E state = copy.opfuncs[op](&copy, op);
+
+        if (state == V502_OP_STATE_SUCCESS)
+            copy.program_counter += 1;
+        else if (state != V502_OP_STATE_SUCCESS_NO_COUNT)
+            return 0;
+
+        if (tripped)
+            return 0;
+
+        if (copy.program_counter != vm->program_counter)
+            continue;
+
+        // Back where it started, it's only idle if nothing changed on the way around
+        if (copy.accumulator != vm->accumulator || copy.index_x != vm->index_x || copy.index_y != vm->index_y
+            || copy.stack_ptr != vm->stack_ptr || v502_pack_flags_vm(&copy) != v502_pack_flags_vm(vm))
+            return 0;
+
+        *cycles = copy.cycles - vm->cycles;
+        return count;
+    }
+
+    return 0;
+}
+
+v502_qword_t v502_fast_forward_vm(v502_6502vm_t* vm, uint32_t instructions, v502_qword_t cycles, v502_qword_t instructions_left, v502_qword_t cycle_limit) {
+    uint32_t lines = v502_atomic_load_u32(&vm->interrupt_lines);
+
+    // An interrupt that can be taken ends the loop, the engine takes it at its next poll
+    if ((lines & v502_INTERRUPT_LINE_NMI) || ((lines & v502_INTERRUPT_LINE_IRQ) && !(vm->flags & v502_STATE_FLAG_INTERRUPT)))
+        return 0;
+
+    int cycle_bound = cycle_limit != UINT64_MAX && cycles != 0;
+
+    // Only an interrupt gets the VM out, so with no budget to skip to there's nothing to do but wait for one
+    if (instructions_left == UINT64_MAX && !cycle_bound) {
+        v502_thread_sleep_ms(1);
+        return 0;
+    }
+
+    v502_qword_t trips = instructions_left == UINT64_MAX ? UINT64_MAX : instructions_left / instructions;
+
+    // Whole trips only, the engine runs the rest of the last one so the run ends exactly where it would have
+    if (cycle_bound) {
+        v502_qword_t room = vm->cycles < cycle_limit ? (cycle_limit - vm->cycles) / cycles : 0;
+
+        if (room < trips)
+            trips = room;
+    }
+
+    vm->cycles += trips * cycles;
+    return trips * instructions;
+}
+
+v502_qword_t v502_skip_idle_vm(v502_6502vm_t* vm, v502_qword_t instructions_left, v502_qword_t cycle_limit) {
+    v502_qword_t cycles;
+    uint32_t instructions = v502_find_idle_loop_vm(vm, &cycles);
+
+    // Busy loops that look idle from their code (delay loops counting down) would otherwise get a trip run on the side every time
+    if (instructions == 0) {
+        if (vm->idle_backoff < v502_IDLE_MAX_BACKOFF)
+            vm->idle_backoff += 1;
+
+        return 0;
+    }
+
+    vm->idle_backoff = 0;
+    return v502_fast_forward_vm(vm, instructions, cycles, instructions_left, cycle_limit);
+}
@@ -0,0 +1,878 @@
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// JIT engine
+//
+// Addresses are interpreted until they've been reached v502_JIT_HOT_THRESHOLD times, then the basic block starting there is translated to x86-64
+// Guest registers stay inside the VM struct, translated code works on them directly through rbx
+//  - Register only instructions and branches are emitted natively, so are ADC, CMP and CPX with an immediate operand
+//  - Flags stay lazy (see v502_6502vm_t), native code writes and tests the same result fields the interpreter does
+//  - Everything else calls its stock opfunc, so memory behavior is shared with the interpreter
+//  - Instructions with overridden or unknown opfuncs end the block and get interpreted
+//
+// Blocks check and take their instruction count from the budget on entry, so budgets stay exact
+// Cycle budgets are turned into an instruction budget no instruction could overrun (v502_MAX_OP_CYCLES each), the tail is interpreted
+// Exits to a known address are patchable jumps, once the target is translated the exit jumps straight into it (block chaining)
+// A store into translated guest code sets flush_pending, the block leaves right after that instruction and the whole cache is dropped
+// The code buffer is never writable and executable at once, it's flipped to read / write only while a block is emitted or an exit linked
+//
+
+#ifdef V502_HAS_JIT_ENGINE
+
+#include <sys/mman.h>
+
+#define v502_JIT_BUFFER_SIZE (4 * 1024 * 1024)
+#define v502_JIT_BLOCK_HEADROOM (16 * 1024) // Comfortably above the worst case block
+#define v502_JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define v502_JIT_MAX_SIDE_EXITS (v502_JIT_MAX_BLOCK_INSTRUCTIONS + 3)
+#define v502_JIT_HOT_THRESHOLD 16
+#define v502_JIT_MAX_RECOMPILES 8 // Code that keeps rewriting itself stays interpreted after this
+#define v502_JIT_HEAT_NEVER 0xFFFF
+
+typedef void*(*v502_jit_enter_t)(v502_6502vm_t*, struct v502_jit*, void*);
+
+typedef struct v502_jit {
+    int64_t budget; // Must stay first, translated code addresses it as [r12]
+    v502_byte_t flush_pending;
+
+    v502_byte_t* buffer; // NULL if we couldn't get executable memory, the engine then falls back to the predecoded one
+    size_t used;
+    size_t stubs_end;
+
+    v502_jit_enter_t enter;
+    v502_byte_t* exit_stub;
+    size_t interrupt_check_length; // Every block starts with the same interrupt check, the dispatcher polls itself and enters past it
+
+    v502_byte_t* blocks[0x10000];
+    v502_byte_t block_instructions[0x10000];
+    uint16_t heat[0x10000];
+    v502_byte_t recompiles[0x10000];
+    v502_byte_t code_map[0x10000 / 8]; // Guest bytes that translated code depends on
+
+    v502_word_t compiled[0x10000];
+    uint32_t compiled_count;
+} v502_jit_t;
+
+// The stock opfunc of every opcode we know, translated code only handles opcodes still using these
+static const v502_opfunc_t v502_jit_stock_ops[256] = {
+#define v502_JIT_STOCK_OP(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = OP_##NAME,
+    v502_MOS_OP_LIST(v502_JIT_STOCK_OP)
+#undef v502_JIT_STOCK_OP
+};
+
+static const v502_byte_t v502_jit_op_lengths[256] = {
+#define v502_JIT_OP_LENGTH(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = v502_MODE_LENGTH_##MODE,
+    v502_MOS_OP_LIST(v502_JIT_OP_LENGTH)
+#undef v502_JIT_OP_LENGTH
+};
+
+//
+// x86-64 emitter
+//
+typedef struct v502_jit_emitter {
+    v502_byte_t* code;
+    size_t at;
+} v502_jit_emitter_t;
+
+// Registers we use by their encoding
+#define X86_EAX 0
+#define X86_ECX 1
+
+// Condition codes for Jcc
+#define X86_CC_E 0x4
+#define X86_CC_NE 0x5
+#define X86_CC_L 0xC
+
+static void v502_jit_emit8(v502_jit_emitter_t* e, v502_byte_t b) {
+    e->code[e->at++] = b;
+}
+
+static void v502_jit_emit16(v502_jit_emitter_t* e, uint16_t w) {
+    memcpy(e->code + e->at, &w, 2);
+    e->at += 2;
+}
+
+static void v502_jit_emit32(v502_jit_emitter_t* e, uint32_t d) {
+    memcpy(e->code + e->at, &d, 4);
+    e->at += 4;
+}
+
+static void v502_jit_emit64(v502_jit_emitter_t* e, uint64_t q) {
+    memcpy(e->code + e->at, &q, 8);
+    e->at += 8;
+}
+
+static void v502_jit_patch_rel32(v502_byte_t* code, size_t rel_at, size_t target) {
+    int32_t rel = (int32_t)((int64_t)target - (int64_t)(rel_at + 4));
+    memcpy(code + rel_at, &rel, 4);
+}
+
+// ModRM + disp32 addressing [rbx + disp], rbx always holds the VM
+static void v502_jit_emit_vm_operand(v502_jit_emitter_t* e, v502_byte_t reg, size_t field) {
+    v502_jit_emit8(e, 0x80 | (reg << 3) | 3);
+    v502_jit_emit32(e, (uint32_t)field);
+}
+
+// movzx reg, byte [rbx + field]
+static void v502_jit_emit_load_field(v502_jit_emitter_t* e, v502_byte_t reg, size_t field) {
+    v502_jit_emit8(e, 0x0F);
+    v502_jit_emit8(e, 0xB6);
+    v502_jit_emit_vm_operand(e, reg, field);
+}
+
+// mov byte [rbx + field], reg8
+static void v502_jit_emit_store_field(v502_jit_emitter_t* e, v502_byte_t reg, size_t field) {
+    v502_jit_emit8(e, 0x88);
+    v502_jit_emit_vm_operand(e, reg, field);
+}
+
+// mov byte [rbx + field], imm8
+static void v502_jit_emit_store_field_imm(v502_jit_emitter_t* e, size_t field, v502_byte_t value) {
+    v502_jit_emit8(e, 0xC6);
+    v502_jit_emit_vm_operand(e, 0, field);
+    v502_jit_emit8(e, value);
+}
+
+// mov word [rbx + field], reg16
+static void v502_jit_emit_store_field16(v502_jit_emitter_t* e, v502_byte_t reg, size_t field) {
+    v502_jit_emit8(e, 0x66);
+    v502_jit_emit8(e, 0x89);
+    v502_jit_emit_vm_operand(e, reg, field);
+}
+
+// test byte [rbx + field], imm8
+static void v502_jit_emit_test_field(v502_jit_emitter_t* e, size_t field, v502_byte_t mask) {
+    v502_jit_emit8(e, 0xF6);
+    v502_jit_emit_vm_operand(e, 0, field);
+    v502_jit_emit8(e, mask);
+}
+
+// add / sub byte [rbx + field], 1
+static void v502_jit_emit_step_field(v502_jit_emitter_t* e, size_t field, int down) {
+    v502_jit_emit8(e, 0x80);
+    v502_jit_emit_vm_operand(e, down ? 5 : 0, field);
+    v502_jit_emit8(e, 1);
+}
+
+// mov word [rbx + program_counter], imm16
+static void v502_jit_emit_set_pc(v502_jit_emitter_t* e, v502_word_t pc) {
+    v502_jit_emit8(e, 0x66);
+    v502_jit_emit8(e, 0xC7);
+    v502_jit_emit_vm_operand(e, 0, offsetof(v502_6502vm_t, program_counter));
+    v502_jit_emit16(e, pc);
+}
+
+// add qword [rbx + cycles], imm8
+static void v502_jit_emit_add_cycles(v502_jit_emitter_t* e, v502_byte_t cycles) {
+    if (cycles == 0)
+        return;
+
+    v502_jit_emit8(e, 0x48);
+    v502_jit_emit8(e, 0x83);
+    v502_jit_emit_vm_operand(e, 0, offsetof(v502_6502vm_t, cycles));
+    v502_jit_emit8(e, cycles);
+}
+
+// add word [rbx + program_counter], 1
+static void v502_jit_emit_step_pc(v502_jit_emitter_t* e) {
+    v502_jit_emit8(e, 0x66);
+    v502_jit_emit8(e, 0x83);
+    v502_jit_emit_vm_operand(e, 0, offsetof(v502_6502vm_t, program_counter));
+    v502_jit_emit8(e, 1);
+}
+
+// jmp rel32, returns where the rel32 lives
+static size_t v502_jit_emit_jmp(v502_jit_emitter_t* e) {
+    v502_jit_emit8(e, 0xE9);
+    v502_jit_emit32(e, 0);
+    return e->at - 4;
+}
+
+// jcc rel32, returns where the rel32 lives
+static size_t v502_jit_emit_jcc(v502_jit_emitter_t* e, v502_byte_t cc) {
+    v502_jit_emit8(e, 0x0F);
+    v502_jit_emit8(e, 0x80 | cc);
+    v502_jit_emit32(e, 0);
+    return e->at - 4;
+}
+
+// Leave translated code, rax tells the dispatcher which exit to chain (0 for none)
+static void v502_jit_emit_leave(v502_jit_emitter_t* e, v502_jit_t* jit) {
+    v502_jit_emit8(e, 0xE9);
+    v502_jit_emit32(e, 0);
+    v502_jit_patch_rel32(e->code, e->at - 4, jit->exit_stub - e->code);
+}
+
+static void v502_jit_emit_leave_unchained(v502_jit_emitter_t* e, v502_jit_t* jit) {
+    v502_jit_emit8(e, 0x31); // xor eax, eax
+    v502_jit_emit8(e, 0xC0);
+    v502_jit_emit_leave(e, jit);
+}
+
+// Calls the opfunc for the instruction at pc, just like the interpreter would
+static void v502_jit_emit_call_opfunc(v502_jit_emitter_t* e, v502_word_t pc, v502_byte_t op, v502_opfunc_t func) {
+    v502_jit_emit_set_pc(e, pc);
+
+    v502_jit_emit8(e, 0x48); // mov rdi, rbx
+    v502_jit_emit8(e, 0x89);
+    v502_jit_emit8(e, 0xDF);
+
+    v502_jit_emit8(e, 0xBE); // mov esi, op
+    v502_jit_emit32(e, op);
+
+    v502_jit_emit8(e, 0x48); // mov rax, func
+    v502_jit_emit8(e, 0xB8);
+    v502_jit_emit64(e, (uint64_t)(uintptr_t)func);
+
+    v502_jit_emit8(e, 0xFF); // call rax
+    v502_jit_emit8(e, 0xD0);
+}
+
+// cmp byte [r12 + flush_pending], 0 then jne, returns where the rel32 lives
+static size_t v502_jit_emit_flush_check(v502_jit_emitter_t* e) {
+    v502_jit_emit8(e, 0x41);
+    v502_jit_emit8(e, 0x80);
+    v502_jit_emit8(e, 0x7C);
+    v502_jit_emit8(e, 0x24);
+    v502_jit_emit8(e, (v502_byte_t)offsetof(v502_jit_t, flush_pending));
+    v502_jit_emit8(e, 0x00);
+
+    return v502_jit_emit_jcc(e, X86_CC_NE);
+}
+
+// qword [r12] op imm32, op is the ModRM reg field (0 = add, 5 = sub, 7 = cmp)
+static void v502_jit_emit_budget_op(v502_jit_emitter_t* e, v502_byte_t op, uint32_t value) {
+    v502_jit_emit8(e, 0x49);
+    v502_jit_emit8(e, 0x81);
+    v502_jit_emit8(e, (op << 3) | 4);
+    v502_jit_emit8(e, 0x24);
+    v502_jit_emit32(e, value);
+}
+
+// An exit to a known guest address, starts as a jump to the next instruction so it can be patched into a jump to the target's block
+static void v502_jit_emit_exit(v502_jit_emitter_t* e, v502_jit_t* jit, v502_word_t target) {
+    size_t site = e->at;
+    size_t rel_at = v502_jit_emit_jmp(e);
+
+    if (jit->blocks[target] != NULL)
+        v502_jit_patch_rel32(e->code, rel_at, jit->blocks[target] - e->code);
+    else
+        v502_jit_patch_rel32(e->code, rel_at, e->at);
+
+    v502_jit_emit_set_pc(e, target);
+
+    v502_jit_emit8(e, 0x48); // lea rax, [rip - back to site]
+    v502_jit_emit8(e, 0x8D);
+    v502_jit_emit8(e, 0x05);
+    v502_jit_emit32(e, (uint32_t)(int32_t)((int64_t)site - (int64_t)(e->at + 4)));
+
+    v502_jit_emit_leave(e, jit);
+}
+
+//
+// Blocks
+//
+typedef enum v502_JIT_SIDE_EXIT {
+    v502_JIT_SIDE_EXIT_BAIL, // Not enough budget to run the block, nothing happened
+    v502_JIT_SIDE_EXIT_FLUSH, // A store hit translated code, resume at the next instruction
+    v502_JIT_SIDE_EXIT_DYNAMIC // The program counter was already set by the instruction
+} v502_JIT_SIDE_EXIT_E;
+
+typedef struct v502_jit_side_exit {
+    v502_JIT_SIDE_EXIT_E type;
+    size_t rel_at;
+    v502_word_t resume;
+    uint32_t executed; // Instructions done once this exit is taken, the rest is refunded
+} v502_jit_side_exit_t;
+
+static void v502_jit_mark_code(v502_jit_t* jit, v502_word_t where) {
+    jit->code_map[where >> 3] |= 1 << (where & 7);
+}
+
+// Called instead of the native ADC # while D is set, the operand comes in where opfuncs get the opcode
+// Cycles are still charged by the block, so this only does the add
+static v502_OP_STATE_E v502_jit_decimal_adc(v502_6502vm_t* vm, v502_byte_t operand) {
+    v502_add_flags_vm(vm, operand);
+    return V502_OP_STATE_SUCCESS;
+}
+
+// Brackets every write into the buffer, nothing may enter translated code in between
+static int v502_jit_begin_write(v502_jit_t* jit) {
+    return mprotect(jit->buffer, v502_JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE) == 0;
+}
+
+// Returns 0 if the buffer couldn't be made executable again, everything in it is dropped then and runs interpreted until the next flush
+static int v502_jit_end_write(v502_jit_t* jit) {
+    if (mprotect(jit->buffer, v502_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) == 0)
+        return 1;
+
+    jit->flush_pending = 1;
+    return 0;
+}
+
+static v502_byte_t* v502_jit_translate(v502_6502vm_t* vm, v502_jit_t* jit, v502_word_t start) {
+    if (v502_JIT_BUFFER_SIZE - jit->used < v502_JIT_BLOCK_HEADROOM) {
+        jit->flush_pending = 1;
+        return NULL;
+    }
+
+    if (++jit->recompiles[start] > v502_JIT_MAX_RECOMPILES)
+        return NULL;
+
+    v502_jit_emitter_t emitter = { jit->buffer, jit->used };
+    v502_jit_emitter_t* e = &emitter;
+
+    v502_jit_side_exit_t side_exits[v502_JIT_MAX_SIDE_EXITS];
+    uint32_t side_exit_count = 0;
+
+    size_t entry = e->at;
+
+    // Blocks chained to each other never pass through the dispatcher, so each one checks for raised interrupt lines itself
+    // Lines that can't be taken yet (a masked IRQ) make every chained entry bail, until then blocks run one at a time
+    v502_jit_emit8(e, 0x83); // cmp dword [rbx + interrupt_lines], 0
+    v502_jit_emit_vm_operand(e, 7, offsetof(v502_6502vm_t, interrupt_lines));
+    v502_jit_emit8(e, 0);
+
+    side_exits[side_exit_count].type = v502_JIT_SIDE_EXIT_BAIL;
+    side_exits[side_exit_count].resume = start;
+    side_exits[side_exit_count].executed = 0;
+    side_exits[side_exit_count++].rel_at = v502_jit_emit_jcc(e, X86_CC_NE);
+
+    jit->interrupt_check_length = e->at - entry;
+
+    // Budget check, the count is patched in once we know it
+    v502_jit_emit_budget_op(e, 7, 0);
+    size_t cmp_at = e->at - 4;
+
+    side_exits[side_exit_count].type = v502_JIT_SIDE_EXIT_BAIL;
+    side_exits[side_exit_count].resume = start;
+    side_exits[side_exit_count].executed = 0;
+    side_exits[side_exit_count++].rel_at = v502_jit_emit_jcc(e, X86_CC_L);
+
+    v502_jit_emit_budget_op(e, 5, 0);
+    size_t sub_at = e->at - 4;
+
+    v502_word_t pc = start;
+    uint32_t count = 0;
+    int ended = 0;
+
+    // Cycles of natively emitted instructions are summed up and added in one go before anything that could look at them
+    const v502_byte_t* cycle_table = v502_get_cycle_table(vm->feature_set);
+    v502_byte_t pending_cycles = 0;
+
+#define v502_JIT_CHARGE_PENDING() \
+    v502_jit_emit_add_cycles(e, pending_cycles); \
+    pending_cycles = 0
+
+    // Opfuncs charge their own cycles, so the instruction's are taken back out first
+#define v502_JIT_CHARGE_BEFORE_OPFUNC() \
+    pending_cycles -= cycle_table[op]; \
+    v502_JIT_CHARGE_PENDING()
+
+    const size_t A = offsetof(v502_6502vm_t, accumulator);
+    const size_t X = offsetof(v502_6502vm_t, index_x);
+    const size_t Y = offsetof(v502_6502vm_t, index_y);
+    const size_t S = offsetof(v502_6502vm_t, stack_ptr);
+    const size_t CARRY = offsetof(v502_6502vm_t, carry_result);
+    const size_t OVERFLOW = offsetof(v502_6502vm_t, overflow_result);
+    const size_t ZERO = offsetof(v502_6502vm_t, zero_result);
+    const size_t NEGATIVE = offsetof(v502_6502vm_t, negative_result);
+    const size_t FLAGS = offsetof(v502_6502vm_t, flags);
+
+    while (!ended && count < v502_JIT_MAX_BLOCK_INSTRUCTIONS) {
+        v502_byte_t op = vm->hunk[pc];
+        v502_opfunc_t func = v502_jit_stock_ops[op];
+
+        if (func == NULL || vm->opfuncs[op] != func)
+            break;
+
+        // Blocks end right before breakpoints, the dispatcher stops there
+        if (vm->debug != NULL && v502_has_breakpoint(vm->debug, pc))
+            break;
+
+        v502_word_t next = pc + v502_jit_op_lengths[op];
+        v502_byte_t operand = vm->hunk[(v502_word_t)(pc + 1)];
+        v502_word_t operand_word = v502_make_word(vm->hunk[(v502_word_t)(pc + 2)], operand);
+
+        count += 1;
+
+        // The add takes a sign extended imm8, so don't let the sum grow past that
+        if (pending_cycles + cycle_table[op] > 0x7F) {
+            v502_JIT_CHARGE_PENDING();
+        }
+
+        pending_cycles += cycle_table[op];
+
+        switch (op) {
+            case v502_MOS_OP_NOP:
+                break;
+
+            case v502_MOS_OP_INX: v502_jit_emit_step_field(e, X, 0); break;
+            case v502_MOS_OP_DEX: v502_jit_emit_step_field(e, X, 1); break;
+            case v502_MOS_OP_INY: v502_jit_emit_step_field(e, Y, 0); break;
+            case v502_MOS_OP_DEY: v502_jit_emit_step_field(e, Y, 1); break;
+
+            case v502_MOS_OP_TAX: v502_jit_emit_load_field(e, X86_EAX, A); v502_jit_emit_store_field(e, X86_EAX, X); break;
+            case v502_MOS_OP_TXA: v502_jit_emit_load_field(e, X86_EAX, X); v502_jit_emit_store_field(e, X86_EAX, A); break;
+            case v502_MOS_OP_TAY: v502_jit_emit_load_field(e, X86_EAX, A); v502_jit_emit_store_field(e, X86_EAX, Y); break;
+            case v502_MOS_OP_TYA: v502_jit_emit_load_field(e, X86_EAX, Y); v502_jit_emit_store_field(e, X86_EAX, A); break;
+            case v502_MOS_OP_TSX: v502_jit_emit_load_field(e, X86_EAX, S); v502_jit_emit_store_field(e, X86_EAX, X); break;
+            case v502_MOS_OP_TXS: v502_jit_emit_load_field(e, X86_EAX, X); v502_jit_emit_store_field(e, X86_EAX, S); break;
+
+            case v502_MOS_OP_LDA_NOW: v502_jit_emit_store_field_imm(e, A, operand); break;
+            case v502_MOS_OP_LDX_NOW: v502_jit_emit_store_field_imm(e, X, operand); break;
+            case v502_MOS_OP_LDY_NOW: v502_jit_emit_store_field_imm(e, Y, operand); break;
+
+            // Same as v502_add_flags_vm(), the sum goes into both results and the accumulator doesn't take the carry
+            // Decimal mode is rare enough that it just calls out instead
+            case v502_MOS_OP_ADC_NOW: {
+                v502_jit_emit_test_field(e, FLAGS, v502_STATE_FLAG_DECIMAL);
+                size_t binary_at = v502_jit_emit_jcc(e, X86_CC_E);
+
+                v502_jit_emit_call_opfunc(e, pc, operand, v502_jit_decimal_adc);
+                size_t done_at = v502_jit_emit_jmp(e);
+
+                v502_jit_patch_rel32(e->code, binary_at, e->at);
+                v502_jit_emit_load_field(e, X86_EAX, A);
+                v502_jit_emit_load_field(e, X86_ECX, CARRY + 1);
+
+                v502_jit_emit8(e, 0x01); // add ecx, eax
+                v502_jit_emit8(e, 0xC1);
+
+                v502_jit_emit8(e, 0x81); // add ecx, operand
+                v502_jit_emit8(e, 0xC1);
+                v502_jit_emit32(e, operand);
+
+                v502_jit_emit_store_field16(e, X86_ECX, CARRY);
+                v502_jit_emit_store_field16(e, X86_ECX, OVERFLOW);
+
+                v502_jit_emit8(e, 0x04); // add al, operand
+                v502_jit_emit8(e, operand);
+                v502_jit_emit_store_field(e, X86_EAX, A);
+
+                v502_jit_patch_rel32(e->code, done_at, e->at);
+                break;
+            }
+
+            // Same as v502_compare_flags_vm()
+            case v502_MOS_OP_CMP_NOW:
+            case v502_MOS_OP_CPX_NOW:
+                v502_jit_emit_load_field(e, X86_EAX, op == v502_MOS_OP_CMP_NOW ? A : X);
+
+                v502_jit_emit8(e, 0x05); // add eax, 0x100 - operand
+                v502_jit_emit32(e, 0x100 - operand);
+
+                v502_jit_emit_store_field16(e, X86_EAX, CARRY);
+                v502_jit_emit_store_field(e, X86_EAX, ZERO);
+
+                v502_jit_emit8(e, 0x84); // test al, al
+                v502_jit_emit8(e, 0xC0);
+                v502_jit_emit8(e, 0x0F); // setnz cl
+                v502_jit_emit8(e, 0x95);
+                v502_jit_emit8(e, 0xC1);
+                v502_jit_emit8(e, 0xF6); // neg cl
+                v502_jit_emit8(e, 0xD9);
+
+                v502_jit_emit8(e, 0x20); // and byte [rbx + negative_result], cl
+                v502_jit_emit_vm_operand(e, X86_ECX, NEGATIVE);
+                break;
+
+            case v502_MOS_OP_BPL:
+            case v502_MOS_OP_BMI:
+            case v502_MOS_OP_BVC:
+            case v502_MOS_OP_BVS:
+            case v502_MOS_OP_BCC:
+            case v502_MOS_OP_BCS:
+            case v502_MOS_OP_BNE:
+            case v502_MOS_OP_BEQ: {
+                v502_word_t taken = (v502_word_t)(pc + 1) + (int8_t)operand;
+                size_t taken_at;
+
+                v502_JIT_CHARGE_PENDING();
+
+                if (op == v502_MOS_OP_BNE || op == v502_MOS_OP_BEQ) {
+                    // Equality is carry and zero together, (C ^ 1) | zero_result is 0 only when both are set
+                    v502_jit_emit_load_field(e, X86_EAX, CARRY + 1);
+                    v502_jit_emit8(e, 0x83); // xor eax, 1
+                    v502_jit_emit8(e, 0xF0);
+                    v502_jit_emit8(e, 1);
+                    v502_jit_emit8(e, 0x0A); // or al, byte [rbx + zero_result]
+                    v502_jit_emit_vm_operand(e, X86_EAX, ZERO);
+                    taken_at = v502_jit_emit_jcc(e, op == v502_MOS_OP_BEQ ? X86_CC_E : X86_CC_NE);
+                } else {
+                    // The high byte of the carry and overflow results is the flag itself
+                    if (op == v502_MOS_OP_BPL || op == v502_MOS_OP_BMI)
+                        v502_jit_emit_test_field(e, NEGATIVE, v502_STATE_FLAG_NEGATIVE);
+                    else if (op == v502_MOS_OP_BVC || op == v502_MOS_OP_BVS)
+                        v502_jit_emit_test_field(e, OVERFLOW + 1, 1);
+                    else
+                        v502_jit_emit_test_field(e, CARRY + 1, 1);
+
+                    int when_set = op == v502_MOS_OP_BMI || op == v502_MOS_OP_BVS || op == v502_MOS_OP_BCS;
+                    taken_at = v502_jit_emit_jcc(e, when_set ? X86_CC_NE : X86_CC_E);
+                }
+
+                v502_jit_emit_exit(e, jit, next);
+                v502_jit_patch_rel32(e->code, taken_at, e->at);
+                v502_jit_emit_add_cycles(e, v502_branch_cycles(next, taken));
+                v502_jit_emit_exit(e, jit, taken);
+
+                ended = 1;
+                break;
+            }
+
+            case v502_MOS_OP_JMP_ABS:
+                v502_JIT_CHARGE_PENDING();
+                v502_jit_emit_exit(e, jit, operand_word);
+                ended = 1;
+                break;
+
+            case v502_MOS_OP_JSR_ABS:
+                v502_JIT_CHARGE_BEFORE_OPFUNC();
+                v502_jit_emit_call_opfunc(e, pc, op, func);
+
+                side_exits[side_exit_count].type = v502_JIT_SIDE_EXIT_DYNAMIC;
+                side_exits[side_exit_count].executed = count;
+                side_exits[side_exit_count++].rel_at = v502_jit_emit_flush_check(e);
+
+                v502_jit_emit_exit(e, jit, operand_word);
+                ended = 1;
+                break;
+
+            case v502_MOS_OP_RTS:
+                v502_JIT_CHARGE_BEFORE_OPFUNC();
+                v502_jit_emit_call_opfunc(e, pc, op, func);
+                v502_jit_emit_step_pc(e);
+                v502_jit_emit_leave_unchained(e, jit);
+                ended = 1;
+                break;
+
+            case v502_MOS_OP_JMP_IND:
+            case v502_MOS_OP_RTI:
+                v502_JIT_CHARGE_BEFORE_OPFUNC();
+                v502_jit_emit_call_opfunc(e, pc, op, func);
+                v502_jit_emit_leave_unchained(e, jit);
+                ended = 1;
+                break;
+
+            default:
+                // Everything left is straight line code that might touch memory
+                v502_JIT_CHARGE_BEFORE_OPFUNC();
+                v502_jit_emit_call_opfunc(e, pc, op, func);
+
+                side_exits[side_exit_count].type = v502_JIT_SIDE_EXIT_FLUSH;
+                side_exits[side_exit_count].resume = next;
+                side_exits[side_exit_count].executed = count;
+                side_exits[side_exit_count++].rel_at = v502_jit_emit_flush_check(e);
+                break;
+        }
+
+        for (v502_word_t b = pc; b != next; b++)
+            v502_jit_mark_code(jit, b);
+
+        pc = next;
+    }
+
+    if (count == 0)
+        return NULL;
+
+    if (!ended) {
+        v502_JIT_CHARGE_PENDING();
+        v502_jit_emit_exit(e, jit, pc);
+    }
+
+#undef v502_JIT_CHARGE_BEFORE_OPFUNC
+#undef v502_JIT_CHARGE_PENDING
+
+    memcpy(e->code + cmp_at, &count, 4);
+    memcpy(e->code + sub_at, &count, 4);
+
+    for (uint32_t s = 0; s < side_exit_count; s++) {
+        v502_jit_side_exit_t* side_exit = &side_exits[s];
+
+        v502_jit_patch_rel32(e->code, side_exit->rel_at, e->at);
+
+        if (side_exit->type == v502_JIT_SIDE_EXIT_DYNAMIC) {
+            v502_jit_emit_leave_unchained(e, jit);
+            continue;
+        }
+
+        if (side_exit->type == v502_JIT_SIDE_EXIT_FLUSH && count > side_exit->executed)
+            v502_jit_emit_budget_op(e, 0, count - side_exit->executed);
+
+        v502_jit_emit_set_pc(e, side_exit->resume);
+        v502_jit_emit_leave_unchained(e, jit);
+    }
+
+    jit->used = e->at;
+    jit->blocks[start] = jit->buffer + entry;
+    jit->block_instructions[start] = count;
+    jit->compiled[jit->compiled_count++] = start;
+
+    return jit->blocks[start];
+}
+
+static v502_byte_t* v502_jit_compile(v502_6502vm_t* vm, v502_jit_t* jit, v502_word_t start) {
+    if (!v502_jit_begin_write(jit))
+        return NULL;
+
+    v502_byte_t* block = v502_jit_translate(vm, jit, start);
+
+    return v502_jit_end_write(jit) ? block : NULL;
+}
+
+static void v502_jit_flush(v502_jit_t* jit) {
+    for (uint32_t c = 0; c < jit->compiled_count; c++) {
+        v502_word_t start = jit->compiled[c];
+
+        jit->blocks[start] = NULL;
+        jit->block_instructions[start] = 0;
+        jit->heat[start] = 0;
+    }
+
+    memset(jit->code_map, 0, sizeof(jit->code_map));
+
+    jit->compiled_count = 0;
+    jit->used = jit->stubs_end;
+    jit->flush_pending = 0;
+}
+
+static v502_jit_t* v502_jit_create() {
+    v502_jit_t* jit = calloc(1, sizeof(v502_jit_t));
+
+    void* buffer = mmap(NULL, v502_JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buffer == MAP_FAILED)
+        return jit;
+
+    jit->buffer = buffer;
+
+    v502_jit_emitter_t e = { jit->buffer, 0 };
+
+    // Entry stub, (vm, jit, block) -> saves what we use, loads rbx / r12 and jumps to the block
+    jit->enter = (v502_jit_enter_t)(void*)(jit->buffer + e.at);
+    v502_jit_emit8(&e, 0x53); // push rbx
+    v502_jit_emit8(&e, 0x41); // push r12
+    v502_jit_emit8(&e, 0x54);
+    v502_jit_emit8(&e, 0x55); // push rbp, keeps the stack 16 byte aligned for calls
+    v502_jit_emit8(&e, 0x48); // mov rbx, rdi
+    v502_jit_emit8(&e, 0x89);
+    v502_jit_emit8(&e, 0xFB);
+    v502_jit_emit8(&e, 0x49); // mov r12, rsi
+    v502_jit_emit8(&e, 0x89);
+    v502_jit_emit8(&e, 0xF4);
+    v502_jit_emit8(&e, 0xFF); // jmp rdx
+    v502_jit_emit8(&e, 0xE2);
+
+    // Exit stub, blocks jump here with rax already set
+    jit->exit_stub = jit->buffer + e.at;
+    v502_jit_emit8(&e, 0x5D); // pop rbp
+    v502_jit_emit8(&e, 0x41); // pop r12
+    v502_jit_emit8(&e, 0x5C);
+    v502_jit_emit8(&e, 0x5B); // pop rbx
+    v502_jit_emit8(&e, 0xC3); // ret
+
+    jit->used = jit->stubs_end = e.at;
+
+    // Systems that never allow writable memory to become executable get the predecoded engine instead
+    if (mprotect(jit->buffer, v502_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        munmap(jit->buffer, v502_JIT_BUFFER_SIZE);
+        jit->buffer = NULL;
+    }
+
+    return jit;
+}
+
+void v502_invalidate_jit_vm(v502_6502vm_t* vm, v502_word_t where, v502_dword_t length) {
+    v502_jit_t* jit = vm->jit;
+
+    if (jit->buffer == NULL || jit->compiled_count == 0)
+        return;
+
+    if (length >= 0x10000) {
+        jit->flush_pending = 1;
+        return;
+    }
+
+    for (v502_dword_t b = 0; b < length; b++) {
+        v502_word_t at = (v502_word_t)(where + b);
+
+        if (jit->code_map[at >> 3] & (1 << (at & 7))) {
+            jit->flush_pending = 1;
+            return;
+        }
+    }
+}
+
+void v502_free_jit_vm(v502_6502vm_t* vm) {
+    if (vm->jit == NULL)
+        return;
+
+    if (vm->jit->buffer != NULL)
+        munmap(vm->jit->buffer, v502_JIT_BUFFER_SIZE);
+
+    free(vm->jit);
+    vm->jit = NULL;
+}
+
+v502_EXIT_REASON_E v502_run_jit_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    assert(vm != NULL);
+
+    if (vm->jit == NULL)
+        vm->jit = v502_jit_create();
+
+    v502_jit_t* jit = vm->jit;
+
+    if (jit->buffer == NULL)
+        return v502_run_predecoded_vm(vm, max_instructions, max_cycles, exit_info);
+
+#ifdef V502_PROFILING
+    // Translated code doesn't count anything
+    if (vm->profile != NULL)
+        return v502_run_predecoded_vm(vm, max_instructions, max_cycles, exit_info);
+#endif
+
+    v502_EXIT_REASON_E reason = v502_EXIT_REASON_BUDGET;
+    v502_qword_t executed = 0;
+    v502_qword_t start_cycles = vm->cycles;
+    v502_qword_t cycle_limit = v502_cycle_limit_vm(vm, max_cycles);
+    v502_byte_t next_op = 0;
+    v502_byte_t* chain_site = NULL;
+
+    v502_begin_flags_vm(vm);
+
+    while ((max_instructions == 0 || executed < max_instructions) && vm->cycles < cycle_limit) {
+        if (jit->flush_pending) {
+            v502_jit_flush(jit);
+            chain_site = NULL;
+        }
+
+        // Same as v502_poll_interrupts_vm(), except the exit we came from must not be linked to the handler
+        if (v502_atomic_load_u32(&vm->interrupt_lines) != 0 && v502_take_interrupt_vm(vm))
+            chain_site = NULL;
+
+        v502_word_t pc = vm->program_counter;
+        v502_byte_t* block = jit->blocks[pc];
+        int at_breakpoint = vm->debug != NULL && v502_has_breakpoint(vm->debug, pc);
+
+        // Unless the run starts here, then this is resuming from the breakpoint and its instruction is interpreted below
+        if (at_breakpoint && executed != 0) {
+            next_op = vm->hunk[pc];
+            reason = v502_EXIT_REASON_BREAKPOINT;
+            break;
+        }
+
+        // Breakpoint addresses are never compiled, so the exits leading to them always come back here
+        if (block == NULL && !at_breakpoint && jit->heat[pc] != v502_JIT_HEAT_NEVER && ++jit->heat[pc] >= v502_JIT_HOT_THRESHOLD) {
+            block = v502_jit_compile(vm, jit, pc);
+
+            if (block == NULL && !jit->flush_pending)
+                jit->heat[pc] = v502_JIT_HEAT_NEVER;
+        }
+
+        // Link the exit we just left through straight to this block, unless the block is an idle loop
+        // Those stay unlinked so every trip around comes back here, where it gets fast-forwarded instead
+        if (chain_site != NULL && block != NULL) {
+            v502_qword_t idle_cycles;
+            uint32_t idle_instructions = v502_find_idle_loop_vm(vm, &idle_cycles);
+
+            if (idle_instructions == 0) {
+                if (v502_jit_begin_write(jit)) {
+                    v502_jit_patch_rel32(chain_site, 1, block - chain_site);
+
+                    if (!v502_jit_end_write(jit))
+                        block = NULL;
+                }
+            } else {
+                v502_qword_t skipped = v502_fast_forward_vm(vm, idle_instructions, idle_cycles, max_instructions == 0 ? UINT64_MAX : max_instructions - executed, cycle_limit);
+
+                // The budget might be used up now
+                if (skipped != 0) {
+                    executed += skipped;
+                    chain_site = NULL;
+                    continue;
+                }
+            }
+        }
+
+        chain_site = NULL;
+
+        v502_qword_t remaining = max_instructions == 0 ? INT64_MAX : max_instructions - executed;
+
+        if (remaining > INT64_MAX)
+            remaining = INT64_MAX;
+
+        if (cycle_limit != UINT64_MAX && remaining > (cycle_limit - vm->cycles) / v502_MAX_OP_CYCLES)
+            remaining = (cycle_limit - vm->cycles) / v502_MAX_OP_CYCLES;
+
+        if (block != NULL && !at_breakpoint && remaining >= jit->block_instructions[pc]) {
+            jit->budget = (int64_t)remaining;
+            chain_site = jit->enter(vm, jit, block + jit->interrupt_check_length);
+            executed += remaining - (v502_qword_t)jit->budget;
+
+            if (jit->flush_pending)
+                chain_site = NULL;
+
+            continue;
+        }
+
+        // Interpret a single instruction, same as v502_run_table_vm()
+        next_op = vm->hunk[pc];
+        v502_OP_STATE_E state = vm->opfuncs[next_op](vm, next_op);
+
+        if (state == V502_OP_STATE_SUCCESS) {
+            vm->program_counter += 1;
+            executed += 1;
+            continue;
+        }
+
+        if (state == V502_OP_STATE_SUCCESS_NO_COUNT) {
+            executed += 1;
+            continue;
+        }
+
+        if (state == V502_OP_STATE_HALT) {
+            vm->program_counter += 1;
+            executed += 1;
+            reason = v502_EXIT_REASON_HALT;
+        } else if (state == V502_OP_STATE_BREAKPOINT)
+            reason = v502_EXIT_REASON_BREAKPOINT;
+        else
+            reason = v502_EXIT_REASON_UNKNOWN_OP;
+
+        break;
+    }
+
+    v502_end_flags_vm(vm);
+
+    if (exit_info != NULL) {
+        exit_info->reason = reason;
+        exit_info->instructions = executed;
+        exit_info->cycles = vm->cycles - start_cycles;
+        exit_info->program_counter = vm->program_counter;
+        exit_info->opcode = next_op;
+        exit_info->watch_address = 0; // Only the table engine stops on watchpoints
+    }
+
+    return reason;
+}
+
+#else
+
+void v502_invalidate_jit_vm(v502_6502vm_t* vm, v502_word_t where, v502_dword_t length) {
+
+}
+
+void v502_free_jit_vm(v502_6502vm_t* vm) {
+
+}
+
+v502_EXIT_REASON_E v502_run_jit_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    return v502_run_predecoded_vm(vm, max_instructions, max_cycles, exit_info);
+}
+
+#endif
@@ -1,7 +1,9 @@
-#include "6502_ops.h"
-#include "6502_vm.h"
+#include "6502_ops_impl.h"
 
+#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 v502_DEFINE_OPFUNC(UNKNOWN) {
     printf("V502: Unknown instruction 0x%x\n", op);
@@ -9,389 +11,126 @@ v502_DEFINE_OPFUNC(UNKNOWN) {
 }
 
 //
-// Accumulator functions
+// Opfuncs, one per opcode
 //
-
-v502_DEFINE_OPFUNC(ADC) {
-    uint16_t where;
-    if (op == v502_MOS_OP_ADC_NOW)
-        where = ++vm->program_counter;
-
-    if (op == v502_MOS_OP_ADC_ZPG || op == v502_MOS_OP_ADC_X_ZPG)
-        where = v502_make_word(0x00, vm->hunk[++vm->program_counter] + (op == v502_MOS_OP_ADC_X_ZPG ? vm->index_x : 0));
-
-    if (op == v502_MOS_OP_ADC_ABS || op == v502_MOS_OP_ADC_X_ABS || op == v502_MOS_OP_ADC_Y_ABS) {
-        where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
-        where += (op == v502_MOS_OP_STA_ABS ? 0 : (op == v502_MOS_OP_STA_X_ABS ? vm->index_x : vm->index_y));
-        vm->program_counter += 2;
-    }
-
-    if (op == v502_MOS_OP_ADC_X_IND || op == v502_MOS_OP_ADC_Y_IND) {
-        where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
-        where += (op == v502_MOS_OP_ADC_X_IND ? vm->index_x : 0);
-
-        where = v502_make_word(vm->hunk[where + 1], vm->hunk[where]) + (op == v502_MOS_OP_ADC_Y_IND ? vm->index_y : 0);
-        vm->program_counter += 2;
-    }
-
-    v502_safe_add_vm(vm, vm->hunk[where]);
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(STA) {
-    uint16_t where = 0;
-    if (op == v502_MOS_OP_STA_ZPG || op == v502_MOS_OP_STA_X_ZPG)
-        where = v502_make_word(0x00, vm->hunk[++vm->program_counter] + (op == v502_MOS_OP_STA_X_ZPG ? vm->index_x : 0));
-
-    if (op == v502_MOS_OP_STA_ABS || op == v502_MOS_OP_STA_X_ABS || op == v502_MOS_OP_STA_Y_ABS) {
-        where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
-        where += (op == v502_MOS_OP_STA_ABS ? 0 : (op == v502_MOS_OP_STA_X_ABS ? vm->index_x : vm->index_y));
-        vm->program_counter += 2;
+#define v502_GENERATE_OPFUNC(NAME, MNEMONIC, MODE, CYCLES, PAGE) \
+    v502_DEFINE_OPFUNC(NAME) { \
+        v502_word_t where = v502_address_##MODE(vm); \
+        v502_CHARGE_CYCLES(vm, MODE, CYCLES, PAGE, where); \
+        return v502_exec_##MNEMONIC(vm, where); \
     }
 
-    vm->hunk[where] = vm->accumulator;
+v502_MOS_OP_LIST(v502_GENERATE_OPFUNC)
 
-    return V502_OP_STATE_SUCCESS;
-}
-
-//
-// X Register
 //
-
-v502_DEFINE_OPFUNC(INX) {
-    vm->index_x += 1;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(DEX) {
-    vm->index_x -= 1;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(TSX) {
-    vm->index_x = vm->stack_ptr;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(TXS) {
-    vm->stack_ptr = vm->index_x;
-    return V502_OP_STATE_SUCCESS;
-}
-
-//
-// Y Register
-//
-
-v502_DEFINE_OPFUNC(INY) {
-    vm->index_y += 1;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(DEY) {
-    vm->index_y -= 1;
-    return V502_OP_STATE_SUCCESS;
-}
-
+// Decimal mode
 //
-// Stack ops
+// One table per operation, holding every digit A and the operand can have (A-F included) with every carry or borrow in
+// Digits past 9 get the same +6 / -6 adjustment the NMOS 6502 applies, so invalid BCD comes out like it does on hardware
 //
-
-v502_DEFINE_OPFUNC(PLA) {
-    vm->accumulator = vm->hunk[v502_make_word(0x01, ++vm->stack_ptr)];
-    vm->hunk[v502_make_word(0x01, vm->stack_ptr)] = 0;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(PHA) {
-    vm->hunk[v502_make_word(0x01, vm->stack_ptr--)] = vm->accumulator;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(PLP) {
-    vm->flags = vm->hunk[v502_make_word(0x01, ++vm->stack_ptr)];
-    vm->hunk[v502_make_word(0x01, vm->stack_ptr)] = 0;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(PHP) {
-    vm->hunk[v502_make_word(0x01, vm->stack_ptr--)] = vm->flags;
-    return V502_OP_STATE_SUCCESS;
-}
+#define v502_BCD_ADD_DIGIT(C, A, M) ((A) + (M) + (C) > 9 ? (((A) + (M) + (C) + 6) & 0x0F) | 0x10 : (A) + (M) + (C))
+#define v502_BCD_SUB_DIGIT(B, A, M) ((A) - (M) - (B) < 0 ? (((A) - (M) - (B) + 26) & 0x0F) | 0x10 : (A) - (M) - (B))
+
+#define v502_BCD_ROW(DIGIT, C, A) { \
+    DIGIT(C, A, 0), DIGIT(C, A, 1), DIGIT(C, A, 2), DIGIT(C, A, 3), DIGIT(C, A, 4), DIGIT(C, A, 5), DIGIT(C, A, 6), DIGIT(C, A, 7), \
+    DIGIT(C, A, 8), DIGIT(C, A, 9), DIGIT(C, A, 10), DIGIT(C, A, 11), DIGIT(C, A, 12), DIGIT(C, A, 13), DIGIT(C, A, 14), DIGIT(C, A, 15) }
+
+#define v502_BCD_TABLE(DIGIT, C) { \
+    v502_BCD_ROW(DIGIT, C, 0), v502_BCD_ROW(DIGIT, C, 1), v502_BCD_ROW(DIGIT, C, 2), v502_BCD_ROW(DIGIT, C, 3), \
+    v502_BCD_ROW(DIGIT, C, 4), v502_BCD_ROW(DIGIT, C, 5), v502_BCD_ROW(DIGIT, C, 6), v502_BCD_ROW(DIGIT, C, 7), \
+    v502_BCD_ROW(DIGIT, C, 8), v502_BCD_ROW(DIGIT, C, 9), v502_BCD_ROW(DIGIT, C, 10), v502_BCD_ROW(DIGIT, C, 11), \
+    v502_BCD_ROW(DIGIT, C, 12), v502_BCD_ROW(DIGIT, C, 13), v502_BCD_ROW(DIGIT, C, 14), v502_BCD_ROW(DIGIT, C, 15) }
+
+const v502_byte_t v502_BCD_ADD[2][16][16] = {
+    v502_BCD_TABLE(v502_BCD_ADD_DIGIT, 0),
+    v502_BCD_TABLE(v502_BCD_ADD_DIGIT, 1)
+};
+
+const v502_byte_t v502_BCD_SUB[2][16][16] = {
+    v502_BCD_TABLE(v502_BCD_SUB_DIGIT, 0),
+    v502_BCD_TABLE(v502_BCD_SUB_DIGIT, 1)
+};
+
+#undef v502_BCD_TABLE
+#undef v502_BCD_ROW
+#undef v502_BCD_SUB_DIGIT
+#undef v502_BCD_ADD_DIGIT
 
 //
-// Combined ops
+// Dispatch tables, one per feature set, shared by every VM that doesn't override an opcode
 //
+#define v502_STOCK_OPFUNC(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = OP_##NAME,
 
-// Accumulator -> Register
-v502_DEFINE_OPFUNC(TAR) {
-    *(op == v502_MOS_OP_TAX ? &vm->index_x : &vm->index_y) = vm->accumulator;
-    return V502_OP_STATE_SUCCESS;
-}
-
-// Register -> Accumulator
-v502_DEFINE_OPFUNC(TRA) {
-    vm->accumulator = (op == v502_MOS_OP_TXA ? vm->index_x : vm->index_y);
-    return V502_OP_STATE_SUCCESS;
-}
+static const v502_opfunc_t v502_MOS6502_OPFUNCS[256] = {
+    v502_REPEAT_256(OP_UNKNOWN),
+    v502_MOS_OP_LIST(v502_STOCK_OPFUNC)
+};
 
-// ComPare Register
-v502_DEFINE_OPFUNC(CPR) {
-    v502_byte_t lhs = vm->accumulator;
-    v502_byte_t rhs = 0;
-
-    if (op == v502_MOS_OP_CPX_NOW)
-        lhs = vm->index_x;
-
-    if (op == v502_MOS_OP_CMP_NOW || op == v502_MOS_OP_CPX_NOW) {
-        rhs = vm->hunk[++vm->program_counter];
-    }
-
-    v502_compare_vm(vm, lhs, rhs);
-    return V502_OP_STATE_SUCCESS;
-}
-
-// LoaD Register
-v502_DEFINE_OPFUNC(LDR) {
-    uint8_t* what = &vm->accumulator;
-    uint16_t where;
-
-    if (op == v502_MOS_OP_LDX_NOW)
-        what = &vm->index_x;
-
-    if (op == v502_MOS_OP_LDA_NOW || op == v502_MOS_OP_LDX_NOW)
-        where = ++vm->program_counter;
-
-    if (op == v502_MOS_OP_LDA_ZPG)
-        where = v502_make_word(0x00, ++vm->program_counter);
-
-    *what = vm->hunk[where];
-
-    return V502_OP_STATE_SUCCESS;
-}
+// TODO: W65C02 Ops, until then it shares the MOS 6502 table
+static const v502_opfunc_t* const v502_FEATURESET_OPFUNCS[] = {
+    [v502_FEATURESET_MOS6502] = v502_MOS6502_OPFUNCS,
+    [v502_FEATURESET_W65C02] = v502_MOS6502_OPFUNCS
+};
 
+#undef v502_STOCK_OPFUNC
 
 //
-// Flow control ops
+// Cycle tables, one per feature set
 //
+#define v502_STOCK_CYCLES(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = CYCLES,
 
-v502_DEFINE_OPFUNC(NOP) {
-    return V502_OP_STATE_SUCCESS; // Waste a cycle
-}
-
-v502_DEFINE_OPFUNC(BPL) {
-    if (!(vm->flags & v502_STATE_FLAG_NEGATIVE)) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
-
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
-}
-
-v502_DEFINE_OPFUNC(BMI) {
-    if (vm->flags & v502_STATE_FLAG_NEGATIVE) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
-
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
-}
+static const v502_byte_t v502_MOS6502_CYCLES[256] = {
+    v502_MOS_OP_LIST(v502_STOCK_CYCLES)
+};
 
-v502_DEFINE_OPFUNC(BVC) {
-    if (!(vm->flags & v502_STATE_FLAG_OVERFLOW)) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
+static const v502_byte_t* const v502_FEATURESET_CYCLES[] = {
+    [v502_FEATURESET_MOS6502] = v502_MOS6502_CYCLES,
+    [v502_FEATURESET_W65C02] = v502_MOS6502_CYCLES
+};
 
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
-}
+#undef v502_STOCK_CYCLES
 
-v502_DEFINE_OPFUNC(BVS) {
-    if (vm->flags & v502_STATE_FLAG_OVERFLOW) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
-
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
+const v502_opfunc_t* v502_get_dispatch_table(v502_FEATURESET_E feature_set) {
+    assert(feature_set >= 0 && feature_set < sizeof(v502_FEATURESET_OPFUNCS) / sizeof(v502_FEATURESET_OPFUNCS[0]));
+    return v502_FEATURESET_OPFUNCS[feature_set];
 }
 
-v502_DEFINE_OPFUNC(BCC) {
-    if (!(vm->flags & v502_STATE_FLAG_CARRY)) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
-
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
+const v502_byte_t* v502_get_cycle_table(v502_FEATURESET_E feature_set) {
+    assert(feature_set >= 0 && feature_set < sizeof(v502_FEATURESET_CYCLES) / sizeof(v502_FEATURESET_CYCLES[0]));
+    return v502_FEATURESET_CYCLES[feature_set];
 }
 
-v502_DEFINE_OPFUNC(BCS) {
-    if (vm->flags & v502_STATE_FLAG_CARRY) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
+void v502_populate_ops_vm(v502_6502vm_t* vm) {
+    free(vm->owned_opfuncs);
+    vm->owned_opfuncs = NULL;
 
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
-}
+    vm->opfuncs = v502_get_dispatch_table(vm->feature_set);
 
-v502_DEFINE_OPFUNC(BNE) {
-    if (!(vm->flags & v502_STATE_FLAG_CARRY && vm->flags & v502_STATE_FLAG_ZERO)) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
-
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
+    v502_invalidate_code_vm(vm, 0, v502_DECODE_CACHE_ENTRIES);
 }
 
-v502_DEFINE_OPFUNC(BEQ) {
-    if (vm->flags & v502_STATE_FLAG_CARRY && vm->flags & v502_STATE_FLAG_ZERO) {
-        vm->program_counter += (int8_t) vm->hunk[++vm->program_counter];
-        return V502_OP_STATE_SUCCESS_NO_COUNT;
-    }
+void v502_set_opfunc_vm(v502_6502vm_t* vm, v502_byte_t opcode, v502_opfunc_t func) {
+    assert(vm != NULL);
 
-    // If we don't branch, skip the argument
-    vm->program_counter += 1;
-    return V502_OP_STATE_SUCCESS;
-}
+    if (func == NULL)
+        func = v502_get_dispatch_table(vm->feature_set)[opcode];
 
-v502_DEFINE_OPFUNC(JMP) {
-    if (op == v502_MOS_OP_JMP_ABS)
-        vm->program_counter = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
+    if (vm->opfuncs[opcode] == func)
+        return;
 
-    if (op == v502_MOS_OP_JMP_IND) {
-        uint16_t ind = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
-        vm->program_counter = v502_make_word(vm->hunk[ind + 1], vm->hunk[ind]);
+    // First override, copy the shared table so no other VM sees this
+    if (vm->owned_opfuncs == NULL) {
+        vm->owned_opfuncs = malloc(256 * sizeof(v502_opfunc_t));
+        memcpy(vm->owned_opfuncs, vm->opfuncs, 256 * sizeof(v502_opfunc_t));
+        vm->opfuncs = vm->owned_opfuncs;
     }
 
-    return V502_OP_STATE_SUCCESS_NO_COUNT;
-}
-
-v502_DEFINE_OPFUNC(JSR) {
-    vm->hunk[v502_make_word(0x01, vm->stack_ptr--)] = (vm->program_counter + 2);
-    vm->hunk[v502_make_word(0x01, vm->stack_ptr--)] = (vm->program_counter + 2) >> 8;
-    vm->program_counter = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
-
-    return V502_OP_STATE_SUCCESS_NO_COUNT;
-}
-
-v502_DEFINE_OPFUNC(RTS) {
-    v502_byte_t l = vm->hunk[v502_make_word(0x01, vm->stack_ptr + 2)];
-    v502_byte_t h = vm->hunk[v502_make_word(0x01, vm->stack_ptr + 1)];
-    vm->program_counter = v502_make_word(h, l);
-
-    vm->hunk[v502_make_word(0x01, ++vm->stack_ptr)] = 0;
-    vm->hunk[v502_make_word(0x01, ++vm->stack_ptr)] = 0;
+    vm->owned_opfuncs[opcode] = func;
 
-    return V502_OP_STATE_SUCCESS;
-}
-
-//
-// opfunc array populate function
-//
-void v502_populate_ops_vm(v502_6502vm_t* vm) {
-    //
-    // Accumulator ops
-    //
-    vm->opfuncs[v502_MOS_OP_ADC_NOW] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_ZPG] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_X_ZPG] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_ABS] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_X_ABS] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_Y_ABS] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_X_IND] = OP_ADC;
-    vm->opfuncs[v502_MOS_OP_ADC_Y_IND] = OP_ADC;
-
-    vm->opfuncs[v502_MOS_OP_STA_ZPG] = OP_STA;
-    vm->opfuncs[v502_MOS_OP_STA_X_ZPG] = OP_STA;
-    vm->opfuncs[v502_MOS_OP_STA_ABS] = OP_STA;
-    vm->opfuncs[v502_MOS_OP_STA_X_ABS] = OP_STA;
-    vm->opfuncs[v502_MOS_OP_STA_Y_ABS] = OP_STA;
-
-    vm->opfuncs[v502_MOS_OP_LDA_NOW] = OP_LDR;
-    vm->opfuncs[v502_MOS_OP_LDA_ZPG] = OP_LDR;
-
-    vm->opfuncs[v502_MOS_OP_CMP_NOW] = OP_CPR;
-
-    //
-    // X Register
-    //
-    vm->opfuncs[v502_MOS_OP_INX] = OP_INX;
-    vm->opfuncs[v502_MOS_OP_DEX] = OP_DEX;
-
-    vm->opfuncs[v502_MOS_OP_TXS] = OP_TXS;
-    vm->opfuncs[v502_MOS_OP_TSX] = OP_TSX;
-
-    vm->opfuncs[v502_MOS_OP_LDX_NOW] = OP_LDR;
-
-    vm->opfuncs[v502_MOS_OP_CPX_NOW] = OP_CPR;
-
-    //
-    // Y Register
-    //
-    vm->opfuncs[v502_MOS_OP_INY] = OP_INY;
-    vm->opfuncs[v502_MOS_OP_DEY] = OP_DEY;
-
-    //
-    // Stack ops
-    //
-    vm->opfuncs[v502_MOS_OP_PLA] = OP_PLA;
-    vm->opfuncs[v502_MOS_OP_PHA] = OP_PHA;
-
-    vm->opfuncs[v502_MOS_OP_PLP] = OP_PLP;
-    vm->opfuncs[v502_MOS_OP_PHP] = OP_PHP;
-
-    //
-    // Transfers
-    //
-    vm->opfuncs[v502_MOS_OP_TAX] = OP_TAR;
-    vm->opfuncs[v502_MOS_OP_TAY] = OP_TAR;
-
-    vm->opfuncs[v502_MOS_OP_TXA] = OP_TRA;
-    vm->opfuncs[v502_MOS_OP_TYA] = OP_TRA;
-
-    //
-    // Branching / Flow
-    //
-    vm->opfuncs[v502_MOS_OP_NOP] = OP_NOP;
-
-    vm->opfuncs[v502_MOS_OP_BPL] = OP_BPL;
-    vm->opfuncs[v502_MOS_OP_BMI] = OP_BMI;
-    vm->opfuncs[v502_MOS_OP_BVC] = OP_BVC;
-    vm->opfuncs[v502_MOS_OP_BVS] = OP_BVS;
-    vm->opfuncs[v502_MOS_OP_BCC] = OP_BCC;
-    vm->opfuncs[v502_MOS_OP_BCS] = OP_BCS;
-    vm->opfuncs[v502_MOS_OP_BNE] = OP_BNE;
-    vm->opfuncs[v502_MOS_OP_BEQ] = OP_BEQ;
-
-    vm->opfuncs[v502_MOS_OP_JMP_ABS] = OP_JMP;
-    vm->opfuncs[v502_MOS_OP_JMP_IND] = OP_JMP;
-
-    vm->opfuncs[v502_MOS_OP_JSR_ABS] = OP_JSR;
-
-    vm->opfuncs[v502_MOS_OP_RTS] = OP_RTS;
-
-    // TODO: W65C02 Ops
-    if (vm->feature_set == v502_FEATURESET_W65C02) {
-
-    }
-
-    for (int o = 0; o < 256; o++)
-        if (vm->opfuncs[o] == NULL)
-            vm->opfuncs[o] = OP_UNKNOWN;
+    // Decoded and translated code was built against the old opfunc
+    v502_invalidate_code_vm(vm, 0, v502_DECODE_CACHE_ENTRIES);
 }
 
 v502_opfunc_t v502_get_fallback_func() {
     return OP_UNKNOWN;
-}
\ No newline at end of file
+}
@@ -98,6 +98,9 @@ typedef enum v502_MOS_OP {
     v502_MOS_OP_PHP         = 0x08,
     v502_MOS_OP_PLP         = 0x28,
 
+    v502_MOS_OP_SEI         = 0x78,
+    v502_MOS_OP_CLI         = 0x58,
+
     //
     // Flow
     //
@@ -106,6 +109,7 @@ typedef enum v502_MOS_OP {
 
     v502_MOS_OP_JSR_ABS     = 0x20,
     v502_MOS_OP_RTS         = 0x60,
+    v502_MOS_OP_RTI         = 0x40,
 
     //
     // Branching
@@ -125,10 +129,122 @@ typedef enum v502_MOS_OP {
     v502_MOS_OP_NOP         = 0x1A // Not a real instruction, wastes a cycle though!
 } v502_MOS_OP_E;
 
+//
+// Opcode description
+//
+// Every implemented opcode is described exactly once here and everything else (the opfunc table, engines, tooling) is generated from it
+// X(NAME, MNEMONIC, MODE, CYCLES, PAGE)
+//  NAME is the suffix of the v502_MOS_OP_ enum value
+//  MNEMONIC selects what the instruction does
+//  MODE selects how the operand is fetched, this is resolved at compile time so handlers never decode it at runtime
+//  CYCLES is how many clock cycles the instruction takes at least
+//  PAGE is 1 if indexing across a page boundary costs an extra cycle (reads do, stores always pay it and have it in CYCLES)
+//  Taken branches cost one extra cycle, two if they land on another page, the branch bodies add those themselves
+//
+// Addressing modes
+//  IMP = Implied (no operand)
+//  NOW = Immediate, the operand byte itself
+//  REL = Relative, a signed branch offset
+//  ZPG / X_ZPG / Y_ZPG = Zero page, optionally indexed
+//  ABS / X_ABS / Y_ABS = Absolute, optionally indexed
+//  IND = Indirect word (JMP only)
+//  X_IND / Y_IND = Zero page indexed indirect / zero page indirect indexed
+//
+#define v502_MOS_OP_LIST(X) \
+    /* Accumulator */ \
+    X(ADC_NOW,      ADC,    NOW,    2,  0) \
+    X(ADC_ZPG,      ADC,    ZPG,    3,  0) \
+    X(ADC_X_ZPG,    ADC,    X_ZPG,  4,  0) \
+    X(ADC_ABS,      ADC,    ABS,    4,  0) \
+    X(ADC_X_ABS,    ADC,    X_ABS,  4,  1) \
+    X(ADC_Y_ABS,    ADC,    Y_ABS,  4,  1) \
+    X(ADC_X_IND,    ADC,    X_IND,  6,  0) \
+    X(ADC_Y_IND,    ADC,    Y_IND,  5,  1) \
+    X(SBC_NOW,      SBC,    NOW,    2,  0) \
+    X(STA_ZPG,      STA,    ZPG,    3,  0) \
+    X(STA_X_ZPG,    STA,    X_ZPG,  4,  0) \
+    X(STA_ABS,      STA,    ABS,    4,  0) \
+    X(STA_X_ABS,    STA,    X_ABS,  5,  0) \
+    X(STA_Y_ABS,    STA,    Y_ABS,  5,  0) \
+    X(LDA_NOW,      LDA,    NOW,    2,  0) \
+    X(LDA_ZPG,      LDA,    ZPG,    3,  0) \
+    X(LDA_X_ZPG,    LDA,    X_ZPG,  4,  0) \
+    X(LDA_ABS,      LDA,    ABS,    4,  0) \
+    X(LDA_X_ABS,    LDA,    X_ABS,  4,  1) \
+    X(LDA_Y_ABS,    LDA,    Y_ABS,  4,  1) \
+    X(LDA_X_IND,    LDA,    X_IND,  6,  0) \
+    X(LDA_Y_IND,    LDA,    Y_IND,  5,  1) \
+    X(CMP_NOW,      CMP,    NOW,    2,  0) \
+    /* X Register */ \
+    X(INX,          INX,    IMP,    2,  0) \
+    X(DEX,          DEX,    IMP,    2,  0) \
+    X(TAX,          TAX,    IMP,    2,  0) \
+    X(TXA,          TXA,    IMP,    2,  0) \
+    X(TXS,          TXS,    IMP,    2,  0) \
+    X(TSX,          TSX,    IMP,    2,  0) \
+    X(LDX_NOW,      LDX,    NOW,    2,  0) \
+    X(LDX_ZPG,      LDX,    ZPG,    3,  0) \
+    X(LDX_Y_ZPG,    LDX,    Y_ZPG,  4,  0) \
+    X(LDX_ABS,      LDX,    ABS,    4,  0) \
+    X(LDX_Y_ABS,    LDX,    Y_ABS,  4,  1) \
+    X(CPX_NOW,      CPX,    NOW,    2,  0) \
+    /* Y Register */ \
+    X(INY,          INY,    IMP,    2,  0) \
+    X(DEY,          DEY,    IMP,    2,  0) \
+    X(TAY,          TAY,    IMP,    2,  0) \
+    X(TYA,          TYA,    IMP,    2,  0) \
+    X(LDY_NOW,      LDY,    NOW,    2,  0) \
+    X(LDY_ZPG,      LDY,    ZPG,    3,  0) \
+    X(LDY_X_ZPG,    LDY,    X_ZPG,  4,  0) \
+    X(LDY_ABS,      LDY,    ABS,    4,  0) \
+    X(LDY_X_ABS,    LDY,    X_ABS,  4,  1) \
+    /* Stack */ \
+    X(PHA,          PHA,    IMP,    3,  0) \
+    X(PLA,          PLA,    IMP,    4,  0) \
+    X(PHP,          PHP,    IMP,    3,  0) \
+    X(PLP,          PLP,    IMP,    4,  0) \
+    /* State register */ \
+    X(SEI,          SEI,    IMP,    2,  0) \
+    X(CLI,          CLI,    IMP,    2,  0) \
+    /* Branching / Flow */ \
+    X(NOP,          NOP,    IMP,    2,  0) \
+    X(BPL,          BPL,    REL,    2,  0) \
+    X(BMI,          BMI,    REL,    2,  0) \
+    X(BVC,          BVC,    REL,    2,  0) \
+    X(BVS,          BVS,    REL,    2,  0) \
+    X(BCC,          BCC,    REL,    2,  0) \
+    X(BCS,          BCS,    REL,    2,  0) \
+    X(BNE,          BNE,    REL,    2,  0) \
+    X(BEQ,          BEQ,    REL,    2,  0) \
+    X(JMP_ABS,      JMP,    ABS,    3,  0) \
+    X(JMP_IND,      JMP,    IND,    5,  0) \
+    X(JSR_ABS,      JSR,    ABS,    6,  0) \
+    X(RTS,          RTS,    IMP,    6,  0) \
+    X(RTI,          RTI,    IMP,    6,  0)
+
+// Instruction length in bytes (opcode included) for each addressing mode
+#define v502_MODE_LENGTH_IMP 1
+#define v502_MODE_LENGTH_NOW 2
+#define v502_MODE_LENGTH_REL 2
+#define v502_MODE_LENGTH_ZPG 2
+#define v502_MODE_LENGTH_X_ZPG 2
+#define v502_MODE_LENGTH_Y_ZPG 2
+#define v502_MODE_LENGTH_ABS 3
+#define v502_MODE_LENGTH_X_ABS 3
+#define v502_MODE_LENGTH_Y_ABS 3
+#define v502_MODE_LENGTH_IND 3
+#define v502_MODE_LENGTH_X_IND 2
+#define v502_MODE_LENGTH_Y_IND 2
+
+// The most cycles a stock instruction can take, page crossings and taken branches included
+#define v502_MAX_OP_CYCLES 7
+
 typedef enum v502_OP_STATE {
     V502_OP_STATE_FAILED, // Tells the VM something went wrong
     V502_OP_STATE_SUCCESS, // Tells the VM we passed
-    V502_OP_STATE_SUCCESS_NO_COUNT // Tells the VM we passed but don't want to increment the program counter
+    V502_OP_STATE_SUCCESS_NO_COUNT, // Tells the VM we passed but don't want to increment the program counter
+    V502_OP_STATE_BREAKPOINT, // Tells the VM to stop before this instruction, the program counter must be left untouched
+    V502_OP_STATE_HALT // Tells the VM to stop after this instruction, the program counter is incremented like V502_OP_STATE_SUCCESS
 } v502_OP_STATE_E;
 
 //
@@ -140,14 +256,18 @@ typedef v502_OP_STATE_E(*v502_opfunc_t)(v502_6502vm_t*, v502_byte_t);
 
 // Optional helper for defining opfuncs faster
 #define v502_DEFINE_OPFUNC(NAME) v502_OP_STATE_E OP_##NAME(v502_6502vm_t* vm, v502_byte_t op)
+// Opfuncs account for their own clock cycles, overrides should add theirs to vm->cycles too
+// They run while the flags are lazy, so read and write them through v502_get_flags_vm() and v502_set_flags_vm() rather than vm->flags
 // Example for TAX
 /*
 V502_OP_STATUS_E OP_TAX(v502_6502vm_t* vm, v502_byte_t op) {
     vm->index_x = vm->accumulator;
+    vm->cycles += 2;
     return V502_OP_STATE_SUCCESS;
 }
 */
 
+// Points the VM back at the shared dispatch table of its feature set, dropping any overrides
 void v502_populate_ops_vm(v502_6502vm_t* vm);
 
 v502_opfunc_t v502_get_fallback_func();
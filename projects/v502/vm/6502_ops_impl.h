@@ -0,0 +1,653 @@
+#ifndef V502_6502_OPS_IMPL_H
+#define V502_6502_OPS_IMPL_H
+
+// Internal to the VM, this holds the instruction bodies shared by the opfuncs and the engines that inline them
+// Don't include this from outside of the vm folder!
+
+#include "6502_ops.h"
+#include "6502_vm.h"
+#include "../misc/threads.h"
+
+#include <stddef.h>
+
+// Labels as values are needed by the threaded engine
+#if defined(__GNUC__) || defined(__clang__)
+#define V502_HAS_THREADED_ENGINE
+#endif
+
+// The JIT emits x86-64 (System V) into mmap'd memory
+#if defined(__x86_64__) && defined(__linux__)
+#define V502_HAS_JIT_ENGINE
+#endif
+
+// JIT internals the rest of the VM needs to reach (see 6502_jit.c)
+void v502_invalidate_jit_vm(v502_6502vm_t* vm, v502_word_t where, v502_dword_t length);
+void v502_free_jit_vm(v502_6502vm_t* vm);
+
+// Hunk allocation and the shared memory objects behind mapped hunks and snapshots (see 6502_hunk.c)
+// Creating an object returns -1 if the platform can't, a NULL name makes an anonymous one
+int v502_alloc_hunk_vm(v502_6502vm_t* vm, const v502_6502vm_createinfo_t* p_createinfo);
+void v502_release_hunk_vm(v502_6502vm_t* vm);
+
+intptr_t v502_create_backing(const char* name, v502_dword_t length);
+void v502_close_backing(intptr_t backing);
+v502_byte_t* v502_map_backing(intptr_t backing, v502_dword_t length, int private_copy);
+void v502_unmap_backing(const v502_byte_t* view, v502_dword_t length);
+
+// Device accesses, kept out of line so the RAM path stays small (see 6502_vm.c)
+v502_byte_t v502_read_device_vm(v502_6502vm_t* vm, v502_word_t where);
+void v502_write_device_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value);
+
+// Takes the NMI or the IRQ if either can be taken right now, returns 0 if neither could (see 6502_vm.c)
+int v502_take_interrupt_vm(v502_6502vm_t* vm);
+
+// Pushes the return state and jumps through the vector whatever the lines say, replays take recorded interrupts with this
+void v502_enter_interrupt_vm(v502_6502vm_t* vm, v502_word_t vector);
+
+// What's mapped at the page underneath the watch device, NULL for RAM
+const v502_bus_device_t* v502_mapped_device_vm(const v502_6502vm_t* vm, uint32_t page);
+
+// Drops decoded and translated code like v502_invalidate_vm(), for the VM's own changes that a recording shouldn't see as host writes (see 6502_predecode.c)
+void v502_invalidate_code_vm(v502_6502vm_t* vm, v502_word_t where, v502_dword_t length);
+
+// Recording hooks, only call these while vm->recording is set (see 6502_record.c)
+void v502_record_read_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value);
+void v502_record_interrupt_vm(v502_6502vm_t* vm, v502_word_t vector);
+void v502_record_write_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value);
+void v502_record_memory_vm(v502_6502vm_t* vm, v502_word_t where, v502_dword_t length);
+void v502_record_reset_vm(v502_6502vm_t* vm);
+void v502_record_map_vm(v502_6502vm_t* vm, v502_byte_t first_page, uint32_t page_count, int device);
+
+// The host put the whole VM into another state, cycles is where it was before and before its memory then (NULL if those pages were recorded already)
+void v502_record_state_vm(v502_6502vm_t* vm, v502_qword_t cycles, const v502_byte_t* before);
+
+// Reverse execution hooks, only call these while vm->history is set (see 6502_history.c)
+// Every step logs itself before it runs, and every RAM store made during it logs the byte it overwrites
+void v502_history_step_vm(v502_6502vm_t* vm);
+void v502_history_interrupt_vm(v502_6502vm_t* vm, v502_word_t vector);
+void v502_history_store_vm(v502_6502vm_t* vm, v502_word_t where);
+
+// Takes back the step just logged, for instructions that didn't run (breakpoints and unknown opcodes)
+void v502_drop_history_step_vm(v502_6502vm_t* vm);
+
+// Forgets everything logged so far and starts over from where the VM is now
+void v502_restart_history_vm(v502_6502vm_t* vm);
+
+//
+// Memory
+//
+// Instructions read and write data through these, operands and opcodes are fetched from the hunk directly
+//
+
+static inline v502_byte_t v502_load_vm(v502_6502vm_t* vm, v502_word_t where) {
+    if (vm->devices[where >> 8] == NULL)
+        return vm->hunk[where];
+
+    return v502_read_device_vm(vm, where);
+}
+
+static inline void v502_mark_dirty_vm(v502_6502vm_t* vm, v502_word_t where) {
+    v502_dirty_map_t* dirty = vm->dirty;
+
+    dirty->pages[where >> 14] |= (uint64_t)1 << ((where >> 8) & 63);
+
+    if (dirty->tracking == v502_DIRTY_TRACKING_LINES)
+        dirty->lines[where >> 10] |= (uint64_t)1 << ((where >> 4) & 63);
+}
+
+// Every store that lands in RAM goes through here so caches and dirty bitmaps built from memory can be kept in sync
+static inline void v502_store_ram_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    if (vm->history != NULL)
+        v502_history_store_vm(vm, where);
+
+    vm->hunk[where] = value;
+
+    if (vm->dirty != NULL)
+        v502_mark_dirty_vm(vm, where);
+
+    if (vm->decode_cache != NULL)
+        v502_invalidate_decoded_vm(vm, where);
+
+    if (vm->jit != NULL)
+        v502_invalidate_jit_vm(vm, where, 1);
+}
+
+static inline void v502_store_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    if (vm->devices[where >> 8] == NULL)
+        v502_store_ram_vm(vm, where, value);
+    else
+        v502_write_device_vm(vm, where, value);
+}
+
+//
+// Flags
+//
+// Instructions that set N, Z, C or V only store the result each flag is derived from (see v502_6502vm_t)
+// Most of those get overwritten before anything looks at them, so the bits are only put together when read
+//
+
+#define v502_LAZY_FLAGS (v502_STATE_FLAG_NEGATIVE | v502_STATE_FLAG_ZERO | v502_STATE_FLAG_CARRY | v502_STATE_FLAG_OVERFLOW)
+
+static inline v502_byte_t v502_carry_vm(const v502_6502vm_t* vm) {
+    return vm->carry_result >> 8;
+}
+
+static inline v502_byte_t v502_pack_flags_vm(const v502_6502vm_t* vm) {
+    v502_byte_t flags = vm->flags & ~v502_LAZY_FLAGS;
+
+    flags |= v502_carry_vm(vm) ? v502_STATE_FLAG_CARRY : 0;
+    flags |= vm->zero_result == 0 ? v502_STATE_FLAG_ZERO : 0;
+    flags |= (vm->overflow_result >> 8) ? v502_STATE_FLAG_OVERFLOW : 0;
+    flags |= vm->negative_result & v502_STATE_FLAG_NEGATIVE;
+
+    return flags;
+}
+
+static inline void v502_unpack_flags_vm(v502_6502vm_t* vm, v502_byte_t flags) {
+    vm->flags = flags;
+
+    vm->carry_result = flags & v502_STATE_FLAG_CARRY ? 0x100 : 0;
+    vm->zero_result = !(flags & v502_STATE_FLAG_ZERO);
+    vm->overflow_result = flags & v502_STATE_FLAG_OVERFLOW ? 0x100 : 0;
+    vm->negative_result = flags & v502_STATE_FLAG_NEGATIVE;
+}
+
+// Engines bracket every run with these, between runs vm->flags holds every bit and hosts can use it directly
+static inline void v502_begin_flags_vm(v502_6502vm_t* vm) {
+    v502_unpack_flags_vm(vm, vm->flags);
+    vm->flags_pending = 1;
+}
+
+static inline void v502_end_flags_vm(v502_6502vm_t* vm) {
+    vm->flags = v502_pack_flags_vm(vm);
+    vm->flags_pending = 0;
+}
+
+// Decimal mode digit tables (see 6502_ops.c), indexed by [carry or borrow in][digit of A][digit of the operand]
+// Each entry holds the adjusted digit in its low nibble and the carry or borrow out in bit 4
+extern const v502_byte_t v502_BCD_ADD[2][16][16];
+extern const v502_byte_t v502_BCD_SUB[2][16][16];
+
+// Both return the two result digits with the carry or borrow out of the high one in bit 8
+static inline v502_word_t v502_bcd_add(v502_byte_t a, v502_byte_t val, v502_byte_t carry) {
+    v502_byte_t low = v502_BCD_ADD[carry][a & 0x0F][val & 0x0F];
+    v502_byte_t high = v502_BCD_ADD[low >> 4][a >> 4][val >> 4];
+
+    return (high << 4) | (low & 0x0F);
+}
+
+static inline v502_word_t v502_bcd_sub(v502_byte_t a, v502_byte_t val, v502_byte_t borrow) {
+    v502_byte_t low = v502_BCD_SUB[borrow][a & 0x0F][val & 0x0F];
+    v502_byte_t high = v502_BCD_SUB[low >> 4][a >> 4][val >> 4];
+
+    return (high << 4) | (low & 0x0F);
+}
+
+// Overflow and carry are both set when A + val + C doesn't fit, the carry itself isn't added to the accumulator
+// With D set this is a BCD add that does take the carry in and sets N, V and Z like the NMOS 6502
+// Those come from the sum before its high digit is adjusted (N and V) and the plain binary sum (Z)
+static inline void v502_add_flags_vm(v502_6502vm_t* vm, v502_byte_t val) {
+    if (vm->flags & v502_STATE_FLAG_DECIMAL) {
+        v502_byte_t a = vm->accumulator;
+        v502_byte_t carry = v502_carry_vm(vm);
+        v502_word_t r = v502_bcd_add(a, val, carry);
+        v502_byte_t half = (a & 0xF0) + (val & 0xF0) + v502_BCD_ADD[carry][a & 0x0F][val & 0x0F];
+
+        vm->carry_result = r;
+        vm->overflow_result = (~(a ^ val) & (a ^ half) & 0x80) << 1;
+        vm->negative_result = half;
+        vm->zero_result = a + val + carry;
+        vm->accumulator = (v502_byte_t)r;
+        return;
+    }
+
+    v502_word_t r = vm->accumulator + val + v502_carry_vm(vm);
+
+    vm->carry_result = vm->overflow_result = r;
+    vm->accumulator += val;
+}
+
+// With D set this is a BCD A - val - (1 - C) and C ends up set when nothing was borrowed, like the NMOS 6502
+// N, V and Z come from the plain binary subtraction there
+static inline void v502_sub_flags_vm(v502_6502vm_t* vm, v502_byte_t val) {
+    if (vm->flags & v502_STATE_FLAG_DECIMAL) {
+        v502_byte_t a = vm->accumulator;
+        v502_byte_t borrow = v502_carry_vm(vm) ^ 1;
+        v502_word_t r = v502_bcd_sub(a, val, borrow);
+        v502_byte_t binary = a - val - borrow;
+
+        vm->carry_result = r ^ 0x100;
+        vm->overflow_result = ((a ^ val) & (a ^ binary) & 0x80) << 1;
+        vm->negative_result = vm->zero_result = binary;
+        vm->accumulator = (v502_byte_t)r;
+        return;
+    }
+
+    v502_word_t r = vm->accumulator + -(int8_t)val + v502_carry_vm(vm);
+
+    vm->carry_result = vm->overflow_result = r > 0xFF ? 0x100 : 0;
+    vm->accumulator += -(int8_t)val;
+}
+
+// Bit 8 of lhs + 0x100 - rhs is set when lhs >= rhs, its low byte is 0 when they're equal
+// C and Z come from the same result, N is only touched when the operands are equal, then it's cleared
+static inline void v502_compare_flags_vm(v502_6502vm_t* vm, v502_byte_t lhs, v502_byte_t rhs) {
+    v502_word_t r = lhs + 0x100 - rhs;
+
+    vm->carry_result = r;
+    vm->zero_result = (v502_byte_t)r;
+    vm->negative_result &= -(v502_byte_t)(vm->zero_result != 0);
+}
+
+//
+// Addressing modes
+//
+// Each returns where the operand lives and leaves the program counter on the last byte of the instruction
+// The VM moves past the instruction afterwards
+//
+
+static inline v502_word_t v502_address_IMP(v502_6502vm_t* vm) {
+    return 0;
+}
+
+static inline v502_word_t v502_address_NOW(v502_6502vm_t* vm) {
+    return ++vm->program_counter;
+}
+
+static inline v502_word_t v502_address_REL(v502_6502vm_t* vm) {
+    return ++vm->program_counter;
+}
+
+static inline v502_word_t v502_address_ZPG(v502_6502vm_t* vm) {
+    return vm->hunk[++vm->program_counter];
+}
+
+static inline v502_word_t v502_address_X_ZPG(v502_6502vm_t* vm) {
+    return (v502_byte_t)(vm->hunk[++vm->program_counter] + vm->index_x);
+}
+
+static inline v502_word_t v502_address_Y_ZPG(v502_6502vm_t* vm) {
+    return (v502_byte_t)(vm->hunk[++vm->program_counter] + vm->index_y);
+}
+
+static inline v502_word_t v502_address_ABS(v502_6502vm_t* vm) {
+    v502_word_t where = v502_make_word(vm->hunk[vm->program_counter + 2], vm->hunk[vm->program_counter + 1]);
+    vm->program_counter += 2;
+    return where;
+}
+
+static inline v502_word_t v502_address_X_ABS(v502_6502vm_t* vm) {
+    return v502_address_ABS(vm) + vm->index_x;
+}
+
+static inline v502_word_t v502_address_Y_ABS(v502_6502vm_t* vm) {
+    return v502_address_ABS(vm) + vm->index_y;
+}
+
+static inline v502_word_t v502_address_IND(v502_6502vm_t* vm) {
+    v502_word_t ind = v502_address_ABS(vm);
+    return v502_make_word(v502_load_vm(vm, (v502_word_t)(ind + 1)), v502_load_vm(vm, ind));
+}
+
+static inline v502_word_t v502_address_X_IND(v502_6502vm_t* vm) {
+    v502_byte_t ind = vm->hunk[++vm->program_counter] + vm->index_x;
+    return v502_make_word(v502_load_vm(vm, (v502_byte_t)(ind + 1)), v502_load_vm(vm, ind));
+}
+
+static inline v502_word_t v502_address_Y_IND(v502_6502vm_t* vm) {
+    v502_byte_t ind = vm->hunk[++vm->program_counter];
+    return v502_make_word(v502_load_vm(vm, (v502_byte_t)(ind + 1)), v502_load_vm(vm, ind)) + vm->index_y;
+}
+
+//
+// Cycles
+//
+
+// Whether indexing crossed into another page, the unindexed address is recovered by taking the index back off
+static inline v502_byte_t v502_page_crossed(v502_word_t where, v502_byte_t index) {
+    return ((v502_word_t)(where - index) >> 8) != (where >> 8);
+}
+
+static inline v502_byte_t v502_page_crossed_X_ABS(v502_6502vm_t* vm, v502_word_t where) {
+    return v502_page_crossed(where, vm->index_x);
+}
+
+static inline v502_byte_t v502_page_crossed_Y_ABS(v502_6502vm_t* vm, v502_word_t where) {
+    return v502_page_crossed(where, vm->index_y);
+}
+
+static inline v502_byte_t v502_page_crossed_Y_IND(v502_6502vm_t* vm, v502_word_t where) {
+    return v502_page_crossed(where, vm->index_y);
+}
+
+// Extra cycles of a taken branch, from is where execution would have gone on otherwise
+static inline v502_byte_t v502_branch_cycles(v502_word_t from, v502_word_t target) {
+    return 1 + ((from >> 8) != (target >> 8));
+}
+
+// Adds an instruction's cycles once its operand address is known, PAGE is a constant so this folds down to a plain add where it's 0
+// Only X_ABS, Y_ABS and Y_IND have PAGE set, so only those need a v502_page_crossed_ function
+#define v502_CHARGE_CYCLES(VM, MODE, CYCLES, PAGE, WHERE) \
+    (VM)->cycles += (CYCLES) + v502_CHARGE_PAGE_##PAGE(VM, MODE, WHERE)
+
+#define v502_CHARGE_PAGE_0(VM, MODE, WHERE) 0
+#define v502_CHARGE_PAGE_1(VM, MODE, WHERE) v502_page_crossed_##MODE(VM, WHERE)
+
+// What vm->cycles may reach before a run stops, passing 0 removes the limit
+static inline v502_qword_t v502_cycle_limit_vm(v502_6502vm_t* vm, v502_qword_t max_cycles) {
+    if (max_cycles == 0 || vm->cycles + max_cycles < vm->cycles)
+        return UINT64_MAX;
+
+    return vm->cycles + max_cycles;
+}
+
+//
+// Profiling
+//
+
+// Engines count every instruction right before executing it, this is nothing at all unless V502_PROFILING is defined
+#ifdef V502_PROFILING
+#define v502_PROFILE_OP(VM, WHERE, OP) \
+    if ((VM)->profile != NULL) { \
+        (VM)->profile->opcodes[OP] += 1; \
+        (VM)->profile->addresses[WHERE] += 1; \
+    }
+#else
+#define v502_PROFILE_OP(VM, WHERE, OP)
+#endif
+
+//
+// Breakpoints and watchpoints
+//
+
+// Why the table engine has to stop before the next instruction, v502_EXIT_REASON_BUDGET if it doesn't
+// Watched accesses by the last instruction come first, a breakpoint only counts once the run executed something (see v502_set_breakpoint_vm)
+static inline v502_EXIT_REASON_E v502_debug_stop_vm(const v502_6502vm_t* vm, v502_qword_t executed) {
+    if (vm->debug->watch_hit != 0)
+        return (v502_EXIT_REASON_E)vm->debug->watch_hit;
+
+    if (executed != 0 && v502_has_breakpoint(vm->debug, vm->program_counter))
+        return v502_EXIT_REASON_BREAKPOINT;
+
+    return v502_EXIT_REASON_BUDGET;
+}
+
+//
+// Tracing (see 6502_trace.c)
+//
+
+// Records the instruction about to run at the program counter, only call this while vm->trace is set
+void v502_trace_op_vm(v502_6502vm_t* vm, v502_byte_t op);
+
+// Takes back the record of an instruction that didn't run (breakpoints and unknown opcodes), only right after v502_trace_op_vm()
+void v502_drop_trace_op_vm(v502_6502vm_t* vm);
+
+// Hands everything recorded so far to the drain thread, engines do this when a run ends
+void v502_publish_trace_vm(v502_6502vm_t* vm);
+
+//
+// Idle loops (see 6502_idle.c)
+//
+
+// Interpreters look for idle loops once every this many taken branches and jumps, shifted left by vm->idle_backoff
+#define v502_IDLE_CHECK_INTERVAL 64
+
+// Returns how many instructions one trip around the idle loop at the program counter takes and its cycles through cycles, 0 if the VM isn't in one
+uint32_t v502_find_idle_loop_vm(v502_6502vm_t* vm, v502_qword_t* cycles);
+
+// Skips as many whole trips around the loop as fit in what's left of the run and returns how many instructions that was
+// UINT64_MAX means unbounded for both limits, if neither is bounded this sleeps for a bit instead
+v502_qword_t v502_fast_forward_vm(v502_6502vm_t* vm, uint32_t instructions, v502_qword_t cycles, v502_qword_t instructions_left, v502_qword_t cycle_limit);
+
+// Both of the above, also keeps vm->idle_backoff up to date
+v502_qword_t v502_skip_idle_vm(v502_6502vm_t* vm, v502_qword_t instructions_left, v502_qword_t cycle_limit);
+
+//
+// Interrupts
+//
+
+// Engines call this when a run starts and wherever control flow was redirected anyway, the common case is a single load
+static inline void v502_poll_interrupts_vm(v502_6502vm_t* vm) {
+    if (v502_atomic_load_u32(&vm->interrupt_lines) != 0)
+        v502_take_interrupt_vm(vm);
+}
+
+//
+// Instructions
+//
+// These receive the operand location from the addressing mode, implied instructions ignore it
+//
+
+#define v502_DEFINE_EXEC(MNEMONIC) static inline v502_OP_STATE_E v502_exec_##MNEMONIC(v502_6502vm_t* vm, v502_word_t where)
+
+//
+// Accumulator functions
+//
+
+v502_DEFINE_EXEC(ADC) {
+    v502_add_flags_vm(vm, v502_load_vm(vm, where));
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(SBC) {
+    v502_sub_flags_vm(vm, v502_load_vm(vm, where));
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(STA) {
+    v502_store_vm(vm, where, vm->accumulator);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(LDA) {
+    vm->accumulator = v502_load_vm(vm, where);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(CMP) {
+    v502_compare_flags_vm(vm, vm->accumulator, v502_load_vm(vm, where));
+    return V502_OP_STATE_SUCCESS;
+}
+
+//
+// X Register
+//
+
+v502_DEFINE_EXEC(INX) {
+    vm->index_x += 1;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(DEX) {
+    vm->index_x -= 1;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(TAX) {
+    vm->index_x = vm->accumulator;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(TXA) {
+    vm->accumulator = vm->index_x;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(TSX) {
+    vm->index_x = vm->stack_ptr;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(TXS) {
+    vm->stack_ptr = vm->index_x;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(LDX) {
+    vm->index_x = v502_load_vm(vm, where);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(CPX) {
+    v502_compare_flags_vm(vm, vm->index_x, v502_load_vm(vm, where));
+    return V502_OP_STATE_SUCCESS;
+}
+
+//
+// Y Register
+//
+
+v502_DEFINE_EXEC(INY) {
+    vm->index_y += 1;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(DEY) {
+    vm->index_y -= 1;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(TAY) {
+    vm->index_y = vm->accumulator;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(TYA) {
+    vm->accumulator = vm->index_y;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(LDY) {
+    vm->index_y = v502_load_vm(vm, where);
+    return V502_OP_STATE_SUCCESS;
+}
+
+//
+// Stack ops
+//
+
+v502_DEFINE_EXEC(PLA) {
+    vm->accumulator = v502_load_vm(vm, v502_make_word(0x01, ++vm->stack_ptr));
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr), 0);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(PHA) {
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), vm->accumulator);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(PLP) {
+    v502_unpack_flags_vm(vm, v502_load_vm(vm, v502_make_word(0x01, ++vm->stack_ptr)));
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr), 0);
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(PHP) {
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), v502_pack_flags_vm(vm));
+    return V502_OP_STATE_SUCCESS;
+}
+
+//
+// State register
+//
+
+v502_DEFINE_EXEC(SEI) {
+    vm->flags |= v502_STATE_FLAG_INTERRUPT;
+    return V502_OP_STATE_SUCCESS;
+}
+
+v502_DEFINE_EXEC(CLI) {
+    vm->flags &= ~v502_STATE_FLAG_INTERRUPT;
+    return V502_OP_STATE_SUCCESS;
+}
+
+//
+// Flow control ops
+//
+
+v502_DEFINE_EXEC(NOP) {
+    return V502_OP_STATE_SUCCESS; // Waste a cycle
+}
+
+// Branches are relative to the offset byte, if we don't branch the VM skips past it
+// Taken branches add their extra cycles here, the base cycles are charged by the caller like for every other instruction
+#define v502_DEFINE_BRANCH(MNEMONIC, CONDITION) \
+    v502_DEFINE_EXEC(MNEMONIC) { \
+        if (!(CONDITION)) \
+            return V502_OP_STATE_SUCCESS; \
+        \
+        vm->program_counter = where + (int8_t) vm->hunk[where]; \
+        vm->cycles += v502_branch_cycles((v502_word_t)(where + 1), vm->program_counter); \
+        return V502_OP_STATE_SUCCESS_NO_COUNT; \
+    }
+
+// Equality is carry and zero together
+#define v502_EQUAL_VM(VM) (v502_carry_vm(VM) && (VM)->zero_result == 0)
+
+v502_DEFINE_BRANCH(BPL, !(vm->negative_result & v502_STATE_FLAG_NEGATIVE))
+v502_DEFINE_BRANCH(BMI, vm->negative_result & v502_STATE_FLAG_NEGATIVE)
+v502_DEFINE_BRANCH(BVC, !(vm->overflow_result >> 8))
+v502_DEFINE_BRANCH(BVS, vm->overflow_result >> 8)
+v502_DEFINE_BRANCH(BCC, !v502_carry_vm(vm))
+v502_DEFINE_BRANCH(BCS, v502_carry_vm(vm))
+v502_DEFINE_BRANCH(BNE, !v502_EQUAL_VM(vm))
+v502_DEFINE_BRANCH(BEQ, v502_EQUAL_VM(vm))
+
+v502_DEFINE_EXEC(JMP) {
+    vm->program_counter = where;
+    return V502_OP_STATE_SUCCESS_NO_COUNT;
+}
+
+// The addressing mode has already moved us onto the last byte of the JSR, that's our return address
+v502_DEFINE_EXEC(JSR) {
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), vm->program_counter);
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), vm->program_counter >> 8);
+    vm->program_counter = where;
+
+    return V502_OP_STATE_SUCCESS_NO_COUNT;
+}
+
+v502_DEFINE_EXEC(RTS) {
+    v502_byte_t l = v502_load_vm(vm, v502_make_word(0x01, vm->stack_ptr + 2));
+    v502_byte_t h = v502_load_vm(vm, v502_make_word(0x01, vm->stack_ptr + 1));
+    vm->program_counter = v502_make_word(h, l);
+
+    v502_store_vm(vm, v502_make_word(0x01, ++vm->stack_ptr), 0);
+    v502_store_vm(vm, v502_make_word(0x01, ++vm->stack_ptr), 0);
+
+    return V502_OP_STATE_SUCCESS;
+}
+
+// Pulls what v502_take_interrupt_vm() pushed, unlike RTS the return address is the interrupted instruction itself
+v502_DEFINE_EXEC(RTI) {
+    v502_unpack_flags_vm(vm, v502_load_vm(vm, v502_make_word(0x01, ++vm->stack_ptr)));
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr), 0);
+
+    v502_byte_t h = v502_load_vm(vm, v502_make_word(0x01, ++vm->stack_ptr));
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr), 0);
+
+    v502_byte_t l = v502_load_vm(vm, v502_make_word(0x01, ++vm->stack_ptr));
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr), 0);
+
+    vm->program_counter = v502_make_word(h, l);
+    return V502_OP_STATE_SUCCESS_NO_COUNT;
+}
+
+//
+// Generated opfuncs (see 6502_ops.c)
+//
+#define v502_DECLARE_OPFUNC(NAME, MNEMONIC, MODE, CYCLES, PAGE) v502_DEFINE_OPFUNC(NAME);
+v502_MOS_OP_LIST(v502_DECLARE_OPFUNC)
+#undef v502_DECLARE_OPFUNC
+
+v502_DEFINE_OPFUNC(UNKNOWN);
+
+// Expands to 256 comma separated copies of X, designated initializers listed after it override single entries
+// This is how the static dispatch tables get a default for every opcode we don't implement
+#define v502_REPEAT_4(X) X, X, X, X
+#define v502_REPEAT_16(X) v502_REPEAT_4(X), v502_REPEAT_4(X), v502_REPEAT_4(X), v502_REPEAT_4(X)
+#define v502_REPEAT_64(X) v502_REPEAT_16(X), v502_REPEAT_16(X), v502_REPEAT_16(X), v502_REPEAT_16(X)
+#define v502_REPEAT_256(X) v502_REPEAT_64(X), v502_REPEAT_64(X), v502_REPEAT_64(X), v502_REPEAT_64(X)
+
+#endif
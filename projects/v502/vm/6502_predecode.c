@@ -0,0 +1,262 @@
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Predecoded engine
+//
+// The first time an address is executed we decode it into vm->decode_cache, after that the opcode and operand are never read again
+// Stores invalidate the entries they overlap (see v502_store_vm), so self modifying code keeps working
+//
+
+//
+// Addressing modes, same as the regular ones but the operand was fetched at decode time
+// The program counter still sits on the opcode when these run
+//
+
+static inline v502_word_t v502_decoded_address_IMP(v502_6502vm_t* vm, v502_word_t operand) {
+    return 0;
+}
+
+static inline v502_word_t v502_decoded_address_NOW(v502_6502vm_t* vm, v502_word_t operand) {
+    return vm->program_counter + 1;
+}
+
+static inline v502_word_t v502_decoded_address_REL(v502_6502vm_t* vm, v502_word_t operand) {
+    return vm->program_counter + 1;
+}
+
+static inline v502_word_t v502_decoded_address_ZPG(v502_6502vm_t* vm, v502_word_t operand) {
+    return operand;
+}
+
+static inline v502_word_t v502_decoded_address_X_ZPG(v502_6502vm_t* vm, v502_word_t operand) {
+    return (v502_byte_t)(operand + vm->index_x);
+}
+
+static inline v502_word_t v502_decoded_address_Y_ZPG(v502_6502vm_t* vm, v502_word_t operand) {
+    return (v502_byte_t)(operand + vm->index_y);
+}
+
+static inline v502_word_t v502_decoded_address_ABS(v502_6502vm_t* vm, v502_word_t operand) {
+    return operand;
+}
+
+static inline v502_word_t v502_decoded_address_X_ABS(v502_6502vm_t* vm, v502_word_t operand) {
+    return operand + vm->index_x;
+}
+
+static inline v502_word_t v502_decoded_address_Y_ABS(v502_6502vm_t* vm, v502_word_t operand) {
+    return operand + vm->index_y;
+}
+
+static inline v502_word_t v502_decoded_address_IND(v502_6502vm_t* vm, v502_word_t operand) {
+    return v502_make_word(v502_load_vm(vm, (v502_word_t)(operand + 1)), v502_load_vm(vm, operand));
+}
+
+static inline v502_word_t v502_decoded_address_X_IND(v502_6502vm_t* vm, v502_word_t operand) {
+    v502_byte_t ind = operand + vm->index_x;
+    return v502_make_word(v502_load_vm(vm, (v502_byte_t)(ind + 1)), v502_load_vm(vm, ind));
+}
+
+static inline v502_word_t v502_decoded_address_Y_IND(v502_6502vm_t* vm, v502_word_t operand) {
+    return v502_make_word(v502_load_vm(vm, (v502_byte_t)(operand + 1)), v502_load_vm(vm, operand)) + vm->index_y;
+}
+
+//
+// Decoded handlers
+//
+#define v502_GENERATE_DECODED(NAME, MNEMONIC, MODE, CYCLES, PAGE) \
+    static v502_OP_STATE_E v502_decoded_##NAME(v502_6502vm_t* vm, const v502_decoded_op_t* decoded) { \
+        v502_word_t where = v502_decoded_address_##MODE(vm, decoded->operand); \
+        v502_CHARGE_CYCLES(vm, MODE, CYCLES, PAGE, where); \
+        vm->program_counter += v502_MODE_LENGTH_##MODE - 1; \
+        return v502_exec_##MNEMONIC(vm, where); \
+    }
+
+v502_MOS_OP_LIST(v502_GENERATE_DECODED)
+#undef v502_GENERATE_DECODED
+
+// Overridden and unknown opcodes are looked up in the opfunc table every time
+static v502_OP_STATE_E v502_decoded_opfunc(v502_6502vm_t* vm, const v502_decoded_op_t* decoded) {
+    return vm->opfuncs[decoded->opcode](vm, decoded->opcode);
+}
+
+// Breakpoints are cached like any other instruction, so addresses without one don't check the bitmap
+static v502_OP_STATE_E v502_decoded_breakpoint(v502_6502vm_t* vm, const v502_decoded_op_t* decoded) {
+    return V502_OP_STATE_BREAKPOINT;
+}
+
+static void v502_decode_instruction(v502_6502vm_t* vm, v502_word_t where, v502_decoded_op_t* decoded) {
+    v502_byte_t opcode = vm->hunk[where];
+
+    decoded->opcode = opcode;
+    decoded->handler = v502_decoded_opfunc;
+    decoded->length = 0;
+    decoded->operand = 0;
+
+    switch (opcode) {
+#define v502_DECODE_CASE(NAME, MNEMONIC, MODE, CYCLES, PAGE) \
+        case v502_MOS_OP_##NAME: \
+            if (vm->opfuncs[opcode] == OP_##NAME) { \
+                decoded->handler = v502_decoded_##NAME; \
+                decoded->length = v502_MODE_LENGTH_##MODE; \
+            } \
+            break;
+
+        v502_MOS_OP_LIST(v502_DECODE_CASE)
+#undef v502_DECODE_CASE
+
+        default:
+            break;
+    }
+
+    if (decoded->length == 2)
+        decoded->operand = vm->hunk[(v502_word_t)(where + 1)];
+
+    if (decoded->length == 3)
+        decoded->operand = v502_make_word(vm->hunk[(v502_word_t)(where + 2)], vm->hunk[(v502_word_t)(where + 1)]);
+}
+
+static void v502_decode_op(v502_6502vm_t* vm, v502_word_t where, v502_decoded_op_t* decoded) {
+    if (vm->debug != NULL && v502_has_breakpoint(vm->debug, where)) {
+        decoded->opcode = vm->hunk[where];
+        decoded->handler = v502_decoded_breakpoint;
+        decoded->length = 0;
+        decoded->operand = 0;
+        return;
+    }
+
+    v502_decode_instruction(vm, where, decoded);
+}
+
+void v502_invalidate_decoded_vm(v502_6502vm_t *vm, v502_word_t where) {
+    v502_decoded_op_t* cache = vm->decode_cache;
+
+    cache[where].handler = NULL;
+
+    // The byte might also be the operand of one of the two instructions before it
+    if (cache[(v502_word_t)(where - 1)].length >= 2)
+        cache[(v502_word_t)(where - 1)].handler = NULL;
+
+    if (cache[(v502_word_t)(where - 2)].length >= 3)
+        cache[(v502_word_t)(where - 2)].handler = NULL;
+}
+
+void v502_invalidate_vm(v502_6502vm_t *vm, v502_word_t where, v502_dword_t length) {
+    assert(vm != NULL);
+
+    // Only the host calls this, whatever it wrote there is input to the program
+    if (vm->recording != NULL)
+        v502_record_memory_vm(vm, where, length);
+
+    v502_invalidate_code_vm(vm, where, length);
+}
+
+void v502_invalidate_code_vm(v502_6502vm_t *vm, v502_word_t where, v502_dword_t length) {
+    if (vm->jit != NULL)
+        v502_invalidate_jit_vm(vm, where, length);
+
+    if (vm->decode_cache == NULL)
+        return;
+
+    if (length >= v502_DECODE_CACHE_ENTRIES) {
+        memset(vm->decode_cache, 0, v502_DECODE_CACHE_ENTRIES * sizeof(v502_decoded_op_t));
+        return;
+    }
+
+    for (v502_dword_t b = 0; b < length; b++)
+        v502_invalidate_decoded_vm(vm, (v502_word_t)(where + b));
+}
+
+v502_EXIT_REASON_E v502_run_predecoded_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    assert(vm != NULL);
+
+    if (vm->decode_cache == NULL)
+        vm->decode_cache = calloc(v502_DECODE_CACHE_ENTRIES, sizeof(v502_decoded_op_t));
+
+    v502_decoded_op_t* cache = vm->decode_cache;
+    v502_EXIT_REASON_E reason = v502_EXIT_REASON_BUDGET;
+    v502_qword_t executed = 0;
+    v502_qword_t start_cycles = vm->cycles;
+    v502_qword_t cycle_limit = v502_cycle_limit_vm(vm, max_cycles);
+    v502_byte_t next_op = 0;
+    uint32_t idle_countdown = v502_IDLE_CHECK_INTERVAL;
+
+    v502_begin_flags_vm(vm);
+    v502_poll_interrupts_vm(vm);
+
+    while ((max_instructions == 0 || executed < max_instructions) && vm->cycles < cycle_limit) {
+        v502_decoded_op_t* decoded = &cache[vm->program_counter];
+
+        if (decoded->handler == NULL)
+            v502_decode_op(vm, vm->program_counter, decoded);
+
+        next_op = decoded->opcode;
+        v502_PROFILE_OP(vm, vm->program_counter, next_op);
+        v502_OP_STATE_E state = decoded->handler(vm, decoded);
+
+        if (state == V502_OP_STATE_SUCCESS) {
+            vm->program_counter += 1;
+            executed += 1;
+            continue;
+        }
+
+        if (state == V502_OP_STATE_SUCCESS_NO_COUNT) {
+            executed += 1;
+            v502_poll_interrupts_vm(vm);
+
+            if (--idle_countdown == 0) {
+                executed += v502_skip_idle_vm(vm, max_instructions == 0 ? UINT64_MAX : max_instructions - executed, cycle_limit);
+                idle_countdown = v502_IDLE_CHECK_INTERVAL << vm->idle_backoff;
+            }
+
+            continue;
+        }
+
+        // A run that starts on a breakpoint is resuming from it, the instruction under it runs once without going into the cache
+        if (state == V502_OP_STATE_BREAKPOINT && executed == 0 && decoded->handler == v502_decoded_breakpoint) {
+            v502_decoded_op_t stepped;
+            v502_decode_instruction(vm, vm->program_counter, &stepped);
+            state = stepped.handler(vm, &stepped);
+
+            if (state == V502_OP_STATE_SUCCESS) {
+                vm->program_counter += 1;
+                executed += 1;
+                continue;
+            }
+
+            if (state == V502_OP_STATE_SUCCESS_NO_COUNT) {
+                executed += 1;
+                v502_poll_interrupts_vm(vm);
+                continue;
+            }
+        }
+
+        if (state == V502_OP_STATE_HALT) {
+            vm->program_counter += 1;
+            executed += 1;
+            reason = v502_EXIT_REASON_HALT;
+        } else if (state == V502_OP_STATE_BREAKPOINT)
+            reason = v502_EXIT_REASON_BREAKPOINT;
+        else
+            reason = v502_EXIT_REASON_UNKNOWN_OP;
+
+        break;
+    }
+
+    v502_end_flags_vm(vm);
+
+    if (exit_info != NULL) {
+        exit_info->reason = reason;
+        exit_info->instructions = executed;
+        exit_info->cycles = vm->cycles - start_cycles;
+        exit_info->program_counter = vm->program_counter;
+        exit_info->opcode = next_op;
+        exit_info->watch_address = 0; // Only the table engine stops on watchpoints
+    }
+
+    return reason;
+}
@@ -0,0 +1,691 @@
+#include "6502_record.h"
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Events
+//
+// Each event is its kind, how far vm->cycles moved since the previous event and then its payload
+// The distance is a zigzag encoded varint so a reset (which winds the cycles back) still fits, most events take 3 to 5 bytes
+//
+
+typedef enum v502_RECORD_EVENT {
+    v502_RECORD_EVENT_READ = 0, // where (2 bytes), value
+    v502_RECORD_EVENT_WRITE = 1, // where (2 bytes), value
+    v502_RECORD_EVENT_MEMORY = 2, // where (2 bytes), length (varint), the bytes written
+    v502_RECORD_EVENT_MAP = 3, // first page, page count (varint), 1 for a device or 0 for RAM
+    v502_RECORD_EVENT_RESET = 4,
+    v502_RECORD_EVENT_IRQ = 5,
+    v502_RECORD_EVENT_NMI = 6,
+    v502_RECORD_EVENT_END = 7, // program counter (2 bytes), stack pointer, accumulator, X, Y, flags, memory hash (8 bytes)
+    v502_RECORD_EVENT_STATE = 8 // program counter (2 bytes), stack pointer, accumulator, X, Y, flags, cycles (8 bytes)
+} v502_RECORD_EVENT_E;
+
+#define v502_RECORD_END_SIZE 15
+#define v502_RECORD_STATE_SIZE 15
+
+// Events are gathered here and written out once it fills up, longer than any event but the memory ones
+#define v502_RECORDING_BUFFER_SIZE (1 << 16)
+#define v502_RECORDING_MAX_EVENT 32
+
+struct v502_recording {
+    FILE* file;
+    v502_qword_t stamp; // vm->cycles at the previous event
+    int failed;
+
+    size_t used;
+    v502_byte_t buffer[v502_RECORDING_BUFFER_SIZE];
+};
+
+// FNV-1a, only has to tell whether the replay ended up with the same memory
+static uint64_t v502_hash_memory(const v502_byte_t* memory, v502_dword_t length) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (v502_dword_t b = 0; b < length; b++)
+        hash = (hash ^ memory[b]) * 0x100000001B3ULL;
+
+    return hash;
+}
+
+//
+// Writing
+//
+
+static void v502_flush_recording(v502_recording_t* recording) {
+    if (recording->used != 0 && fwrite(recording->buffer, 1, recording->used, recording->file) != recording->used)
+        recording->failed = 1;
+
+    recording->used = 0;
+}
+
+static void v502_put_byte(v502_recording_t* recording, v502_byte_t value) {
+    recording->buffer[recording->used++] = value;
+}
+
+static void v502_put_word(v502_recording_t* recording, v502_word_t value) {
+    v502_put_byte(recording, value & 0xFF);
+    v502_put_byte(recording, value >> 8);
+}
+
+static void v502_put_varint(v502_recording_t* recording, v502_qword_t value) {
+    while (value >= 0x80) {
+        v502_put_byte(recording, (value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+
+    v502_put_byte(recording, (v502_byte_t)value);
+}
+
+static void v502_put_bytes(v502_recording_t* recording, const v502_byte_t* bytes, size_t length) {
+    while (length != 0) {
+        if (recording->used == v502_RECORDING_BUFFER_SIZE)
+            v502_flush_recording(recording);
+
+        size_t count = v502_RECORDING_BUFFER_SIZE - recording->used;
+
+        if (count > length)
+            count = length;
+
+        memcpy(recording->buffer + recording->used, bytes, count);
+        recording->used += count;
+
+        bytes += count;
+        length -= count;
+    }
+}
+
+// Leaves room for the rest of the event, except the bytes of memory events which v502_put_bytes() makes room for itself
+static v502_recording_t* v502_begin_event_at(v502_6502vm_t* vm, v502_RECORD_EVENT_E kind, v502_qword_t cycles) {
+    v502_recording_t* recording = vm->recording;
+
+    if (recording->used + v502_RECORDING_MAX_EVENT > v502_RECORDING_BUFFER_SIZE)
+        v502_flush_recording(recording);
+
+    int64_t distance = (int64_t)(cycles - recording->stamp);
+    recording->stamp = cycles;
+
+    v502_put_byte(recording, kind);
+    v502_put_varint(recording, ((uint64_t)distance << 1) ^ (uint64_t)(distance >> 63));
+
+    return recording;
+}
+
+static v502_recording_t* v502_begin_event(v502_6502vm_t* vm, v502_RECORD_EVENT_E kind) {
+    return v502_begin_event_at(vm, kind, vm->cycles);
+}
+
+static void v502_put_memory_event(v502_6502vm_t* vm, v502_qword_t cycles, v502_word_t where, v502_dword_t length) {
+    v502_recording_t* recording = v502_begin_event_at(vm, v502_RECORD_EVENT_MEMORY, cycles);
+
+    v502_put_word(recording, where);
+    v502_put_varint(recording, length);
+    v502_put_bytes(recording, vm->hunk + where, length);
+}
+
+void v502_record_read_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    v502_recording_t* recording = v502_begin_event(vm, v502_RECORD_EVENT_READ);
+
+    v502_put_word(recording, where);
+    v502_put_byte(recording, value);
+}
+
+void v502_record_interrupt_vm(v502_6502vm_t* vm, v502_word_t vector) {
+    v502_begin_event(vm, vector == v502_NMI_VECTOR_INDEX ? v502_RECORD_EVENT_NMI : v502_RECORD_EVENT_IRQ);
+}
+
+void v502_record_write_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    v502_recording_t* recording = v502_begin_event(vm, v502_RECORD_EVENT_WRITE);
+
+    v502_put_word(recording, where);
+    v502_put_byte(recording, value);
+}
+
+void v502_record_memory_vm(v502_6502vm_t* vm, v502_word_t where, v502_dword_t length) {
+    // Pages past the end of the hunk have no memory to write
+    if (where >= vm->hunk_length)
+        return;
+
+    if (length > vm->hunk_length - where)
+        length = vm->hunk_length - where;
+
+    v502_put_memory_event(vm, vm->cycles, where, length);
+}
+
+void v502_record_state_vm(v502_6502vm_t* vm, v502_qword_t cycles, const v502_byte_t* before) {
+    // The replay gets there by running up to cycles, so everything is stamped with that rather than where the VM is now
+    if (before != NULL) {
+        for (v502_dword_t where = 0; where < vm->hunk_length; where += 256) {
+            v502_dword_t length = vm->hunk_length - where < 256 ? vm->hunk_length - where : 256;
+
+            if (memcmp(vm->hunk + where, before + where, length) != 0)
+                v502_put_memory_event(vm, cycles, (v502_word_t)where, length);
+        }
+    }
+
+    v502_recording_t* recording = v502_begin_event_at(vm, v502_RECORD_EVENT_STATE, cycles);
+
+    v502_put_word(recording, vm->program_counter);
+    v502_put_byte(recording, vm->stack_ptr);
+    v502_put_byte(recording, vm->accumulator);
+    v502_put_byte(recording, vm->index_x);
+    v502_put_byte(recording, vm->index_y);
+    v502_put_byte(recording, v502_get_flags_vm(vm));
+
+    for (int b = 0; b < 8; b++)
+        v502_put_byte(recording, (v502_byte_t)(vm->cycles >> (b * 8)));
+}
+
+void v502_record_reset_vm(v502_6502vm_t* vm) {
+    v502_begin_event(vm, v502_RECORD_EVENT_RESET);
+}
+
+void v502_record_map_vm(v502_6502vm_t* vm, v502_byte_t first_page, uint32_t page_count, int device) {
+    v502_recording_t* recording = v502_begin_event(vm, v502_RECORD_EVENT_MAP);
+
+    v502_put_byte(recording, first_page);
+    v502_put_varint(recording, page_count);
+    v502_put_byte(recording, device != 0);
+}
+
+int v502_begin_recording_vm(v502_6502vm_t* vm, const char* path) {
+    assert(vm != NULL && path != NULL);
+
+    if (vm->recording != NULL)
+        return 0;
+
+    FILE* file = fopen(path, "wb");
+
+    if (file == NULL)
+        return 0;
+
+    v502_recording_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, v502_RECORDING_MAGIC, sizeof(v502_RECORDING_MAGIC));
+    header.version = v502_RECORDING_VERSION;
+    header.feature_set = (uint16_t)vm->feature_set;
+    header.hunk_length = vm->hunk_length;
+
+    header.cycles = vm->cycles;
+    header.program_counter = vm->program_counter;
+    header.stack_ptr = vm->stack_ptr;
+    header.accumulator = vm->accumulator;
+    header.index_x = vm->index_x;
+    header.index_y = vm->index_y;
+    header.flags = vm->flags;
+
+    for (uint32_t p = 0; p < v502_BUS_PAGES; p++)
+        if (v502_mapped_device_vm(vm, p) != NULL)
+            header.device_pages[p >> 6] |= (uint64_t)1 << (p & 63);
+
+    // Flushed straight away, a process that dies while recording still leaves something to replay
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(vm->hunk, 1, vm->hunk_length, file) != vm->hunk_length || fflush(file) != 0) {
+        fclose(file);
+        return 0;
+    }
+
+    v502_recording_t* recording = calloc(1, sizeof(v502_recording_t));
+
+    recording->file = file;
+    recording->stamp = vm->cycles;
+
+    vm->recording = recording;
+    return 1;
+}
+
+int v502_end_recording_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+
+    v502_recording_t* recording = vm->recording;
+
+    if (recording == NULL)
+        return 1;
+
+    v502_begin_event(vm, v502_RECORD_EVENT_END);
+
+    v502_put_word(recording, vm->program_counter);
+    v502_put_byte(recording, vm->stack_ptr);
+    v502_put_byte(recording, vm->accumulator);
+    v502_put_byte(recording, vm->index_x);
+    v502_put_byte(recording, vm->index_y);
+    v502_put_byte(recording, vm->flags);
+
+    uint64_t hash = v502_hash_memory(vm->hunk, vm->hunk_length);
+
+    for (int b = 0; b < 8; b++)
+        v502_put_byte(recording, (v502_byte_t)(hash >> (b * 8)));
+
+    v502_flush_recording(recording);
+
+    int succeeded = !recording->failed;
+
+    if (fclose(recording->file) != 0)
+        succeeded = 0;
+
+    free(recording);
+
+    vm->recording = NULL;
+    return succeeded;
+}
+
+//
+// Replaying
+//
+// The whole recording is loaded up front and walked by two cursors
+// v502_run_replay_vm() looks for the next host event, runs the VM up to its stamp and applies it
+// Device reads happen in the middle of those runs, the replay device picks them up with a cursor of its own which may never pass the host one
+//
+
+typedef struct v502_replay_cursor {
+    size_t position;
+    v502_qword_t stamp;
+} v502_replay_cursor_t;
+
+typedef struct v502_replay_event {
+    v502_RECORD_EVENT_E kind;
+    v502_qword_t stamp;
+
+    v502_word_t where;
+    v502_byte_t value;
+    v502_dword_t length; // Bytes of a memory event, pages of a map event
+    const v502_byte_t* data; // The bytes of a memory event or the state of the end event
+} v502_replay_event_t;
+
+struct v502_replay {
+    v502_recording_header_t header;
+    v502_byte_t* memory; // header.hunk_length bytes
+
+    v502_byte_t* events;
+    size_t length;
+
+    v502_bus_device_t device; // Mapped over every device page, reads come from the recording and writes go nowhere
+    v502_replay_cursor_t reads;
+    size_t pending; // Where the host event v502_run_replay_vm() is running towards starts
+    int diverged;
+};
+
+static int v502_get_varint(const v502_replay_t* replay, size_t* position, v502_qword_t* value) {
+    *value = 0;
+
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        if (*position >= replay->length)
+            return 0;
+
+        v502_byte_t b = replay->events[(*position)++];
+        *value |= (v502_qword_t)(b & 0x7F) << shift;
+
+        if (!(b & 0x80))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Decodes the event at the cursor and moves past it, returns 0 once the recording ends (or ends with half an event)
+static int v502_next_event(const v502_replay_t* replay, v502_replay_cursor_t* cursor, v502_replay_event_t* event) {
+    size_t position = cursor->position;
+    v502_qword_t distance;
+
+    // Only the fields the kind has get filled in below
+    memset(event, 0, sizeof(*event));
+
+    if (position >= replay->length)
+        return 0;
+
+    event->kind = (v502_RECORD_EVENT_E)replay->events[position++];
+
+    if (!v502_get_varint(replay, &position, &distance))
+        return 0;
+
+    event->stamp = cursor->stamp + (v502_qword_t)((distance >> 1) ^ -(distance & 1));
+
+    const v502_byte_t* payload = replay->events + position;
+    size_t left = replay->length - position;
+    size_t size;
+
+    switch (event->kind) {
+        case v502_RECORD_EVENT_READ:
+        case v502_RECORD_EVENT_WRITE:
+            size = 3;
+
+            if (left >= size) {
+                event->where = v502_make_word(payload[1], payload[0]);
+                event->value = payload[2];
+            }
+
+            break;
+
+        case v502_RECORD_EVENT_MEMORY: {
+            v502_qword_t length;
+            size_t start = position + 2;
+
+            if (left < 2 || !v502_get_varint(replay, &start, &length))
+                return 0;
+
+            event->where = v502_make_word(payload[1], payload[0]);
+            event->length = (v502_dword_t)length;
+            event->data = replay->events + start;
+
+            size = start - position + length;
+            break;
+        }
+
+        case v502_RECORD_EVENT_MAP: {
+            v502_qword_t count;
+            size_t start = position + 1;
+
+            if (left < 1 || !v502_get_varint(replay, &start, &count))
+                return 0;
+
+            event->where = payload[0];
+            event->length = (v502_dword_t)count;
+            event->value = start < replay->length ? replay->events[start] : 0;
+
+            size = start - position + 1;
+            break;
+        }
+
+        case v502_RECORD_EVENT_RESET:
+        case v502_RECORD_EVENT_IRQ:
+        case v502_RECORD_EVENT_NMI:
+            size = 0;
+            break;
+
+        case v502_RECORD_EVENT_END:
+            size = v502_RECORD_END_SIZE;
+            event->data = payload;
+            break;
+
+        case v502_RECORD_EVENT_STATE:
+            size = v502_RECORD_STATE_SIZE;
+            event->data = payload;
+            break;
+
+        default:
+            return 0;
+    }
+
+    if (left < size)
+        return 0;
+
+    cursor->position = position + size;
+    cursor->stamp = event->stamp;
+
+    return 1;
+}
+
+static v502_byte_t v502_replay_read(void* user, v502_6502vm_t* vm, v502_word_t where) {
+    v502_replay_t* replay = user;
+    v502_replay_event_t event;
+
+    // Host events the cursor passes were applied already, the one being run towards wasn't so reads can't go past it
+    while (replay->reads.position < replay->pending && v502_next_event(replay, &replay->reads, &event)) {
+        if (event.kind != v502_RECORD_EVENT_READ)
+            continue;
+
+        if (event.where != where || event.stamp != vm->cycles)
+            break;
+
+        return event.value;
+    }
+
+    replay->diverged = 1;
+    return 0xFF;
+}
+
+// Every read recorded before the pending host event has to have been made by the time the VM gets there
+static int v502_replay_caught_up(v502_replay_t* replay) {
+    v502_replay_event_t event;
+
+    while (replay->reads.position < replay->pending && v502_next_event(replay, &replay->reads, &event))
+        if (event.kind == v502_RECORD_EVENT_READ)
+            return 0;
+
+    return 1;
+}
+
+v502_replay_t* v502_open_replay(const char* path) {
+    assert(path != NULL);
+
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+        return NULL;
+
+    v502_recording_header_t header;
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, v502_RECORDING_MAGIC, sizeof(v502_RECORDING_MAGIC)) != 0
+        || header.version != v502_RECORDING_VERSION) {
+        fclose(file);
+        return NULL;
+    }
+
+    v502_replay_t* replay = calloc(1, sizeof(v502_replay_t));
+
+    replay->header = header;
+    replay->memory = malloc(header.hunk_length);
+
+    if (fread(replay->memory, 1, header.hunk_length, file) != header.hunk_length) {
+        fclose(file);
+        free(replay->memory);
+        free(replay);
+        return NULL;
+    }
+
+    // The events run to the end of the file, however far that is
+    size_t capacity = v502_RECORDING_BUFFER_SIZE;
+    replay->events = malloc(capacity);
+
+    for (;;) {
+        replay->length += fread(replay->events + replay->length, 1, capacity - replay->length, file);
+
+        if (replay->length < capacity)
+            break;
+
+        capacity *= 2;
+        replay->events = realloc(replay->events, capacity);
+    }
+
+    fclose(file);
+
+    replay->device.read = v502_replay_read;
+    replay->device.user = replay;
+
+    return replay;
+}
+
+void v502_close_replay(v502_replay_t* replay) {
+    if (replay == NULL)
+        return;
+
+    free(replay->memory);
+    free(replay->events);
+    free(replay);
+}
+
+v502_6502vm_t* v502_create_replay_vm(v502_replay_t* replay, v502_ENGINE_E engine) {
+    assert(replay != NULL);
+
+    const v502_recording_header_t* header = &replay->header;
+
+    v502_6502vm_createinfo_t createinfo;
+    memset(&createinfo, 0, sizeof(createinfo));
+
+    createinfo.hunk_size = header->hunk_length;
+    createinfo.feature_set = (v502_FEATURESET_E)header->feature_set;
+    createinfo.engine = engine;
+
+    v502_6502vm_t* vm = v502_create_vm(&createinfo);
+
+    if (vm == NULL)
+        return NULL;
+
+    memcpy(vm->hunk, replay->memory, header->hunk_length);
+
+    vm->cycles = header->cycles;
+    vm->program_counter = header->program_counter;
+    vm->stack_ptr = header->stack_ptr;
+    vm->accumulator = header->accumulator;
+    vm->index_x = header->index_x;
+    vm->index_y = header->index_y;
+    vm->flags = header->flags;
+
+    for (uint32_t p = 0; p < v502_BUS_PAGES; p++)
+        if ((header->device_pages[p >> 6] >> (p & 63)) & 1)
+            v502_map_device_vm(vm, (v502_byte_t)p, 1, &replay->device);
+
+    return vm;
+}
+
+// Runs the VM until vm->cycles reaches target, returns 0 if it can't get there or stopped following the recording on the way
+static int v502_replay_until(v502_replay_t* replay, v502_6502vm_t* vm, v502_qword_t target, v502_exit_info_t* total) {
+    while (vm->cycles < target) {
+        v502_exit_info_t exit_info;
+        v502_run_budgeted_vm(vm, 0, target - vm->cycles, &exit_info);
+
+        total->reason = exit_info.reason;
+        total->instructions += exit_info.instructions;
+        total->cycles += exit_info.cycles;
+        total->opcode = exit_info.opcode;
+
+        if (replay->diverged)
+            return 0;
+
+        // Whatever stopped the recorded VM, its host carried on, but one that stops again straight away will never get there
+        if (exit_info.instructions == 0)
+            return 0;
+    }
+
+    return vm->cycles == target && v502_replay_caught_up(replay);
+}
+
+v502_REPLAY_RESULT_E v502_run_replay_vm(v502_replay_t* replay, v502_6502vm_t* vm, v502_exit_info_t* exit_info) {
+    assert(replay != NULL && vm != NULL);
+
+    v502_replay_cursor_t host = { 0, replay->header.cycles };
+    v502_REPLAY_RESULT_E result = v502_REPLAY_RESULT_TRUNCATED;
+    v502_exit_info_t total;
+
+    memset(&total, 0, sizeof(total));
+
+    replay->reads = host;
+    replay->diverged = 0;
+
+    for (;;) {
+        v502_replay_event_t event;
+        size_t start = host.position;
+
+        if (!v502_next_event(replay, &host, &event)) {
+            // Never ended, all that can be done is make the reads that made it into the file
+            replay->pending = replay->length;
+
+            if (host.stamp > vm->cycles && !v502_replay_until(replay, vm, host.stamp + 1, &total) && replay->diverged)
+                result = v502_REPLAY_RESULT_DIVERGED;
+
+            break;
+        }
+
+        if (event.kind == v502_RECORD_EVENT_READ)
+            continue;
+
+        replay->pending = start;
+
+        if (!v502_replay_until(replay, vm, event.stamp, &total)) {
+            result = v502_REPLAY_RESULT_DIVERGED;
+            break;
+        }
+
+        // Reads made while applying it come right after it
+        replay->pending = host.position;
+
+        if (event.kind == v502_RECORD_EVENT_END) {
+            const v502_byte_t* state = event.data;
+            uint64_t hash = 0;
+
+            for (int b = 0; b < 8; b++)
+                hash |= (uint64_t)state[7 + b] << (b * 8);
+
+            int matched = vm->program_counter == v502_make_word(state[1], state[0])
+                && vm->stack_ptr == state[2] && vm->accumulator == state[3] && vm->index_x == state[4] && vm->index_y == state[5]
+                && vm->flags == state[6] && v502_hash_memory(vm->hunk, vm->hunk_length) == hash;
+
+            result = matched ? v502_REPLAY_RESULT_MATCHED : v502_REPLAY_RESULT_MISMATCHED;
+            break;
+        }
+
+        switch (event.kind) {
+            case v502_RECORD_EVENT_WRITE:
+                v502_write_vm(vm, event.where, event.value);
+                break;
+
+            case v502_RECORD_EVENT_MEMORY:
+                if (event.where < vm->hunk_length && event.length <= vm->hunk_length - event.where) {
+                    memcpy(vm->hunk + event.where, event.data, event.length);
+                    v502_invalidate_vm(vm, event.where, event.length);
+                }
+
+                break;
+
+            case v502_RECORD_EVENT_MAP:
+                if (event.where + event.length > v502_BUS_PAGES)
+                    break;
+
+                if (event.value)
+                    v502_map_device_vm(vm, (v502_byte_t)event.where, event.length, &replay->device);
+                else
+                    v502_map_ram_vm(vm, (v502_byte_t)event.where, event.length);
+
+                break;
+
+            case v502_RECORD_EVENT_RESET:
+                v502_reset_vm(vm);
+                break;
+
+            case v502_RECORD_EVENT_STATE: {
+                const v502_byte_t* state = event.data;
+
+                vm->program_counter = v502_make_word(state[1], state[0]);
+                vm->stack_ptr = state[2];
+                vm->accumulator = state[3];
+                vm->index_x = state[4];
+                vm->index_y = state[5];
+                v502_set_flags_vm(vm, state[6]);
+
+                vm->cycles = 0;
+                for (int b = 0; b < 8; b++)
+                    vm->cycles |= (v502_qword_t)state[7 + b] << (b * 8);
+
+                break;
+            }
+
+            case v502_RECORD_EVENT_IRQ:
+                v502_enter_interrupt_vm(vm, v502_IRQ_VECTOR_INDEX);
+                break;
+
+            case v502_RECORD_EVENT_NMI:
+                v502_enter_interrupt_vm(vm, v502_NMI_VECTOR_INDEX);
+                break;
+
+            default:
+                break;
+        }
+
+        // Interrupt vectors can sit on a device page too
+        if (replay->diverged) {
+            result = v502_REPLAY_RESULT_DIVERGED;
+            break;
+        }
+    }
+
+    if (exit_info != NULL) {
+        *exit_info = total;
+        exit_info->program_counter = vm->program_counter;
+    }
+
+    return result;
+}
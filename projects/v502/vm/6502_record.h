@@ -0,0 +1,100 @@
+#ifndef V502_6502_RECORD_H
+#define V502_6502_RECORD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+#include <stdint.h>
+
+//
+// Record and replay
+//
+// Given the same starting state a VM only does something different when something outside of it steps in
+// A recording is that starting state followed by every such input, replaying it drives a fresh VM through exactly the same run
+//
+// The inputs recorded are:
+//  * Device reads made by instructions (or while taking an interrupt), host reads through v502_read_vm() aren't input to the program
+//  * Interrupts, as the points where the VM took them rather than where the lines were raised
+//  * Host writes through v502_write_vm() and into vm->hunk (as reported to v502_invalidate_vm())
+//  * v502_reset_vm() and device mapping changes
+//  * Restoring snapshots and going back through the VM's history, as the pages that changed and the registers they left behind
+//
+// Anything else the host does to a recorded VM isn't, like writing registers directly or storing batch lanes into it
+// Opfunc overrides aren't either, install the same ones on the replay VM before running it
+//
+// Every input is stamped with vm->cycles at the time, host inputs have to happen between runs so the replay can stop on that exact cycle
+// The file is append only, a header and the starting memory followed by events of a few bytes each, all in the host's byte order
+// It ends in the state the VM was left in, so a replay can tell whether it got there
+//
+
+#define v502_RECORDING_MAGIC "V502REC"
+#define v502_RECORDING_VERSION 1
+
+typedef struct v502_recording_header {
+    char magic[8]; // v502_RECORDING_MAGIC, zero terminated
+    uint16_t version; // v502_RECORDING_VERSION
+    uint16_t feature_set;
+    v502_dword_t hunk_length; // This many bytes of memory follow the header
+
+    // The state the recording starts from
+    v502_qword_t cycles;
+    v502_word_t program_counter;
+    v502_byte_t stack_ptr;
+    v502_byte_t accumulator;
+    v502_byte_t index_x;
+    v502_byte_t index_y;
+    v502_byte_t flags;
+    v502_byte_t reserved;
+
+    uint64_t device_pages[v502_BUS_PAGES / 64]; // Pages that had a device mapped, watchpoints don't count
+} v502_recording_header_t;
+
+typedef enum v502_REPLAY_RESULT {
+    v502_REPLAY_RESULT_MATCHED = 0, // Reached the end of the recording in the recorded state
+    v502_REPLAY_RESULT_DIVERGED = 1, // The VM stopped following the recording (read a different device address, got stuck before the next input)
+    v502_REPLAY_RESULT_MISMATCHED = 2, // Followed the whole recording but ended up with different registers or memory
+    v502_REPLAY_RESULT_TRUNCATED = 3 // Followed the recording as far as it goes, it was never ended so there's no state to compare with
+} v502_REPLAY_RESULT_E;
+
+typedef struct v502_recording v502_recording_t;
+typedef struct v502_replay v502_replay_t;
+
+//
+// Recording
+//
+
+// Writes out the VM's current state and records every input from now on, call it between runs
+// Returns 0 if the file couldn't be created or the VM is already being recorded
+int v502_begin_recording_vm(v502_6502vm_t* vm, const char* path);
+
+// Writes out the state the VM was left in and closes the file, v502_free_vm() does this too
+// Returns 0 if any of the recording couldn't be written
+int v502_end_recording_vm(v502_6502vm_t* vm);
+
+//
+// Replaying
+//
+
+// Loads the whole recording, returns NULL if the file can't be read or isn't a recording this version of v502 understands
+v502_replay_t* v502_open_replay(const char* path);
+
+// VMs created from the replay keep mapping it as a device, free them first
+void v502_close_replay(v502_replay_t* replay);
+
+// Creates a VM in the state the recording starts from, every device page is mapped to the replay instead
+// Returns NULL if the hunk couldn't be allocated, the VM is freed with v502_free_vm() like any other
+v502_6502vm_t* v502_create_replay_vm(v502_replay_t* replay, v502_ENGINE_E engine);
+
+// Runs a VM from v502_create_replay_vm() through the whole recording at full speed
+// exit_info is optional, it covers everything the replay executed
+v502_REPLAY_RESULT_E v502_run_replay_vm(v502_replay_t* replay, v502_6502vm_t* vm, v502_exit_info_t* exit_info);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+#include "6502_snapshot.h"
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Snapshots
+//
+// Snapshots keep a shared view of their memory object, forks get a private (copy on write) view of it
+// Views stay valid after the object itself is closed, so snapshots can go away while their forks keep running
+//
+v502_snapshot_t* v502_snapshot_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+
+    v502_snapshot_t* snapshot = calloc(1, sizeof(v502_snapshot_t));
+
+    snapshot->program_counter = vm->program_counter;
+    snapshot->stack_ptr = vm->stack_ptr;
+    snapshot->accumulator = vm->accumulator;
+    snapshot->index_x = vm->index_x;
+    snapshot->index_y = vm->index_y;
+    snapshot->flags = v502_get_flags_vm(vm);
+    snapshot->cycles = vm->cycles;
+
+    snapshot->hunk_length = vm->hunk_length;
+    snapshot->backing = -1;
+
+    if (vm->hunk_length != 0)
+        snapshot->backing = v502_create_backing(NULL, vm->hunk_length);
+
+    if (snapshot->backing != -1) {
+        v502_byte_t* view = v502_map_backing(snapshot->backing, vm->hunk_length, 0);
+
+        if (view != NULL) {
+            memcpy(view, vm->hunk, vm->hunk_length);
+            snapshot->memory = view;
+        } else {
+            v502_close_backing(snapshot->backing);
+            snapshot->backing = -1;
+        }
+    }
+
+    // No shared memory, forks will have to copy
+    if (snapshot->backing == -1) {
+        v502_byte_t* copy = malloc(vm->hunk_length);
+        memcpy(copy, vm->hunk, vm->hunk_length);
+        snapshot->memory = copy;
+    }
+
+    memcpy(snapshot->devices, vm->devices, sizeof(vm->devices));
+
+    // Watchpoints belong to the VM, forks get what's mapped behind them
+    if (vm->debug != NULL)
+        for (uint32_t p = 0; p < v502_BUS_PAGES; p++)
+            if (snapshot->devices[p] == &vm->debug->watch_device)
+                snapshot->devices[p] = vm->debug->devices[p];
+
+    snapshot->opfuncs = vm->opfuncs;
+    snapshot->feature_set = vm->feature_set;
+    snapshot->engine = vm->engine;
+
+    if (vm->owned_opfuncs != NULL) {
+        snapshot->owned_opfuncs = malloc(256 * sizeof(v502_opfunc_t));
+        memcpy(snapshot->owned_opfuncs, vm->owned_opfuncs, 256 * sizeof(v502_opfunc_t));
+        snapshot->opfuncs = snapshot->owned_opfuncs;
+    }
+
+    return snapshot;
+}
+
+void v502_free_snapshot(v502_snapshot_t* snapshot) {
+    if (snapshot == NULL)
+        return;
+
+    if (snapshot->backing != -1) {
+        v502_unmap_backing(snapshot->memory, snapshot->hunk_length);
+        v502_close_backing(snapshot->backing);
+    } else
+        free((void*)snapshot->memory);
+
+    free(snapshot->owned_opfuncs);
+    free(snapshot);
+}
+
+static void v502_restore_registers(v502_6502vm_t* vm, const v502_snapshot_t* snapshot) {
+    vm->program_counter = snapshot->program_counter;
+    vm->stack_ptr = snapshot->stack_ptr;
+    vm->accumulator = snapshot->accumulator;
+    vm->index_x = snapshot->index_x;
+    vm->index_y = snapshot->index_y;
+    v502_set_flags_vm(vm, snapshot->flags);
+    vm->cycles = snapshot->cycles;
+}
+
+v502_6502vm_t* v502_fork_vm(const v502_snapshot_t* snapshot) {
+    assert(snapshot != NULL);
+
+    v502_6502vm_t* vm = calloc(1, sizeof(v502_6502vm_t));
+
+    vm->hunk_length = snapshot->hunk_length;
+    vm->hunk_object = -1;
+
+    if (snapshot->backing != -1)
+        vm->hunk = v502_map_backing(snapshot->backing, vm->hunk_length, 1);
+
+    if (vm->hunk != NULL)
+        vm->hunk_backing = v502_HUNK_BACKING_FORK;
+    else {
+        vm->hunk = malloc(vm->hunk_length);
+        memcpy(vm->hunk, snapshot->memory, vm->hunk_length);
+    }
+
+    vm->feature_set = snapshot->feature_set;
+    vm->engine = snapshot->engine;
+    vm->opfuncs = snapshot->opfuncs;
+
+    if (snapshot->owned_opfuncs != NULL) {
+        vm->owned_opfuncs = malloc(256 * sizeof(v502_opfunc_t));
+        memcpy(vm->owned_opfuncs, snapshot->owned_opfuncs, 256 * sizeof(v502_opfunc_t));
+        vm->opfuncs = vm->owned_opfuncs;
+    }
+
+    memcpy(vm->devices, snapshot->devices, sizeof(vm->devices));
+
+    v502_restore_registers(vm, snapshot);
+
+    return vm;
+}
+
+void v502_restore_vm(v502_6502vm_t* vm, const v502_snapshot_t* snapshot) {
+    assert(vm != NULL && snapshot != NULL);
+    assert(vm->hunk_length == snapshot->hunk_length);
+
+    // Comparing first means pages that weren't written don't get dirtied, or lose what was decoded from them
+    for (v502_dword_t where = 0; where < vm->hunk_length; where += 256) {
+        v502_dword_t length = vm->hunk_length - where < 256 ? vm->hunk_length - where : 256;
+
+        if (memcmp(vm->hunk + where, snapshot->memory + where, length) == 0)
+            continue;
+
+        memcpy(vm->hunk + where, snapshot->memory + where, length);
+        v502_invalidate_code_vm(vm, where, length);
+
+        if (vm->recording != NULL)
+            v502_record_memory_vm(vm, (v502_word_t)where, length);
+
+        // Not worth comparing line by line, the whole page counts as written
+        if (vm->dirty != NULL)
+            for (v502_dword_t line = 0; line < length; line += v502_DIRTY_LINE_SIZE)
+                v502_mark_dirty_vm(vm, where + line);
+    }
+
+    v502_qword_t cycles = vm->cycles;
+    v502_restore_registers(vm, snapshot);
+
+    if (vm->recording != NULL)
+        v502_record_state_vm(vm, cycles, NULL);
+}
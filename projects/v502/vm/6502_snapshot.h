@@ -0,0 +1,62 @@
+#ifndef V502_6502_SNAPSHOT_H
+#define V502_6502_SNAPSHOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+#include <stdint.h>
+
+//
+// Snapshots capture a VM's registers and memory so it can be forked or rolled back later
+//
+// The memory is kept in an anonymous shared memory object, forks map it privately so the OS shares it copy on write
+// Forking copies nothing but the registers and the page tables, a fork only gets its own copy of a page once it writes to it
+// Those are the host's pages (4K on x86), so the first write copies sixteen of the VM's 256 byte pages at once
+// Where the platform has no such objects (anything but Linux and Windows) forks copy the whole hunk instead
+//
+
+typedef struct v502_snapshot {
+    v502_word_t program_counter;
+
+    v502_byte_t stack_ptr;
+    v502_byte_t accumulator;
+    v502_byte_t index_x;
+    v502_byte_t index_y;
+    v502_byte_t flags;
+
+    v502_qword_t cycles;
+
+    const v502_byte_t* memory; // hunk_length bytes
+    v502_dword_t hunk_length;
+    intptr_t backing; // The shared memory object memory is mapped from, -1 if it's a plain heap copy
+
+    // Forks start out configured like the VM the snapshot was taken from
+    const v502_bus_device_t* devices[v502_BUS_PAGES];
+    const v502_opfunc_t* opfuncs;
+    v502_opfunc_t* owned_opfuncs; // A copy of the VM's overrides, NULL if it had none
+    v502_FEATURESET_E feature_set;
+    v502_ENGINE_E engine;
+} v502_snapshot_t;
+
+// Captures the VM, this copies its memory once so take one snapshot and fork it as often as needed
+v502_snapshot_t* v502_snapshot_vm(v502_6502vm_t* vm);
+
+// Forks keep their memory when the snapshot they came from is freed
+void v502_free_snapshot(v502_snapshot_t* snapshot);
+
+// Creates a new VM in the captured state, like any other VM it's freed with v502_free_vm()
+v502_6502vm_t* v502_fork_vm(const v502_snapshot_t* snapshot);
+
+// Copies the captured state back into the VM, 256 byte pages that didn't change keep their decoded and translated code
+// The VM keeps its own device mappings and opfuncs, and the hunk lengths have to match
+void v502_restore_vm(v502_6502vm_t* vm, const v502_snapshot_t* snapshot);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
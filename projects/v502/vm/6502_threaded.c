@@ -0,0 +1,141 @@
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+//
+// Direct threaded engine
+//
+// Every opcode gets a label with its instruction body inlined, each label ends by dispatching the next opcode itself
+// This spreads the indirect jumps over many sites instead of funneling everything through one call, which predicts far better
+// Opfuncs that were overridden on the VM, and opcodes we don't know, go through the regular opfunc table
+//
+
+#ifdef V502_HAS_THREADED_ENGINE
+
+v502_EXIT_REASON_E v502_run_threaded_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    assert(vm != NULL);
+
+    // VMs on a shared dispatch table only use stock opfuncs, so every opcode we know can be inlined
+#define v502_THREADED_STOCK_ENTRY(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = &&op_##NAME,
+
+    static const void* const stock_dispatch[256] = {
+        v502_REPEAT_256(&&op_opfunc),
+        v502_MOS_OP_LIST(v502_THREADED_STOCK_ENTRY)
+    };
+
+#undef v502_THREADED_STOCK_ENTRY
+
+    const void* const* dispatch = stock_dispatch;
+    const void* custom_dispatch[256];
+
+    // Otherwise only opcodes still using their stock opfunc can be inlined
+    if (vm->owned_opfuncs != NULL) {
+        for (int o = 0; o < 256; o++)
+            custom_dispatch[o] = &&op_opfunc;
+
+#define v502_THREADED_ENTRY(NAME, MNEMONIC, MODE, CYCLES, PAGE) \
+        if (vm->opfuncs[v502_MOS_OP_##NAME] == OP_##NAME) \
+            custom_dispatch[v502_MOS_OP_##NAME] = &&op_##NAME;
+
+        v502_MOS_OP_LIST(v502_THREADED_ENTRY)
+#undef v502_THREADED_ENTRY
+
+        dispatch = custom_dispatch;
+    }
+
+    v502_qword_t remaining = max_instructions == 0 ? UINT64_MAX : max_instructions;
+    v502_qword_t start_cycles = vm->cycles;
+    v502_qword_t cycle_limit = v502_cycle_limit_vm(vm, max_cycles);
+    v502_EXIT_REASON_E reason = v502_EXIT_REASON_BUDGET;
+    v502_OP_STATE_E state;
+    v502_byte_t next_op;
+    uint32_t idle_countdown = v502_IDLE_CHECK_INTERVAL;
+
+#define v502_THREADED_DISPATCH() \
+    next_op = vm->hunk[vm->program_counter]; \
+    v502_PROFILE_OP(vm, vm->program_counter, next_op); \
+    goto *dispatch[next_op]
+
+    // Mirrors the state handling in v502_run_table_vm(), for inlined bodies the compiler folds this away
+#define v502_THREADED_NEXT() \
+    if (state == V502_OP_STATE_SUCCESS) \
+        vm->program_counter += 1; \
+    else if (state != V502_OP_STATE_SUCCESS_NO_COUNT) \
+        goto stop; \
+    else { \
+        v502_poll_interrupts_vm(vm); \
+        \
+        if (--idle_countdown == 0) \
+            goto idle; \
+    } \
+    \
+    if (--remaining == 0 || vm->cycles >= cycle_limit) \
+        goto done; \
+    \
+    v502_THREADED_DISPATCH()
+
+    v502_begin_flags_vm(vm);
+    v502_poll_interrupts_vm(vm);
+    v502_THREADED_DISPATCH();
+
+#define v502_THREADED_LABEL(NAME, MNEMONIC, MODE, CYCLES, PAGE) \
+    op_##NAME: { \
+        v502_word_t where = v502_address_##MODE(vm); \
+        v502_CHARGE_CYCLES(vm, MODE, CYCLES, PAGE, where); \
+        state = v502_exec_##MNEMONIC(vm, where); \
+        v502_THREADED_NEXT(); \
+    }
+
+    v502_MOS_OP_LIST(v502_THREADED_LABEL)
+#undef v502_THREADED_LABEL
+
+    op_opfunc:
+        state = vm->opfuncs[next_op](vm, next_op);
+        v502_THREADED_NEXT();
+
+    // Shared by every label so the check doesn't get copied into each of them, this instruction isn't off the budget yet
+    idle:
+        remaining -= v502_skip_idle_vm(vm, max_instructions == 0 ? UINT64_MAX : remaining - 1, cycle_limit);
+        idle_countdown = v502_IDLE_CHECK_INTERVAL << vm->idle_backoff;
+
+        if (--remaining == 0 || vm->cycles >= cycle_limit)
+            goto done;
+
+        v502_THREADED_DISPATCH();
+
+    stop:
+        if (state == V502_OP_STATE_HALT) {
+            vm->program_counter += 1;
+            remaining -= 1;
+            reason = v502_EXIT_REASON_HALT;
+        } else if (state == V502_OP_STATE_BREAKPOINT)
+            reason = v502_EXIT_REASON_BREAKPOINT;
+        else
+            reason = v502_EXIT_REASON_UNKNOWN_OP;
+
+    done:
+#undef v502_THREADED_NEXT
+#undef v502_THREADED_DISPATCH
+
+    v502_end_flags_vm(vm);
+
+    if (exit_info != NULL) {
+        exit_info->reason = reason;
+        exit_info->instructions = (max_instructions == 0 ? UINT64_MAX : max_instructions) - remaining;
+        exit_info->cycles = vm->cycles - start_cycles;
+        exit_info->program_counter = vm->program_counter;
+        exit_info->opcode = next_op;
+        exit_info->watch_address = 0; // Only the table engine stops on watchpoints
+    }
+
+    return reason;
+}
+
+#else
+
+v502_EXIT_REASON_E v502_run_threaded_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    return v502_run_table_vm(vm, max_instructions, max_cycles, exit_info);
+}
+
+#endif
@@ -0,0 +1,326 @@
+#include "6502_trace.h"
+#include "6502_ops_impl.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define v502_fseek64 _fseeki64
+#define v502_ftell64 _ftelli64
+#else
+#define v502_fseek64 fseeko
+#define v502_ftell64 ftello
+#endif
+
+//
+// Ring buffer
+//
+// Single producer (the VM) and single consumer (the drain thread), head and tail only ever grow and wrap around at 2^32
+// The VM only publishes its head every v502_TRACE_PUBLISH_RECORDS records and at the end of each run, so most records cost no atomics at all
+// The newest record is never published before the next one starts, so an instruction that didn't run after all can take its record back
+//
+
+#define v502_TRACE_RING_RECORDS (1 << 16)
+#define v502_TRACE_RING_MASK (v502_TRACE_RING_RECORDS - 1)
+#define v502_TRACE_PUBLISH_RECORDS 1024
+
+struct v502_trace {
+    v502_trace_record_t* ring; // v502_TRACE_RING_RECORDS records
+
+    uint32_t head; // Records the drain thread may write out
+    uint32_t tail; // Records the drain thread is done with
+    uint32_t stopping; // Set once the drain thread should exit after emptying the ring
+    uint32_t failed; // Set by the drain thread if a write failed, it keeps draining so the VM never gets stuck
+
+    // Only touched by the VM's thread
+    uint32_t written; // Records filled in, head lags behind this until the next publish
+    uint32_t known_tail; // The last tail the VM saw, reloaded only when the ring looks full
+
+    FILE* file;
+    v502_thread_t thread;
+};
+
+static v502_THREAD_FUNC(v502_drain_trace) {
+    v502_trace_t* trace = arg;
+    uint32_t tail = trace->tail;
+
+    for (;;) {
+        // Load stopping before head, the final publish happens before stopping is set so nothing can be missed
+        uint32_t stopping = v502_atomic_load_u32(&trace->stopping);
+        uint32_t head = v502_atomic_load_u32(&trace->head);
+
+        if (head == tail) {
+            if (stopping)
+                break;
+
+            v502_thread_sleep_ms(1);
+            continue;
+        }
+
+        // Only up to the end of the ring, the rest is picked up next time around
+        uint32_t first = tail & v502_TRACE_RING_MASK;
+        uint32_t count = head - tail;
+
+        if (count > v502_TRACE_RING_RECORDS - first)
+            count = v502_TRACE_RING_RECORDS - first;
+
+        if (fwrite(trace->ring + first, sizeof(v502_trace_record_t), count, trace->file) != count)
+            v502_atomic_store_u32(&trace->failed, 1);
+
+        tail += count;
+        v502_atomic_store_u32(&trace->tail, tail);
+    }
+
+    return 0;
+}
+
+void v502_publish_trace_vm(v502_6502vm_t* vm) {
+    v502_atomic_store_u32(&vm->trace->head, vm->trace->written);
+}
+
+//
+// Addressing modes, same as the regular ones but without moving the program counter or asking devices
+//
+
+static v502_word_t v502_trace_word(const v502_6502vm_t* vm, v502_word_t where) {
+    return v502_make_word(vm->hunk[(v502_word_t)(where + 1)], vm->hunk[where]);
+}
+
+static v502_word_t v502_trace_zpg_word(const v502_6502vm_t* vm, v502_byte_t where) {
+    return v502_make_word(vm->hunk[(v502_byte_t)(where + 1)], vm->hunk[where]);
+}
+
+static v502_word_t v502_trace_address_IMP(const v502_6502vm_t* vm, v502_word_t pc) {
+    return 0;
+}
+
+static v502_word_t v502_trace_address_NOW(const v502_6502vm_t* vm, v502_word_t pc) {
+    return pc + 1;
+}
+
+// Unlike v502_address_REL() this is where the branch goes if it's taken, relative to the offset byte like v502_DEFINE_BRANCH()
+static v502_word_t v502_trace_address_REL(const v502_6502vm_t* vm, v502_word_t pc) {
+    return pc + 1 + (int8_t)vm->hunk[(v502_word_t)(pc + 1)];
+}
+
+static v502_word_t v502_trace_address_ZPG(const v502_6502vm_t* vm, v502_word_t pc) {
+    return vm->hunk[(v502_word_t)(pc + 1)];
+}
+
+static v502_word_t v502_trace_address_X_ZPG(const v502_6502vm_t* vm, v502_word_t pc) {
+    return (v502_byte_t)(vm->hunk[(v502_word_t)(pc + 1)] + vm->index_x);
+}
+
+static v502_word_t v502_trace_address_Y_ZPG(const v502_6502vm_t* vm, v502_word_t pc) {
+    return (v502_byte_t)(vm->hunk[(v502_word_t)(pc + 1)] + vm->index_y);
+}
+
+static v502_word_t v502_trace_address_ABS(const v502_6502vm_t* vm, v502_word_t pc) {
+    return v502_trace_word(vm, pc + 1);
+}
+
+static v502_word_t v502_trace_address_X_ABS(const v502_6502vm_t* vm, v502_word_t pc) {
+    return v502_trace_word(vm, pc + 1) + vm->index_x;
+}
+
+static v502_word_t v502_trace_address_Y_ABS(const v502_6502vm_t* vm, v502_word_t pc) {
+    return v502_trace_word(vm, pc + 1) + vm->index_y;
+}
+
+static v502_word_t v502_trace_address_IND(const v502_6502vm_t* vm, v502_word_t pc) {
+    return v502_trace_word(vm, v502_trace_word(vm, pc + 1));
+}
+
+static v502_word_t v502_trace_address_X_IND(const v502_6502vm_t* vm, v502_word_t pc) {
+    return v502_trace_zpg_word(vm, vm->hunk[(v502_word_t)(pc + 1)] + vm->index_x);
+}
+
+static v502_word_t v502_trace_address_Y_IND(const v502_6502vm_t* vm, v502_word_t pc) {
+    return v502_trace_zpg_word(vm, vm->hunk[(v502_word_t)(pc + 1)]) + vm->index_y;
+}
+
+typedef v502_word_t(*v502_trace_address_t)(const v502_6502vm_t*, v502_word_t);
+
+// Opcodes we don't implement have no operand as far as the trace is concerned
+#define v502_TRACE_ADDRESS(NAME, MNEMONIC, MODE, CYCLES, PAGE) [v502_MOS_OP_##NAME] = v502_trace_address_##MODE,
+static const v502_trace_address_t v502_TRACE_ADDRESSES[256] = {
+    v502_MOS_OP_LIST(v502_TRACE_ADDRESS)
+};
+#undef v502_TRACE_ADDRESS
+
+//
+// Recording
+//
+void v502_trace_op_vm(v502_6502vm_t* vm, v502_byte_t op) {
+    v502_trace_t* trace = vm->trace;
+
+    // Everything before this instruction ran, the newest record stays unpublished until then so it can still be dropped
+    if (trace->written % v502_TRACE_PUBLISH_RECORDS == 0)
+        v502_publish_trace_vm(vm);
+
+    // Full, wait for the drain thread to make room
+    if (trace->written - trace->known_tail == v502_TRACE_RING_RECORDS) {
+        v502_publish_trace_vm(vm);
+
+        while ((trace->known_tail = v502_atomic_load_u32(&trace->tail)) == trace->written - v502_TRACE_RING_RECORDS)
+            v502_thread_yield();
+    }
+
+    v502_word_t pc = vm->program_counter;
+    v502_trace_record_t* record = &trace->ring[trace->written & v502_TRACE_RING_MASK];
+
+    record->program_counter = pc;
+    record->opcode = op;
+    record->operand[0] = vm->hunk[(v502_word_t)(pc + 1)];
+    record->operand[1] = vm->hunk[(v502_word_t)(pc + 2)];
+
+    record->accumulator = vm->accumulator;
+    record->index_x = vm->index_x;
+    record->index_y = vm->index_y;
+    record->stack_ptr = vm->stack_ptr;
+    record->flags = v502_pack_flags_vm(vm);
+
+    v502_trace_address_t address = v502_TRACE_ADDRESSES[op];
+    record->effective_address = address != NULL ? address(vm, pc) : 0;
+    record->cycles = (uint32_t)vm->cycles;
+
+    trace->written += 1;
+}
+
+void v502_drop_trace_op_vm(v502_6502vm_t* vm) {
+    vm->trace->written -= 1;
+}
+
+//
+// Writing
+//
+int v502_begin_trace_vm(v502_6502vm_t* vm, const char* path) {
+    assert(vm != NULL && path != NULL);
+
+    if (vm->trace != NULL)
+        return 0;
+
+    FILE* file = fopen(path, "wb");
+
+    if (file == NULL)
+        return 0;
+
+    v502_trace_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, v502_TRACE_MAGIC, sizeof(v502_TRACE_MAGIC));
+    header.version = v502_TRACE_VERSION;
+    header.record_size = sizeof(v502_trace_record_t);
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return 0;
+    }
+
+    v502_trace_t* trace = calloc(1, sizeof(v502_trace_t));
+
+    trace->ring = malloc(v502_TRACE_RING_RECORDS * sizeof(v502_trace_record_t));
+    trace->file = file;
+
+    if (!v502_thread_create(&trace->thread, v502_drain_trace, trace)) {
+        fclose(file);
+        free(trace->ring);
+        free(trace);
+        return 0;
+    }
+
+    vm->trace = trace;
+    return 1;
+}
+
+int v502_end_trace_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+
+    v502_trace_t* trace = vm->trace;
+
+    if (trace == NULL)
+        return 1;
+
+    v502_publish_trace_vm(vm);
+    v502_atomic_store_u32(&trace->stopping, 1);
+    v502_thread_join(trace->thread);
+
+    int succeeded = !trace->failed;
+
+    if (fclose(trace->file) != 0)
+        succeeded = 0;
+
+    free(trace->ring);
+    free(trace);
+
+    vm->trace = NULL;
+    return succeeded;
+}
+
+//
+// Reading
+//
+v502_trace_reader_t* v502_open_trace(const char* path) {
+    assert(path != NULL);
+
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+        return NULL;
+
+    v502_trace_header_t header;
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, v502_TRACE_MAGIC, sizeof(v502_TRACE_MAGIC)) != 0
+        || header.version != v502_TRACE_VERSION
+        || header.record_size != sizeof(v502_trace_record_t)) {
+        fclose(file);
+        return NULL;
+    }
+
+    v502_trace_reader_t* reader = calloc(1, sizeof(v502_trace_reader_t));
+
+    reader->file = file;
+    reader->header = header;
+
+    return reader;
+}
+
+void v502_close_trace(v502_trace_reader_t* reader) {
+    if (reader == NULL)
+        return;
+
+    fclose(reader->file);
+    free(reader);
+}
+
+size_t v502_read_trace(v502_trace_reader_t* reader, v502_trace_record_t* records, size_t count) {
+    assert(reader != NULL && records != NULL);
+
+    // A trace that was cut short can end in a partial record, fread() leaves that one out
+    size_t read = fread(records, sizeof(v502_trace_record_t), count, reader->file);
+    reader->position += read;
+
+    return read;
+}
+
+int v502_seek_trace(v502_trace_reader_t* reader, v502_qword_t record) {
+    assert(reader != NULL);
+
+    if (v502_fseek64(reader->file, 0, SEEK_END) != 0)
+        return 0;
+
+    v502_qword_t length = (v502_qword_t)v502_ftell64(reader->file);
+    v502_qword_t offset = sizeof(v502_trace_header_t) + record * sizeof(v502_trace_record_t);
+
+    int found = offset <= length;
+
+    if (!found)
+        offset = sizeof(v502_trace_header_t) + reader->position * sizeof(v502_trace_record_t);
+    else
+        reader->position = record;
+
+    v502_fseek64(reader->file, (int64_t)offset, SEEK_SET);
+    return found;
+}
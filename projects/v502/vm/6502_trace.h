@@ -0,0 +1,93 @@
+#ifndef V502_6502_TRACE_H
+#define V502_6502_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "../v502_types.h"
+#include "6502_vm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// Execution traces
+//
+// A traced VM records every instruction into a ring buffer right before executing it, a background thread drains it into a file
+// The VM only waits on that thread when the ring is full, so a trace never drops records but can slow the VM down to disk speed
+// Traced runs always take the opfunc table engine (see v502_run_budgeted_vm()), batches are never traced
+//
+// Trace files are a v502_trace_header_t followed by nothing but records, both in the host's byte order (little endian everywhere v502 runs)
+// Interrupts don't get a record of their own, the first record of the handler shows them through its program counter and stack pointer
+//
+
+#define v502_TRACE_MAGIC "V502TRC"
+#define v502_TRACE_VERSION 1
+
+typedef struct v502_trace_header {
+    char magic[8]; // v502_TRACE_MAGIC, zero terminated
+    uint16_t version; // v502_TRACE_VERSION
+    uint16_t record_size; // sizeof(v502_trace_record_t)
+    uint32_t reserved;
+} v502_trace_header_t;
+
+// The state right before the instruction ran
+typedef struct v502_trace_record {
+    v502_word_t program_counter;
+    v502_byte_t opcode;
+    v502_byte_t operand[2]; // The two bytes after the opcode, whether or not the instruction uses them
+
+    v502_byte_t accumulator;
+    v502_byte_t index_x;
+    v502_byte_t index_y;
+    v502_byte_t stack_ptr;
+    v502_byte_t flags;
+
+    // Where the operand lives (see v502_MOS_OP_LIST), the branch target for branches and 0 for implied instructions
+    // Indirect pointers are read straight from the hunk, devices mapped over them aren't asked
+    v502_word_t effective_address;
+
+    uint32_t cycles; // The low 32 bits of vm->cycles, subtract neighbouring records to get how long an instruction took
+} v502_trace_record_t;
+
+typedef struct v502_trace v502_trace_t;
+
+//
+// Writing
+//
+
+// Creates the file and starts tracing every instruction the VM executes from now on
+// Returns 0 if the file couldn't be created or the VM is already being traced
+int v502_begin_trace_vm(v502_6502vm_t* vm, const char* path);
+
+// Writes out whatever is still in the ring and closes the file, v502_free_vm() does this too
+// Returns 0 if any of the trace couldn't be written
+int v502_end_trace_vm(v502_6502vm_t* vm);
+
+//
+// Reading
+//
+
+typedef struct v502_trace_reader {
+    FILE* file;
+    v502_trace_header_t header;
+    v502_qword_t position; // Index of the record the next read starts at
+} v502_trace_reader_t;
+
+// Returns NULL if the file can't be opened or isn't a trace this version of v502 understands
+v502_trace_reader_t* v502_open_trace(const char* path);
+
+void v502_close_trace(v502_trace_reader_t* reader);
+
+// Reads up to count records, returns how many were read and 0 once the trace ends
+size_t v502_read_trace(v502_trace_reader_t* reader, v502_trace_record_t* records, size_t count);
+
+// Moves to the given record, returns 0 if the trace is shorter than that
+int v502_seek_trace(v502_trace_reader_t* reader, v502_qword_t record);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
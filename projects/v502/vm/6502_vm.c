@@ -1,4 +1,8 @@
 #include "6502_vm.h"
+#include "6502_trace.h"
+#include "6502_record.h"
+#include "6502_history.h"
+#include "6502_ops_impl.h"
 
 #include <assert.h>
 #include <stdlib.h>
@@ -16,12 +20,18 @@ v502_6502vm_t* v502_create_vm(v502_6502vm_createinfo_t* p_createinfo) {
     v502_6502vm_t* vm = calloc(1, sizeof(v502_6502vm_t));
 
     vm->hunk_length = p_createinfo->hunk_size;
-    vm->hunk = calloc(1, vm->hunk_length);
+
+    if (!v502_alloc_hunk_vm(vm, p_createinfo)) {
+        free(vm);
+        return NULL;
+    }
 
     vm->feature_set = p_createinfo->feature_set;
+    vm->engine = p_createinfo->engine;
 
-    vm->opfuncs = calloc(256, sizeof(v502_opfunc_t));
-    v502_populate_ops_vm(vm);
+    vm->opfuncs = v502_get_dispatch_table(vm->feature_set);
+
+    v502_map_ram_vm(vm, 0, v502_BUS_PAGES);
 
     return vm;
 }
@@ -29,61 +39,633 @@ v502_6502vm_t* v502_create_vm(v502_6502vm_createinfo_t* p_createinfo) {
 void v502_reset_vm(v502_6502vm_t *vm) {
     assert(vm != NULL);
 
+    if (vm->recording != NULL)
+        v502_record_reset_vm(vm);
+
     v502_word_t org = v502_make_word(vm->hunk[v502_MAGIC_VECTOR_INDEX + 1], vm->hunk[v502_MAGIC_VECTOR_INDEX]);
 
     vm->accumulator = vm->index_x = vm->index_y = 0;
     vm->stack_ptr = 0xFF;
 
     vm->program_counter = org;
+    vm->cycles = 0;
+
+    // There's no going back past a reset, the program starts over
+    if (vm->history != NULL)
+        v502_restart_history_vm(vm);
+
+    if (vm->decode_cache != NULL)
+        memset(vm->decode_cache, 0, v502_DECODE_CACHE_ENTRIES * sizeof(v502_decoded_op_t));
+
+    if (vm->jit != NULL)
+        v502_invalidate_jit_vm(vm, 0, v502_DECODE_CACHE_ENTRIES);
+}
+
+void v502_free_vm(v502_6502vm_t *vm) {
+    if (vm == NULL)
+        return;
+
+    v502_end_trace_vm(vm);
+    v502_end_recording_vm(vm);
+    v502_end_history_vm(vm);
+    v502_free_jit_vm(vm);
+
+    free(vm->decode_cache);
+    free(vm->owned_opfuncs);
+    free(vm->dirty);
+    free(vm->profile);
+    free(vm->debug);
+
+    v502_release_hunk_vm(vm);
+    free(vm);
 }
 
 int v502_cycle_vm(v502_6502vm_t* vm) {
+    // Single steps gain nothing from the faster engines, so always take the reference path
+    return v502_run_table_vm(vm, 1, 0, NULL) == v502_EXIT_REASON_BUDGET;
+}
+
+v502_EXIT_REASON_E v502_run_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_exit_info_t *exit_info) {
+    return v502_run_budgeted_vm(vm, max_instructions, 0, exit_info);
+}
+
+v502_EXIT_REASON_E v502_run_budgeted_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    assert(vm != NULL);
+
+    // Only the table engine records traces, logs history and stops on watchpoints
+    if (vm->trace != NULL || vm->history != NULL || (vm->debug != NULL && vm->debug->reads.count + vm->debug->writes.count != 0))
+        return v502_run_table_vm(vm, max_instructions, max_cycles, exit_info);
+
+    if (vm->engine == v502_ENGINE_THREADED && v502_engine_supported(v502_ENGINE_THREADED)) {
+        // Breakpoints are all that's left in the map, the threaded engine doesn't check those
+        if (vm->debug != NULL)
+            return v502_run_predecoded_vm(vm, max_instructions, max_cycles, exit_info);
+
+        return v502_run_threaded_vm(vm, max_instructions, max_cycles, exit_info);
+    }
+
+    if (vm->engine == v502_ENGINE_PREDECODED)
+        return v502_run_predecoded_vm(vm, max_instructions, max_cycles, exit_info);
+
+    if (vm->engine == v502_ENGINE_JIT)
+        return v502_run_jit_vm(vm, max_instructions, max_cycles, exit_info);
+
+    return v502_run_table_vm(vm, max_instructions, max_cycles, exit_info);
+}
+
+int v502_engine_supported(v502_ENGINE_E engine) {
+    if (engine == v502_ENGINE_OPFUNC_TABLE || engine == v502_ENGINE_PREDECODED)
+        return 1;
+
+#ifdef V502_HAS_THREADED_ENGINE
+    if (engine == v502_ENGINE_THREADED)
+        return 1;
+#endif
+
+#ifdef V502_HAS_JIT_ENGINE
+    if (engine == v502_ENGINE_JIT)
+        return 1;
+#endif
+
+    return 0;
+}
+
+v502_EXIT_REASON_E v502_run_table_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info) {
+    assert(vm != NULL);
+
+    const v502_opfunc_t* opfuncs = vm->opfuncs;
+    v502_EXIT_REASON_E reason = v502_EXIT_REASON_BUDGET;
+    v502_qword_t executed = 0;
+    v502_qword_t start_cycles = vm->cycles;
+    v502_qword_t cycle_limit = v502_cycle_limit_vm(vm, max_cycles);
+    v502_byte_t next_op = 0;
+
+    v502_begin_flags_vm(vm);
+    v502_poll_interrupts_vm(vm);
+
+    // Accesses the host made since the last run don't count
+    if (vm->debug != NULL)
+        vm->debug->watch_hit = 0;
+
+    // Tracing, history and debugging are only switched between runs, so one local check covers them for VMs that use none
+    int observed = vm->trace != NULL || vm->history != NULL || vm->debug != NULL;
+    uint32_t idle_countdown = v502_IDLE_CHECK_INTERVAL;
+
+    while ((max_instructions == 0 || executed < max_instructions) && vm->cycles < cycle_limit) {
+        next_op = vm->hunk[vm->program_counter];
+
+        if (observed) {
+            // Before recording, the instruction we stop on hasn't run and mustn't leave a record
+            if (vm->debug != NULL && (reason = v502_debug_stop_vm(vm, executed)) != v502_EXIT_REASON_BUDGET)
+                break;
+
+            if (vm->trace != NULL)
+                v502_trace_op_vm(vm, next_op);
+
+            if (vm->history != NULL)
+                v502_history_step_vm(vm);
+        }
+
+        v502_PROFILE_OP(vm, vm->program_counter, next_op);
+
+        v502_OP_STATE_E state = opfuncs[next_op](vm, next_op);
+
+        if (state == V502_OP_STATE_SUCCESS) {
+            vm->program_counter += 1;
+            executed += 1;
+            continue;
+        }
+
+        if (state == V502_OP_STATE_SUCCESS_NO_COUNT) {
+            executed += 1;
+            v502_poll_interrupts_vm(vm);
+
+            if (--idle_countdown == 0) {
+                executed += v502_skip_idle_vm(vm, max_instructions == 0 ? UINT64_MAX : max_instructions - executed, cycle_limit);
+                idle_countdown = v502_IDLE_CHECK_INTERVAL << vm->idle_backoff;
+            }
+
+            continue;
+        }
+
+        if (state == V502_OP_STATE_HALT) {
+            vm->program_counter += 1;
+            executed += 1;
+            reason = v502_EXIT_REASON_HALT;
+        } else if (state == V502_OP_STATE_BREAKPOINT)
+            reason = v502_EXIT_REASON_BREAKPOINT;
+        else
+            reason = v502_EXIT_REASON_UNKNOWN_OP;
+
+        if (reason != v502_EXIT_REASON_HALT && observed) {
+            if (vm->trace != NULL)
+                v502_drop_trace_op_vm(vm);
+
+            if (vm->history != NULL)
+                v502_drop_history_step_vm(vm);
+        }
+
+        break;
+    }
+
+    // The last instruction of the run can still have touched a watchpoint
+    if (reason == v502_EXIT_REASON_BUDGET && vm->debug != NULL && vm->debug->watch_hit != 0)
+        reason = (v502_EXIT_REASON_E)vm->debug->watch_hit;
+
+    v502_end_flags_vm(vm);
+
+    if (vm->trace != NULL)
+        v502_publish_trace_vm(vm);
+
+    if (exit_info != NULL) {
+        exit_info->reason = reason;
+        exit_info->instructions = executed;
+        exit_info->cycles = vm->cycles - start_cycles;
+        exit_info->program_counter = vm->program_counter;
+        exit_info->opcode = next_op;
+        exit_info->watch_address = vm->debug != NULL ? vm->debug->watch_address : 0;
+    }
+
+    return reason;
+}
+
+//
+// Memory bus
+//
+
+// Stands in for pages past the end of the hunk, reads back 0xFF and ignores writes
+static const v502_bus_device_t v502_UNMAPPED_DEVICE = { NULL, NULL, NULL };
+
+// Watched pages keep the watch device in front (see v502_set_watchpoint_vm), the new mapping goes behind it
+static void v502_set_page_device_vm(v502_6502vm_t* vm, uint32_t page, const v502_bus_device_t* device) {
+    if (vm->debug != NULL && vm->devices[page] == &vm->debug->watch_device)
+        vm->debug->devices[page] = device;
+    else
+        vm->devices[page] = device;
+}
+
+void v502_map_device_vm(v502_6502vm_t* vm, v502_byte_t first_page, uint32_t page_count, const v502_bus_device_t* device) {
+    assert(vm != NULL && device != NULL);
+    assert(first_page + page_count <= v502_BUS_PAGES);
+
+    if (vm->recording != NULL)
+        v502_record_map_vm(vm, first_page, page_count, 1);
+
+    for (uint32_t p = first_page; p < first_page + page_count; p++)
+        v502_set_page_device_vm(vm, p, device);
+}
+
+void v502_map_ram_vm(v502_6502vm_t* vm, v502_byte_t first_page, uint32_t page_count) {
+    assert(vm != NULL);
+    assert(first_page + page_count <= v502_BUS_PAGES);
+
+    if (vm->recording != NULL)
+        v502_record_map_vm(vm, first_page, page_count, 0);
+
+    for (uint32_t p = first_page; p < first_page + page_count; p++)
+        v502_set_page_device_vm(vm, p, (p + 1) * 256 <= vm->hunk_length ? NULL : &v502_UNMAPPED_DEVICE);
+}
+
+const v502_bus_device_t* v502_mapped_device_vm(const v502_6502vm_t* vm, uint32_t page) {
+    if (vm->debug != NULL && vm->devices[page] == &vm->debug->watch_device)
+        return vm->debug->devices[page];
+
+    return vm->devices[page];
+}
+
+// Asks the device without recording anything
+static v502_byte_t v502_ask_device_vm(v502_6502vm_t* vm, v502_word_t where) {
+    const v502_bus_device_t* device = vm->devices[where >> 8];
+
+    if (device->read == NULL)
+        return 0xFF;
+
+    return device->read(device->user, vm, where);
+}
+
+v502_byte_t v502_read_device_vm(v502_6502vm_t* vm, v502_word_t where) {
+    v502_byte_t value = v502_ask_device_vm(vm, where);
+
+    // Watched RAM only goes through here because of the watch device, it's no more input than any other RAM
+    if (vm->recording != NULL && v502_mapped_device_vm(vm, where >> 8) != NULL)
+        v502_record_read_vm(vm, where, value);
+
+    return value;
+}
+
+void v502_write_device_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    const v502_bus_device_t* device = vm->devices[where >> 8];
+
+    if (device->write != NULL)
+        device->write(device->user, vm, where, value);
+}
+
+// The program never sees what the host reads, so unlike instructions these don't end up in recordings
+v502_byte_t v502_read_vm(v502_6502vm_t* vm, v502_word_t where) {
+    assert(vm != NULL);
+
+    if (vm->devices[where >> 8] == NULL)
+        return vm->hunk[where];
+
+    return v502_ask_device_vm(vm, where);
+}
+
+void v502_write_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    assert(vm != NULL);
+
+    if (vm->recording != NULL)
+        v502_record_write_vm(vm, where, value);
+
+    // Host writes aren't part of any step, going back leaves them alone
+    struct v502_history* history = vm->history;
+
+    vm->history = NULL;
+    v502_store_vm(vm, where, value);
+    vm->history = history;
+}
+
+//
+// Interrupts
+//
+void v502_set_irq_vm(v502_6502vm_t* vm, int asserted) {
     assert(vm != NULL);
 
-    v502_byte_t next_op = vm->hunk[vm->program_counter];
-    v502_OP_STATE_E state = vm->opfuncs[next_op](vm, next_op);
+    if (asserted)
+        v502_atomic_fetch_or_u32(&vm->interrupt_lines, v502_INTERRUPT_LINE_IRQ);
+    else
+        v502_atomic_fetch_and_u32(&vm->interrupt_lines, ~(uint32_t)v502_INTERRUPT_LINE_IRQ);
+}
 
-    if (state <= 0)
+void v502_raise_nmi_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+    v502_atomic_fetch_or_u32(&vm->interrupt_lines, v502_INTERRUPT_LINE_NMI);
+}
+
+int v502_take_interrupt_vm(v502_6502vm_t* vm) {
+    uint32_t lines = v502_atomic_load_u32(&vm->interrupt_lines);
+    v502_word_t vector;
+
+    // Only the NMI is consumed here, the IRQ stays asserted until whoever raised it lets go
+    if (lines & v502_INTERRUPT_LINE_NMI) {
+        v502_atomic_fetch_and_u32(&vm->interrupt_lines, ~(uint32_t)v502_INTERRUPT_LINE_NMI);
+        vector = v502_NMI_VECTOR_INDEX;
+    } else if ((lines & v502_INTERRUPT_LINE_IRQ) && !(vm->flags & v502_STATE_FLAG_INTERRUPT))
+        vector = v502_IRQ_VECTOR_INDEX;
+    else
         return 0;
 
-    if (state != V502_OP_STATE_SUCCESS_NO_COUNT)
-        vm->program_counter += 1;
+    if (vm->recording != NULL)
+        v502_record_interrupt_vm(vm, vector);
 
+    v502_enter_interrupt_vm(vm, vector);
     return 1;
 }
 
-void v502_safe_add_vm(v502_6502vm_t *vm, v502_byte_t val) {
-    v502_word_t r = vm->accumulator + val;
-    r += vm->flags & v502_STATE_FLAG_CARRY ? 1 : 0; // Adds one to r if we've got a carry bit
+void v502_enter_interrupt_vm(v502_6502vm_t* vm, v502_word_t vector) {
+    // Taking it is a step of its own, going back one from the handler's first instruction lands right before it
+    if (vm->history != NULL)
+        v502_history_interrupt_vm(vm, vector);
+
+    // Same order as JSR then PHP, with the break flag clear so handlers can tell this apart from a BRK
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), vm->program_counter);
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), vm->program_counter >> 8);
+    v502_store_vm(vm, v502_make_word(0x01, vm->stack_ptr--), v502_get_flags_vm(vm) & ~v502_STATE_FLAG_BREAK);
+
+    vm->flags |= v502_STATE_FLAG_INTERRUPT;
+    vm->program_counter = v502_make_word(v502_load_vm(vm, vector + 1), v502_load_vm(vm, vector));
+    vm->cycles += 7;
+}
 
-    if (r < 0x00 || r > 0xFF)
-        vm->flags |= (v502_STATE_FLAG_OVERFLOW | v502_STATE_FLAG_CARRY);
+//
+// Dirty tracking
+//
+void v502_track_dirty_vm(v502_6502vm_t* vm, v502_DIRTY_TRACKING_E tracking) {
+    assert(vm != NULL);
+
+    if (tracking == v502_DIRTY_TRACKING_NONE) {
+        free(vm->dirty);
+        vm->dirty = NULL;
+        return;
+    }
+
+    if (vm->dirty == NULL)
+        vm->dirty = malloc(sizeof(v502_dirty_map_t));
+
+    memset(vm->dirty, 0, sizeof(v502_dirty_map_t));
+    vm->dirty->tracking = tracking;
+}
+
+static uint32_t v502_take_bitmap(uint64_t* bitmap, uint64_t* out, uint32_t words) {
+    uint32_t count = 0;
+
+    for (uint32_t w = 0; w < words; w++) {
+        for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1)
+            count += 1;
+
+        if (out != NULL)
+            out[w] = bitmap[w];
+
+        bitmap[w] = 0;
+    }
+
+    return count;
+}
+
+uint32_t v502_take_dirty_pages_vm(v502_6502vm_t* vm, uint64_t* pages) {
+    assert(vm != NULL);
+
+    if (vm->dirty == NULL) {
+        if (pages != NULL)
+            memset(pages, 0, v502_DIRTY_PAGE_WORDS * sizeof(uint64_t));
+
+        return 0;
+    }
+
+    return v502_take_bitmap(vm->dirty->pages, pages, v502_DIRTY_PAGE_WORDS);
+}
+
+uint32_t v502_take_dirty_lines_vm(v502_6502vm_t* vm, uint64_t* lines) {
+    assert(vm != NULL);
+
+    if (vm->dirty == NULL) {
+        if (lines != NULL)
+            memset(lines, 0, v502_DIRTY_LINE_WORDS * sizeof(uint64_t));
+
+        return 0;
+    }
+
+    return v502_take_bitmap(vm->dirty->lines, lines, v502_DIRTY_LINE_WORDS);
+}
+
+//
+// Breakpoints and watchpoints
+//
+
+static void v502_hit_watch(v502_debug_map_t* debug, uint32_t reason, v502_word_t where) {
+    if (debug->watch_hit != 0)
+        return;
+
+    debug->watch_hit = reason;
+    debug->watch_address = where;
+}
+
+// Watched pages are mapped to this, it checks the address then does what the page would have done without it
+static v502_byte_t v502_watch_read(void* user, v502_6502vm_t* vm, v502_word_t where) {
+    v502_debug_map_t* debug = vm->debug;
+
+    if (v502_is_watched(&debug->reads, where))
+        v502_hit_watch(debug, v502_EXIT_REASON_WATCH_READ, where);
+
+    const v502_bus_device_t* device = debug->devices[where >> 8];
+
+    if (device == NULL)
+        return vm->hunk[where];
+
+    return device->read == NULL ? 0xFF : device->read(device->user, vm, where);
+}
+
+static void v502_watch_write(void* user, v502_6502vm_t* vm, v502_word_t where, v502_byte_t value) {
+    v502_debug_map_t* debug = vm->debug;
+
+    if (v502_is_watched(&debug->writes, where))
+        v502_hit_watch(debug, v502_EXIT_REASON_WATCH_WRITE, where);
+
+    const v502_bus_device_t* device = debug->devices[where >> 8];
+
+    if (device == NULL)
+        v502_store_ram_vm(vm, where, value);
+    else if (device->write != NULL)
+        device->write(device->user, vm, where, value);
+}
+
+static v502_debug_map_t* v502_get_debug_map_vm(v502_6502vm_t* vm) {
+    if (vm->debug == NULL) {
+        vm->debug = calloc(1, sizeof(v502_debug_map_t));
+
+        vm->debug->watch_device.read = v502_watch_read;
+        vm->debug->watch_device.write = v502_watch_write;
+    }
+
+    return vm->debug;
+}
+
+// The map goes away once it's empty, so the engines are back to not checking anything
+static void v502_release_debug_map_vm(v502_6502vm_t* vm) {
+    v502_debug_map_t* debug = vm->debug;
+
+    if (debug->breakpoint_count == 0 && debug->reads.count == 0 && debug->writes.count == 0) {
+        free(debug);
+        vm->debug = NULL;
+    }
+}
+
+// Flips the address' bit if it isn't in the wanted state yet and keeps its page's bit in sync
+static void v502_update_watch(v502_watch_map_t* watch, v502_word_t where, int enabled) {
+    uint64_t* word = &watch->addresses[where >> 6];
+    uint64_t bit = (uint64_t)1 << (where & 63);
+
+    if (!(*word & bit) == !enabled)
+        return;
+
+    *word ^= bit;
+    watch->count += enabled ? 1 : -1;
+
+    const uint64_t* page = &watch->addresses[(where >> 8) * 4];
+    uint64_t page_bit = (uint64_t)1 << ((where >> 8) & 63);
+
+    if (page[0] | page[1] | page[2] | page[3])
+        watch->pages[where >> 14] |= page_bit;
     else
-        vm->flags &= ~(v502_STATE_FLAG_OVERFLOW | v502_STATE_FLAG_CARRY);
+        watch->pages[where >> 14] &= ~page_bit;
+}
 
-    vm->accumulator += val;
+void v502_set_breakpoint_vm(v502_6502vm_t* vm, v502_word_t where, int enabled) {
+    assert(vm != NULL);
+
+    if (vm->debug == NULL && !enabled)
+        return;
+
+    v502_debug_map_t* debug = v502_get_debug_map_vm(vm);
+
+    if (v502_has_breakpoint(debug, where) != !!enabled) {
+        debug->breakpoints[where >> 6] ^= (uint64_t)1 << (where & 63);
+        debug->breakpoint_count += enabled ? 1 : -1;
+
+        // Decoded and translated code that ran past the address has to see the breakpoint
+        v502_invalidate_code_vm(vm, where, 1);
+    }
+
+    v502_release_debug_map_vm(vm);
+}
+
+void v502_set_watchpoint_vm(v502_6502vm_t* vm, v502_word_t where, uint32_t watch, int enabled) {
+    assert(vm != NULL);
+
+    if (vm->debug == NULL && !enabled)
+        return;
+
+    v502_debug_map_t* debug = v502_get_debug_map_vm(vm);
+    v502_byte_t page = where >> 8;
+    int routed = vm->devices[page] == &debug->watch_device;
+
+    if (watch & v502_WATCH_READ)
+        v502_update_watch(&debug->reads, where, enabled);
+
+    if (watch & v502_WATCH_WRITE)
+        v502_update_watch(&debug->writes, where, enabled);
+
+    int watched = v502_is_dirty(debug->reads.pages, page) || v502_is_dirty(debug->writes.pages, page);
+
+    // Unwatched pages don't pay for any of this, their accesses never reach the watch device
+    if (watched && !routed) {
+        debug->devices[page] = vm->devices[page];
+        vm->devices[page] = &debug->watch_device;
+    } else if (!watched && routed)
+        vm->devices[page] = debug->devices[page];
+
+    v502_release_debug_map_vm(vm);
+}
+
+void v502_clear_debug_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+
+    v502_debug_map_t* debug = vm->debug;
+
+    if (debug == NULL)
+        return;
+
+    for (uint32_t p = 0; p < v502_BUS_PAGES; p++)
+        if (vm->devices[p] == &debug->watch_device)
+            vm->devices[p] = debug->devices[p];
+
+    for (uint32_t where = 0; where < 0x10000; where++)
+        if (v502_has_breakpoint(debug, (v502_word_t)where))
+            v502_invalidate_code_vm(vm, (v502_word_t)where, 1);
+
+    free(debug);
+    vm->debug = NULL;
+}
+
+//
+// Profiling
+//
+int v502_profile_vm(v502_6502vm_t* vm, int enabled) {
+    assert(vm != NULL);
+
+#ifdef V502_PROFILING
+    if (!enabled) {
+        free(vm->profile);
+        vm->profile = NULL;
+        return 1;
+    }
+
+    if (vm->profile == NULL)
+        vm->profile = malloc(sizeof(v502_profile_t));
+
+    memset(vm->profile, 0, sizeof(v502_profile_t));
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+const v502_profile_t* v502_get_profile_vm(const v502_6502vm_t* vm) {
+    assert(vm != NULL);
+    return vm->profile;
+}
+
+//
+// Helpers
+//
+// These work on the lazy flags during a run, outside of one the flags are unpacked and packed again around them
+//
+void v502_safe_add_vm(v502_6502vm_t *vm, v502_byte_t val) {
+    v502_byte_t pending = vm->flags_pending;
+
+    if (!pending)
+        v502_begin_flags_vm(vm);
+
+    v502_add_flags_vm(vm, val);
+
+    if (!pending)
+        v502_end_flags_vm(vm);
 }
 
 //TODO: I haven't tested if this actually lines up with SDC behavior on an actual 6502
 void v502_safe_sub_vm(v502_6502vm_t *vm, v502_byte_t val) {
-    v502_word_t r = vm->accumulator + -(int8_t)val;
-    r += vm->flags & v502_STATE_FLAG_CARRY ? 1 : 0; // Adds one to r if we've got a carry bit
+    v502_byte_t pending = vm->flags_pending;
 
-    if (r < 0x00 || r > 0xFF)
-        vm->flags |= (v502_STATE_FLAG_OVERFLOW | v502_STATE_FLAG_CARRY);
-    else
-        vm->flags &= ~(v502_STATE_FLAG_OVERFLOW | v502_STATE_FLAG_CARRY);
+    if (!pending)
+        v502_begin_flags_vm(vm);
+
+    v502_sub_flags_vm(vm, val);
 
-    vm->accumulator += -(int8_t)val;
+    if (!pending)
+        v502_end_flags_vm(vm);
 }
 
 void v502_compare_vm(v502_6502vm_t* vm, v502_byte_t lhs, v502_byte_t rhs) {
-    vm->flags &= ~(v502_STATE_FLAG_CARRY | v502_STATE_FLAG_ZERO);
+    v502_byte_t pending = vm->flags_pending;
 
-    if (lhs > rhs)
-        vm->flags |= (v502_STATE_FLAG_CARRY);
-    else if (lhs == rhs) {
-        vm->flags |= (v502_STATE_FLAG_CARRY | v502_STATE_FLAG_ZERO);
-        vm->flags &= ~v502_STATE_FLAG_NEGATIVE;
-    }
+    if (!pending)
+        v502_begin_flags_vm(vm);
+
+    v502_compare_flags_vm(vm, lhs, rhs);
+
+    if (!pending)
+        v502_end_flags_vm(vm);
+}
+
+v502_byte_t v502_get_flags_vm(v502_6502vm_t* vm) {
+    assert(vm != NULL);
+    return vm->flags_pending ? v502_pack_flags_vm(vm) : vm->flags;
+}
+
+void v502_set_flags_vm(v502_6502vm_t* vm, v502_byte_t flags) {
+    assert(vm != NULL);
+
+    if (vm->flags_pending)
+        v502_unpack_flags_vm(vm, flags);
+    else
+        vm->flags = flags;
 }
\ No newline at end of file
@@ -25,14 +25,151 @@ typedef enum v502_STATE_FLAGS {
 } v502_STATE_FLAGS_E;
 
 
+// How the VM dispatches instructions when running batches through v502_run_vm()
+typedef enum v502_ENGINE {
+    v502_ENGINE_OPFUNC_TABLE = 0, // Indirect call through vm->opfuncs for every instruction, portable and the reference behavior
+    v502_ENGINE_THREADED = 1, // Computed goto (GCC / Clang only), falls back to the opfunc table where unsupported
+    v502_ENGINE_PREDECODED = 2, // Caches the decoded form of each instruction by address, see v502_decoded_op_t
+    v502_ENGINE_JIT = 3 // Translates hot basic blocks to native code (x86-64 Linux only), falls back to v502_ENGINE_PREDECODED elsewhere
+} v502_ENGINE_E;
+
 //
 // Creation helper
 //
+// Where the hunk (the VM's memory) comes from
+typedef enum v502_HUNK_BACKING {
+    v502_HUNK_BACKING_HEAP = 0, // Private heap memory, the default
+    v502_HUNK_BACKING_SHARED = 1, // A named shared memory object other processes can map (see 6502_hunk.h)
+    v502_HUNK_BACKING_EXTERNAL = 2, // Memory the caller hands over and keeps owning, like its own mmap() region
+    v502_HUNK_BACKING_FORK = 3 // A copy on write view of a snapshot, only v502_fork_vm() makes these
+} v502_HUNK_BACKING_E;
+
 typedef struct v502_6502vm_createinfo {
     v502_dword_t hunk_size;
     v502_FEATURESET_E feature_set;
+    v502_ENGINE_E engine;
+
+    v502_HUNK_BACKING_E hunk_backing;
+    const char* hunk_name; // Name of the shared memory object for v502_HUNK_BACKING_SHARED, creation fails if the name is taken (see v502_remove_hunk())
+    v502_byte_t* hunk; // hunk_size bytes for v502_HUNK_BACKING_EXTERNAL, it has to outlive the VM
 } v502_6502vm_createinfo_t;
 
+//
+// Decode cache
+//
+typedef struct v502_decoded_op v502_decoded_op_t;
+typedef v502_OP_STATE_E(*v502_decoded_opfunc_t)(v502_6502vm_t*, const v502_decoded_op_t*);
+
+// The cache covers the whole address space so it can be indexed by program counter directly
+#define v502_DECODE_CACHE_ENTRIES 0x10000
+
+// One entry per address, built the first time the instruction there is executed
+typedef struct v502_decoded_op {
+    v502_decoded_opfunc_t handler; // NULL if this address hasn't been decoded (or was written to since)
+    v502_word_t operand; // Raw operand bytes, already assembled into a word for absolute modes
+    v502_byte_t opcode;
+    v502_byte_t length; // Instruction length in bytes, 0 if the opcode isn't decoded and goes through vm->opfuncs instead
+} v502_decoded_op_t;
+
+//
+// Memory bus
+//
+// The address space is split into 256 pages of 256 bytes, each one is either RAM (the hunk) or mapped to a device
+// Data reads and writes to RAM pages index the hunk directly, device pages go through the device's callbacks
+// Instructions are always fetched straight from the hunk, so code has to run from RAM pages
+//
+#define v502_BUS_PAGES 256
+
+typedef v502_byte_t(*v502_bus_read_t)(void* user, v502_6502vm_t* vm, v502_word_t where);
+typedef void(*v502_bus_write_t)(void* user, v502_6502vm_t* vm, v502_word_t where, v502_byte_t value);
+
+typedef struct v502_bus_device {
+    v502_bus_read_t read; // NULL reads back 0xFF
+    v502_bus_write_t write; // NULL ignores writes, which makes the pages read only
+    void* user; // Handed to both callbacks
+} v502_bus_device_t;
+
+//
+// Dirty tracking
+//
+// Every store that lands in RAM marks its page (and optionally its 16 byte line) in these bitmaps
+// Writing into vm->hunk directly doesn't, and neither do batch lanes
+//
+#define v502_DIRTY_LINE_SIZE 16
+#define v502_DIRTY_PAGE_WORDS (v502_BUS_PAGES / 64)
+#define v502_DIRTY_LINE_WORDS (0x10000 / v502_DIRTY_LINE_SIZE / 64)
+
+typedef enum v502_DIRTY_TRACKING {
+    v502_DIRTY_TRACKING_NONE = 0,
+    v502_DIRTY_TRACKING_PAGES = 1, // One bit per 256 byte page
+    v502_DIRTY_TRACKING_LINES = 2 // Pages plus one bit per 16 byte line
+} v502_DIRTY_TRACKING_E;
+
+typedef struct v502_dirty_map {
+    uint64_t pages[v502_DIRTY_PAGE_WORDS];
+    uint64_t lines[v502_DIRTY_LINE_WORDS];
+    v502_DIRTY_TRACKING_E tracking;
+} v502_dirty_map_t;
+
+// Tests a bit of either bitmap, index is a page or line number
+static inline int v502_is_dirty(const uint64_t* bitmap, uint32_t index) {
+    return (bitmap[index >> 6] >> (index & 63)) & 1;
+}
+
+//
+// Breakpoints and watchpoints
+//
+// Both are one bit per address, watchpoints also keep one bit per page so only watched pages are routed through the bus' slow path
+// VMs without any have no map at all, see v502_set_breakpoint_vm() for how the engines check them
+//
+#define v502_DEBUG_ADDRESS_WORDS (0x10000 / 64)
+
+typedef enum v502_WATCH {
+    v502_WATCH_READ = 1,
+    v502_WATCH_WRITE = 2
+} v502_WATCH_E;
+
+typedef struct v502_watch_map {
+    uint64_t pages[v502_BUS_PAGES / 64];
+    uint64_t addresses[v502_DEBUG_ADDRESS_WORDS];
+    uint32_t count; // Watched addresses
+} v502_watch_map_t;
+
+typedef struct v502_debug_map {
+    uint64_t breakpoints[v502_DEBUG_ADDRESS_WORDS];
+    uint32_t breakpoint_count;
+
+    v502_watch_map_t reads;
+    v502_watch_map_t writes;
+
+    // Watched pages are mapped to watch_device, which checks the address and passes the access on to what's really mapped there (NULL for RAM)
+    v502_bus_device_t watch_device;
+    const v502_bus_device_t* devices[v502_BUS_PAGES];
+
+    // The first watched access of the current run, a v502_EXIT_REASON_WATCH_ reason or 0 if there was none
+    uint32_t watch_hit;
+    v502_word_t watch_address;
+} v502_debug_map_t;
+
+static inline int v502_has_breakpoint(const v502_debug_map_t* debug, v502_word_t where) {
+    return (debug->breakpoints[where >> 6] >> (where & 63)) & 1;
+}
+
+static inline int v502_is_watched(const v502_watch_map_t* watch, v502_word_t where) {
+    return (watch->addresses[where >> 6] >> (where & 63)) & 1;
+}
+
+//
+// Profiling
+//
+// Only builds with V502_PROFILING defined count anything (see CMakeLists.txt), without it the engines have no counting code at all
+//
+
+typedef struct v502_profile {
+    v502_qword_t opcodes[256]; // Executions of each opcode
+    v502_qword_t addresses[0x10000]; // Executions of the instruction at each address
+} v502_profile_t;
+
 //
 // The VM
 //
@@ -40,6 +177,15 @@ typedef struct v502_6502vm_createinfo {
 // Magic start vector index, this was used by the actual 6502 for finding the origin of a program
 #define v502_MAGIC_VECTOR_INDEX 0xFFFC
 
+// Where the handlers for the two interrupt lines are found
+#define v502_NMI_VECTOR_INDEX 0xFFFA
+#define v502_IRQ_VECTOR_INDEX 0xFFFE
+
+typedef enum v502_INTERRUPT_LINE {
+    v502_INTERRUPT_LINE_IRQ = 1,
+    v502_INTERRUPT_LINE_NMI = 2
+} v502_INTERRUPT_LINE_E;
+
 typedef struct v502_6502vm {
     v502_word_t program_counter;
 
@@ -47,13 +193,42 @@ typedef struct v502_6502vm {
     v502_byte_t accumulator;
     v502_byte_t index_x;
     v502_byte_t index_y;
-    v502_byte_t flags;
+    v502_byte_t flags; // Only fully up to date between runs, opfuncs and devices should use v502_get_flags_vm() and v502_set_flags_vm()
+
+    // Lazy flags, while a run is in progress N, Z, C and V are kept as the results they were derived from
+    // The bits are only worked out when a branch, PHP or v502_get_flags_vm() needs them, and folded back into flags when the run ends
+    v502_word_t carry_result; // C is bit 8
+    v502_word_t overflow_result; // V is bit 8
+    v502_byte_t zero_result; // Z is set when this is 0
+    v502_byte_t negative_result; // N is bit 7
+    v502_byte_t flags_pending; // Set while the fields above hold N, Z, C and V instead of flags
+
+    v502_qword_t cycles; // Clock cycles executed since the last reset
+
+    uint32_t interrupt_lines; // v502_INTERRUPT_LINE_E bits, other threads change these through v502_set_irq_vm() and v502_raise_nmi_vm()
+    uint32_t idle_backoff; // Looks for idle loops that found none in a row, see 6502_idle.c
 
     v502_byte_t *hunk;
     v502_dword_t hunk_length;
+    v502_HUNK_BACKING_E hunk_backing;
+    intptr_t hunk_object; // The shared memory object behind a v502_HUNK_BACKING_SHARED hunk, -1 otherwise
+    char* hunk_name; // Its name, the object is unlinked when the VM is freed
+
+    const v502_bus_device_t* devices[v502_BUS_PAGES]; // Indexed by page, NULL for RAM pages
+    v502_dirty_map_t* dirty; // NULL unless dirty tracking was turned on with v502_track_dirty_vm()
+    v502_profile_t* profile; // NULL unless profiling was turned on with v502_profile_vm()
+    v502_debug_map_t* debug; // NULL unless there are breakpoints or watchpoints
+    struct v502_trace* trace; // NULL unless the VM is being traced (see 6502_trace.h)
+    struct v502_recording* recording; // NULL unless the VM's inputs are being recorded (see 6502_record.h)
+    struct v502_history* history; // NULL unless reverse execution is on (see 6502_history.h)
 
-    v502_opfunc_t* opfuncs;
+    const v502_opfunc_t* opfuncs; // Shared between VMs of the same feature set, use v502_set_opfunc_vm() to override opcodes
+    v502_opfunc_t* owned_opfuncs; // This VM's private copy once something was overridden, NULL otherwise
     v502_FEATURESET_E feature_set;
+    v502_ENGINE_E engine;
+
+    v502_decoded_op_t* decode_cache; // v502_DECODE_CACHE_ENTRIES entries, allocated by the predecoded engine on first use
+    struct v502_jit* jit; // Private to the JIT engine, allocated on first use
 } v502_6502vm_t;
 
 //
@@ -61,26 +236,179 @@ typedef struct v502_6502vm {
 //
 
 // NOTE: Creating the VM doesn't initialize it, call v502_reset_vm() to initialize it!
+// Returns NULL if a v502_HUNK_BACKING_SHARED hunk couldn't be created
 v502_6502vm_t *v502_create_vm(v502_6502vm_createinfo_t *p_createinfo);
 
 void v502_reset_vm(v502_6502vm_t *vm);
 
+// Frees the VM along with its hunk and anything the engines allocated, external hunks are left to the caller
+void v502_free_vm(v502_6502vm_t *vm);
+
+// Executes a single instruction, returns 0 if the VM stopped (see v502_run_vm for why it might)
 int v502_cycle_vm(v502_6502vm_t *vm);
 
+//
+// Batched execution
+//
+typedef enum v502_EXIT_REASON {
+    v502_EXIT_REASON_BUDGET = 0, // The instruction or cycle budget ran out
+    v502_EXIT_REASON_UNKNOWN_OP = 1, // An opfunc failed, by default only the fallback for unimplemented opcodes does this
+    v502_EXIT_REASON_BREAKPOINT = 2, // The next instruction has a breakpoint (see v502_set_breakpoint_vm()) or an opfunc returned V502_OP_STATE_BREAKPOINT
+    v502_EXIT_REASON_HALT = 3, // An opfunc returned V502_OP_STATE_HALT
+    v502_EXIT_REASON_WATCH_READ = 4, // An instruction read a watched address
+    v502_EXIT_REASON_WATCH_WRITE = 5 // An instruction wrote a watched address
+} v502_EXIT_REASON_E;
+
+typedef struct v502_exit_info {
+    v502_EXIT_REASON_E reason;
+    v502_qword_t instructions; // How many instructions were executed during the run
+    v502_qword_t cycles; // How many clock cycles those took
+    v502_word_t program_counter; // Where the program counter was left
+    v502_byte_t opcode; // The opcode that stopped the VM, only meaningful if reason isn't v502_EXIT_REASON_BUDGET
+    v502_word_t watch_address; // The watched address that was accessed, only meaningful for the v502_EXIT_REASON_WATCH_ reasons
+} v502_exit_info_t;
+
+// Runs until max_instructions have been executed or something stops the VM, passing 0 removes the limit
+// exit_info is optional, pass NULL if you only care about the reason
+v502_EXIT_REASON_E v502_run_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_exit_info_t *exit_info);
+
+// Same as v502_run_vm() but also stops once max_cycles clock cycles have passed, again 0 removes the limit
+// Instructions are never cut in half, so the run can end up to v502_MAX_OP_CYCLES - 1 cycles past max_cycles
+v502_EXIT_REASON_E v502_run_budgeted_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info);
+
+// Returns 1 if the engine is available in this build, unavailable engines fall back to v502_ENGINE_OPFUNC_TABLE
+int v502_engine_supported(v502_ENGINE_E engine);
+
+// Engine entry points, v502_run_budgeted_vm() picks one of these based on vm->engine (or the table engine while tracing or watching)
+// They share its behavior and can be called directly to compare engines, only the table engine records traces and stops on watchpoints
+v502_EXIT_REASON_E v502_run_table_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info);
+v502_EXIT_REASON_E v502_run_threaded_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info);
+v502_EXIT_REASON_E v502_run_predecoded_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info);
+v502_EXIT_REASON_E v502_run_jit_vm(v502_6502vm_t *vm, v502_qword_t max_instructions, v502_qword_t max_cycles, v502_exit_info_t *exit_info);
+
+// The VM invalidates cached decoding and translated code itself whenever an instruction writes memory
+// If you write into vm->hunk while a program is loaded, tell the VM which range changed
+// v502_reset_vm() drops everything, so loading a program and resetting needs no extra call
+void v502_invalidate_vm(v502_6502vm_t *vm, v502_word_t where, v502_dword_t length);
+
+// Drops any cached decoding that covers the byte at where
+void v502_invalidate_decoded_vm(v502_6502vm_t *vm, v502_word_t where);
+
+//
+// Dispatch tables
+//
+
+// The read only opfunc table every VM of this feature set starts out with
+const v502_opfunc_t* v502_get_dispatch_table(v502_FEATURESET_E feature_set);
+
+// How many cycles each opcode of this feature set takes at least, 0 for opcodes we don't implement
+const v502_byte_t* v502_get_cycle_table(v502_FEATURESET_E feature_set);
+
+// Overrides the opfunc of a single opcode on this VM, passing NULL restores the stock one
+// VMs share the table above until their first override, which gives them a private copy
+void v502_set_opfunc_vm(v502_6502vm_t* vm, v502_byte_t opcode, v502_opfunc_t func);
+
+//
+// Memory bus
+//
+
+// Maps page_count pages starting at first_page to device, the VM only keeps the pointer so the device has to outlive the mapping
+void v502_map_device_vm(v502_6502vm_t* vm, v502_byte_t first_page, uint32_t page_count, const v502_bus_device_t* device);
+
+// Maps pages back to RAM, pages past the end of the hunk read back 0xFF and ignore writes
+// v502_create_vm() does this for the whole address space
+void v502_map_ram_vm(v502_6502vm_t* vm, v502_byte_t first_page, uint32_t page_count);
+
+// Reads and writes exactly like instructions do, devices included
+// Recordings (see 6502_record.h) take host writes as input but leave host reads out, the program never sees those
+v502_byte_t v502_read_vm(v502_6502vm_t* vm, v502_word_t where);
+void v502_write_vm(v502_6502vm_t* vm, v502_word_t where, v502_byte_t value);
+
+//
+// Interrupts
+//
+// Both of these can be called from any thread while the VM runs, no locking needed
+// Engines pick the lines up when a run starts and after every taken branch, jump or translated block, not between every instruction
+// Taking an interrupt pushes the program counter and flags (like JSR then PHP), sets the interrupt disable flag and jumps through the vector
+// RTI undoes it, batches don't take interrupts
+//
+
+// IRQ is level triggered, it stays asserted until the device releases it and is only taken while the interrupt disable flag is clear
+void v502_set_irq_vm(v502_6502vm_t* vm, int asserted);
+
+// NMI is edge triggered and ignores the interrupt disable flag, raising it again before it was taken doesn't queue a second one
+void v502_raise_nmi_vm(v502_6502vm_t* vm);
+
+//
+// Dirty tracking
+//
+
+// Turns tracking on, off or switches its granularity, either way everything starts out clean
+void v502_track_dirty_vm(v502_6502vm_t* vm, v502_DIRTY_TRACKING_E tracking);
+
+// Copies the page bitmap into pages (v502_DIRTY_PAGE_WORDS words) and clears it, returns how many pages were dirty
+// pages can be NULL to only clear the bitmap, nothing is ever dirty while tracking is off
+uint32_t v502_take_dirty_pages_vm(v502_6502vm_t* vm, uint64_t* pages);
+
+// Same for the line bitmap (v502_DIRTY_LINE_WORDS words), only filled in with v502_DIRTY_TRACKING_LINES
+uint32_t v502_take_dirty_lines_vm(v502_6502vm_t* vm, uint64_t* lines);
+
+//
+// Breakpoints and watchpoints
+//
+// Breakpoints stop the VM right before the instruction at their address runs (v502_EXIT_REASON_BREAKPOINT)
+// A run never stops on the breakpoint it starts on, so running again after a hit steps over it
+// The table engine checks them per instruction, the predecoded engine decodes them as a stop and the JIT ends blocks before them
+// The threaded engine has nowhere to check them, so threaded runs take the predecoded engine while any are set
+//
+// Watchpoints stop the VM right after the instruction that read or wrote their address, opcode fetches don't count but immediate operands do
+// Only the table engine stops on them, so every run takes it while any are set
+// Host accesses through v502_read_vm() and v502_write_vm() don't stop anything, batch lanes ignore both kinds
+//
+// Change these between runs, not while the VM is running on another thread
+//
+
+void v502_set_breakpoint_vm(v502_6502vm_t* vm, v502_word_t where, int enabled);
+
+// watch is a combination of v502_WATCH_E bits
+void v502_set_watchpoint_vm(v502_6502vm_t* vm, v502_word_t where, uint32_t watch, int enabled);
+
+// Removes every breakpoint and watchpoint
+void v502_clear_debug_vm(v502_6502vm_t* vm);
+
+//
+// Profiling
+//
+
+// Turns counting on or off, either way the counts start over
+// Returns 0 if the library was built without V502_PROFILING, batches and the JIT never count (JIT runs take the predecoded engine while profiling)
+int v502_profile_vm(v502_6502vm_t* vm, int enabled);
+
+// NULL while profiling is off
+const v502_profile_t* v502_get_profile_vm(const v502_6502vm_t* vm);
+
 //
 // Helpers
 //
 v502_word_t v502_make_word(v502_byte_t a, v502_byte_t b);
 
 // Adds and sets the overflow flag, please do this rather than add directly into the accumulator inside of C!
+// Adds in BCD while the decimal flag is set, like the NMOS 6502 does
 void v502_safe_add_vm(v502_6502vm_t *vm, v502_byte_t val);
 
 // Subtracts and sets the overflow flag, please do this rather than subtracting directly from the accumulator inside of C!
+// Subtracts in BCD while the decimal flag is set, like the NMOS 6502 does
 void v502_safe_sub_vm(v502_6502vm_t *vm, v502_byte_t val);
 
 // Sets the cpu flags accordingly for compare ops
 void v502_compare_vm(v502_6502vm_t* vm, v502_byte_t lhs, v502_byte_t rhs);
 
+// The processor status as PHP would push it, works both during and between runs
+v502_byte_t v502_get_flags_vm(v502_6502vm_t* vm);
+
+// Replaces the processor status like PLP would
+void v502_set_flags_vm(v502_6502vm_t* vm, v502_byte_t flags);
+
 #ifdef __cplusplus
 };
 #endif